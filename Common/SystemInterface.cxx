@@ -54,6 +54,7 @@
 #include "GlobalState.h"
 #include "SNAPRegistryIO.h"
 #include "HistoryManager.h"
+#include "GuidedNativeImageIO.h"
 #include "UIReporterDelegates.h"
 #include <itksys/Directory.hxx>
 #include <itksys/SystemTools.hxx>
@@ -178,6 +179,9 @@ SystemInterface
 
   // Set the preferences file
   m_UserPreferenceFile = appdir + "/UserPreferences.xml";
+
+  // Keep the headers of parsed DICOM directories to speed up parsing them again
+  GuidedNativeImageIO::SetDicomHeaderIndexDirectory(appdir + "/DicomHeaderIndex");
 }
 
 SystemInterface
@@ -253,7 +253,6 @@ bool Generic3DModel::AcceptAction()
 
   // Get the segmentation image
   LabelImageWrapper *seg = app->GetSelectedSegmentationLayer();
-  LabelImageWrapper::ImageType *imSeg = seg->GetImage();
 
   // Accept the current action
   if(mode == SPRAYPAINT_MODE)
@@ -274,7 +273,7 @@ bool Generic3DModel::AcceptAction()
       region.SetIndex(2, static_cast<unsigned int>(x[2])); region.SetSize(2, 1);
 
       // Treat each point as a region update
-      SegmentationUpdateIterator it(imSeg, region,
+      SegmentationUpdateIterator it(seg, region,
                                     app->GetGlobalState()->GetDrawingColorLabel(),
                                     app->GetGlobalState()->GetDrawOverFilter());
 
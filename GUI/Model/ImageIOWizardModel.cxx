@@ -295,7 +295,8 @@ ImageIOWizardModel::FileFormat ImageIOWizardModel::GetSelectedFormat()
 
 
 
-void ImageIOWizardModel::LoadImage(std::string filename)
+void ImageIOWizardModel::LoadImage(std::string filename,
+                                   itk::Command *progressCommand)
 {
   // There is no loaded image to start with
   m_LoadedImage = NULL;
@@ -315,7 +316,7 @@ void ImageIOWizardModel::LoadImage(std::string filename)
     m_LoadDelegate->UnloadCurrentImage();
 
     // Load the data from the image
-    m_GuidedIO->ReadNativeImageData();
+    m_GuidedIO->ReadNativeImageData(progressCommand);
 
     // Validate the image data
     m_LoadDelegate->ValidateImage(m_GuidedIO, m_Warnings);
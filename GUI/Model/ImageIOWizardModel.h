@@ -137,9 +137,10 @@ public:
 
   /**
     Load the image from filename, putting warnings into a warning list. This
-    may also fire an exception (e.g., if validation failed)
+    may also fire an exception (e.g., if validation failed). The optional
+    progress command is called while the image data is read
     */
-  void LoadImage(std::string filename);
+  void LoadImage(std::string filename, itk::Command *progressCommand = NULL);
 
   /**
    Save the image to a filename
@@ -5,6 +5,8 @@
 #include "ScalarImageWrapper.h"
 #include "itkMorphologicalContourInterpolator.h"
 #include "SegmentationUpdateIterator.h"
+#include "RLEImageOperations.h"
+#include "RLERegionOfInterestImageFilter.h"
 
 void InterpolateLabelModel::SetParentModel(GlobalUIModel *parent)
 {
@@ -27,15 +29,49 @@ void InterpolateLabelModel::Interpolate()
 {
   // Get the segmentation wrapper
   LabelImageWrapper *liw = m_Parent->GetDriver()->GetSelectedSegmentationLayer();
+  typedef GenericImageData::LabelImageType LabelImageType;
+  LabelImageType *seg = liw->GetImage();
 
   // Create the morphological interpolation filter
-  typedef itk::MorphologicalContourInterpolator<GenericImageData::LabelImageType> MCIType;
+  typedef itk::MorphologicalContourInterpolator<LabelImageType> MCIType;
   SmartPtr<MCIType> mci = MCIType::New();
 
   // Are we interpolating all labels?
   bool interp_all = this->GetInterpolateAll();
 
-  mci->SetInput(liw->GetImage());
+  // The interpolated voxels lie between the slices that contain the labels,
+  // so the interpolation can be restricted to the bounding box of the label
+  // (or of all labels), padded by a voxel so that the filter sees the same
+  // boundary as in the full image
+  LabelImageType::RegionType region = seg->GetBufferedRegion();
+  if(this->GetRestrictToBoundingBox())
+    {
+    typedef RLEImageOperations<LabelImageType> OpsType;
+    LabelType l_box = interp_all ? 0 : this->GetInterpolateLabel();
+    LabelImageType::RegionType box;
+
+    // Nothing to interpolate if the label is absent
+    if(!OpsType::ComputeBoundingBox(seg, region, l_box, interp_all, box))
+      return;
+
+    box.PadByRadius(1);
+    box.Crop(region);
+    region = box;
+    }
+
+  // Only extract a sub-volume if it is smaller than the image
+  typedef itk::RegionOfInterestImageFilter<LabelImageType, LabelImageType> ROIFilter;
+  SmartPtr<ROIFilter> roi = ROIFilter::New();
+  if(region != seg->GetBufferedRegion())
+    {
+    roi->SetInput(seg);
+    roi->SetRegionOfInterest(region);
+    mci->SetInput(roi->GetOutput());
+    }
+  else
+    {
+    mci->SetInput(seg);
+    }
 
   // Should we be interpolating a specific label?
   if (!interp_all)
@@ -57,11 +93,11 @@ void InterpolateLabelModel::Interpolate()
   // Update the filter
   mci->Update();
 
-  // Apply the labels back to the segmentation
-  SegmentationUpdateIterator it_trg(liw->GetImage(), liw->GetImage()->GetBufferedRegion(),
+  // Apply the labels back to the segmentation, within the interpolated region
+  SegmentationUpdateIterator it_trg(liw, region,
                                     this->GetDrawingLabel(), this->GetDrawOverFilter());
 
-  itk::ImageRegionConstIterator<GenericImageData::LabelImageType>
+  itk::ImageRegionConstIterator<LabelImageType>
       it_src(mci->GetOutput(), mci->GetOutput()->GetBufferedRegion());
 
   // The way we paint back into the segmentation depends on whether all labels
@@ -111,6 +147,7 @@ InterpolateLabelModel::InterpolateLabelModel()
   m_MorphologyUseDistanceModel = NewSimpleConcreteProperty(false);
   m_MorphologyUseOptimalAlignmentModel = NewSimpleConcreteProperty(false);
   m_MorphologyInterpolateOneAxisModel = NewSimpleConcreteProperty(false);
+  m_RestrictToBoundingBoxModel = NewSimpleConcreteProperty(true);
 
   RegistryEnumMap<AnatomicalDirection> emap_interp_axis;
   emap_interp_axis.AddPair(ANATOMY_AXIAL,"Axial");
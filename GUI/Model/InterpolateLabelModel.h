@@ -53,6 +53,9 @@ public:
   /** Whether to use optimal slice alignment for morphological interpolation */
   irisSimplePropertyAccessMacro(MorphologyUseOptimalAlignment, bool)
 
+  /** Whether to only interpolate within the bounding box of the labels */
+  irisSimplePropertyAccessMacro(RestrictToBoundingBox, bool)
+
   /** Which interpolation method to use */
   irisSimplePropertyAccessMacro(InterpolationMethod, InterpolationType)
 
@@ -91,6 +94,8 @@ protected:
   typedef ConcretePropertyModel<AnatomicalDirection, TrivialDomain> ConcreteInterpolationAxisType;
   SmartPtr<ConcreteInterpolationAxisType> m_MorphologyInterpolationAxisModel;
 
+  SmartPtr<ConcreteSimpleBooleanProperty> m_RestrictToBoundingBoxModel;
+
   typedef ConcretePropertyModel<InterpolationType, TrivialDomain> ConcreteInterpolationType;
   SmartPtr<ConcreteInterpolationType> m_InterpolationMethodModel;
 
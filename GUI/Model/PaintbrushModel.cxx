@@ -11,94 +11,223 @@
 #include "itkGradientAnisotropicDiffusionImageFilter.h"
 #include "itkGradientMagnitudeImageFilter.h"
 #include "itkWatershedImageFilter.h"
+#include "itkImageRegionConstIterator.h"
+#include <list>
+#include <algorithm>
 
 
 // TODO: move this into a separate file!!!!
+/**
+ * Watersheds for the adaptive brush. The smoothing, gradient and watershed
+ * hierarchy are computed over a tile that is larger than the brush. The tile
+ * is the brush region padded by half its size and snapped outwards to a grid
+ * of that step, so it only depends on the region, and nearby brush positions
+ * share it. The most recently used tiles are kept, up to a total number of
+ * voxels. When the brush is applied again with the same tile (e.g., while
+ * dragging), only the watershed level is changed, which the watershed filter
+ * handles by relabeling its segment tree.
+ *
+ * The watershed filter takes the level as a fraction of the depth of its
+ * segment tree, which depends on the tile. The brush level is taken as a
+ * fraction of the gradient range inside the brush region instead, and mapped
+ * to the tile's tree, so that the segments do not depend on the tile size.
+ */
 class BrushWatershedPipeline
 {
 public:
   typedef itk::Image<GreyType, 3> GreyImageType;
-  typedef LabelImageWrapperTraits::ImageType LabelImageType;
   typedef itk::Image<float, 3> FloatImageType;
   typedef itk::Image<itk::IdentifierType, 3> WatershedImageType;
   typedef WatershedImageType::IndexType IndexType;
 
-  BrushWatershedPipeline()
-    {
-    roi = ROIType::New();
-    adf = ADFType::New();
-    adf->SetInput(roi->GetOutput());
-    adf->SetConductanceParameter(0.5);
-    gmf = GMFType::New();
-    gmf->SetInput(adf->GetOutput());
-    wf = WFType::New();
-    wf->SetInput(gmf->GetOutput());
-    }
+  BrushWatershedPipeline() : tile(NULL), regionDepth(0.0) {}
 
   void PrecomputeWatersheds(
     GreyImageType *grey,
-    LabelImageType *label,
     itk::ImageRegion<3> region,
     itk::Index<3> vcenter,
     size_t smoothing_iter)
     {
-    this->region = region;
-
-    // Get the offset of vcenter in the region
+    // The center is given in image coordinates
     if(region.IsInside(vcenter))
-      for(size_t d = 0; d < 3; d++)
-        this->vcenter[d] = vcenter[d] - region.GetIndex()[d];
+      this->vcenter = vcenter;
     else
       for(size_t d = 0; d < 3; d++)
-        this->vcenter[d] = region.GetSize()[d] / 2;
+        this->vcenter[d] = region.GetIndex()[d] + region.GetSize()[d] / 2;
 
-    // Create a backup of the label image
-    LROIType::Pointer lroi = LROIType::New();
-    lroi->SetInput(label);
-    lroi->SetRegionOfInterest(region);
-    lroi->Update();
-    lsrc = lroi->GetOutput();
-    lsrc->DisconnectPipeline();
+    // Find the tile of the region: the region padded by half its size along
+    // each direction in which the brush extends, snapped to a grid of the
+    // same step
+    itk::ImageRegion<3> tileRegion = region;
+    for(size_t d = 0; d < 3; d++)
+      {
+      if(region.GetSize()[d] > 1)
+        {
+        long step = (region.GetSize()[d] + 1) / 2;
+        long lo = region.GetIndex()[d] - step;
+        long hi = region.GetIndex()[d] + region.GetSize()[d] + step;
+        lo = FloorToGrid(lo, step);
+        hi = -FloorToGrid(-hi, step);
+        tileRegion.SetIndex(d, lo);
+        tileRegion.SetSize(d, hi - lo);
+        }
+      }
+    tileRegion.Crop(grey->GetBufferedRegion());
 
-    // Initialize the watershed pipeline
-    roi->SetInput(grey);
-    roi->SetRegionOfInterest(region);
-    adf->SetNumberOfIterations(smoothing_iter);
+    // Look for that tile computed from the same image and parameters, and
+    // make it the most recently used one
+    tile = NULL;
+    for(std::list<Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+      {
+      if(it->Image == grey && it->ImageMTime == grey->GetMTime()
+         && it->SmoothingIterations == smoothing_iter
+         && it->Region == tileRegion)
+        {
+        tiles.splice(tiles.begin(), tiles, it);
+        tile = &tiles.front();
+        break;
+        }
+      }
 
-    // Set the initial level to lowest possible - to get all watersheds
-    wf->SetLevel(1.0);
-    wf->Update();
+    if(!tile)
+      this->ComputeTile(grey, tileRegion, smoothing_iter);
+
+    // Find the gradient range inside of the brush region
+    const FloatImageType *grad = tile->Watershed->GetInput();
+    itk::ImageRegion<3> rtile = region;
+    rtile.SetIndex(ToTile(region.GetIndex()));
+    itk::ImageRegionConstIterator<FloatImageType> itg(grad, rtile);
+    float gmin = itg.Get(), gmax = itg.Get();
+    for(; !itg.IsAtEnd(); ++itg)
+      {
+      gmin = std::min(gmin, itg.Get());
+      gmax = std::max(gmax, itg.Get());
+      }
+    regionDepth = gmax - gmin;
     }
 
   void RecomputeWatersheds(double level)
     {
-    // Reupdate the filter with new level
-    wf->SetLevel(level);
-    wf->Update();
+    // Map the level from the gradient range of the brush region to the depth
+    // of the tile's segment tree
+    double treeDepth = tile->Watershed->GetSegmentTree()->Empty()
+        ? 0.0 : tile->Watershed->GetSegmentTree()->Back().saliency;
+    double tileLevel = 1.0;
+    if(treeDepth > 0.0)
+      tileLevel = std::min(1.0, level * regionDepth / treeDepth);
+
+    // Reupdate the filter with new level. This does nothing if the tile was
+    // last used with the same level
+    tile->Watershed->SetLevel(tileLevel);
+    tile->Watershed->Update();
     }
 
   bool IsPixelInSegmentation(IndexType idx)
     {
     // Get the watershed ID at the center voxel
-    unsigned long wctr = wf->GetOutput()->GetPixel(vcenter);
-    unsigned long widx = wf->GetOutput()->GetPixel(idx);
+    WatershedImageType *ws = tile->Watershed->GetOutput();
+    unsigned long wctr = ws->GetPixel(ToTile(vcenter));
+    unsigned long widx = ws->GetPixel(ToTile(idx));
     return wctr == widx;
     }
 
 private:
   typedef itk::RegionOfInterestImageFilter<GreyImageType, FloatImageType> ROIType;
-  typedef itk::RegionOfInterestImageFilter<LabelImageType, LabelImageType> LROIType;
   typedef itk::GradientAnisotropicDiffusionImageFilter<FloatImageType,FloatImageType> ADFType;
   typedef itk::GradientMagnitudeImageFilter<FloatImageType, FloatImageType> GMFType;
   typedef itk::WatershedImageFilter<FloatImageType> WFType;
 
-  ROIType::Pointer roi;
-  ADFType::Pointer adf;
-  GMFType::Pointer gmf;
-  WFType::Pointer wf;
+  // Round down to a multiple of the step, also for negative values
+  static long FloorToGrid(long x, long step)
+    {
+    long q = x / step;
+    if(q * step > x)
+      q--;
+    return q * step;
+    }
+
+  // Compute the watershed hierarchy of a tile, and make it the most recently
+  // used one
+  void ComputeTile(GreyImageType *grey, const itk::ImageRegion<3> &region,
+                   size_t smoothing_iter)
+    {
+    Tile t;
+    t.Region = region;
+    t.Image = grey;
+    t.ImageMTime = grey->GetMTime();
+    t.SmoothingIterations = smoothing_iter;
+
+    // Compute the gradient magnitude of the smoothed tile
+    ROIType::Pointer roi = ROIType::New();
+    roi->SetInput(grey);
+    roi->SetRegionOfInterest(t.Region);
+
+    ADFType::Pointer adf = ADFType::New();
+    adf->SetInput(roi->GetOutput());
+    adf->SetConductanceParameter(0.5);
+    adf->SetNumberOfIterations(smoothing_iter);
+
+    GMFType::Pointer gmf = GMFType::New();
+    gmf->SetInput(adf->GetOutput());
+    gmf->Update();
+
+    // The watershed filter only keeps the gradient of the tile, not the image
+    FloatImageType::Pointer grad = gmf->GetOutput();
+    grad->DisconnectPipeline();
+
+    // Set the initial level to lowest possible - to get all watersheds
+    t.Watershed = WFType::New();
+    t.Watershed->SetInput(grad);
+    t.Watershed->SetLevel(1.0);
+    t.Watershed->Update();
+
+    tiles.push_front(t);
+
+    // Evict the least recently used tiles until the cache fits the budget.
+    // The new tile is always kept, even if it is larger than the budget
+    size_t nVoxels = 0;
+    for(std::list<Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it)
+      nVoxels += it->Region.GetNumberOfPixels();
+    while(tiles.size() > 1 && nVoxels > MaxCachedVoxels)
+      {
+      nVoxels -= tiles.back().Region.GetNumberOfPixels();
+      tiles.pop_back();
+      }
+    tile = &tiles.front();
+    }
+
+  // Total number of voxels in the cached tiles. Each voxel of a tile holds
+  // the float gradient and the watershed filter's label images, about 40
+  // bytes in all, so this keeps the cache under about 160MB
+  enum { MaxCachedVoxels = 0x400000 };
+
+  // A tile with its watershed hierarchy. The image pointer is only used to
+  // identify the source of the tile and is never dereferenced
+  struct Tile
+  {
+    itk::ImageRegion<3> Region;
+    const GreyImageType *Image;
+    unsigned long ImageMTime;
+    size_t SmoothingIterations;
+    WFType::Pointer Watershed;
+  };
+
+  // Map an image index to the current tile, whose output starts at zero
+  IndexType ToTile(const IndexType &idx) const
+    {
+    IndexType t;
+    for(size_t d = 0; d < 3; d++)
+      t[d] = idx[d] - tile->Region.GetIndex()[d];
+    return t;
+    }
+
+  // Cached tiles, most recently used first, and the tile in use
+  std::list<Tile> tiles;
+  Tile *tile;
+
+  // Gradient range inside of the brush region
+  double regionDepth;
 
-  itk::ImageRegion<3> region;
-  LabelImageType::Pointer lsrc;
   itk::Index<3> vcenter;
 };
 
@@ -136,16 +265,8 @@ Vector3d PaintbrushModel::ComputeOffset()
   return offset;
 }
 
-void PaintbrushModel::ComputeMousePosition(const Vector3d &xSlice)
+Vector3ui PaintbrushModel::MapSliceToVoxel(const Vector3d &xSlice)
 {
-  // Only when an image is loaded
-  if(!m_Parent->GetDriver()->IsMainImageLoaded())
-    return;
-
-  // Get the paintbrush properties
-  PaintbrushSettings pbs =
-      m_Parent->GetDriver()->GetGlobalState()->GetPaintbrushSettings();
-
   // Compute the new cross-hairs position in image space
   Vector3d xCross = m_Parent->MapSliceToImage(xSlice);
 
@@ -157,8 +278,17 @@ void PaintbrushModel::ComputeMousePosition(const Vector3d &xSlice)
   Vector3i xSize =
       to_int(m_Parent->GetDriver()->GetCurrentImageData()->GetVolumeExtents());
 
-  Vector3ui newpos = to_unsigned_int(
+  return to_unsigned_int(
     xCrossInteger.clamp(Vector3i(0),xSize - Vector3i(1)));
+}
+
+void PaintbrushModel::ComputeMousePosition(const Vector3d &xSlice)
+{
+  // Only when an image is loaded
+  if(!m_Parent->GetDriver()->IsMainImageLoaded())
+    return;
+
+  Vector3ui newpos = MapSliceToVoxel(xSlice);
 
   if(newpos != m_MousePosition || m_MouseInside == false)
     {
@@ -200,6 +330,53 @@ bool PaintbrushModel::TestInside(const Vector3d &x, const PaintbrushSettings &ps
     }
 }
 
+bool PaintbrushModel::TestInside(const Vector3d &x, const Vector3d &u,
+                                 const PaintbrushSettings &ps)
+{
+  // Determine how to scale the voxels
+  Vector3d xTest = x, uTest = u;
+  if(ps.isotropic)
+    {
+    const Vector3d &spacing = m_Parent->GetSliceSpacing();
+    double xMinVoxelDim = spacing.min_value();
+    for(int i = 0; i < 3; i++)
+      {
+      xTest(i) *= spacing(i) / xMinVoxelDim;
+      uTest(i) *= spacing(i) / xMinVoxelDim;
+      }
+    }
+
+  double r = ps.radius - 0.25;
+  if(ps.mode == PAINTBRUSH_ROUND)
+    {
+    // Find the point of the segment closest to the origin
+    double uu = uTest.squared_magnitude();
+    double s = (uu > 0) ? dot_product(xTest, uTest) / uu : 0.0;
+    s = std::max(0.0, std::min(1.0, s));
+    return (xTest - s * uTest).squared_magnitude() <= r * r;
+    }
+  else
+    {
+    // Intersect the ranges of s over which each coordinate is within r
+    double s0 = 0.0, s1 = 1.0;
+    for(int i = 0; i < 3; i++)
+      {
+      if(uTest(i) == 0.0)
+        {
+        if(fabs(xTest(i)) > r)
+          return false;
+        }
+      else
+        {
+        double a = (xTest(i) - r) / uTest(i), b = (xTest(i) + r) / uTest(i);
+        s0 = std::max(s0, std::min(a, b));
+        s1 = std::min(s1, std::max(a, b));
+        }
+      }
+    return s0 <= s1;
+    }
+}
+
 bool
 PaintbrushModel
 ::ProcessPushEvent(const Vector3d &xSlice, const Vector2ui &gridCell, bool reverse_mode)
@@ -249,13 +426,12 @@ PaintbrushModel
 
   if(m_IsEngaged)
     {
-    // The behavior is different for 'fast' regular brushes and adaptive brush. For the
-    // adaptive brush, dragging is disabled.
-    if(pbs.mode != PAINTBRUSH_WATERSHED || m_ReverseMode)
+    if(pbs.mode == PAINTBRUSH_WATERSHED && !m_ReverseMode)
       {
-      // See how much we have moved since the last event. If we moved more than
-      // the value of the radius, we interpolate the path and place brush strokes
-      // along the path
+      // See how much we have moved since the last event. If we moved more
+      // than the value of the radius, we interpolate the path and place brush
+      // strokes along the path. Successive steps of the adaptive brush mostly
+      // reuse the watersheds of cached tiles
       if(pixelsMoved > pbs.radius)
         {
         // Break up the path into steps
@@ -276,10 +452,18 @@ PaintbrushModel
         // Scan convert the points into the slice
         ApplyBrush(m_ReverseMode, true);
         }
-
-      // Store this as the last apply position
-      m_LastApplyX = xSlice;
       }
+    else
+      {
+      // Paint the volume swept by the brush between the last position where
+      // it was applied and the pixel under the mouse in a single update
+      Vector3ui xFrom = MapSliceToVoxel(m_LastApplyX);
+      ComputeMousePosition(xSlice);
+      ApplyBrush(m_ReverseMode, true, xFrom);
+      }
+
+    // Store this as the last apply position
+    m_LastApplyX = xSlice;
 
     // If the mouse is being released, we need to commit the drawing
     if(release)
@@ -336,6 +520,12 @@ void PaintbrushModel::AcceptAtCursor()
 
 bool
 PaintbrushModel::ApplyBrush(bool reverse_mode, bool dragging)
+{
+  return ApplyBrush(reverse_mode, dragging, m_MousePosition);
+}
+
+bool
+PaintbrushModel::ApplyBrush(bool reverse_mode, bool dragging, const Vector3ui &xFrom)
 {
   // Get the global objects
   IRISApplication *driver = m_Parent->GetDriver();
@@ -352,27 +542,31 @@ PaintbrushModel::ApplyBrush(bool reverse_mode, bool dragging)
   // Get the paintbrush properties
   PaintbrushSettings pbs = gs->GetPaintbrushSettings();
 
-  // Whether watershed filter is used (adaptive brush)
+  // Whether watershed filter is used (adaptive brush). The watersheds are
+  // computed around a single position, so it is not applied along strokes
   bool flagWatershed = (
-        pbs.mode == PAINTBRUSH_WATERSHED
-        && (!reverse_mode) && (!dragging));
+        pbs.mode == PAINTBRUSH_WATERSHED && (!reverse_mode));
+  assert(!flagWatershed || xFrom == m_MousePosition);
 
-  // Define a region of interest
+  // Define a region of interest that holds the brush at both ends of the stroke
   LabelImageWrapper::ImageType::RegionType xTestRegion;
   for(size_t i = 0; i < 3; i++)
     {
+    long x0 = std::min(xFrom(i), m_MousePosition(i));
+    long x1 = std::max(xFrom(i), m_MousePosition(i));
     if(i != imgLabel->GetDisplaySliceImageAxis(m_Parent->GetId())
        || pbs.volumetric)
       {
       // For watersheds, the radius must be > 2
       double rad = (flagWatershed && pbs.radius < 1.5) ? 1.5 : pbs.radius;
-      xTestRegion.SetIndex(i, (long) (m_MousePosition(i) - rad)); // + 1);
-      xTestRegion.SetSize(i, (long) (2 * rad + 1)); // - 1);
+      xTestRegion.SetIndex(i, (long) (x0 - rad)); // + 1);
+      xTestRegion.SetSize(i, (long) (x1 - rad) - (long) (x0 - rad)
+                          + (long) (2 * rad + 1)); // - 1);
       }
     else
       {
-      xTestRegion.SetIndex(i, m_MousePosition(i));
-      xTestRegion.SetSize(i, 1);
+      xTestRegion.SetIndex(i, x0);
+      xTestRegion.SetSize(i, x1 - x0 + 1);
       }
     }
 
@@ -388,10 +582,9 @@ PaintbrushModel::ApplyBrush(bool reverse_mode, bool dragging)
     if(!context_layer)
       context_layer = gid->GetMain();
 
-    // Precompute the watersheds
+    // Precompute the watersheds, or reuse those of a cached tile
     m_Watershed->PrecomputeWatersheds(
           context_layer->GetDefaultScalarRepresentation()->GetCommonFormatImage(),
-          driver->GetSelectedSegmentationLayer()->GetImage(),
           xTestRegion, to_itkIndex(m_MousePosition), pbs.watershed.smooth_iterations);
 
     m_Watershed->RecomputeWatersheds(pbs.watershed.level);
@@ -400,9 +593,14 @@ PaintbrushModel::ApplyBrush(bool reverse_mode, bool dragging)
   // Shift vector (different depending on whether the brush has odd/even diameter
   Vector3d offset = ComputeOffset();
 
+  // The vector from the end of the stroke to its start in slice space
+  Vector3d xStrokeSliceSpace = to_double(
+        m_Parent->GetImageToDisplayTransform()->TransformVector(
+          to_double(xFrom) - to_double(m_MousePosition)));
+
   // Iterate over the region using
   SegmentationUpdateIterator it_update(
-        imgLabel->GetImage(), xTestRegion, drawing_color, drawover);
+        imgLabel, xTestRegion, drawing_color, drawover);
 
   for(; !it_update.IsAtEnd(); ++it_update)
     {
@@ -416,18 +614,13 @@ PaintbrushModel::ApplyBrush(bool reverse_mode, bool dragging)
     Vector3d xDeltaSliceSpace = to_double(
           m_Parent->GetImageToDisplayTransform()->TransformVector(xDelta));
 
-    // Check if the pixel is inside
-    if(!TestInside(xDeltaSliceSpace, pbs))
+    // Check if the pixel is inside of the volume swept by the brush
+    if(!TestInside(xDeltaSliceSpace, xStrokeSliceSpace, pbs))
       continue;
 
     // Check if the pixel is in the watershed
-    if(flagWatershed)
-      {
-      LabelImageWrapper::ImageType::IndexType idxoff = to_itkIndex(
-        Vector3l(idx.GetIndex()) - Vector3l(xTestRegion.GetIndex().GetIndex()));
-      if(!m_Watershed->IsPixelInSegmentation(idxoff))
-        continue;
-      }
+    if(flagWatershed && !m_Watershed->IsPixelInSegmentation(idx))
+      continue;
 
     // Paint the pixel
     if(reverse_mode)
@@ -60,11 +60,20 @@ protected:
 
   Vector3d ComputeOffset();
   void ComputeMousePosition(const Vector3d &xSlice);
+  Vector3ui MapSliceToVoxel(const Vector3d &xSlice);
 
   bool ApplyBrush(bool reverse_mode, bool dragging);
+
+  // Apply the brush along the stroke from xFrom to the mouse position
+  bool ApplyBrush(bool reverse_mode, bool dragging, const Vector3ui &xFrom);
+
   bool TestInside(const Vector2d &x, const PaintbrushSettings &ps);
   bool TestInside(const Vector3d &x, const PaintbrushSettings &ps);
 
+  // Test whether the brush contains x when its center is moved along the
+  // segment from the origin to u
+  bool TestInside(const Vector3d &x, const Vector3d &u, const PaintbrushSettings &ps);
+
   GenericSliceModel *m_Parent;
   BrushWatershedPipeline *m_Watershed;
 
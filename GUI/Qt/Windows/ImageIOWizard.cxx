@@ -33,6 +33,7 @@
 #include "ImageIOWizardModel.h"
 #include "MetaDataAccess.h"
 #include "SNAPQtCommon.h"
+#include "ProcessEventsITKCommand.h"
 #include "FileChooserPanelWithHistory.h"
 
 #include "ImageIOWizard/OverlayRolePage.h"
@@ -103,7 +104,20 @@ bool AbstractPage::PerformIO()
     m_Model->SetSelectedFormat(fmt);
     if(m_Model->IsLoadMode())
       {
-      m_Model->LoadImage(to_utf8(filename));
+      // Keep the GUI responsive while a DICOM series is decoded, with the
+      // page disabled until the image is loaded
+      SmartPtr<ProcessEventsITKCommand> cmd = ProcessEventsITKCommand::New();
+      this->setEnabled(false);
+      try
+        {
+        m_Model->LoadImage(to_utf8(filename), cmd);
+        }
+      catch(...)
+        {
+        this->setEnabled(true);
+        throw;
+        }
+      this->setEnabled(true);
       }
     else
       {
@@ -440,8 +454,6 @@ void DICOMPage::cleanupPage()
   AbstractPage::cleanupPage();
 }
 
-#include "ProcessEventsITKCommand.h"
-
 void DICOMPage::processDicomDirectory()
 {
   // Change cursor until this object moves out of scope
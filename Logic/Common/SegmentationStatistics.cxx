@@ -39,12 +39,189 @@
 
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <algorithm>
 
 
 using namespace std;
 
 
-// TODO: improve efficiency by using filters to integrate label intensities
+// Number of histogram bins used to compute the median of each image
+static const int MEDIAN_HISTOGRAM_BINS = 1024;
+
+// Statistics of one label accumulated by one thread
+struct SegmentationStatistics::Accumulator
+{
+  unsigned long count;
+  itk::Index<3> lower, upper;
+  double sx, sy, sz;
+  std::vector<double> sum, sumsq, min, max;
+  std::vector<unsigned long> hist;
+};
+
+// A dense table of the labels seen by one thread. Labels are mapped to
+// entries through a lookup table, which is much faster than a std::map
+struct SegmentationStatistics::ThreadTable
+{
+  std::vector<int> slot;
+  std::vector<LabelType> labels;
+  std::vector<Accumulator> entries;
+
+  // Intensities of all the layers along the current line
+  std::vector<double> line;
+};
+
+// Data shared by the threads
+struct SegmentationStatistics::ThreadData
+{
+  LabelImageWrapper::ImageType *Image;
+  itk::ImageRegion<3> Region;
+  std::vector<ScalarImageWrapperBase *> Layers;
+
+  // Histogram mapping for each layer, used for the median
+  bool Extended;
+  std::vector<double> HistMin, HistScale;
+
+  std::vector<ThreadTable> Tables;
+};
+
+SegmentationStatistics
+::SegmentationStatistics()
+{
+  m_ComputeExtendedStatistics = false;
+  m_NumberOfThreads = 0;
+}
+
+void
+SegmentationStatistics
+::AccumulateSlab(ThreadData *data, ThreadTable &table, const itk::ImageRegion<3> &slab)
+{
+  typedef LabelImageWrapper::ImageType LabelImageType;
+  typedef LabelImageType::RLLine RLLine;
+  const LabelImageType::BufferType *buffer = data->Image->GetBuffer();
+
+  size_t ngray = data->Layers.size();
+  long x0 = slab.GetIndex(0), nx = slab.GetSize(0);
+  int nbins = data->Extended ? MEDIAN_HISTOGRAM_BINS : 0;
+
+  table.slot.resize(MAX_COLOR_LABELS + 1, -1);
+  table.line.resize(ngray * nx);
+
+  itk::Index<3> start;
+  start[0] = x0;
+  for(start[2] = slab.GetIndex(2); start[2] <= slab.GetUpperIndex()[2]; start[2]++)
+    {
+    for(start[1] = slab.GetIndex(1); start[1] <= slab.GetUpperIndex()[1]; start[1]++)
+      {
+      // Get the intensities of all the layers along the line, with a single
+      // virtual call per layer
+      for(size_t j = 0; j < ngray; j++)
+        data->Layers[j]->GetRunLengthIntensities(
+              data->Region, start, nx, &table.line[j * nx]);
+
+      // The line of the label image is indexed by (y,z)
+      LabelImageType::BufferType::IndexType bi = {{ start[1], start[2] }};
+      const RLLine &line = buffer->GetPixel(bi);
+
+      long x = 0;
+      for(size_t r = 0; r < line.size(); r++)
+        {
+        LabelType label = line[r].second;
+        long len = line[r].first;
+
+        // Find or create the entry for the label
+        int &k = table.slot[label];
+        if(k < 0)
+          {
+          k = (int) table.entries.size();
+          table.labels.push_back(label);
+          table.entries.push_back(Accumulator());
+          Accumulator &na = table.entries.back();
+          na.count = 0;
+          na.lower = na.upper = start;
+          na.lower[0] = na.upper[0] = x0 + x;
+          na.sx = na.sy = na.sz = 0.0;
+          na.sum.resize(ngray, 0.0);
+          na.sumsq.resize(ngray, 0.0);
+          na.min.resize(ngray, std::numeric_limits<double>::infinity());
+          na.max.resize(ngray, -std::numeric_limits<double>::infinity());
+          na.hist.resize(ngray * nbins, 0);
+          }
+        Accumulator &acc = table.entries[k];
+
+        // Count, centroid and bounding box
+        acc.count += len;
+        acc.sx += len * (x0 + x + 0.5 * (len - 1));
+        acc.sy += len * (double) start[1];
+        acc.sz += len * (double) start[2];
+        acc.lower[0] = std::min(acc.lower[0], (itk::IndexValueType) (x0 + x));
+        acc.upper[0] = std::max(acc.upper[0], (itk::IndexValueType) (x0 + x + len - 1));
+        for(int d = 1; d < 3; d++)
+          {
+          acc.lower[d] = std::min(acc.lower[d], start[d]);
+          acc.upper[d] = std::max(acc.upper[d], start[d]);
+          }
+
+        // Intensity statistics over the run, for each layer
+        for(size_t j = 0; j < ngray; j++)
+          {
+          const double *v = &table.line[j * nx + x];
+          double s = 0.0, ss = 0.0, vmin = acc.min[j], vmax = acc.max[j];
+          for(long q = 0; q < len; q++)
+            {
+            s += v[q];
+            ss += v[q] * v[q];
+            vmin = std::min(vmin, v[q]);
+            vmax = std::max(vmax, v[q]);
+            }
+          acc.sum[j] += s;
+          acc.sumsq[j] += ss;
+          acc.min[j] = vmin;
+          acc.max[j] = vmax;
+
+          if(nbins)
+            {
+            unsigned long *hist = &acc.hist[j * nbins];
+            double hmin = data->HistMin[j], hscale = data->HistScale[j];
+            for(long q = 0; q < len; q++)
+              {
+              if(v[q] == v[q])
+                {
+                int bin = (int) ((v[q] - hmin) * hscale);
+                hist[std::max(0, std::min(nbins - 1, bin))]++;
+                }
+              }
+            }
+          }
+
+        x += len;
+        }
+      }
+    }
+}
+
+ITK_THREAD_RETURN_TYPE
+SegmentationStatistics
+::ComputeThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ThreadData *data = static_cast<ThreadData *>(info->UserData);
+
+  // Each thread takes a slab of slices
+  itk::ImageRegion<3> slab = data->Region;
+  long z0 = data->Region.GetIndex(2), nz = data->Region.GetSize(2);
+  long zb = z0 + (nz * info->ThreadID) / info->NumberOfThreads;
+  long ze = z0 + (nz * (info->ThreadID + 1)) / info->NumberOfThreads;
+  slab.SetIndex(2, zb);
+  slab.SetSize(2, ze - zb);
+
+  if(ze > zb)
+    AccumulateSlab(data, data->Tables[info->ThreadID], slab);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
 void
 SegmentationStatistics
 ::Compute(IRISApplication *app)
@@ -89,86 +266,147 @@ SegmentationStatistics
   // Get the number of gray image layers
   size_t ngray = layers.size();
 
-  // Clear and initialize the statistics table
-  m_Stats.clear();
+  // Set up the data shared by the threads
+  ThreadData data;
+  data.Image = seg->GetImage();
+  data.Region = data.Image->GetBufferedRegion();
+  data.Layers = layers;
+  data.Extended = m_ComputeExtendedStatistics;
+
+  // The histograms used for the median span the range of each image. The
+  // range is computed here, since it is cached by the layer on demand. If the
+  // range has fewer values than there are bins, each bin holds one value and
+  // the median of integer images is exact
+  if(data.Extended)
+    {
+    for(size_t j = 0; j < ngray; j++)
+      {
+      double hmin = layers[j]->GetImageMinAsDouble();
+      double hmax = layers[j]->GetImageMaxAsDouble();
+      double range = std::max(hmax - hmin + 1.0, 1.0);
+      data.HistMin.push_back(hmin);
+      data.HistScale.push_back(range <= MEDIAN_HISTOGRAM_BINS
+                               ? 1.0 : MEDIAN_HISTOGRAM_BINS / range);
+      }
+    }
 
-  // Start the label image iteration
-  LabelImageWrapper::ConstIterator itLabel = seg->GetImageConstIterator();
-  itk::ImageRegion<3> region = itLabel.GetRegion();
+  // Split the image into slabs of slices, one per thread
+  unsigned int nt = m_NumberOfThreads
+      ? m_NumberOfThreads : itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  nt = std::max(1u, std::min(nt, (unsigned int) data.Region.GetSize(2)));
+  data.Tables.resize(nt);
+
+  if(nt > 1)
+    {
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(nt);
+    threader->SetSingleMethod(&SegmentationStatistics::ComputeThreadCallback, &data);
+    threader->SingleMethodExecute();
+    }
+  else
+    {
+    AccumulateSlab(&data, data.Tables[0], data.Region);
+    }
 
-  // Cache the entry to avoid many calls to std::map
-  LabelType runLabel = 0;
-  Entry *cachedEntry = &m_Stats[runLabel];
-  cachedEntry->resize(ngray);
-  itk::Index<3> runStart = itLabel.GetIndex();
-  long runLength = 0;
+  // Clear and initialize the statistics table
+  m_Stats.clear();
 
-  // Aggregate the statistical data
-  for( ; !itLabel.IsAtEnd(); ++itLabel, ++runLength)
+  // Reduce the tables of the threads into the statistics table
+  std::map<LabelType, Accumulator> total;
+  for(size_t t = 0; t < nt; t++)
     {
-    // Get the label and the corresponding entry (use cache to reduce time wasted in std::map)
-    LabelType label = itLabel.Value();
-    if(label != runLabel)
+    ThreadTable &table = data.Tables[t];
+    for(size_t k = 0; k < table.labels.size(); k++)
       {
-      // Record the statistics from the last run
-      this->RecordRunLength(ngray, layers, region, runStart, runLength, cachedEntry);
-
-      // Change the cached entry
-      runLabel = label;
-      cachedEntry = &m_Stats[runLabel];
-      if(cachedEntry->count == 0)
-        cachedEntry->resize(ngray);
+      Accumulator &src = table.entries[k];
+      std::map<LabelType, Accumulator>::iterator it = total.find(table.labels[k]);
+      if(it == total.end())
+        {
+        total[table.labels[k]] = src;
+        continue;
+        }
 
-      runStart = itLabel.GetIndex();
-      runLength = 0;
+      Accumulator &trg = it->second;
+      trg.count += src.count;
+      trg.sx += src.sx; trg.sy += src.sy; trg.sz += src.sz;
+      for(int d = 0; d < 3; d++)
+        {
+        trg.lower[d] = std::min(trg.lower[d], src.lower[d]);
+        trg.upper[d] = std::max(trg.upper[d], src.upper[d]);
+        }
+      for(size_t j = 0; j < ngray; j++)
+        {
+        trg.sum[j] += src.sum[j];
+        trg.sumsq[j] += src.sumsq[j];
+        trg.min[j] = std::min(trg.min[j], src.min[j]);
+        trg.max[j] = std::max(trg.max[j], src.max[j]);
+        }
+      for(size_t b = 0; b < trg.hist.size(); b++)
+        trg.hist[b] += src.hist[b];
       }
     }
 
-  // Record the statistics from the last run
-  this->RecordRunLength(ngray, layers, region, runStart, runLength, cachedEntry);
-
   // Compute the size of a voxel, in mm^3
   const double *spacing = 
     id->GetMain()->GetImageBase()->GetSpacing().GetDataPointer();
   double volVoxel = spacing[0] * spacing[1] * spacing[2];
   
   // Compute the mean and standard deviation
-  for(EntryMap::iterator it = m_Stats.begin(); it != m_Stats.end(); ++it)
+  for(std::map<LabelType, Accumulator>::iterator it = total.begin(); it != total.end(); ++it)
     {
-    Entry &entry = it->second;
+    const Accumulator &acc = it->second;
+    Entry &entry = m_Stats[it->first];
+    entry.resize(ngray);
+    entry.count = acc.count;
+    entry.centroid = Vector3d(acc.sx / acc.count, acc.sy / acc.count, acc.sz / acc.count);
+    entry.bbox_lower = Vector3i(acc.lower);
+    entry.bbox_upper = Vector3i(acc.upper);
+
     for(size_t j = 0; j < ngray; j++)
       {
+      const AbstractNativeIntensityMapping *nim = layers[j]->GetNativeIntensityMapping();
+      entry.sum[j] = acc.sum[j];
+      entry.sumsq[j] = acc.sumsq[j];
+
       // Map to native format
       double mean = entry.sum[j] / entry.count;
       double stdev = sqrt((entry.sumsq[j] - entry.sum[j] * mean) / (entry.count - 1));
 
       // Map with scale and shift
-      entry.mean[j] = layers[j]->GetNativeIntensityMapping()->MapInternalToNative(mean);
+      entry.mean[j] = nim->MapInternalToNative(mean);
 
       // Map with just shift
-      entry.stdev[j] = layers[j]->GetNativeIntensityMapping()->MapGradientMagnitudeToNative(stdev);
+      entry.stdev[j] = nim->MapGradientMagnitudeToNative(stdev);
+
+      entry.min[j] = nim->MapInternalToNative(acc.min[j]);
+      entry.max[j] = nim->MapInternalToNative(acc.max[j]);
+
+      // Find the median from the histogram, averaging the two middle values
+      // when the count is even
+      if(data.Extended)
+        {
+        const unsigned long *hist = &acc.hist[j * MEDIAN_HISTOGRAM_BINS];
+        unsigned long r1 = (acc.count - 1) / 2, r2 = acc.count / 2, cum = 0;
+        double hscale = data.HistScale[j], offset = (hscale < 1.0) ? 0.5 : 0.0;
+        double v1 = 0.0, v2 = 0.0;
+        for(int b = 0; b < MEDIAN_HISTOGRAM_BINS; b++)
+          {
+          if(cum <= r1 && r1 < cum + hist[b])
+            v1 = data.HistMin[j] + (b + offset) / hscale;
+          if(cum <= r2 && r2 < cum + hist[b])
+            {
+            v2 = data.HistMin[j] + (b + offset) / hscale;
+            break;
+            }
+          cum += hist[b];
+          }
+        entry.median[j] = nim->MapInternalToNative(0.5 * (v1 + v2));
+        }
       }
     entry.volume_mm3 = entry.count * volVoxel;
     }
 }
 
-void SegmentationStatistics
-::RecordRunLength(size_t ngray, vector<ScalarImageWrapperBase *> &layers,
-                  itk::ImageRegion<3> &region, itk::Index<3> &runStart,
-                  long runLength, Entry *cachedEntry)
-{
-  // Record the statistics from the last run
-  for(size_t j = 0; j < ngray; j++)
-    {
-    layers[j]->GetRunLengthIntensityStatistics(
-          region, runStart, runLength,
-          cachedEntry->sum.data_block() + j,
-          cachedEntry->sumsq.data_block() + j);
-    }
-
-  cachedEntry->count += runLength;
-}
-
 void 
 SegmentationStatistics
 ::ExportLegacy(ostream &fout, const ColorLabelTable &clt)
@@ -230,6 +468,20 @@ void SegmentationStatistics
 
     oss << colsep << "Image mean (" << colname << ")";
     oss << colsep << "Image stdev (" << colname << ")";
+
+    if(m_ComputeExtendedStatistics)
+      {
+      oss << colsep << "Image min (" << colname << ")";
+      oss << colsep << "Image max (" << colname << ")";
+      oss << colsep << "Image median (" << colname << ")";
+      }
+    }
+
+  if(m_ComputeExtendedStatistics)
+    {
+    oss << colsep << "Centroid X (voxel)" << colsep << "Centroid Y (voxel)"
+        << colsep << "Centroid Z (voxel)";
+    oss << colsep << "Bounding Box Min" << colsep << "Bounding Box Max";
     }
 
   // Endline
@@ -253,6 +505,21 @@ void SegmentationStatistics
       {
       oss << colsep << entry.mean[j];
       oss << colsep << entry.stdev[j];
+
+      if(m_ComputeExtendedStatistics)
+        {
+        oss << colsep << entry.min[j];
+        oss << colsep << entry.max[j];
+        oss << colsep << entry.median[j];
+        }
+      }
+
+    if(m_ComputeExtendedStatistics)
+      {
+      for(int d = 0; d < 3; d++)
+        oss << colsep << entry.centroid[d];
+      oss << colsep << entry.bbox_lower[0] << " " << entry.bbox_lower[1] << " " << entry.bbox_lower[2];
+      oss << colsep << entry.bbox_upper[0] << " " << entry.bbox_upper[1] << " " << entry.bbox_upper[2];
       }
 
     oss << std::endl;
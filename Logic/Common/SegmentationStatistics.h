@@ -36,6 +36,7 @@
 #define __SegmentationStatistics_h_
 
 #include "SNAPCommon.h"
+#include "itkMultiThreader.h"
 #include <vector>
 #include <string>
 #include <iostream>
@@ -67,17 +68,29 @@ public:
     unsigned long int count;
     double volume_mm3;
     vnl_vector<double> sum, sumsq, mean, stdev;
+
+    // Extended statistics: intensity range and median of each image, and
+    // the centroid (in voxel coordinates) and bounding box of the label
+    vnl_vector<double> min, max, median;
+    Vector3d centroid;
+    Vector3i bbox_lower, bbox_upper;
+
     Entry() : count(0),volume_mm3(0) {}
     void resize(int n) {
       sum.set_size(n); sum.fill(0);
       sumsq.set_size(n); sumsq.fill(0);
       mean.set_size(n); mean.fill(0);
       stdev.set_size(n); stdev.fill(0);
+      min.set_size(n); min.fill(0);
+      max.set_size(n); max.fill(0);
+      median.set_size(n); median.fill(0);
     }
   };
 
   typedef std::map<LabelType, Entry> EntryMap;
 
+  SegmentationStatistics();
+
   /* Compute statistics from a segmentation image */
   void Compute(IRISApplication *app);
   
@@ -93,6 +106,19 @@ public:
   const std::vector<std::string> &GetImageStatisticsColumns() const
     { return m_ImageStatisticsColumnNames; }
 
+  /* Whether to compute (and export) the median of each image over each label,
+   * using histograms, as well as the range, centroid and bounding box */
+  void SetComputeExtendedStatistics(bool value)
+    { m_ComputeExtendedStatistics = value; }
+
+  bool GetComputeExtendedStatistics() const
+    { return m_ComputeExtendedStatistics; }
+
+  /* Number of threads used by Compute(). Zero (default) uses the global
+   * default number of threads */
+  void SetNumberOfThreads(unsigned int value)
+    { m_NumberOfThreads = value; }
+
 private:
 
   // Label statistics
@@ -100,14 +126,21 @@ private:
 
   // Column information
   std::vector<std::string> m_ImageStatisticsColumnNames;
-  
-  void RecordRunLength(
-      size_t ngray,
-      std::vector<ScalarImageWrapperBase *> &layers,
-      itk::ImageRegion<3> &region,
-      itk::Index<3> &runStart,
-      long runLength,
-      Entry *cachedEntry);
+
+  // Settings
+  bool m_ComputeExtendedStatistics;
+  unsigned int m_NumberOfThreads;
+
+  // Per-thread accumulators, defined in the .cxx file
+  struct Accumulator;
+  struct ThreadTable;
+  struct ThreadData;
+
+  // Accumulate the statistics of one slab of the label image
+  static void AccumulateSlab(ThreadData *data, ThreadTable &table,
+                             const itk::ImageRegion<3> &slab);
+
+  static ITK_THREAD_RETURN_TYPE ComputeThreadCallback(void *arg);
 };
 
 #endif
@@ -85,9 +85,11 @@
 #include "LabelUseHistory.h"
 #include "ImageAnnotationData.h"
 #include "SegmentationUpdateIterator.h"
+#include "RLEImageOperations.h"
 #include "AffineTransformHelper.h"
 
 #include <stdio.h>
+#include <cmath>
 #include <sstream>
 #include <iomanip>
 
@@ -191,6 +193,14 @@ IRISApplication
   delete m_SystemInterface;
 }
 
+// Functor that clears all labels but one, used to seed the snake ROI
+struct KeepSingleLabelFunctor
+{
+  LabelType Label;
+  KeepSingleLabelFunctor(LabelType label) : Label(label) {}
+  LabelType operator()(LabelType v) const { return v == Label ? v : 0; }
+};
+
 void 
 IRISApplication
 ::InitializeSNAPImageData(const SNAPSegmentationROISettings &roi,
@@ -210,21 +220,24 @@ IRISApplication
   LabelImageWrapper *seg = this->GetSelectedSegmentationLayer();
   LabelImageType::Pointer imgNewLabel = seg->DeepCopyRegion(roiLabel,progressCommand);
 
-  // Filter the segmentation image to only allow voxels of 0 intensity and 
-  // of the current drawing color
+  // Filter the segmentation image to only allow voxels of 0 intensity and
+  // of the current drawing color. This is done run by run
   LabelType passThroughLabel = m_GlobalState->GetDrawingColorLabel();
 
-  typedef itk::ImageRegionIterator<LabelImageType> IteratorType;
-  IteratorType itLabel(imgNewLabel,imgNewLabel->GetBufferedRegion());
-  unsigned int nCopied = 0;
-  while(!itLabel.IsAtEnd())
+  typedef RLEImageOperations<LabelImageType> LabelOps;
+  unsigned long nCopied = 0;
+  if(roi.IsSeedWithCurrentSegmentation())
     {
-    if(itLabel.Get() != passThroughLabel || !roi.IsSeedWithCurrentSegmentation())
-      itLabel.Set((LabelType) 0);
-    else
-      nCopied++;
-    ++itLabel;
+    KeepSingleLabelFunctor keep(passThroughLabel);
+    RLENullRunVisitor nv;
+    LabelOps::TransformValues(imgNewLabel, imgNewLabel->GetBufferedRegion(), keep, nv);
+    nCopied = LabelOps::CountValue(imgNewLabel, passThroughLabel);
+    }
+  else
+    {
+    imgNewLabel->FillBuffer(0);
     }
+  imgNewLabel->Modified();
 
   // Record whether the segmentation has any values that are not zero
   m_GlobalState->SetSnakeInitializedWithManualSegmentation(nCopied > 0);
@@ -622,7 +635,7 @@ IRISApplication
   r_vol.Crop(seg->GetBufferedRegion());
 
   // Create an iterator for painting
-  SegmentationUpdateIterator itVol(seg, r_vol,
+  SegmentationUpdateIterator itVol(this->GetSelectedSegmentationLayer(), r_vol,
                                    m_GlobalState->GetDrawingColorLabel(),
                                    m_GlobalState->GetDrawOverFilter());
 
@@ -666,6 +679,46 @@ IRISApplication
   return itVol.GetNumberOfChangedVoxels();
 }
 
+// Compute the bounding box of the voxels inside of the zero level set of a
+// level set image. Each line is scanned from both ends up to its first and
+// last inside voxel. Returns false if there are no voxels inside
+static bool ComputeLevelSetInsideBox(
+    const LevelSetImageWrapper::ImageType *ls, itk::ImageRegion<3> &box)
+{
+  itk::ImageRegion<3> region = ls->GetBufferedRegion();
+  long nx = region.GetSize(0), ny = region.GetSize(1), nz = region.GetSize(2);
+  const float *p = ls->GetBufferPointer();
+
+  long lo[] = { nx, ny, nz }, hi[] = { -1, -1, -1 };
+  for(long z = 0; z < nz; z++)
+    {
+    for(long y = 0; y < ny; y++, p += nx)
+      {
+      long x0 = 0, x1 = nx - 1;
+      while(x0 < nx && p[x0] > 0)
+        x0++;
+      if(x0 == nx)
+        continue;
+      while(p[x1] > 0)
+        x1--;
+
+      lo[0] = std::min(lo[0], x0); hi[0] = std::max(hi[0], x1);
+      lo[1] = std::min(lo[1], y); hi[1] = std::max(hi[1], y);
+      lo[2] = std::min(lo[2], z); hi[2] = z;
+      }
+    }
+
+  if(hi[2] < 0)
+    return false;
+
+  for(unsigned int d = 0; d < 3; d++)
+    {
+    box.SetIndex(d, region.GetIndex(d) + lo[d]);
+    box.SetSize(d, hi[d] - lo[d] + 1);
+    }
+  return true;
+}
+
 void 
 IRISApplication
 ::UpdateIRISWithSnapImageData(CommandType *progressCommand)
@@ -675,6 +728,7 @@ IRISApplication
   // Get pointers to the source and destination images
   typedef LevelSetImageWrapper::ImageType SourceImageType;
   typedef LabelImageWrapper::ImageType TargetImageType;
+  typedef TargetImageType::RegionType RegionType;
 
   // If the voxel size of the image does not match the voxel size of the 
   // main image, we need to resample the region  
@@ -689,6 +743,80 @@ IRISApplication
 
   // Construct are region of interest into which the result will be pasted
   SNAPSegmentationROISettings roi = m_GlobalState->GetSegmentationROISettings();
+  RegionType rgnROI = roi.GetROI();
+
+  // Inversion state and the label being drawn
+  bool invert = m_GlobalState->GetPolygonInvert();
+  LabelType label = m_GlobalState->GetDrawingColorLabel();
+
+  // Radius of the sinc interpolator used for resampling
+  const unsigned int VRadius = 5;
+
+  // Find the part of the ROI that may change, relative to the start of the
+  // ROI. The voxels inside of the snake get the drawing label, and those
+  // outside only change if they already have the drawing label, so unless
+  // the snake is inverted, the rest of the ROI can be skipped
+  long lo[] = { 0, 0, 0 }, hi[] = { -1, -1, -1 };
+  if(invert)
+    {
+    for(unsigned int d = 0; d < 3; d++)
+      hi[d] = rgnROI.GetSize(d) - 1;
+    }
+  else
+    {
+    RegionType box;
+    if(ComputeLevelSetInsideBox(source, box))
+      {
+      for(unsigned int d = 0; d < 3; d++)
+        {
+        long s0 = box.GetIndex(d) - source->GetBufferedRegion().GetIndex(d);
+        long s1 = s0 + box.GetSize(d) - 1;
+        if(roi.IsResampling())
+          {
+          // Map the box into the voxels of the target, padded by the support
+          // of the interpolator in the snake image
+          double r = source->GetSpacing()[d] / target->GetSpacing()[d];
+          lo[d] = (long) floor((s0 - (long) VRadius - 1) * r);
+          hi[d] = (long) ceil((s1 + (long) VRadius + 1) * r);
+          }
+        else
+          {
+          lo[d] = s0; hi[d] = s1;
+          }
+        }
+      }
+
+    typedef RLEImageOperations<TargetImageType> LabelOps;
+    if(label != 0 && LabelOps::ComputeBoundingBox(target, rgnROI, label, false, box))
+      {
+      for(unsigned int d = 0; d < 3; d++)
+        {
+        long b0 = box.GetIndex(d) - rgnROI.GetIndex(d);
+        long b1 = b0 + box.GetSize(d) - 1;
+        lo[d] = (hi[d] < lo[d]) ? b0 : std::min(lo[d], b0);
+        hi[d] = (hi[d] < b0) ? b1 : std::max(hi[d], b1);
+        }
+      }
+    }
+
+  // Clip the region to the ROI. If it is empty, nothing can change
+  RegionType rgnUpdate, rgnSource, rgnTarget;
+  for(unsigned int d = 0; d < 3; d++)
+    {
+    lo[d] = std::max(lo[d], 0l);
+    hi[d] = std::min(hi[d], (long) rgnROI.GetSize(d) - 1);
+    if(hi[d] < lo[d])
+      return;
+
+    rgnUpdate.SetIndex(d, lo[d]);
+    rgnUpdate.SetSize(d, hi[d] - lo[d] + 1);
+
+    // The matching regions of the snake image and of the IRIS segmentation
+    rgnSource.SetIndex(d, lo[d] + source->GetBufferedRegion().GetIndex(d));
+    rgnTarget.SetIndex(d, lo[d] + rgnROI.GetIndex(d));
+    }
+  rgnSource.SetSize(rgnUpdate.GetSize());
+  rgnTarget.SetSize(rgnUpdate.GetSize());
 
   // If the ROI has been resampled, resample the segmentation in reverse direction
   if(roi.IsResampling())
@@ -710,7 +838,6 @@ IRISApplication
       SourceImageType,double> CubicInterpolatorType;
 
     // More typedefs are needed for the sinc interpolator
-    const unsigned int VRadius = 5;
     typedef itk::Function::HammingWindowFunction<VRadius> WindowFunction;
     typedef itk::ConstantBoundaryCondition<SourceImageType> Condition;
     typedef itk::WindowedSincInterpolateImageFunction<
@@ -738,10 +865,17 @@ IRISApplication
       };
 
     // Set the image sizes and spacing. We are creating an image of the 
-    // dimensions of the ROI defined in the IRIS image space. 
-    fltSample->SetSize(roi.GetROI().GetSize());
+    // dimensions of the region to update in the IRIS image space, which
+    // starts at the ROI corner of the snake image offset by the start of
+    // the region in target voxels
+    SourceImageType::PointType origin = source->GetOrigin();
+    for(unsigned int i = 0; i < 3; i++)
+      for(unsigned int j = 0; j < 3; j++)
+        origin[i] += source->GetDirection()(i,j) * lo[j] * target->GetSpacing()[j];
+
+    fltSample->SetSize(rgnUpdate.GetSize());
     fltSample->SetOutputSpacing(target->GetSpacing());
-    fltSample->SetOutputOrigin(source->GetOrigin());
+    fltSample->SetOutputOrigin(origin);
     fltSample->SetOutputDirection(source->GetDirection());
 
     // Watch the segmentation progress
@@ -756,19 +890,17 @@ IRISApplication
     
     // Change the source to the output
     source = fltSample->GetOutput();
-    }  
+    rgnSource = source->GetLargestPossibleRegion();
+    }
 
   // Creat the source iterator
   typedef itk::ImageRegionConstIterator<SourceImageType> SourceIteratorType;
-  SourceIteratorType itSource(source,source->GetLargestPossibleRegion());
+  SourceIteratorType itSource(source, rgnSource);
 
-  // Create the smart target iterator
+  // Create the smart target iterator, whose delta only covers the region
+  // that may change
   SegmentationUpdateIterator itTarget(
-        target, roi.GetROI(),
-        m_GlobalState->GetDrawingColorLabel(), m_GlobalState->GetDrawOverFilter());
-
-  // Inversion state
-  bool invert = m_GlobalState->GetPolygonInvert();
+        iris_seg, rgnTarget, label, m_GlobalState->GetDrawOverFilter());
 
   // Go through both iterators, copy the new over the old
   while(!itSource.IsAtEnd())
@@ -1170,32 +1302,25 @@ IRISApplication
 ::ReplaceLabel(LabelType drawing, LabelType drawover)
 {
   // Get the label image
-  LabelImageWrapper::ImageType *imgLabel = this->GetSelectedSegmentationLayer()->GetImage();
+  LabelImageWrapper *wrapper = this->GetSelectedSegmentationLayer();
+  LabelImageWrapper::ImageType *imgLabel = wrapper->GetImage();
 
-  // Get the number of voxels
-  size_t nvoxels = 0;
+  // The label counts are updated without rescanning the image
+  LabelCountIndex *index = wrapper->GetLabelCountIndex();
+  index->BeginIncrementalUpdate();
 
-  // Update the segmentation
-  typedef itk::ImageRegionIterator<
-    LabelImageWrapper::ImageType> IteratorType;
-  for(IteratorType it(imgLabel, imgLabel->GetBufferedRegion());  
-    !it.IsAtEnd(); ++it)
-    {
-    if(it.Get() == drawover)
-      {
-      it.Set(drawing);
-      ++nvoxels;
-      }
-    }
+  // Update the segmentation by relabeling the runs of the RLE image
+  size_t nvoxels = RLEImageOperations<LabelImageType>::ReplaceValue(
+        imgLabel, drawover, drawing);
 
   // Register that the image has been updated
+  index->RecordReplaceLabel(drawover, drawing);
   imgLabel->Modified();
+  index->EndIncrementalUpdate();
 
   return nvoxels;
 }
 
-// TODO: This information should be cached at the segmentation layer level
-// by keeping track of label counts after every update operation.
 size_t
 IRISApplication
 ::GetNumberOfVoxelsWithLabel(LabelType label)
@@ -1203,20 +1328,13 @@ IRISApplication
   // Number of voxels matching current label
   size_t nvoxels = 0;
 
-  // We must iterate over all the label images
+  // We must iterate over all the label images. The counts are cached by each
+  // layer, so this does not require scanning the images
   for(LayerIterator it = this->GetCurrentImageData()->GetLayers(LABEL_ROLE);
       !it.IsAtEnd(); ++it)
     {
     LabelImageWrapper *wrapper = dynamic_cast<LabelImageWrapper *>(it.GetLayer());
-    LabelImageType *seg = wrapper->GetImage();
-
-    // Get the number of voxels
-    for(LabelImageWrapper::ConstIterator it(seg, seg->GetBufferedRegion());
-        !it.IsAtEnd(); ++it)
-      {
-      if(it.Get() == label)
-        ++nvoxels;
-      }
+    nvoxels += wrapper->GetNumberOfVoxelsWithLabel(label);
     }
 
   return nvoxels;
@@ -1228,46 +1346,39 @@ IRISApplication
 ::RelabelSegmentationWithCutPlane(const Vector3d &normal, double intercept) 
 {
   // Get the label image
-  LabelImageWrapper::ImageType *imgLabel = this->GetSelectedSegmentationLayer()->GetImage();
-  
-  // Create the smart target iterator
-  SegmentationUpdateIterator it(
-        imgLabel, imgLabel->GetBufferedRegion(),
-        m_GlobalState->GetDrawingColorLabel(), m_GlobalState->GetDrawOverFilter());
+  LabelImageWrapper *wrapper = this->GetSelectedSegmentationLayer();
+  LabelImageWrapper::ImageType *imgLabel = wrapper->GetImage();
+  LabelImageWrapper::ImageType::RegionType region = imgLabel->GetBufferedRegion();
 
-  // Adjust the intercept by 0.5 for voxel offset
-  intercept -= 0.5 * (normal[0] + normal[1] + normal[2]);
+  // The recorder keeps track of the changes for undo
+  SegmentationRunRecorder recorder(wrapper, region);
 
-  // Iterate over the image, relabeling labels on one side of the plane
-  while(!it.IsAtEnd())
-    {
-    // Compute the distance to the plane
-    itk::Index<3> index = it.GetIndex();
-    double distance = 
-      index[0]*normal[0] + 
-      index[1]*normal[1] + 
-      index[2]*normal[2] - intercept;
+  // The paint operation applied on the positive side of the plane
+  SegmentationPaintFunctor paint(
+        m_GlobalState->GetDrawingColorLabel(), m_GlobalState->GetDrawOverFilter(), true);
 
-    // Check the side of the plane
-    if(distance > 0)
-      it.PaintAsForegroundPreserveClear();
+  // Adjust the intercept by 0.5 for voxel offset
+  intercept -= 0.5 * (normal[0] + normal[1] + normal[2]);
 
-    // Next voxel
-    ++it;
-    }
+  // Relabel the runs on the positive side of the plane. Along each line of the
+  // image, the plane splits the line into two intervals, so this is done run
+  // by run rather than voxel by voxel.
+  double n[3] = { normal[0], normal[1], normal[2] };
+  RLEImageOperations<LabelImageType>::TransformHalfSpace(
+        imgLabel, region, n, intercept, paint, recorder);
 
   // Finalize
-  it.Finalize();
+  recorder.Finalize();
 
   // Store the undo point if needed
-  if(it.GetNumberOfChangedVoxels() > 0)
+  if(recorder.GetNumberOfChangedVoxels() > 0)
     {
-    this->GetSelectedSegmentationLayer()->StoreUndoPoint("3D scalpel", it.RelinquishDelta());
+    wrapper->StoreUndoPoint("3D scalpel", recorder.RelinquishDelta());
     RecordCurrentLabelUse();
     InvokeEvent(SegmentationChangeEvent());
     }
 
-  return it.GetNumberOfChangedVoxels();
+  return recorder.GetNumberOfChangedVoxels();
 }
 
 int 
@@ -1805,7 +1916,8 @@ IRISApplication
 ::LoadImageViaDelegate(const char *fname,
                        AbstractLoadImageDelegate *del,
                        IRISWarningList &wl,
-                       Registry *ioHints)
+                       Registry *ioHints,
+                       itk::Command *progressCommand)
 {
   Registry regAssoc;
 
@@ -1832,7 +1944,7 @@ IRISApplication
   del->UnloadCurrentImage();
 
   // Read the image body
-  io->ReadNativeImageData();
+  io->ReadNativeImageData(progressCommand);
 
   // Validate the image data
   del->ValidateImage(io, wl);
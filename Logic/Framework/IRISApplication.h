@@ -209,12 +209,14 @@ public:
    * By default the IO hints are obtained from the association files, i.e. by
    * looking up the hints associated with fname in the user's application data
    * directory. But it is also possible to provide a pointer to the ioHints, i.e.,
-   * if the image is being as part of loading a workspace.
+   * if the image is being as part of loading a workspace. The optional progress
+   * command observes the progress of reading the image data.
    */
   ImageWrapperBase* LoadImageViaDelegate(const char *fname,
                                          AbstractLoadImageDelegate *del,
                                          IRISWarningList &wl,
-                                         Registry *ioHints = NULL);
+                                         Registry *ioHints = NULL,
+                                         itk::Command *progressCommand = NULL);
 
   /**
    * List available additional DICOM series that can be loaded given the currently
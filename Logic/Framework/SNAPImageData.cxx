@@ -56,6 +56,7 @@
 #include "ThresholdSettings.h"
 #include "ColorMap.h"
 #include "SNAPImageData.h"
+#include "AllPurposeProgressAccumulator.h"
 
 #include "SlicePreviewFilterWrapper.h"
 #include "PreprocessingFilterConfigTraits.h"
@@ -75,7 +76,7 @@ SNAPImageData
   // Create the mutex lock
   m_LevelSetPipelineMutexLock = itk::FastMutexLock::New();
 
-  m_CompressedAlternateLabelImage = NULL;
+  m_AlternateUndoManager = NULL;
 }
 
 
@@ -85,8 +86,7 @@ SNAPImageData
   if(m_LevelSetDriver)
     delete m_LevelSetDriver;
 
-  if(m_CompressedAlternateLabelImage)
-    delete m_CompressedAlternateLabelImage;
+  this->DiscardAlternateLabelImage();
 }
 
 void 
@@ -509,51 +509,43 @@ SNAPImageData
   return m_LevelSetDriver->GetLevelSetFunction();
 }
 
-// TODO: this must go away!
-void SNAPImageData::SwapLabelImageWithCompressedAlternative()
+void SNAPImageData::SwapLabelImageWithAlternative()
 {
-  // Create a compressed version of the current segmentation
-  CompressedLabelImageType *save = new CompressedLabelImageType();
   LabelImageWrapper *liw = this->GetFirstSegmentationLayer();
-  for(LabelImageWrapper::ConstIterator iter(liw->GetImage(), liw->GetBufferedRegion());
-      !iter.IsAtEnd(); ++iter)
-    {
-    save->Encode(iter.Value());
-    }
-  save->FinishEncoding();
+  LabelImageType *seg = liw->GetImage();
 
-  // Clear the undo manager
-  liw->ClearUndoPoints();
-
-  // Decompress the currently saved alternative
-  if(m_CompressedAlternateLabelImage)
-    {
-    LabelImageWrapper::Iterator it_write(liw->GetImage(), liw->GetBufferedRegion());
-    for(size_t i = 0; i < m_CompressedAlternateLabelImage->GetNumberOfRLEs(); ++i)
-      {
-      LabelType value = m_CompressedAlternateLabelImage->GetRLEValue(i);
-      for(size_t j = 0; j < m_CompressedAlternateLabelImage->GetRLELength(i); ++j, ++it_write)
-        it_write.Set(value);
-      }
-    }
-  else
+  // The alternate image starts out empty
+  if(!m_AlternateLabelImage
+     || m_AlternateLabelImage->GetBufferedRegion() != seg->GetBufferedRegion())
     {
-    liw->GetImage()->FillBuffer(0);
+    this->DiscardAlternateLabelImage();
+    m_AlternateLabelImage = LabelImageType::New();
+    m_AlternateLabelImage->CopyInformation(seg);
+    m_AlternateLabelImage->SetRegions(seg->GetBufferedRegion());
+    m_AlternateLabelImage->Allocate();
+    m_AlternateLabelImage->FillBuffer(0);
     }
 
-  liw->GetImage()->Modified();
-  m_CompressedAlternateLabelImage = save;
+  // Exchange the runs and the undo histories of the two images
+  liw->SwapImageContents(m_AlternateLabelImage, m_AlternateUndoManager);
+}
+
+void SNAPImageData::DiscardAlternateLabelImage()
+{
+  m_AlternateLabelImage = NULL;
+  delete m_AlternateUndoManager;
+  m_AlternateUndoManager = NULL;
 }
 
 void SNAPImageData::SwitchLabelImageToExamples()
 {
-  this->SwapLabelImageWithCompressedAlternative();
+  this->SwapLabelImageWithAlternative();
   m_LabelImageInExampleMode = true;
 }
 
 void SNAPImageData::SwitchLabelImageToMainSegmentation()
 {
-  this->SwapLabelImageWithCompressedAlternative();
+  this->SwapLabelImageWithAlternative();
   m_LabelImageInExampleMode = false;
 }
 
@@ -566,8 +558,22 @@ SNAPImageData
   // Get the source main wrapper
   ImageWrapperBase *srcMain = source->GetMain();
 
+  // The progress of all the layers is combined into a single report, with
+  // each layer weighted by its number of components
+  SmartPtr<AllPurposeProgressAccumulator> accum = AllPurposeProgressAccumulator::New();
+  if(progressCommand)
+    accum->AddObserver(itk::ProgressEvent(), progressCommand);
+
+  SmartPtr<itk::Command> cmdMain =
+      accum->RegisterITKSourceViaCommand(srcMain->GetNumberOfComponents());
+
+  std::vector<SmartPtr<itk::Command> > cmdOverlay;
+  for(LayerIterator lit = source->GetLayers(OVERLAY_ROLE); !lit.IsAtEnd(); ++lit)
+    cmdOverlay.push_back(
+          accum->RegisterITKSourceViaCommand(lit.GetLayer()->GetNumberOfComponents()));
+
   // Extract the ROI into a generic type
-  SmartPtr<ImageWrapperBase> roiMain = srcMain->ExtractROI(roi, progressCommand);
+  SmartPtr<ImageWrapperBase> roiMain = srcMain->ExtractROI(roi, cmdMain);
 
   // Assign the new wrapper to the target
   this->SetMainImageInternal(roiMain);
@@ -576,12 +582,13 @@ SNAPImageData
   this->CopyLayerMetadata(this->GetMain(), source->GetMain());
 
   // Repeat all of this for the overlays
+  int iOverlay = 0;
   for(LayerIterator lit = source->GetLayers(OVERLAY_ROLE);
-      !lit.IsAtEnd(); ++lit)
+      !lit.IsAtEnd(); ++lit, ++iOverlay)
     {
     // Do the same for all the anatomic wrappers
     SmartPtr<ImageWrapperBase> roiOvl =
-        lit.GetLayer()->ExtractROI(roi, progressCommand);
+        lit.GetLayer()->ExtractROI(roi, cmdOverlay[iOverlay]);
 
     // Add the overlay
     this->AddOverlayInternal(roiOvl);
@@ -591,11 +598,8 @@ SNAPImageData
     }
 
   // Destroy the alternate image if there is none or if the ROI settings have changed
-  if(m_CompressedAlternateLabelImage && m_ROISettings != roi)
-    {
-    delete m_CompressedAlternateLabelImage;
-    m_CompressedAlternateLabelImage = NULL;
-    }
+  if(m_ROISettings != roi)
+    this->DiscardAlternateLabelImage();
 
   // Cache the ROI settings
   m_ROISettings = roi;
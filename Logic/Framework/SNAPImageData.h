@@ -297,15 +297,18 @@ protected:
   // Are we in example mode
   bool m_LabelImageInExampleMode;
 
-  // Compressed data for the example/main segmentation image
-  typedef UndoDataManager<LabelType>::Delta CompressedLabelImageType;
-  CompressedLabelImageType *m_CompressedAlternateLabelImage;
+  // The example/main segmentation image not currently in the label wrapper,
+  // and its undo history. The two are swapped in and out of the wrapper
+  LabelImageType::Pointer m_AlternateLabelImage;
+  LabelImageWrapper::UndoManagerType *m_AlternateUndoManager;
 
   // Current ROI settings
   SNAPSegmentationROISettings m_ROISettings;
 
 
-  void SwapLabelImageWithCompressedAlternative();
+  void SwapLabelImageWithAlternative();
+
+  void DiscardAlternateLabelImage();
 };
 
 
@@ -45,6 +45,7 @@
 
 #include "SNAPCommon.h"
 #include "ImageWrapperTraits.h"
+#include "LabelImageWrapper.h"
 #include "UndoDataManager.h"
 
 
@@ -74,20 +75,39 @@ public:
       m_ActiveLabel(active_label),
       m_DrawOver(draw_over),
       m_Iterator(labelImage, region),
-      m_ChangedVoxels(0)
+      m_ChangedVoxels(0),
+      m_CountIndex(NULL)
   {
-    // Create the delta
-    m_Delta = new UndoDelta();
-    m_Delta->SetRegion(region);
+    this->InitializeDelta();
+  }
 
-    // Set the voxel delta to zero
-    m_VoxelDelta = 0;
+  /**
+   * This constructor should be used when updating the segmentation held by a
+   * label image wrapper. The label counts stored by the wrapper are updated
+   * as voxels are painted.
+   */
+  SegmentationUpdateIterator(LabelImageWrapper *labelWrapper,
+                             const RegionType &region,
+                             LabelType active_label,
+                             DrawOverFilter draw_over)
+    : m_Region(region),
+      m_ActiveLabel(active_label),
+      m_DrawOver(draw_over),
+      m_Iterator(labelWrapper->GetImage(), region),
+      m_ChangedVoxels(0),
+      m_CountIndex(labelWrapper->GetLabelCountIndex())
+  {
+    this->InitializeDelta();
+    m_CountIndex->BeginIncrementalUpdate();
   }
 
   ~SegmentationUpdateIterator()
   {
     if(m_Delta)
       delete m_Delta;
+
+    if(m_CountIndex)
+      m_CountIndex->EndIncrementalUpdate();
   }
 
   void operator ++()
@@ -121,11 +141,7 @@ public:
        (m_DrawOver.CoverageMode == PAINT_OVER_VISIBLE && lOld != 0))
       {
       if(lOld != new_label)
-        {
-        m_VoxelDelta += new_label - lOld;
-        m_Iterator.Set(new_label);
-        m_ChangedVoxels++;
-        }
+        this->SetLabel(lOld, new_label);
       }
   }
 
@@ -152,11 +168,7 @@ public:
        (m_DrawOver.CoverageMode == PAINT_OVER_VISIBLE && lOld != 0))
       {
       if(lOld != m_ActiveLabel)
-        {
-        m_VoxelDelta += m_ActiveLabel - lOld;
-        m_Iterator.Set(m_ActiveLabel);
-        m_ChangedVoxels++;
-        }
+        this->SetLabel(lOld, m_ActiveLabel);
       }
   }
 
@@ -170,11 +182,7 @@ public:
     LabelType lOld = m_Iterator.Get();
 
     if(m_ActiveLabel != 0 && lOld == m_ActiveLabel)
-      {
-      m_VoxelDelta += 0 - lOld;
-      m_Iterator.Set(0);
-      m_ChangedVoxels++;
-      }
+      this->SetLabel(lOld, 0);
   }
 
   /**
@@ -186,11 +194,7 @@ public:
     LabelType lOld = m_Iterator.Get();
 
     if(lOld == target_label)
-      {
-      m_VoxelDelta += new_label - lOld;
-      m_Iterator.Set(new_label);
-      m_ChangedVoxels++;
-      }
+      this->SetLabel(lOld, new_label);
   }
 
   /**
@@ -213,9 +217,7 @@ public:
        (m_DrawOver.CoverageMode == PAINT_OVER_ONE && lOld == m_DrawOver.DrawOverLabel) ||
        (m_DrawOver.CoverageMode == PAINT_OVER_VISIBLE && lOld != 0))
       {
-      m_VoxelDelta += new_label - lOld;
-      m_Iterator.Set(new_label);
-      m_ChangedVoxels++;
+      this->SetLabel(lOld, new_label);
       }
   }
 
@@ -234,6 +236,13 @@ public:
     m_Delta->FinishEncoding();
     if(m_ChangedVoxels > 0)
       m_Iterator.GetImage()->Modified();
+
+    // The label counts are now in sync with the modified image
+    if(m_CountIndex)
+      {
+      m_CountIndex->EndIncrementalUpdate();
+      m_CountIndex = NULL;
+      }
   }
 
   // Keep delta from being deleted
@@ -258,6 +267,27 @@ public:
 
 protected:
 
+  void InitializeDelta()
+  {
+    // Create the delta
+    m_Delta = new UndoDelta();
+    m_Delta->SetRegion(m_Region);
+
+    // Set the voxel delta to zero
+    m_VoxelDelta = 0;
+  }
+
+  // Assign a new label to the current voxel, recording the change
+  void SetLabel(LabelType lOld, LabelType lNew)
+  {
+    m_VoxelDelta += lNew - lOld;
+    m_Iterator.Set(lNew);
+    m_ChangedVoxels++;
+
+    if(m_CountIndex)
+      m_CountIndex->RecordChange(lOld, lNew, m_Iterator.GetIndex());
+  }
+
   // Name of the segmentation update (for undo tracking)
   std::string m_Title;
 
@@ -281,7 +311,139 @@ protected:
 
   // Number of voxels actually modified
   unsigned long m_ChangedVoxels;
+
+  // Label count index updated along with the image (may be NULL)
+  LabelCountIndex *m_CountIndex;
+};
+
+
+
+/**
+ * \class SegmentationPaintFunctor
+ * \brief Maps an existing label to the label it should have after painting
+ * with the active label, respecting the draw-over mask.
+ *
+ * This is the value-level equivalent of SegmentationUpdateIterator's
+ * PaintAsForeground() and PaintAsForegroundPreserveClear(), for use with the
+ * run-level operations in RLEImageOperations.
+ */
+class SegmentationPaintFunctor
+{
+public:
+  SegmentationPaintFunctor(LabelType active_label, DrawOverFilter draw_over,
+                           bool preserve_clear = false)
+    : m_ActiveLabel(active_label), m_DrawOver(draw_over),
+      m_PreserveClear(preserve_clear) {}
+
+  LabelType operator()(LabelType lOld) const
+  {
+    if(m_PreserveClear && lOld == 0)
+      return lOld;
+
+    if(m_DrawOver.CoverageMode == PAINT_OVER_ALL ||
+       (m_DrawOver.CoverageMode == PAINT_OVER_ONE && lOld == m_DrawOver.DrawOverLabel) ||
+       (m_DrawOver.CoverageMode == PAINT_OVER_VISIBLE && lOld != 0))
+      return m_ActiveLabel;
+
+    return lOld;
+  }
+
+protected:
+  LabelType m_ActiveLabel;
+  DrawOverFilter m_DrawOver;
+  bool m_PreserveClear;
 };
 
 
+/**
+ * \class SegmentationRunRecorder
+ * \brief Records run-level updates to the segmentation, made with the
+ * operations in RLEImageOperations, as an undo delta and as changes to the
+ * label counts of the wrapper.
+ *
+ * This is passed as the visitor to the run-level operations, which report
+ * every run of the region being updated in traversal order. The interface
+ * after the update mirrors that of SegmentationUpdateIterator.
+ */
+class SegmentationRunRecorder
+{
+public:
+  typedef itk::Index<3>                                        IndexType;
+  typedef itk::ImageRegion<3>                                  RegionType;
+  typedef UndoDataManager<LabelType>::Delta                    UndoDelta;
+
+  SegmentationRunRecorder(LabelImageWrapper *labelWrapper, const RegionType &region)
+    : m_Image(labelWrapper->GetImage()),
+      m_CountIndex(labelWrapper->GetLabelCountIndex()),
+      m_ChangedVoxels(0)
+  {
+    m_Delta = new UndoDelta();
+    m_Delta->SetRegion(region);
+    m_CountIndex->BeginIncrementalUpdate();
+  }
+
+  ~SegmentationRunRecorder()
+  {
+    if(m_Delta)
+      delete m_Delta;
+
+    if(m_CountIndex)
+      m_CountIndex->EndIncrementalUpdate();
+  }
+
+  /** Called by the run-level operations for each run in the region */
+  void operator()(const IndexType &start, itk::SizeValueType n,
+                  LabelType lOld, LabelType lNew)
+  {
+    m_Delta->EncodeRun((LabelType)(lNew - lOld), n);
+    if(lOld != lNew)
+      {
+      m_ChangedVoxels += n;
+      m_CountIndex->RecordRunChange(lOld, lNew, start, n);
+      }
+  }
+
+  /** Finish encoding and mark the image as modified if there were changes */
+  void Finalize()
+  {
+    m_Delta->FinishEncoding();
+    if(m_ChangedVoxels > 0)
+      m_Image->Modified();
+
+    if(m_CountIndex)
+      {
+      m_CountIndex->EndIncrementalUpdate();
+      m_CountIndex = NULL;
+      }
+  }
+
+  // Keep delta from being deleted
+  UndoDelta *RelinquishDelta()
+  {
+    UndoDelta *delta = m_Delta;
+    m_Delta = NULL;
+    return delta;
+  }
+
+  // Get the number of changed voxels
+  unsigned long GetNumberOfChangedVoxels() const
+  {
+    return m_ChangedVoxels;
+  }
+
+protected:
+
+  // The image being updated
+  LabelImageWrapper::ImageType *m_Image;
+
+  // Label count index updated along with the image
+  LabelCountIndex *m_CountIndex;
+
+  // RLE encoding of the segmentation update
+  UndoDelta *m_Delta;
+
+  // Number of voxels actually modified
+  unsigned long m_ChangedVoxels;
+};
+
 #endif // SegmentationUpdateIterator
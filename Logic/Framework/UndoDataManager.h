@@ -44,6 +44,12 @@
  * The Delta class represents a difference between two images used in
  * the Undo system. It only supports linear traversal of images and
  * stores differences in an RLE (run length encoding) format.
+ *
+ * The runs are stored as two streams: the run lengths, encoded as variable
+ * length integers (7 bits per byte, so most runs take a single byte), and
+ * the run values. A delta can also be compressed with zlib, which pays off
+ * for the large deltas generated by whole-volume operations. The runs are
+ * read back sequentially with a RunIterator.
  */
 template <typename TPixel>
 class UndoDelta
@@ -61,26 +67,81 @@ public:
 
   void Encode(const TPixel &value);
 
+  /** Encode a run of identical values, equivalent to calling Encode n times */
+  void EncodeRun(const TPixel &value, size_t n);
+
   void FinishEncoding();
 
-  size_t GetNumberOfRLEs()
-  { return m_Array.size(); }
+  size_t GetNumberOfRLEs() const
+  { return m_NumberOfRLEs; }
+
+  /** Number of bytes used to store the runs */
+  size_t GetStoredSize() const;
 
-  TPixel GetRLEValue(size_t i)
-  { return m_Array[i].second; }
+  /** Compress the runs. Nothing is done if this does not save memory, and
+   * only the first call attempts the compression */
+  void Compress();
 
-  size_t GetRLELength(size_t i)
-  { return m_Array[i].first; }
+  bool IsCompressed() const
+  { return m_Compressed.size() > 0; }
 
   unsigned long GetUniqueID() const
   { return m_UniqueID; }
 
   UndoDelta & operator = (const UndoDelta &other);
 
+  /**
+   * Sequential access to the runs of a delta. A compressed delta is
+   * decompressed into a buffer owned by the iterator.
+   */
+  class RunIterator
+  {
+  public:
+    RunIterator(const UndoDelta *delta);
+
+    bool IsAtEnd() const
+    { return m_Index >= m_Count; }
+
+    size_t GetLength() const
+    { return m_Length; }
+
+    TPixel GetValue() const
+    { return m_Values[m_Index]; }
+
+    RunIterator &operator++();
+
+  private:
+    // Decode the length of the current run
+    void ReadLength();
+
+    std::vector<unsigned char> m_Buffer;
+    const unsigned char *m_LengthPtr;
+    const TPixel *m_Values;
+    size_t m_Index, m_Count, m_Length;
+
+    // Not copyable, since the pointers may point into m_Buffer
+    RunIterator(const RunIterator &);
+    void operator=(const RunIterator &);
+  };
+
 protected:
-  typedef std::pair<size_t, TPixel> RLEPair;
-  typedef std::vector<RLEPair> RLEArray;
-  RLEArray m_Array;
+
+  friend class RunIterator;
+
+  // Append a run to the streams
+  void AppendRun(size_t length, const TPixel &value);
+
+  // Run lengths as variable length integers, and run values
+  std::vector<unsigned char> m_Lengths;
+  std::vector<TPixel> m_Values;
+  size_t m_NumberOfRLEs;
+
+  // The compressed streams (values, then lengths), if compressed
+  std::vector<unsigned char> m_Compressed;
+  size_t m_LengthsSize;
+  bool m_CompressionAttempted;
+
+  // The run being encoded
   size_t m_CurrentLength;
   TPixel m_LastValue;
 
@@ -96,6 +157,12 @@ protected:
 /**
  * \class UndoDataManager
  * \brief Manages data (delta updates) for undo/redo in itk-snap
+ *
+ * The size of the undo stack is limited by the memory taken by the deltas.
+ * Deltas larger than a threshold are compressed when they are committed. When
+ * the limit is exceeded, the deltas of the oldest commits are compressed
+ * first, and only if that is not enough are the oldest commits discarded,
+ * always keeping at least a minimum number of commits.
  */
 template<typename TPixel> class UndoDataManager
 {
@@ -123,12 +190,18 @@ public:
     Commit(const DList &list, const char *name);
     void DeleteDeltas();
     size_t GetNumberOfRLEs() const;
+    size_t GetStoredSize() const;
+    void Compress(size_t minDeltaSize);
     const DList &GetDeltas() const { return m_Deltas; }
   protected:
     DList m_Deltas;
     std::string m_Name;
   };
 
+  /**
+   * Create the manager, keeping at least nMinCommits commits, and otherwise
+   * no more commits than fit into nMaxTotalSize bytes
+   */
   UndoDataManager(size_t nMinCommits, size_t nMaxTotalSize);
 
   /** Add a delta to the staging list. The staging list must be committed */
@@ -149,6 +222,17 @@ public:
   size_t GetNumberOfCommits()
     { return m_CommitList.size(); }
 
+  /** Memory used by the commits, in bytes */
+  size_t GetTotalSize() const
+    { return m_TotalSize; }
+
+  /** Enable or disable the compression of deltas (on by default) */
+  void SetCompressDeltas(bool value)
+    { m_CompressDeltas = value; }
+
+  /** Size, in bytes, above which deltas are compressed when committed */
+  enum { CompressionThreshold = 0x10000 };
+
 private:
 
   // Current staging list - where deltas are added
@@ -163,6 +247,7 @@ private:
   CList m_CommitList;
   CIterator m_Position;
   size_t m_TotalSize, m_MinCommits, m_MaxTotalSize;
+  bool m_CompressDeltas;
 };
 
 #endif // __UndoDataManager_h_
@@ -33,16 +33,41 @@
 
 =========================================================================*/
 
+#include "IRISException.h"
+#include "itk_zlib.h"
+#include <cstring>
+
 template<typename TPixel> unsigned long UndoDelta<TPixel>::m_UniqueIDCounter = 0;
 
 template<typename TPixel>
 UndoDelta<TPixel>
 ::UndoDelta()
 {
+  m_NumberOfRLEs = 0;
+  m_LengthsSize = 0;
+  m_CompressionAttempted = false;
   m_CurrentLength = 0;
   m_UniqueID = m_UniqueIDCounter++;
 }
 
+template<typename TPixel>
+void
+UndoDelta<TPixel>
+::AppendRun(size_t length, const TPixel &value)
+{
+  // Write the length 7 bits at a time, setting the high bit of every byte
+  // except the last
+  while(length >= 0x80)
+    {
+    m_Lengths.push_back((unsigned char) (length | 0x80));
+    length >>= 7;
+    }
+  m_Lengths.push_back((unsigned char) length);
+
+  m_Values.push_back(value);
+  m_NumberOfRLEs++;
+}
+
 template<typename TPixel>
 void
 UndoDelta<TPixel>
@@ -59,19 +84,87 @@ UndoDelta<TPixel>
     }
   else
     {
-    m_Array.push_back(std::make_pair(m_CurrentLength, m_LastValue));
+    this->AppendRun(m_CurrentLength, m_LastValue);
     m_CurrentLength = 1;
     m_LastValue = value;
     }
 }
 
+template<typename TPixel>
+void
+UndoDelta<TPixel>
+::EncodeRun(const TPixel &value, size_t n)
+{
+  if(n == 0)
+    return;
+
+  if(m_CurrentLength == 0)
+    {
+    m_LastValue = value;
+    m_CurrentLength = n;
+    }
+  else if(value == m_LastValue)
+    {
+    m_CurrentLength += n;
+    }
+  else
+    {
+    this->AppendRun(m_CurrentLength, m_LastValue);
+    m_CurrentLength = n;
+    m_LastValue = value;
+    }
+}
+
 template<typename TPixel>
 void
 UndoDelta<TPixel>
 ::FinishEncoding()
 {
   if(m_CurrentLength > 0)
-    m_Array.push_back(std::make_pair(m_CurrentLength, m_LastValue));
+    this->AppendRun(m_CurrentLength, m_LastValue);
+  m_CurrentLength = 0;
+
+  // Release the memory reserved by the vectors as they grew
+  std::vector<unsigned char>(m_Lengths).swap(m_Lengths);
+  std::vector<TPixel>(m_Values).swap(m_Values);
+}
+
+template<typename TPixel>
+size_t
+UndoDelta<TPixel>
+::GetStoredSize() const
+{
+  return sizeof(*this)
+      + m_Lengths.capacity()
+      + m_Values.capacity() * sizeof(TPixel)
+      + m_Compressed.capacity();
+}
+
+template<typename TPixel>
+void
+UndoDelta<TPixel>
+::Compress()
+{
+  if(m_CompressionAttempted || m_NumberOfRLEs == 0)
+    return;
+  m_CompressionAttempted = true;
+
+  // Put the values and then the lengths into one buffer
+  size_t nv = m_Values.size() * sizeof(TPixel);
+  std::vector<unsigned char> raw(nv + m_Lengths.size());
+  memcpy(&raw[0], &m_Values[0], nv);
+  memcpy(&raw[nv], &m_Lengths[0], m_Lengths.size());
+
+  // Compress with the fastest setting, since this happens interactively
+  uLongf nz = compressBound(raw.size());
+  std::vector<unsigned char> zbuf(nz);
+  if(compress2(&zbuf[0], &nz, &raw[0], raw.size(), 1) != Z_OK || nz >= raw.size())
+    return;
+
+  m_Compressed.assign(zbuf.begin(), zbuf.begin() + nz);
+  m_LengthsSize = m_Lengths.size();
+  std::vector<unsigned char>().swap(m_Lengths);
+  std::vector<TPixel>().swap(m_Values);
 }
 
 template<typename TPixel>
@@ -79,13 +172,80 @@ UndoDelta<TPixel> &
 UndoDelta<TPixel>
 ::operator = (const UndoDelta<TPixel> &other)
 {
-  m_Array = other.m_Array;
+  m_Lengths = other.m_Lengths;
+  m_Values = other.m_Values;
+  m_NumberOfRLEs = other.m_NumberOfRLEs;
+  m_Compressed = other.m_Compressed;
+  m_LengthsSize = other.m_LengthsSize;
+  m_CompressionAttempted = other.m_CompressionAttempted;
   m_CurrentLength = other.m_CurrentLength;
   m_LastValue = other.m_LastValue;
   m_Region = other.m_Region;
   return *this;
 }
 
+template<typename TPixel>
+UndoDelta<TPixel>::RunIterator
+::RunIterator(const UndoDelta<TPixel> *delta)
+{
+  m_Index = 0;
+  m_Count = delta->m_NumberOfRLEs;
+  m_Length = 0;
+  m_Values = NULL;
+  m_LengthPtr = NULL;
+  if(m_Count == 0)
+    return;
+
+  if(delta->IsCompressed())
+    {
+    size_t nv = m_Count * sizeof(TPixel);
+    uLongf nRaw = nv + delta->m_LengthsSize;
+    m_Buffer.resize(nRaw);
+    if(uncompress(&m_Buffer[0], &nRaw,
+                  &delta->m_Compressed[0], delta->m_Compressed.size()) != Z_OK
+       || nRaw != m_Buffer.size())
+      throw IRISException("Failed to decompress undo data");
+
+    m_Values = reinterpret_cast<const TPixel *>(&m_Buffer[0]);
+    m_LengthPtr = &m_Buffer[nv];
+    }
+  else
+    {
+    m_Values = &delta->m_Values[0];
+    m_LengthPtr = &delta->m_Lengths[0];
+    }
+
+  this->ReadLength();
+}
+
+template<typename TPixel>
+void
+UndoDelta<TPixel>::RunIterator
+::ReadLength()
+{
+  size_t length = 0;
+  unsigned char b;
+  int shift = 0;
+  do
+    {
+    b = *m_LengthPtr++;
+    length |= ((size_t) (b & 0x7f)) << shift;
+    shift += 7;
+    }
+  while(b & 0x80);
+  m_Length = length;
+}
+
+template<typename TPixel>
+typename UndoDelta<TPixel>::RunIterator &
+UndoDelta<TPixel>::RunIterator
+::operator++()
+{
+  if(++m_Index < m_Count)
+    this->ReadLength();
+  return *this;
+}
+
 
 template<typename TPixel>
 UndoDataManager<TPixel>
@@ -94,6 +254,7 @@ UndoDataManager<TPixel>
   this->m_MinCommits = nMinCommits;
   this->m_MaxTotalSize = nMaxTotalSize;
   this->m_TotalSize = 0;
+  this->m_CompressDeltas = true;
   m_Position = m_CommitList.begin();
 }
 
@@ -135,7 +296,7 @@ UndoDataManager<TPixel>
   // to the end. So that's the loop that we do
   while(m_Position != m_CommitList.end())
     {
-    m_TotalSize -= m_Position->GetNumberOfRLEs();
+    m_TotalSize -= m_Position->GetStoredSize();
     m_Position->DeleteDeltas();
     m_Position = m_CommitList.erase(m_Position);
     }
@@ -156,11 +317,29 @@ UndoDataManager<TPixel>
     return 0;
     }
 
+  // Compress the large deltas right away
+  if(m_CompressDeltas)
+    new_commit.Compress(CompressionThreshold);
+  size_t new_size = new_commit.GetStoredSize();
+
+  // If the new commit does not fit, first try compressing the older commits,
+  // starting with the oldest
+  if(m_CompressDeltas)
+    {
+    for(CIterator it = m_CommitList.begin();
+        it != m_CommitList.end() && m_TotalSize + new_size > m_MaxTotalSize; ++it)
+      {
+      m_TotalSize -= it->GetStoredSize();
+      it->Compress(0);
+      m_TotalSize += it->GetStoredSize();
+      }
+    }
+
   // Check whether we need to prune from the back to keep total size under control
   CIterator itHead = m_CommitList.begin();
-  while(m_CommitList.size() > m_MinCommits && m_TotalSize + n_new_rles > m_MaxTotalSize)
+  while(m_CommitList.size() > m_MinCommits && m_TotalSize + new_size > m_MaxTotalSize)
     {
-    m_TotalSize -= itHead->GetNumberOfRLEs();
+    m_TotalSize -= itHead->GetStoredSize();
     itHead->DeleteDeltas();
     itHead = m_CommitList.erase(itHead);
     }
@@ -169,7 +348,7 @@ UndoDataManager<TPixel>
   // the current delta to it;
   m_CommitList.push_back(new_commit);
   m_Position = m_CommitList.end();
-  m_TotalSize += n_new_rles;
+  m_TotalSize += new_size;
 
   // Return the number of RLEs
   return n_new_rles;
@@ -263,3 +442,27 @@ UndoDataManager<TPixel>::Commit::GetNumberOfRLEs() const
     }
   return n;
 }
+
+template<typename TPixel>
+size_t
+UndoDataManager<TPixel>::Commit::GetStoredSize() const
+{
+  size_t n = 0;
+  for(DConstIterator dit = m_Deltas.begin(); dit != m_Deltas.end(); ++dit)
+    {
+    if(*dit)
+      n += (*dit)->GetStoredSize();
+    }
+  return n;
+}
+
+template<typename TPixel>
+void
+UndoDataManager<TPixel>::Commit::Compress(size_t minDeltaSize)
+{
+  for(DIterator dit = m_Deltas.begin(); dit != m_Deltas.end(); ++dit)
+    {
+    if(*dit && (*dit)->GetStoredSize() >= minDeltaSize)
+      (*dit)->Compress();
+    }
+}
@@ -65,17 +65,24 @@
 #include "itkNumericTraits.h"
 #include <itkTimeProbe.h>
 #include "itksys/MD5.h"
+#include "itksys/SystemTools.hxx"
 #include "ExtendedGDCMSerieHelper.h"
+#include "NativeBufferKernels.h"
 #include "itkComposeImageFilter.h"
 #include "itkStreamingImageFilter.h"
 
 #include <itk_zlib.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
 
 
 using namespace std;
 
 bool GuidedNativeImageIO::m_StaticDataInitialized = false;
 
+std::string GuidedNativeImageIO::m_DicomHeaderIndexDirectory;
+
 RegistryEnumMap<GuidedNativeImageIO::FileFormat> GuidedNativeImageIO::m_EnumFileFormat;
 RegistryEnumMap<GuidedNativeImageIO::RawPixelType> GuidedNativeImageIO::m_EnumRawPixelType;
 
@@ -297,6 +304,13 @@ GuidedNativeImageIO
   m_NativeFileName = "";
   m_NativeByteOrder = itk::ImageIOBase::OrderNotApplicable;
   m_NativeSizeInBytes = 0;
+
+  // Files over 256MB are streamed, if the format allows it
+  m_NativeDataDeferred = false;
+  m_StreamingThreshold = 256ul << 20;
+
+  m_ParallelDicomDecoding = true;
+  m_DicomSeriesReadProgress = 0.0;
 }
 
 GuidedNativeImageIO::FileFormat 
@@ -564,26 +578,302 @@ GuidedNativeImageIO
 
 void
 GuidedNativeImageIO
-::ReadNativeImageData()
+::ReadNativeImageData(itk::Command *progressCommand)
 {
+  // The progress command observes this object while the data is read
+  unsigned long tag = 0;
+  if(progressCommand)
+    tag = this->AddObserver(itk::ProgressEvent(), progressCommand);
+
   // Based on the component type, read image in native mode
+  m_NativeDataDeferred = false;
   DispatchBase *dispatch = this->CreateDispatch(m_IOBase->GetComponentType());
-  dispatch->ReadNative(this, m_NativeFileName.c_str(), m_Hints);
+  try
+    {
+    dispatch->ReadNative(this, m_NativeFileName.c_str(), m_Hints);
+    }
+  catch(...)
+    {
+    delete dispatch;
+    if(progressCommand)
+      this->RemoveObserver(tag);
+    throw;
+    }
   delete dispatch;
+  if(progressCommand)
+    this->RemoveObserver(tag);
+
+  // Get rid of the IOBase, it may store useless data (in case of NIFTI). If
+  // the data has not been read yet, the IOBase is still needed to read it
+  if(!m_NativeDataDeferred)
+    m_IOBase = NULL;
+}
+
+bool
+GuidedNativeImageIO
+::CanDeferNativeImageData()
+{
+  // Small images and DICOM series are read right away
+  if(m_FileFormat == FORMAT_DICOM_DIR || m_NativeSizeInBytes < m_StreamingThreshold)
+    return false;
+
+  // Images with more than three dimensions need to be transposed in memory
+  if(m_IOBase->GetNumberOfDimensions() > 3 || !m_IOBase->CanStreamRead())
+    return false;
+
+  // Compressed files can not be read in pieces without decompressing them
+  // from the start each time
+  std::string ext = itksys::SystemTools::LowerCase(
+        itksys::SystemTools::GetFilenameLastExtension(m_NativeFileName));
+  if(ext == ".gz" || ext == ".zraw" || ext == ".bz2")
+    return false;
+
+  itk::MetaImageIO *mio = dynamic_cast<itk::MetaImageIO *>(m_IOBase.GetPointer());
+  if(mio && mio->GetMetaImagePointer()->CompressedData())
+    return false;
+
+  return true;
+}
+
+void
+GuidedNativeImageIO
+::ReadDeferredNativeImageData()
+{
+  if(m_NativeDataDeferred)
+    {
+    DispatchBase *dispatch = this->CreateDispatch(m_NativeType);
+    dispatch->ReadDeferredNative(this);
+    delete dispatch;
+
+    m_NativeDataDeferred = false;
+    m_IOBase = NULL;
+    }
+}
+
+template<class TScalar>
+void
+GuidedNativeImageIO
+::DoReadDeferredNative()
+{
+  typedef itk::VectorImage<TScalar, 3> NativeImageType;
+  NativeImageType *image = dynamic_cast<NativeImageType *>(m_NativeImage.GetPointer());
+  assert(image);
+
+  // Read the whole image into the buffer
+  image->Allocate();
+  itk::ImageIORegion ioRegion(3);
+  typename NativeImageType::IndexType index = {{0, 0, 0}};
+  itk::ImageIORegionAdaptor<3>::Convert(image->GetBufferedRegion(), ioRegion, index);
+  m_IOBase->SetIORegion(ioRegion);
+  m_IOBase->Read(image->GetBufferPointer());
+}
+
+template<typename TNative, typename TVisitor>
+void
+GuidedNativeImageIO
+::StreamNativeImageData(TVisitor &visitor)
+{
+  assert(m_NativeDataDeferred && m_IOBase);
+
+  // Number of components in the image and in one slice
+  ImageBase::SizeType size = m_NativeImage->GetBufferedRegion().GetSize();
+  size_t ncomp = m_NativeImage->GetNumberOfComponentsPerPixel();
+  size_t slice = size[0] * size[1] * ncomp;
 
-  // Get rid of the IOBase, it may store useless data (in case of NIFTI)
-  m_IOBase = NULL;
+  // Read as many whole slices at a time as fit into 64MB
+  const size_t slab_bytes = 64ul << 20;
+  size_t nz = std::max((size_t) 1, slab_bytes / (slice * sizeof(TNative)));
+  nz = std::min(nz, (size_t) size[2]);
+  std::vector<TNative> slab(nz * slice);
+
+  for(size_t z = 0; z < size[2]; z += nz)
+    {
+    size_t nzs = std::min(nz, (size_t) size[2] - z);
+
+    itk::ImageIORegion ioRegion(3);
+    for(int d = 0; d < 3; d++)
+      {
+      ioRegion.SetIndex(d, d == 2 ? z : 0);
+      ioRegion.SetSize(d, d == 2 ? nzs : size[d]);
+      }
+    m_IOBase->SetIORegion(ioRegion);
+    m_IOBase->Read(&slab[0]);
+
+    visitor(&slab[0], z * slice, nzs * slice);
+    }
 }
 
 void
 GuidedNativeImageIO
-::ReadNativeImage(const char *FileName, Registry &folder)
+::ReadNativeImage(const char *FileName, Registry &folder,
+                  itk::Command *progressCommand)
 {
   this->ReadNativeImageHeader(FileName, folder);
-  this->ReadNativeImageData();
+  this->ReadNativeImageData(progressCommand);
 }
 
 
+ITK_THREAD_RETURN_TYPE
+GuidedNativeImageIO
+::DicomSliceThreaderCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  DicomSliceThreadData *data = static_cast<DicomSliceThreadData *>(info->UserData);
+
+  size_t k = data->ImagesPerIPP;
+  size_t slice_bytes = data->Columns * data->Rows * data->ComponentSize;
+  std::vector<char> scratch;
+
+  // Files are dealt out to the threads in turn, since their decoding times vary
+  for(size_t i = data->Begin + info->ThreadID;
+      i < data->End && !data->Failed; i += info->NumberOfThreads)
+    {
+    try
+      {
+      itk::GDCMImageIO::Pointer io = itk::GDCMImageIO::New();
+      io->SetFileName((*data->Files)[i]);
+      io->ReadImageInformation();
+
+      // The slice must be a single 2D frame of the same size and type as the
+      // first slice, so that it can be decoded straight into the buffer
+      bool match =
+          io->GetComponentType() == data->ComponentType
+          && io->GetNumberOfComponents() == 1
+          && io->GetDimensions(0) == data->Columns
+          && io->GetDimensions(1) == data->Rows
+          && (io->GetNumberOfDimensions() < 3 || io->GetDimensions(2) == 1);
+      if(!match)
+        {
+        data->Failed = true;
+        break;
+        }
+
+      // Set the IO region to the whole slice
+      itk::ImageIORegion ioRegion(io->GetNumberOfDimensions());
+      for(unsigned int d = 0; d < io->GetNumberOfDimensions(); d++)
+        {
+        ioRegion.SetIndex(d, 0);
+        ioRegion.SetSize(d, io->GetDimensions(d));
+        }
+      io->SetIORegion(ioRegion);
+
+      // A single volume is decoded in place. With several images per position,
+      // the slice is decoded separately and interleaved into the components
+      size_t s = i / k, c = i % k;
+      if(k == 1)
+        {
+        io->Read(data->Buffer + s * slice_bytes);
+        }
+      else
+        {
+        scratch.resize(slice_bytes);
+        io->Read(&scratch[0]);
+
+        size_t cs = data->ComponentSize, n = data->Columns * data->Rows;
+        char *trg = data->Buffer + (s * n * k + c) * cs;
+        for(size_t p = 0; p < n; p++, trg += k * cs)
+          memcpy(trg, &scratch[p * cs], cs);
+        }
+
+      if(i == 0)
+        data->Dictionary = io->GetMetaDataDictionary();
+      }
+    catch(...)
+      {
+      data->Failed = true;
+      }
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template<class TScalar>
+bool
+GuidedNativeImageIO
+::DoReadDicomSeriesParallel()
+{
+  typedef itk::VectorImage<TScalar, 3> NativeImageType;
+  typedef itk::Image<TScalar, 3> GreyImageType;
+  typedef itk::ImageSeriesReader<GreyImageType> ReaderType;
+
+  // Only series of single frame grayscale files are handled here
+  size_t k = m_DICOMImagesPerIPP, n_files = m_DICOMFiles.size();
+  if(k < 1 || n_files % k != 0
+     || !dynamic_cast<itk::GDCMImageIO *>(m_IOBase.GetPointer())
+     || m_IOBase->GetNumberOfComponents() != 1
+     || (m_IOBase->GetNumberOfDimensions() > 2 && m_IOBase->GetDimensions(2) > 1))
+    return false;
+
+  // Let the series reader compute the geometry of the first volume from the
+  // headers of its first and last slices, just like when it reads the data
+  std::vector<std::string> myFiles;
+  for(size_t s = 0; s < n_files / k; s++)
+    myFiles.push_back(m_DICOMFiles[s * k]);
+
+  typename ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileNames(myFiles);
+  reader->SetImageIO(m_IOBase);
+  reader->UpdateOutputInformation();
+
+  GreyImageType *geometry = reader->GetOutput();
+  typename GreyImageType::RegionType region = geometry->GetLargestPossibleRegion();
+  if(region.GetSize(2) != myFiles.size())
+    return false;
+
+  // Allocate the native image, with one component per image at each position
+  typename NativeImageType::Pointer image = NativeImageType::New();
+  image->CopyInformation(geometry);
+  image->SetRegions(region);
+  image->SetVectorLength(k);
+  image->Allocate();
+
+  DicomSliceThreadData data;
+  data.Files = &m_DICOMFiles;
+  data.ComponentType = IOBase::MapPixelType<TScalar>::CType;
+  data.ComponentSize = sizeof(TScalar);
+  data.Columns = region.GetSize(0);
+  data.Rows = region.GetSize(1);
+  data.ImagesPerIPP = (int) k;
+  data.Buffer = reinterpret_cast<char *>(image->GetBufferPointer());
+  data.Failed = false;
+
+  // Decode the files in batches, reporting progress after each batch
+  unsigned int n_threads = std::min(
+        (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(),
+        (unsigned int) ITK_MAX_THREADS);
+  size_t batch_size = 4 * n_threads;
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  m_DicomSeriesReadProgress = 0.0;
+  for(size_t b = 0; b < n_files && !data.Failed; b += batch_size)
+    {
+    data.Begin = b;
+    data.End = std::min(b + batch_size, n_files);
+    threader->SetNumberOfThreads(
+          (unsigned int) std::min((size_t) n_threads, data.End - data.Begin));
+    threader->SetSingleMethod(&DicomSliceThreaderCallback, &data);
+    threader->SingleMethodExecute();
+
+    if(!data.Failed)
+      {
+      m_DicomSeriesReadProgress = (double) data.End / n_files;
+      this->InvokeEvent(itk::ProgressEvent());
+      }
+    }
+
+  if(data.Failed)
+    return false;
+
+  // Copy the metadata from the first scan in the series
+  if(k == 1)
+    image->SetMetaDataDictionary(data.Dictionary);
+
+  m_NativeImage = image;
+  m_NativeComponents = k;
+  return true;
+}
+
 template<class TScalar>
 void
 GuidedNativeImageIO
@@ -601,7 +891,11 @@ GuidedNativeImageIO
     // Create an image series reader 
     typedef itk::ImageSeriesReader<GreyImageType> ReaderType;
 
-    if(this->m_DICOMImagesPerIPP == 1)
+    if(m_ParallelDicomDecoding && this->DoReadDicomSeriesParallel<TScalar>())
+      {
+      // The slices have been decoded concurrently into the native image
+      }
+    else if(this->m_DICOMImagesPerIPP == 1)
       {
       // When there is a single volume
       typename ReaderType::Pointer reader = ReaderType::New();
@@ -736,12 +1030,19 @@ GuidedNativeImageIO
     region.SetSize(dim);
     image->SetRegions(region);
     image->SetVectorLength(ncomp);
-    image->Allocate();
+
+    // Large files that can be read in pieces are left on disk. They will be
+    // read in slabs when the image is cast to the internal type
+    if(this->CanDeferNativeImageData())
+      {
+      m_NativeDataDeferred = true;
+      }
 
     // Set the IO region
-    if(nd_actual <= 3)
+    else if(nd_actual <= 3)
       {
       // This is the old code, which we preserve
+      image->Allocate();
       itk::ImageIORegion ioRegion(3);
       itk::ImageIORegionAdaptor<3>::Convert(region, ioRegion, index);
       m_IOBase->SetIORegion(ioRegion);
@@ -759,10 +1060,12 @@ GuidedNativeImageIO
       ioRegion.SetIndex(ioIndex);
       ioRegion.SetSize(ioSize);
       m_IOBase->SetIORegion(ioRegion);
+      image->Allocate();
       }
 
     // Read the image into the buffer
-    m_IOBase->Read(image->GetBufferPointer());
+    if(!m_NativeDataDeferred)
+      m_IOBase->Read(image->GetBufferPointer());
     m_NativeImage = image;
 
     // If the image is 4-dimensional or more, we must perform an in-place transpose
@@ -831,6 +1134,9 @@ void
 GuidedNativeImageIO
 ::SaveNativeImage(const char *FileName, Registry &folder)
 {
+  // The data must be in memory, since the IO object is about to be replaced
+  this->ReadDeferredNativeImageData();
+
   // Cast image from native format to TPixel
   DispatchBase *dispatch = this->CreateDispatch(this->GetComponentTypeInNativeImage());
   dispatch->SaveNative(this, FileName, folder);
@@ -875,6 +1181,20 @@ GuidedNativeImageIO
 }
 
 
+/** Slab visitor that appends native data read in slabs to an MD5 hash */
+template<typename TNative>
+class NativeMD5Visitor
+{
+public:
+  NativeMD5Visitor(itksysMD5 *md5) : m_MD5(md5) {}
+
+  void operator()(const TNative *slab, size_t, size_t n)
+    { itksysMD5_Append(m_MD5, (const unsigned char *) slab, n * sizeof(TNative)); }
+
+protected:
+  itksysMD5 *m_MD5;
+};
+
 std::string
 GuidedNativeImageIO
 ::GetNativeImageMD5Hash()
@@ -907,9 +1227,19 @@ GuidedNativeImageIO
   hex_code[32] = 0;
   itksysMD5 *md5 = itksysMD5_New();
   itksysMD5_Initialize(md5);
-  itksysMD5_Append(md5, 
-    (unsigned char *) input->GetBufferPointer(), 
-    input->GetPixelContainer()->Size() * sizeof(TNative));
+
+  // If the data is on disk, the hash is computed slab by slab
+  if(m_NativeDataDeferred)
+    {
+    NativeMD5Visitor<TNative> hasher(md5);
+    this->StreamNativeImageData<TNative>(hasher);
+    }
+  else
+    {
+    itksysMD5_Append(md5, 
+      (unsigned char *) input->GetBufferPointer(), 
+      input->GetPixelContainer()->Size() * sizeof(TNative));
+    }
   itksysMD5_FinalizeHex(md5, hex_code);
   itksysMD5_Delete(md5);
 
@@ -923,28 +1253,92 @@ GuidedNativeImageIO
  * ADAPTER OBJECTS TO CAST NATIVE IMAGE TO GIVEN IMAGE
  ****************************************************************************/
 
+/**
+ * Slab visitor used to find the range of native data that is read in slabs.
+ * If asked to, it also checks whether all the values are whole numbers that
+ * the output type can represent, as RescaleNativeImageToIntegralType does.
+ */
+template<typename TNative, typename TOutputComponent>
+class NativeRangeVisitor
+{
+public:
+
+  NativeRangeVisitor(bool checkWhole)
+    : m_Empty(true), m_Whole(checkWhole), m_Min(0), m_Max(0) {}
+
+  void operator()(const TNative *slab, size_t, size_t n)
+  {
+    TNative smin, smax;
+    NativeBufferKernels<TNative>::ComputeRange(slab, n, smin, smax);
+    if(m_Empty || smin < m_Min) m_Min = smin;
+    if(m_Empty || smax > m_Max) m_Max = smax;
+    m_Empty = false;
+
+    // Once a value is out of the output range, the whole test is moot
+    if(m_Whole)
+      {
+      if(1.0 * smin < 1.0 * itk::NumericTraits<TOutputComponent>::min()
+         || 1.0 * smax > 1.0 * itk::NumericTraits<TOutputComponent>::max())
+        m_Whole = false;
+      else
+        m_Whole = NativeBufferKernels<TNative>::template
+            IsExactlyRepresentable<TOutputComponent>(slab, n);
+      }
+  }
+
+  TNative GetMinimum() const { return m_Min; }
+  TNative GetMaximum() const { return m_Max; }
+  bool IsWhole() const { return m_Whole; }
+
+protected:
+
+  bool m_Empty, m_Whole;
+  TNative m_Min, m_Max;
+};
+
+/**
+ * Slab visitor that casts native data read in slabs into an output buffer
+ */
+template<typename TNative, typename TOutputComponent, typename TFunctor>
+class NativeCastVisitor
+{
+public:
+
+  NativeCastVisitor(TOutputComponent *output, const TFunctor &functor)
+    : m_Output(output), m_Functor(functor) {}
+
+  void operator()(const TNative *slab, size_t offset, size_t n)
+  {
+    NativeBufferKernels<TNative>::template Cast<TOutputComponent>(
+          slab, m_Output + offset, n, m_Functor);
+  }
+
+protected:
+
+  TOutputComponent *m_Output;
+  TFunctor m_Functor;
+};
+
+
 template<class TOutputImage>
 typename RescaleNativeImageToIntegralType<TOutputImage>::OutputImageType *
 RescaleNativeImageToIntegralType<TOutputImage>::operator()(
     GuidedNativeImageIO *nativeIO)
 {
-  // Get the native image pointer
-  itk::ImageBase<3> *native = nativeIO->GetNativeImage();
-
   // Cast image from native format to TPixel
   itk::ImageIOBase::IOComponentType itype = nativeIO->GetComponentTypeInNativeImage();
   switch(itype) 
     {
-    case itk::ImageIOBase::UCHAR:  DoCast<unsigned char>(native);   break;
-    case itk::ImageIOBase::CHAR:   DoCast<signed char>(native);     break;
-    case itk::ImageIOBase::USHORT: DoCast<unsigned short>(native);  break;
-    case itk::ImageIOBase::SHORT:  DoCast<signed short>(native);    break;
-    case itk::ImageIOBase::UINT:   DoCast<unsigned int>(native);    break;
-    case itk::ImageIOBase::INT:    DoCast<signed int>(native);      break;
-    case itk::ImageIOBase::ULONG:  DoCast<unsigned long>(native);   break;
-    case itk::ImageIOBase::LONG:   DoCast<signed long>(native);     break;
-    case itk::ImageIOBase::FLOAT:  DoCast<float>(native);           break;
-    case itk::ImageIOBase::DOUBLE: DoCast<double>(native);          break;
+    case itk::ImageIOBase::UCHAR:  DoCast<unsigned char>(nativeIO);  break;
+    case itk::ImageIOBase::CHAR:   DoCast<signed char>(nativeIO);    break;
+    case itk::ImageIOBase::USHORT: DoCast<unsigned short>(nativeIO); break;
+    case itk::ImageIOBase::SHORT:  DoCast<signed short>(nativeIO);   break;
+    case itk::ImageIOBase::UINT:   DoCast<unsigned int>(nativeIO);   break;
+    case itk::ImageIOBase::INT:    DoCast<signed int>(nativeIO);     break;
+    case itk::ImageIOBase::ULONG:  DoCast<unsigned long>(nativeIO);  break;
+    case itk::ImageIOBase::LONG:   DoCast<signed long>(nativeIO);    break;
+    case itk::ImageIOBase::FLOAT:  DoCast<float>(nativeIO);          break;
+    case itk::ImageIOBase::DOUBLE: DoCast<double>(nativeIO);         break;
     default: 
       throw IRISException("Unknown pixel type when reading image");
     }
@@ -1037,15 +1431,18 @@ template<class TOutputImage>
 template<typename TNative>
 void
 RescaleNativeImageToIntegralType<TOutputImage>
-::DoCast(itk::ImageBase<3> *native)
+::DoCast(GuidedNativeImageIO *nativeIO)
 {
   // Get the native image
+  itk::ImageBase<3> *native = nativeIO->GetNativeImage();
   typedef itk::VectorImage<TNative, 3> InputImageType;
-  typedef itk::ImageRegionConstIterator<InputImageType> InputIterator;
   SmartPtr<InputImageType> input = dynamic_cast<InputImageType *>(native);
 
+  // The data may still be on disk, in which case it is read in slabs
+  bool deferred = nativeIO->IsNativeImageDataDeferred();
+
   assert(input);
-  assert(input->GetPixelContainer()->Size() > 0);
+  assert(deferred || input->GetPixelContainer()->Size() > 0);
 
   // Get the number of components in the native image
   size_t ncomp = input->GetNumberOfComponentsPerPixel();
@@ -1057,26 +1454,39 @@ RescaleNativeImageToIntegralType<TOutputImage>
   // may be either a VectorImage or an Image.
   typedef typename OutputImageType::InternalPixelType OutputComponentType;
 
+  // Integer types whose whole range fits into the output type never need to
+  // be rescaled, so there is no need to scan the data for its range
+  bool fits = itk::NumericTraits<TNative>::is_integer
+      && 1.0 * itk::NumericTraits<TNative>::NonpositiveMin()
+         >= 1.0 * itk::NumericTraits<OutputComponentType>::min()
+      && 1.0 * itk::NumericTraits<TNative>::max()
+         <= 1.0 * itk::NumericTraits<OutputComponentType>::max();
+
   // Only bother with computing the scale and shift if the types are different
-  if(typeid(OutputComponentType) != typeid(TNative))
+  if(typeid(OutputComponentType) != typeid(TNative) && !fits)
     {
     // We must compute the range of the input data    
     OutputComponentType omax = itk::NumericTraits<OutputComponentType>::max();
     OutputComponentType omin = itk::NumericTraits<OutputComponentType>::min();
 
-    // Scan over all the image components. Avoid using iterators here because of
-    // unnecessary overhead for vector images.
-    TNative *ib_begin = input->GetBufferPointer();
-    TNative *ib_end = ib_begin + input->GetPixelContainer()->Size();
-
-    TNative imin_nat = *ib_begin, imax_nat = *ib_begin;
-
-    // Iterate over all the components in the input image
-    for(TNative *buffer = ib_begin + 1; buffer < ib_end; ++buffer)
+    // Find the range of the components, using all available threads. If the
+    // data is on disk, this is a first pass over the file, which also checks
+    // if the values are whole, so that a second pass is not needed for that
+    TNative imin_nat, imax_nat;
+    bool whole = false;
+    if(deferred)
       {
-      TNative val = *buffer;
-      if(val < imin_nat) imin_nat = val;
-      if(val > imax_nat) imax_nat = val;
+      NativeRangeVisitor<TNative, OutputComponentType> range(ncomp == 1);
+      nativeIO->StreamNativeImageData<TNative>(range);
+      imin_nat = range.GetMinimum();
+      imax_nat = range.GetMaximum();
+      whole = range.IsWhole();
+      }
+    else
+      {
+      NativeBufferKernels<TNative>::ComputeRange(
+            input->GetBufferPointer(), input->GetPixelContainer()->Size(),
+            imin_nat, imax_nat);
       }
 
     // Cast the values to double
@@ -1091,16 +1501,12 @@ RescaleNativeImageToIntegralType<TOutputImage>
       bool isint = false;
       if(1.0 * omin <= imin && 1.0 * omax >= imax && ncomp == 1)
         {
-        isint = true;
-
-        // Another pass through the image? Why is this necessary?
-        for(TNative *buffer = ib_begin; buffer < ib_end; ++buffer)
-          {
-          TNative vin = *buffer;
-          TNative vcmp = static_cast<TNative>(static_cast<OutputComponentType>(vin + 0.5));
-          if(vin != vcmp)
-            { isint = false; break; }
-          }
+        // Another pass through the image, to check that all values are whole
+        if(deferred)
+          isint = whole;
+        else
+          isint = NativeBufferKernels<TNative>::template IsExactlyRepresentable<OutputComponentType>(
+                input->GetBufferPointer(), input->GetPixelContainer()->Size());
         }
 
       // If underlying data is really integer, no scale or shift is necessary
@@ -1163,7 +1569,7 @@ RescaleNativeImageToIntegralType<TOutputImage>
   typedef RescaleVectorNativeImageToVectorFunctor<OutputComponentType, TNative> Functor;
   CastNativeImage<OutputImageType, Functor> caster;
   caster.SetFunctor(Functor(shift, scale));
-  caster.template DoCast<TNative>(native);
+  caster.template DoCast<TNative>(nativeIO);
   m_Output = caster.m_Output;
 }
 
@@ -1172,23 +1578,20 @@ typename CastNativeImage<TOutputImage,TCastFunctor>::OutputImageType *
 CastNativeImage<TOutputImage,TCastFunctor>
 ::operator()(GuidedNativeImageIO *nativeIO)
 {
-  // Get the native image pointer
-  itk::ImageBase<3> *native = nativeIO->GetNativeImage();
-
   // Cast image from native format to TPixel
   itk::ImageIOBase::IOComponentType itype = nativeIO->GetComponentTypeInNativeImage();
   switch(itype) 
     {
-    case itk::ImageIOBase::UCHAR:  DoCast<unsigned char>(native);   break;
-    case itk::ImageIOBase::CHAR:   DoCast<signed char>(native);     break;
-    case itk::ImageIOBase::USHORT: DoCast<unsigned short>(native);  break;
-    case itk::ImageIOBase::SHORT:  DoCast<signed short>(native);    break;
-    case itk::ImageIOBase::UINT:   DoCast<unsigned int>(native);    break;
-    case itk::ImageIOBase::INT:    DoCast<signed int>(native);      break;
-    case itk::ImageIOBase::ULONG:  DoCast<unsigned long>(native);   break;
-    case itk::ImageIOBase::LONG:   DoCast<signed long>(native);     break;
-    case itk::ImageIOBase::FLOAT:  DoCast<float>(native);           break;
-    case itk::ImageIOBase::DOUBLE: DoCast<double>(native);          break;
+    case itk::ImageIOBase::UCHAR:  DoCast<unsigned char>(nativeIO);  break;
+    case itk::ImageIOBase::CHAR:   DoCast<signed char>(nativeIO);    break;
+    case itk::ImageIOBase::USHORT: DoCast<unsigned short>(nativeIO); break;
+    case itk::ImageIOBase::SHORT:  DoCast<signed short>(nativeIO);   break;
+    case itk::ImageIOBase::UINT:   DoCast<unsigned int>(nativeIO);   break;
+    case itk::ImageIOBase::INT:    DoCast<signed int>(nativeIO);     break;
+    case itk::ImageIOBase::ULONG:  DoCast<unsigned long>(nativeIO);  break;
+    case itk::ImageIOBase::LONG:   DoCast<signed long>(nativeIO);    break;
+    case itk::ImageIOBase::FLOAT:  DoCast<float>(nativeIO);          break;
+    case itk::ImageIOBase::DOUBLE: DoCast<double>(nativeIO);         break;
     default: 
       throw IRISException("Error: Unknown pixel type when reading image."
                           "The voxels in the image you are loading have format '%s', "
@@ -1206,9 +1609,10 @@ template<class TOutputImage, class TCastFunctor>
 template<typename TNative>
 void
 CastNativeImage<TOutputImage,TCastFunctor>
-::DoCast(itk::ImageBase<3> *native)
+::DoCast(GuidedNativeImageIO *nativeIO)
 {
   // Get the native image
+  itk::ImageBase<3> *native = nativeIO->GetNativeImage();
   typedef itk::VectorImage<TNative, 3> InputImageType;
   typename InputImageType::Pointer input = 
     reinterpret_cast<InputImageType *>(native);
@@ -1217,8 +1621,6 @@ CastNativeImage<TOutputImage,TCastFunctor>
   typedef typename InputImageType::PixelContainer InPixCon;
   typedef typename OutputImageType::PixelContainer OutPixCon;
 
-  InPixCon *ipc = input->GetPixelContainer();
-
   // Allocate the output image
   m_Output = OutputImageType::New();
   m_Output->CopyInformation(native);
@@ -1238,6 +1640,19 @@ CastNativeImage<TOutputImage,TCastFunctor>
                         "an output image with %d components", ncomp, ncomp_out);
     }
 
+  // If the data is still on disk, read it slab by slab into the output
+  // image, so that only one slab of native data is held in memory
+  if(nativeIO->IsNativeImageDataDeferred())
+    {
+    m_Output->Allocate();
+    NativeCastVisitor<TNative, OutputComponentType, TCastFunctor> caster(
+          m_Output->GetBufferPointer(), m_Functor);
+    nativeIO->StreamNativeImageData<TNative>(caster);
+    return;
+    }
+
+  InPixCon *ipc = input->GetPixelContainer();
+
   // Special case: native image is the same as target image
   if(typeid(OutputComponentType) == typeid(TNative))
     {
@@ -1284,22 +1699,12 @@ CastNativeImage<TOutputImage,TCastFunctor>
   // same than the target image, we want to proceed in ascending order, since each
   // input element will be replaced by one or more output elements. But if the
   // native image is smaller, we want to proceed from the end of the memory
-  // block in a descending order, so that the native data is not overridden
+  // block in a descending order, so that the native data is not overridden.
+  // NativeBufferKernels takes care of this, and splits the work into rounds
+  // that can be done in parallel without overriding the native data.
   unsigned long nval =  nvoxels * ncomp;
-  if(szTarget > szNative)
-    {
-    TNative *pn = ib + nval - 1;
-    OutputComponentType *pt = ob + nval - 1;
-    for(; pt >= ob; pt--, pn--)
-      m_Functor(pn, pt);
-    }
-  else
-    {
-    TNative *pn = ib;
-    OutputComponentType *pt = ob;
-    for(; pt < ob + nval; pt++, pn++)
-      m_Functor(pn, pt);
-    }
+  NativeBufferKernels<TNative>::template CastInPlace<OutputComponentType>(
+        ib, nval, m_Functor);
 
   // If needed, squeeze the memory
   if(nbTarget < nbNative)
@@ -1386,6 +1791,251 @@ const gdcm::Tag GuidedNativeImageIO::m_tagSliceThickness(0x0018, 0x0050);
 #include "gdcmDirectory.h"
 #include "gdcmImageReader.h"
 
+void
+GuidedNativeImageIO
+::ReadDicomFileHeader(DicomFileHeader &hdr)
+{
+  // List of tags used for refined grouping of files - order matters!
+  const gdcm::Tag tags_refine[] = {
+    m_tagSeriesNumber, m_tagSequenceName, m_tagSliceThickness,
+    m_tagRows, m_tagCols };
+  const int n_refine = sizeof(tags_refine) / sizeof(gdcm::Tag);
+
+  // List of tags that we want to parse - everything else may be ignored
+  std::set<gdcm::Tag> tags_all(tags_refine, tags_refine + n_refine);
+  tags_all.insert(m_tagDesc);
+  tags_all.insert(m_tagSeriesInstanceUID);
+
+  hdr.Valid = false;
+  hdr.Rows = hdr.Columns = 0;
+
+  // Try reading this file. Fail quietly.
+  gdcm::Reader reader;
+  reader.SetFileName(hdr.FileName.c_str());
+  try { hdr.Valid = reader.ReadSelectedTags(tags_all, true); }
+  catch(...) {}
+
+  // If nothing read, keep going
+  if(!hdr.Valid)
+    return;
+
+  // Create a string filter to get tags
+  gdcm::StringFilter sf;
+  sf.SetFile(reader.GetFile());
+
+  // Start with the ID being the UID
+  std::string uid = sf.ToString(m_tagSeriesInstanceUID);
+  std::string full_id = uid;
+
+  // Iterate over the tags in the refine list
+  for(int iTag = 0; iTag < n_refine; iTag++)
+    {
+    // Read the tag value
+    std::string s = sf.ToString(tags_refine[iTag]);
+
+    // This code is from gdcmSerieHelper
+    if( full_id == uid && !s.empty() )
+      {
+      full_id += "."; // add separator
+      }
+    full_id += s;
+    }
+
+  // Eliminate non-alnum characters, including whitespace...
+  //   that may have been introduced by concats.
+  for(size_t i=0; i<full_id.size(); i++)
+    {
+    while(i<full_id.size()
+      && !( full_id[i] == '.'
+        || (full_id[i] >= 'a' && full_id[i] <= 'z')
+        || (full_id[i] >= '0' && full_id[i] <= '9')
+        || (full_id[i] >= 'A' && full_id[i] <= 'Z')))
+      {
+      full_id.erase(i, 1);
+      }
+    }
+
+  hdr.SeriesId = full_id;
+  hdr.SeriesDescription = sf.ToString(m_tagDesc);
+  hdr.SeriesNumber = sf.ToString(m_tagSeriesNumber);
+  hdr.Rows = std::atoi(sf.ToString(m_tagRows).c_str());
+  hdr.Columns = std::atoi(sf.ToString(m_tagCols).c_str());
+}
+
+ITK_THREAD_RETURN_TYPE
+GuidedNativeImageIO
+::DicomHeaderThreaderCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  DicomHeaderThreadData *data = static_cast<DicomHeaderThreadData *>(info->UserData);
+
+  // Files are dealt out to the threads in turn, since their read times vary
+  for(size_t i = data->Begin + info->ThreadID; i < data->End; i += info->NumberOfThreads)
+    ReadDicomFileHeader((*data->Headers)[(*data->Pending)[i]]);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void
+GuidedNativeImageIO
+::AddDicomFileToParseResult(const DicomFileHeader &hdr)
+{
+  // The info for the current series
+  DicomDirectoryParseResult::DicomSeriesInfo &series_info
+      = m_LastDicomParseResult.SeriesMap[hdr.SeriesId];
+
+  // The registry for the current series
+  Registry &r = series_info.MetaData;
+
+  // Have we found this ID before?
+  if(r.IsEmpty())
+    {
+    r["SeriesId"] << hdr.SeriesId;
+
+    // Read series description
+    r["SeriesDescription"] << hdr.SeriesDescription;
+    r["SeriesNumber"] << hdr.SeriesNumber;
+
+    // Read the dimensions
+    r["Rows"] << hdr.Rows;
+    r["Columns"] << hdr.Columns;
+    r["NumberOfImages"] << 1;
+    }
+  else
+    {
+    // Increement the number of images
+    r["NumberOfImages"] << r["NumberOfImages"][0] + 1;
+    }
+
+  // Update the dimensions string
+  ostringstream oss;
+  oss << r["Rows"][0] << " x " << r["Columns"][0] << " x " << r["NumberOfImages"][0];
+  r["Dimensions"] << oss.str();
+
+  // Update the filelist
+  series_info.FileList.push_back(hdr.FileName);
+}
+
+// First line of a DICOM header index file, changed if the format changes
+static const char *dicom_header_index_signature = "ITK-SNAP DICOM Header Index 1";
+
+std::string
+GuidedNativeImageIO
+::GetDicomHeaderIndexFile(const std::string &dir)
+{
+  if(m_DicomHeaderIndexDirectory.empty())
+    return std::string();
+
+  // The index is named after the hash of the directory path
+  std::string path = itksys::SystemTools::CollapseFullPath(dir.c_str());
+  char hex_code[33];
+  hex_code[32] = 0;
+  itksysMD5 *md5 = itksysMD5_New();
+  itksysMD5_Initialize(md5);
+  itksysMD5_Append(md5, (const unsigned char *) path.c_str(), (int) path.size());
+  itksysMD5_FinalizeHex(md5, hex_code);
+  itksysMD5_Delete(md5);
+
+  return m_DicomHeaderIndexDirectory + "/" + hex_code + ".txt";
+}
+
+void
+GuidedNativeImageIO
+::ReadDicomHeaderIndex(const std::string &dir, DicomHeaderIndex &index)
+{
+  index.clear();
+  std::string fn = GetDicomHeaderIndexFile(dir);
+  if(fn.empty())
+    return;
+
+  std::ifstream ifs(fn.c_str());
+  if(!ifs.good())
+    return;
+
+  // Check the signature, and that the index is for the same directory
+  std::string line;
+  if(!std::getline(ifs, line) || line != dicom_header_index_signature)
+    return;
+  if(!std::getline(ifs, line)
+     || line != itksys::SystemTools::CollapseFullPath(dir.c_str()))
+    return;
+
+  // Each line holds the tab-separated fields of one file. Damaged lines
+  // are ignored, and the files they describe are simply read again
+  while(std::getline(ifs, line))
+    {
+    std::vector<std::string> f;
+    size_t pos = 0;
+    for(size_t tab; (tab = line.find('\t', pos)) != std::string::npos; pos = tab + 1)
+      f.push_back(line.substr(pos, tab - pos));
+    f.push_back(line.substr(pos));
+    if(f.size() != 9)
+      continue;
+
+    DicomFileHeader hdr;
+    hdr.FileName = f[0];
+    hdr.ModifiedTime = std::atol(f[1].c_str());
+    hdr.FileSize = std::strtoul(f[2].c_str(), NULL, 10);
+    hdr.Valid = (f[3] == "1");
+    hdr.Rows = std::atoi(f[4].c_str());
+    hdr.Columns = std::atoi(f[5].c_str());
+    hdr.SeriesId = f[6];
+    hdr.SeriesNumber = f[7];
+    hdr.SeriesDescription = f[8];
+    index[hdr.FileName] = hdr;
+    }
+}
+
+void
+GuidedNativeImageIO
+::WriteDicomHeaderIndex(const std::string &dir, const DicomFileHeaderList &headers)
+{
+  std::string fn = GetDicomHeaderIndexFile(dir);
+  if(fn.empty())
+    return;
+
+  // The index is only a cache, so failing to write it is not an error
+  if(!itksys::SystemTools::MakeDirectory(m_DicomHeaderIndexDirectory.c_str()))
+    return;
+
+  // Write to a temporary file first, so that a parse running in another
+  // process never sees a partially written index
+  std::string fn_temp = fn + ".tmp";
+  std::ofstream ofs(fn_temp.c_str());
+  if(!ofs.good())
+    return;
+
+  ofs << dicom_header_index_signature << "\n";
+  ofs << itksys::SystemTools::CollapseFullPath(dir.c_str()) << "\n";
+  for(size_t i = 0; i < headers.size(); i++)
+    {
+    const DicomFileHeader &hdr = headers[i];
+
+    // Text that would break the line format is not indexed, and such files
+    // are read again on the next parse
+    std::string text = hdr.FileName + hdr.SeriesNumber + hdr.SeriesDescription;
+    if(text.find_first_of("\t\r\n") != std::string::npos)
+      continue;
+
+    ofs << hdr.FileName << "\t" << hdr.ModifiedTime << "\t" << hdr.FileSize << "\t"
+        << (hdr.Valid ? 1 : 0) << "\t" << hdr.Rows << "\t" << hdr.Columns << "\t"
+        << hdr.SeriesId << "\t" << hdr.SeriesNumber << "\t"
+        << hdr.SeriesDescription << "\n";
+    }
+
+  ofs.close();
+  if(ofs.fail())
+    {
+    itksys::SystemTools::RemoveFile(fn_temp.c_str());
+    return;
+    }
+
+  itksys::SystemTools::RemoveFile(fn.c_str());
+  if(std::rename(fn_temp.c_str(), fn.c_str()) != 0)
+    itksys::SystemTools::RemoveFile(fn_temp.c_str());
+}
+
 void
 GuidedNativeImageIO
 ::ParseDicomDirectory(const std::string &dir, itk::Command *progressCommand)
@@ -1400,20 +2050,6 @@ GuidedNativeImageIO
         "Trying to look for DICOM series in '%s', which is not a directory",
         dir.c_str());
 
-  // List of tags used for refined grouping of files - order matters!
-  std::vector<gdcm::Tag> tags_refine;
-  tags_refine.push_back(m_tagSeriesNumber);
-  tags_refine.push_back(m_tagSequenceName);
-  tags_refine.push_back(m_tagSliceThickness);
-  tags_refine.push_back(m_tagRows);
-  tags_refine.push_back(m_tagCols);
-
-  // List of tags that we want to parse - everything else may be ignored
-  std::set<gdcm::Tag> tags_all;
-  tags_all.insert(tags_refine.begin(), tags_refine.end());
-  tags_all.insert(m_tagDesc);
-  tags_all.insert(m_tagSeriesInstanceUID);
-
   // Clear the information about the last parse
   m_LastDicomParseResult.Reset();
   m_LastDicomParseResult.Directory = dir;
@@ -1424,98 +2060,80 @@ GuidedNativeImageIO
   // Load the directory - this should be quick
   dirList.Load(dir, false);
   gdcm::Directory::FilenamesType const &filenames = dirList.GetFilenames();
-  for(gdcm::Directory::FilenamesType::const_iterator it = filenames.begin();
-    it != filenames.end(); ++it)
-    {
-    // Process each filename in the directory
-    gdcm::Reader reader;
-    reader.SetFileName(it->c_str());
 
-    // Try reading this file. Fail quietly.
-    bool read = false;
-    try { read = reader.ReadSelectedTags(tags_all, true); }
-    catch(...) {}
+  // Load the headers of the files that have not changed since the last parse
+  // from the index, and make a list of the files that must be read
+  DicomHeaderIndex index;
+  ReadDicomHeaderIndex(dir, index);
 
-    // If nothing read, keep going
-    if(!read)
-      continue;
-
-    // Create a string filter to get tags
-    gdcm::StringFilter sf;
-    sf.SetFile(reader.GetFile());
-
-    // Start with the ID being the UID
-    std::string uid = sf.ToString(m_tagSeriesInstanceUID);
-    std::string full_id = uid;
-
-    // Iterate over the tags in the refine list
-    for(int iTag = 0; iTag < tags_refine.size(); iTag++)
-      {
-      // Read the tag value
-      std::string s = sf.ToString(tags_refine[iTag]);
-
-      // This code is from gdcmSerieHelper
-      if( full_id == uid && !s.empty() )
-        {
-        full_id += "."; // add separator
-        }
-      full_id += s;
-      }
+  DicomFileHeaderList headers(filenames.size());
+  std::vector<size_t> pending;
+  for(size_t i = 0; i < filenames.size(); i++)
+    {
+    DicomFileHeader &hdr = headers[i];
+    hdr.FileName = filenames[i];
+    hdr.ModifiedTime = itksys::SystemTools::ModifiedTime(hdr.FileName.c_str());
+    hdr.FileSize = itksys::SystemTools::FileLength(hdr.FileName.c_str());
+
+    DicomHeaderIndex::const_iterator it = index.find(hdr.FileName);
+    if(it != index.end()
+       && it->second.ModifiedTime == hdr.ModifiedTime
+       && it->second.FileSize == hdr.FileSize)
+      hdr = it->second;
+    else
+      pending.push_back(i);
+    }
 
-    // Eliminate non-alnum characters, including whitespace...
-    //   that may have been introduced by concats.
-    for(size_t i=0; i<full_id.size(); i++)
+  // The index only needs to be written if files were read or removed
+  bool index_changed = !pending.empty() || index.size() != headers.size() - pending.size();
+
+  // Read the pending headers in parallel, in batches. After each batch, the
+  // files up to the end of the batch are added to the result in the order in
+  // which they were listed, so that the result does not depend on the number
+  // of threads, and progress is reported from this thread as before
+  unsigned int n_threads = std::min(
+        (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(),
+        (unsigned int) ITK_MAX_THREADS);
+  size_t batch_size = 32 * n_threads;
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  DicomHeaderThreadData data;
+  data.Headers = &headers;
+  data.Pending = &pending;
+
+  size_t next = 0;
+  for(size_t b = 0; b <= pending.size(); b += batch_size)
+    {
+    data.Begin = b;
+    data.End = std::min(b + batch_size, pending.size());
+    if(data.End > data.Begin)
       {
-      while(i<full_id.size()
-        && !( full_id[i] == '.'
-          || (full_id[i] >= 'a' && full_id[i] <= 'z')
-          || (full_id[i] >= '0' && full_id[i] <= '9')
-          || (full_id[i] >= 'A' && full_id[i] <= 'Z')))
-        {
-        full_id.erase(i, 1);
-        }
+      unsigned int nt = (unsigned int) std::min((size_t) n_threads, data.End - data.Begin);
+      threader->SetNumberOfThreads(nt);
+      threader->SetSingleMethod(&DicomHeaderThreaderCallback, &data);
+      threader->SingleMethodExecute();
       }
 
-    // The info for the current series
-    DicomDirectoryParseResult::DicomSeriesInfo &series_info
-        = m_LastDicomParseResult.SeriesMap[full_id];
-
-    // The registry for the current series
-    Registry &r = series_info.MetaData;
-
-    // Have we found this ID before?
-    if(r.IsEmpty())
+    // Merge the files up to the next one that has not been read yet
+    size_t last = (data.End < pending.size()) ? pending[data.End] : headers.size();
+    for(; next < last; next++)
       {
-      r["SeriesId"] << full_id;
+      // If nothing read, keep going
+      if(!headers[next].Valid)
+        continue;
 
-      // Read series description
-      r["SeriesDescription"] << sf.ToString(m_tagDesc);
-      r["SeriesNumber"] << sf.ToString(m_tagSeriesNumber);
+      AddDicomFileToParseResult(headers[next]);
 
-      // Read the dimensions
-      r["Rows"] << std::atoi(sf.ToString(m_tagRows).c_str());
-      r["Columns"] << std::atoi(sf.ToString(m_tagCols).c_str());
-      r["NumberOfImages"] << 1;
+      // Indicate some progress
+      if(progressCommand)
+        progressCommand->Execute(this, itk::ProgressEvent());
       }
-    else
-      {
-      // Increement the number of images
-      r["NumberOfImages"] << r["NumberOfImages"][0] + 1;
-      }
-
-    // Update the dimensions string
-    ostringstream oss;
-    oss << r["Rows"][0] << " x " << r["Columns"][0] << " x " << r["NumberOfImages"][0];
-    r["Dimensions"] << oss.str();
-
-    // Update the filelist
-    series_info.FileList.push_back(*it);
-
-    // Indicate some progress
-    if(progressCommand)
-      progressCommand->Execute(this, itk::ProgressEvent());
     }
 
+  // Save the headers for the next time this directory is parsed
+  if(index_changed)
+    WriteDicomHeaderIndex(dir, headers);
+
   // Complain if no series have been found
   if(m_LastDicomParseResult.SeriesMap.size() == 0)
     throw IRISException(
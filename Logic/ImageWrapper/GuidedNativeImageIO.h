@@ -40,6 +40,7 @@
 #include "itkImage.h"
 #include "itkImageIOBase.h"
 #include "itkVectorImage.h"
+#include "itkMultiThreader.h"
 #include "gdcmTag.h"
 
   
@@ -133,13 +134,15 @@ public:
    * such as header size and image dimensions. The image is read in native
    * format and stored inside of this object. In order to cast the image to 
    * the format of interest, the user must cast the image to one of the 
-   * desired formats.
+   * desired formats. The optional progress command observes the progress
+   * events invoked while the data is read.
    */
-  void ReadNativeImage(const char *FileName, Registry &folder);
+  void ReadNativeImage(const char *FileName, Registry &folder,
+                       itk::Command *progressCommand = NULL);
 
   void ReadNativeImageHeader(const char *FileName, Registry &folder);
 
-  void ReadNativeImageData();
+  void ReadNativeImageData(itk::Command *progressCommand = NULL);
 
   /**
    * Get the number of components in the native image read by ReadNativeImage.
@@ -193,6 +196,51 @@ public:
   bool IsNativeImageLoaded() const
     { return m_NativeImage.IsNotNull(); }
 
+  /**
+   * Was the reading of the image data deferred by ReadNativeImageData()? This
+   * is done for large uncompressed files that ITK can read in pieces. The
+   * native image then has all the header information, but no buffer, and the
+   * cast and rescale adapters below read the data slab by slab directly into
+   * their output image. This way the data is never held in memory in both
+   * native and internal formats.
+   */
+  bool IsNativeImageDataDeferred() const
+    { return m_NativeDataDeferred; }
+
+  /**
+   * Read the image data into the native image buffer, if reading it was
+   * deferred. This is needed before accessing the buffer directly.
+   */
+  void ReadDeferredNativeImageData();
+
+  /**
+   * Files smaller than this size (in bytes) are always read into memory in
+   * full by ReadNativeImageData(). Set to zero to stream all files that can
+   * be streamed.
+   */
+  irisGetSetMacro(StreamingThreshold, unsigned long)
+
+  /**
+   * Whether the slices of a DICOM series are decoded concurrently (default).
+   * Series whose slices do not all match the first slice in size and pixel
+   * type are always read with the ITK series reader. While the slices are
+   * decoded, a ProgressEvent is invoked on this object after every batch of
+   * slices.
+   */
+  irisGetSetMacro(ParallelDicomDecoding, bool)
+
+  /** Fraction of the slices of the DICOM series decoded so far */
+  irisGetMacro(DicomSeriesReadProgress, double)
+
+  /**
+   * Read the deferred image data in slabs of whole slices. For each slab, the
+   * visitor is called as visitor(const TNative *data, size_t offset, size_t n)
+   * where n is the number of components in the slab and offset is the index
+   * of the first component of the slab in the image buffer.
+   */
+  template <typename TNative, typename TVisitor>
+    void StreamNativeImageData(TVisitor &visitor);
+
   /** 
    * Save the native image it its native format (to a different location and
    * filename, presumably). This function is not meant as part of the normal
@@ -212,7 +260,7 @@ public:
    * the format of interest.
    */
   void DeallocateNativeImage()
-    { m_IOBase = NULL; m_NativeImage = NULL; }
+    { m_IOBase = NULL; m_NativeImage = NULL; m_NativeDataDeferred = false; }
 
   /** 
    * Get RAI code for an image. If there is nothing in the registry, this will
@@ -276,6 +324,19 @@ public:
    */
   itkGetConstReferenceMacro(LastDicomParseResult, DicomDirectoryParseResult)
 
+  /**
+   * Set the directory where ParseDicomDirectory() keeps an index of the
+   * headers it has read, one index file per DICOM directory. When the same
+   * directory is parsed again, only the files that are new or whose time
+   * stamp or size have changed are read. An empty string (the default)
+   * disables the index.
+   */
+  static void SetDicomHeaderIndexDirectory(const std::string &dir)
+    { m_DicomHeaderIndexDirectory = dir; }
+
+  static const std::string &GetDicomHeaderIndexDirectory()
+    { return m_DicomHeaderIndexDirectory; }
+
   /**
    * Create an ImageIO object using a registry folder. Second parameter is
    * true for reading the file, false for writing the file
@@ -303,12 +364,23 @@ protected:
   /** Templated function that computes an MD5 hash from the stored image */
   template <typename TScalar> std::string DoGetNativeMD5Hash();
 
+  /** Templated function that decodes the slices of a DICOM series in
+   * parallel. Returns false if the series must be read serially instead */
+  template <typename TScalar> bool DoReadDicomSeriesParallel();
+
+  /** Templated function that reads deferred data into the native image */
+  template <typename TScalar> void DoReadDeferredNative();
+
+  /** Can reading of the image data be deferred, to be streamed later? */
+  bool CanDeferNativeImageData();
+
   /** A dispatch class that calls templated functions in the main class. */
   class DispatchBase {
   public:
     virtual void ReadNative(GuidedNativeImageIO *self, const char *fname, Registry &folder) = 0;
     virtual void SaveNative(GuidedNativeImageIO *self, const char *fname, Registry &folder) = 0;
     virtual std::string GetNativeMD5Hash(GuidedNativeImageIO *self) = 0;
+    virtual void ReadDeferredNative(GuidedNativeImageIO *self) = 0;
     virtual ~DispatchBase() {}
   };
 
@@ -320,6 +392,8 @@ protected:
       { self->DoSaveNative<TScalar>(fname, folder); }
     virtual std::string GetNativeMD5Hash(GuidedNativeImageIO *self)
       { return self->DoGetNativeMD5Hash<TScalar>(); }
+    virtual void ReadDeferredNative(GuidedNativeImageIO *self)
+      { self->DoReadDeferredNative<TScalar>(); }
   };
 
   /** 
@@ -342,9 +416,92 @@ protected:
   // The IO base used to read the files
   IOBasePointer m_IOBase;
 
+  // Whether the image data has been left on disk, to be read in slabs. The
+  // IO base is kept open for reading while this is the case
+  bool m_NativeDataDeferred;
+
+  // Size of files above which the image data is streamed
+  unsigned long m_StreamingThreshold;
+
+  // Whether DICOM slices are decoded concurrently, and the progress
+  bool m_ParallelDicomDecoding;
+  double m_DicomSeriesReadProgress;
+
   // DICOM directory last processed by ParseDicomSeries
   DicomDirectoryParseResult m_LastDicomParseResult;
 
+  // The tags of a DICOM file used to group it into a series
+  struct DicomFileHeader
+  {
+    std::string FileName;
+    long ModifiedTime;
+    unsigned long FileSize;
+
+    // Whether the file could be read as DICOM
+    bool Valid;
+
+    std::string SeriesId, SeriesDescription, SeriesNumber;
+    int Rows, Columns;
+  };
+
+  typedef std::vector<DicomFileHeader> DicomFileHeaderList;
+  typedef std::map<std::string, DicomFileHeader> DicomHeaderIndex;
+
+  // Data shared by the threads that read DICOM headers
+  struct DicomHeaderThreadData
+  {
+    DicomFileHeaderList *Headers;
+    const std::vector<size_t> *Pending;
+    size_t Begin, End;
+  };
+
+  // Data shared by the threads that decode the slices of a DICOM series
+  struct DicomSliceThreadData
+  {
+    const std::vector<std::string> *Files;
+    IOBase::IOComponentType ComponentType;
+    size_t ComponentSize, Columns, Rows;
+    int ImagesPerIPP;
+
+    // The output buffer. File i holds component i % ImagesPerIPP of slice
+    // i / ImagesPerIPP
+    char *Buffer;
+
+    // Range of files decoded in the current batch
+    size_t Begin, End;
+
+    // Set if any slice could not be decoded into the buffer
+    volatile bool Failed;
+
+    // Metadata of the first file
+    itk::MetaDataDictionary Dictionary;
+  };
+
+  // Thread callback decoding a range of DICOM slices
+  static ITK_THREAD_RETURN_TYPE DicomSliceThreaderCallback(void *arg);
+
+  // Read the tags of a DICOM file into the header structure
+  static void ReadDicomFileHeader(DicomFileHeader &hdr);
+
+  // Thread callback reading a range of pending headers
+  static ITK_THREAD_RETURN_TYPE DicomHeaderThreaderCallback(void *arg);
+
+  // Add a file to the series of the last parse result
+  void AddDicomFileToParseResult(const DicomFileHeader &hdr);
+
+  // Get the index file for a DICOM directory, or an empty string if the
+  // index is disabled
+  static std::string GetDicomHeaderIndexFile(const std::string &dir);
+
+  // Read and write the header index of a DICOM directory
+  static void ReadDicomHeaderIndex(
+      const std::string &dir, DicomHeaderIndex &index);
+  static void WriteDicomHeaderIndex(
+      const std::string &dir, const DicomFileHeaderList &headers);
+
+  // Directory where DICOM header indices are stored
+  static std::string m_DicomHeaderIndexDirectory;
+
   // This information is copied from IOBase in order to delete IOBase at the 
   // earliest possible point, so as to conserve memory
   IOBase::IOComponentType m_NativeType;
@@ -418,7 +575,7 @@ private:
   double m_NativeScale, m_NativeShift;
 
   // Method that does the casting
-  template<typename TNative> void DoCast(itk::ImageBase<3> *native);
+  template<typename TNative> void DoCast(GuidedNativeImageIO *nativeIO);
 };
 
 template<class TPixel> class TrivialCastFunctor
@@ -460,7 +617,7 @@ private:
   TCastFunctor m_Functor;
 
   // Method that does the casting
-  template<typename TNative> void DoCast(itk::ImageBase<3> *native);
+  template<typename TNative> void DoCast(GuidedNativeImageIO *nativeIO);
 
   friend class RescaleNativeImageToIntegralType<OutputImageType>;
 };
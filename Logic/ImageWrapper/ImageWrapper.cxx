@@ -72,6 +72,8 @@
 #include "itkTransform.h"
 #include "itkExtractImageFilter.h"
 #include "AffineTransformHelper.h"
+#include "AllPurposeProgressAccumulator.h"
+#include "itkMultiThreader.h"
 
 
 #include <vnl/vnl_inverse.h>
@@ -209,47 +211,228 @@ public:
             element_product((to_double(vROIIndex) - 0.5), vOldSpacing) +
             vNewSpacing * 0.5);
 
-      // Create a filter for resampling the image
-      typedef itk::ResampleImageFilter<ImageType,ImageType> ResampleFilterType;
-      typename ResampleFilterType::Pointer fltSample = ResampleFilterType::New();
+      // The resampled image
+      SmartPtr<ImageType> output = ImageType::New();
+      RegionType outRegion;
+      outRegion.SetSize(to_itkSize(roi.GetResampleDimensions()));
+      output->SetRegions(outRegion);
+      output->SetSpacing(vNewSpacing.data_block());
+      output->SetOrigin(vNewOrigin.data_block());
+      output->SetDirection(refspace->GetDirection());
+      output->SetNumberOfComponentsPerPixel(image->GetNumberOfComponentsPerPixel());
+      output->Allocate();
+
+      // Resample in slabs. The interpolator is set up once, which for the
+      // B-spline interpolator computes the coefficients, and is then shared
+      // by all the threads and slabs
+      interp->SetInputImage(image);
+
+      SlabResampleData<TInterpolateFunction> data;
+      data.Output = output;
+      data.Transform = transform;
+      data.Interpolator = interp;
+      data.NumberOfComponents = image->GetNumberOfComponentsPerPixel();
+      ProcessSlabs(data, outRegion, &SlabResampleCallback<TInterpolateFunction>,
+                   progressCommand);
+
+      return output;
+      }
+    else
+      {
+      // Copy the region of interest in slabs
+      return CopyRegionInSlabs(image, roi.GetROI(), progressCommand);
+      }
+  }
+
+  /**
+   * Copy a region of an image into a new image, like RegionOfInterestImageFilter
+   * does, but by whole rows of voxels. The rows of each slab of slices are
+   * copied in parallel, and progress is reported after each slab.
+   */
+  static SmartPtr<ImageType> CopyRegionInSlabs(
+      ImageType *image,
+      const typename ImageType::RegionType &region,
+      itk::Command *progressCommand)
+  {
+    // The output is placed in physical space like the output of the ROI filter
+    typename ImageType::PointType origin;
+    image->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+
+    typename ImageType::RegionType outRegion;
+    outRegion.SetSize(region.GetSize());
+
+    SmartPtr<ImageType> output = ImageType::New();
+    output->CopyInformation(image);
+    output->SetOrigin(origin);
+    output->SetRegions(outRegion);
+    output->SetNumberOfComponentsPerPixel(image->GetNumberOfComponentsPerPixel());
+    output->Allocate();
+
+    SlabCopyData data;
+    data.Input = image;
+    data.Region = region;
+    data.Output = output->GetBufferPointer();
+    data.RowLength = region.GetSize(0) * image->GetNumberOfComponentsPerPixel();
+    ProcessSlabs(data, region, &SlabCopyCallback, progressCommand);
+
+    return output;
+  }
 
-      // Initialize the resampling filter
-      fltSample->SetInput(image);
-      fltSample->SetTransform(transform);
-      fltSample->SetInterpolator(interp);
+protected:
 
-      // Set the image sizes and spacing
-      fltSample->SetSize(to_itkSize(roi.GetResampleDimensions()));
-      fltSample->SetOutputSpacing(vNewSpacing.data_block());
-      fltSample->SetOutputOrigin(vNewOrigin.data_block());
-      fltSample->SetOutputDirection(refspace->GetDirection());
+  // Number of slabs in which a region is copied or resampled
+  enum { SlabCount = 32 };
 
-      // Set the progress bar
-      if(progressCommand)
-        fltSample->AddObserver(itk::AnyEvent(),progressCommand);
+  // Range of rows of a region, counted over the slices, that the threads
+  // process in a slab
+  struct SlabData
+  {
+    unsigned long RowBegin, RowEnd;
+  };
 
-      fltSample->Update();
+  // Data shared by the threads copying the rows of a slab
+  struct SlabCopyData : public SlabData
+  {
+    ImageType *Input;
+    typename ImageType::RegionType Region;
+    typename ImageType::InternalPixelType *Output;
+    size_t RowLength;
+  };
 
-      return fltSample->GetOutput();
-      }
-    else
+  // Data shared by the threads resampling the rows of a slab
+  template <class TInterpolateFunction>
+  struct SlabResampleData : public SlabData
+  {
+    ImageType *Output;
+    const TransformType *Transform;
+    const TInterpolateFunction *Interpolator;
+    size_t NumberOfComponents;
+  };
+
+  /**
+   * Run the callback over the rows of the region in slabs of slices. The
+   * rows of each slab are split between the threads, and progress is
+   * reported after each slab.
+   */
+  template <class TSlabData>
+  static void ProcessSlabs(TSlabData &data,
+                           const typename ImageType::RegionType &region,
+                           ITK_THREAD_RETURN_TYPE (*callback)(void *),
+                           itk::Command *progressCommand)
+  {
+    // Progress is reported through a trivial source
+    SmartPtr<TrivalProgressSource> progress = TrivalProgressSource::New();
+    if(progressCommand)
+      progress->AddObserver(itk::AnyEvent(), progressCommand);
+
+    unsigned long nz = region.GetSize(2), slab = (nz + SlabCount - 1) / SlabCount;
+    unsigned long ny = region.GetSize(1);
+    unsigned int nt = std::min(
+          (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(),
+          (unsigned int) ITK_MAX_THREADS);
+
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    progress->StartProgress(nz * ny);
+    for(unsigned long z = 0; z < nz; z += slab)
       {
-      // The filter used to chop off the region of interest
-      typedef itk::RegionOfInterestImageFilter <ImageType,ImageType> ChopFilterType;
-      typename ChopFilterType::Pointer fltChop = ChopFilterType::New();
+      data.RowBegin = z * ny;
+      data.RowEnd = std::min(z + slab, nz) * ny;
+      threader->SetNumberOfThreads(
+            (unsigned int) std::min((unsigned long) nt, data.RowEnd - data.RowBegin));
+      threader->SetSingleMethod(callback, &data);
+      threader->SingleMethodExecute();
+      progress->AddProgress(data.RowEnd - data.RowBegin);
+      }
+    progress->EndProgress();
+  }
+
+  // Store an interpolated value, clamped to the range of the pixel type as
+  // ResampleImageFilter does
+  template <class TComponent>
+  static void StoreInterpolated(double value, TComponent *out, size_t)
+  {
+    typedef itk::NumericTraits<TComponent> Traits;
+    value = std::max(value, (double) Traits::NonpositiveMin());
+    value = std::min(value, (double) Traits::max());
+    *out = static_cast<TComponent>(value);
+  }
 
-      // Pipe image into the chopper
-      fltChop->SetInput(image);
+  template <class TComponent>
+  static void StoreInterpolated(const itk::VariableLengthVector<double> &value,
+                                TComponent *out, size_t ncomp)
+  {
+    for(size_t c = 0; c < ncomp; c++)
+      StoreInterpolated(value[c], out + c, 1);
+  }
 
-      // Set the region of interest
-      fltChop->SetRegionOfInterest(roi.GetROI());
+  template <class TInterpolateFunction>
+  static ITK_THREAD_RETURN_TYPE SlabResampleCallback(void *arg)
+  {
+    itk::MultiThreader::ThreadInfoStruct *info =
+        static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+    SlabResampleData<TInterpolateFunction> *data =
+        static_cast<SlabResampleData<TInterpolateFunction> *>(info->UserData);
+
+    // Each thread resamples a contiguous range of the rows of the slab
+    unsigned long n = data->RowEnd - data->RowBegin;
+    unsigned long r0 = data->RowBegin + (n * info->ThreadID) / info->NumberOfThreads;
+    unsigned long r1 = data->RowBegin + (n * (info->ThreadID + 1)) / info->NumberOfThreads;
+
+    ImageType *output = data->Output;
+    size_t ncomp = data->NumberOfComponents;
+    unsigned long nx = output->GetBufferedRegion().GetSize(0);
+    unsigned long ny = output->GetBufferedRegion().GetSize(1);
+    typename ImageType::InternalPixelType *out =
+        output->GetBufferPointer() + r0 * nx * ncomp;
+
+    typename TransformType::InputPointType pOut;
+    typename TransformType::OutputPointType pIn;
+    for(unsigned long r = r0; r < r1; r++)
+      {
+      typename ImageType::IndexType idx;
+      idx[1] = r % ny;
+      idx[2] = r / ny;
+      for(unsigned long x = 0; x < nx; x++, out += ncomp)
+        {
+        // Voxels that map outside of the image are set to zero
+        idx[0] = x;
+        output->TransformIndexToPhysicalPoint(idx, pOut);
+        pIn = data->Transform->TransformPoint(pOut);
+        if(data->Interpolator->IsInsideBuffer(pIn))
+          StoreInterpolated(data->Interpolator->Evaluate(pIn), out, ncomp);
+        else
+          std::fill(out, out + ncomp, 0);
+        }
+      }
 
-      // Update the pipeline
-      fltChop->Update();
+    return ITK_THREAD_RETURN_VALUE;
+  }
 
-      // Return the resulting image
-      return fltChop->GetOutput();
+  static ITK_THREAD_RETURN_TYPE SlabCopyCallback(void *arg)
+  {
+    itk::MultiThreader::ThreadInfoStruct *info =
+        static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+    SlabCopyData *data = static_cast<SlabCopyData *>(info->UserData);
+
+    // Each thread copies a contiguous range of the rows of the slab
+    unsigned long n = data->RowEnd - data->RowBegin;
+    unsigned long r0 = data->RowBegin + (n * info->ThreadID) / info->NumberOfThreads;
+    unsigned long r1 = data->RowBegin + (n * (info->ThreadID + 1)) / info->NumberOfThreads;
+
+    const typename ImageType::InternalPixelType *src = data->Input->GetBufferPointer();
+    size_t ncomp = data->Input->GetNumberOfComponentsPerPixel();
+    unsigned long ny = data->Region.GetSize(1);
+    for(unsigned long r = r0; r < r1; r++)
+      {
+      typename ImageType::IndexType idx = data->Region.GetIndex();
+      idx[1] += r % ny;
+      idx[2] += r / ny;
+      const typename ImageType::InternalPixelType *row =
+          src + data->Input->ComputeOffset(idx) * ncomp;
+      std::copy(row, row + data->RowLength, data->Output + r * data->RowLength);
       }
+
+    return ITK_THREAD_RETURN_VALUE;
   }
 
 };
@@ -321,6 +321,15 @@ public:
       const itk::Index<3> &startIdx, long runlength,
       double *out_sum, double *out_sumsq) const = 0;
 
+  /** Copy the intensities of a run of voxels starting at the index startIdx
+   * into an array of runlength times the number of components values. This
+   * allows statistics to be computed over many runs of the same line with a
+   * single virtual call. The values are in internal (not native) format */
+  virtual void GetRunLengthIntensities(
+      const itk::ImageRegion<3> &region,
+      const itk::Index<3> &startIdx, long runlength,
+      double *out) const = 0;
+
   /**
    * This method returns a vector of values for the voxel under the cursor.
    * This is the natural value or set of values that should be displayed to
@@ -0,0 +1,248 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: LabelCountIndex.cxx,v $
+  Language:  C++
+  Date:      $Date: 2018/01/05 $
+  Version:   $Revision: 1 $
+  Copyright (c) 2018 Paul A. Yushkevich
+
+  This file is part of ITK-SNAP
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "LabelCountIndex.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+
+LabelCountIndex::LabelCountIndex()
+{
+  m_Valid = false;
+  m_SyncTime = 0;
+  m_LogValid = false;
+  m_SliceOrigin = 0;
+  m_ChangeTime.Modified();
+  m_JournalStart = m_ChangeTime.GetMTime();
+  m_UpdateDepth = 0;
+  m_Tracking = false;
+}
+
+void LabelCountIndex::SetImage(ImageType *image)
+{
+  m_Image = image;
+  this->Invalidate();
+}
+
+void LabelCountIndex::Invalidate()
+{
+  m_Valid = false;
+  m_LogValid = false;
+  m_Tracking = false;
+  m_Entries.clear();
+  this->RestartJournal();
+}
+
+bool LabelCountIndex::IsUpToDate() const
+{
+  return m_Valid && m_Image && m_Image->GetMTime() == m_SyncTime;
+}
+
+void LabelCountIndex::Update()
+{
+  if(!this->IsUpToDate())
+    this->Rebuild();
+}
+
+void LabelCountIndex::Rebuild()
+{
+  // Changes made since the log was last consumed are lost
+  m_Entries.clear();
+  m_Valid = false;
+  m_LogValid = false;
+  this->RestartJournal();
+  if(!m_Image)
+    return;
+
+  m_SliceOrigin = m_Image->GetBufferedRegion().GetIndex(2);
+  m_SliceChangeTime.resize(m_Image->GetBufferedRegion().GetSize(2), 0);
+
+  // Walk over the run-length lines, recording each run in the entry of its label
+  typedef ImageType::BufferType BufferType;
+  BufferType *buffer = m_Image->GetBuffer();
+  itk::IndexValueType x0 = m_Image->GetBufferedRegion().GetIndex(0);
+
+  itk::ImageRegionConstIteratorWithIndex<BufferType> bit(
+        buffer, buffer->GetBufferedRegion());
+  for(; !bit.IsAtEnd(); ++bit)
+    {
+    const ImageType::RLLine &line = bit.Value();
+    IndexType start;
+    start[0] = x0;
+    start[1] = bit.GetIndex()[0];
+    start[2] = bit.GetIndex()[1];
+
+    for(size_t i = 0; i < line.size(); i++)
+      {
+      unsigned long n = line[i].first;
+      this->GetEntry(line[i].second).Add(start, start[0] + n - 1, n);
+      start[0] += n;
+      }
+    }
+
+  m_Valid = true;
+  m_SyncTime = m_Image->GetMTime();
+}
+
+unsigned long LabelCountIndex::GetCount(LabelType label)
+{
+  this->Update();
+  return label < m_Entries.size() ? m_Entries[label].Count : 0;
+}
+
+LabelCountIndex::RegionType LabelCountIndex::GetBoundingBox(LabelType label)
+{
+  this->Update();
+  RegionType region;
+  if(label < m_Entries.size() && m_Entries[label].Count > 0)
+    {
+    region.SetIndex(m_Entries[label].Lower);
+    region.SetUpperIndex(m_Entries[label].Upper);
+    }
+  return region;
+}
+
+std::vector<LabelType> LabelCountIndex::GetLabelsPresent()
+{
+  this->Update();
+  std::vector<LabelType> labels;
+  for(size_t i = 0; i < m_Entries.size(); i++)
+    if(m_Entries[i].Count > 0)
+      labels.push_back((LabelType) i);
+  return labels;
+}
+
+void LabelCountIndex::BeginIncrementalUpdate()
+{
+  // Only the outermost update decides whether changes are tracked
+  if(m_UpdateDepth++ == 0)
+    {
+    m_Tracking = this->IsUpToDate();
+    m_ChangeTime.Modified();
+    }
+}
+
+void LabelCountIndex::EndIncrementalUpdate()
+{
+  assert(m_UpdateDepth > 0);
+  if(--m_UpdateDepth == 0)
+    {
+    // If changes were tracked, the index reflects the current state of the image
+    if(m_Tracking)
+      m_SyncTime = m_Image->GetMTime();
+    m_Tracking = false;
+    }
+}
+
+void LabelCountIndex::RecordReplaceLabel(LabelType source, LabelType target)
+{
+  if(!m_Tracking || source == target)
+    return;
+
+  Entry src = this->GetEntry(source);
+  if(src.Count == 0)
+    return;
+
+  // Merge the source into the target and clear the source
+  this->MarkSlicesChanged(src.Lower[2], src.Upper[2]);
+  Entry &trg = this->GetEntry(target);
+  trg.Add(src.Lower, src.Upper[0], src.Count);
+  trg.Add(src.Upper, src.Upper[0], 0);
+  trg.MarkDirty(src.Lower, src.Upper);
+  m_Entries[source].Count = 0;
+  m_Entries[source].MarkDirty(src.Lower, src.Upper);
+}
+
+bool LabelCountIndex::ConsumeDirtyRegions(std::map<LabelType, RegionType> &dirty)
+{
+  dirty.clear();
+  if(!m_Image)
+    return false;
+
+  // Bring the index up to date, which may invalidate the log
+  this->Update();
+  bool valid = m_LogValid;
+
+  for(size_t i = 0; i < m_Entries.size(); i++)
+    {
+    Entry &e = m_Entries[i];
+    if(e.Dirty)
+      {
+      if(valid)
+        {
+        RegionType region;
+        region.SetIndex(e.DirtyLower);
+        region.SetUpperIndex(e.DirtyUpper);
+        dirty[(LabelType) i] = region;
+        }
+      e.Dirty = false;
+      }
+    }
+
+  // From now on, the log is complete until the next unreported change
+  m_LogValid = true;
+  return valid;
+}
+
+void LabelCountIndex::RestartJournal()
+{
+  m_SliceChangeTime.clear();
+  m_ChangeTime.Modified();
+  m_JournalStart = m_ChangeTime.GetMTime();
+}
+
+bool LabelCountIndex::GetChangedSlices(
+    unsigned long time, std::vector<itk::IndexValueType> &slices)
+{
+  slices.clear();
+  if(!m_Image)
+    return false;
+
+  // Bring the index up to date, which restarts the journal if the image has
+  // been modified without the index knowing
+  this->Update();
+  if(time < m_JournalStart)
+    return false;
+
+  for(size_t k = 0; k < m_SliceChangeTime.size(); k++)
+    if(m_SliceChangeTime[k] > time)
+      slices.push_back(m_SliceOrigin + (itk::IndexValueType) k);
+  return true;
+}
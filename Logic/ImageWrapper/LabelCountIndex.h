@@ -0,0 +1,278 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: LabelCountIndex.h,v $
+  Language:  C++
+  Date:      $Date: 2018/01/05 $
+  Version:   $Revision: 1 $
+  Copyright (c) 2018 Paul A. Yushkevich
+
+  This file is part of ITK-SNAP
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef LABELCOUNTINDEX_H
+#define LABELCOUNTINDEX_H
+
+#include "SNAPCommon.h"
+#include "RLEImage.h"
+#include "itkImageRegion.h"
+#include "itkTimeStamp.h"
+#include <vector>
+#include <map>
+
+/**
+ * \class LabelCountIndex
+ * \brief Keeps track of the number of voxels and the bounding box of each
+ * label in a label image.
+ *
+ * The index is owned by the LabelImageWrapper and is kept up to date by the
+ * code that edits the segmentation (SegmentationUpdateIterator, undo/redo,
+ * label replacement). Each incremental update is bracketed by calls to
+ * BeginIncrementalUpdate() and EndIncrementalUpdate(), and the index records
+ * the modification time of the image at the end of the update. If the image
+ * is modified by code that does not report to the index, the times will not
+ * match and the index is rebuilt from the runs of the RLE image the next time
+ * it is queried.
+ *
+ * Bounding boxes grow as voxels are assigned a label, but do not shrink when
+ * voxels are removed from a label, until the label is removed entirely or the
+ * index is rebuilt. They are therefore guaranteed to contain all the voxels
+ * with the label, but are not always tight.
+ *
+ * The index also keeps a log of the regions where each label gained or lost
+ * voxels. The log is consumed by a single client (the mesh pipeline of the
+ * layer) to update only what has changed since it last looked. Other clients
+ * can find the slices that have changed since a given time, which is taken
+ * from GetChangeTime() when they last looked.
+ */
+class LabelCountIndex
+{
+public:
+
+  typedef RLEImage<LabelType> ImageType;
+  typedef itk::ImageRegion<3> RegionType;
+  typedef itk::Index<3> IndexType;
+
+  LabelCountIndex();
+
+  /** Set the image tracked by the index. This invalidates the index */
+  void SetImage(ImageType *image);
+
+  /** Mark the index as invalid, forcing it to be recomputed on next access */
+  void Invalidate();
+
+  /** Check whether the index is in sync with the image */
+  bool IsUpToDate() const;
+
+  /** Recompute the index if it is out of sync with the image */
+  void Update();
+
+  /** Get the number of voxels with the given label */
+  unsigned long GetCount(LabelType label);
+
+  /**
+   * Get the bounding box of the voxels with the given label. The region is
+   * empty if the label is not present in the image.
+   */
+  RegionType GetBoundingBox(LabelType label);
+
+  /** Get the list of labels present in the image (including zero) */
+  std::vector<LabelType> GetLabelsPresent();
+
+  /**
+   * Begin an incremental update. Changes recorded between this call and the
+   * matching call to EndIncrementalUpdate() are only applied to the index if
+   * the index was up to date when the update began.
+   */
+  void BeginIncrementalUpdate();
+
+  /**
+   * End an incremental update. This should be called after the image has been
+   * marked as modified, so that the index is in sync with its new MTime.
+   */
+  void EndIncrementalUpdate();
+
+  /** Record a change of a single voxel from one label to another */
+  void RecordChange(LabelType oldLabel, LabelType newLabel, const IndexType &idx)
+  {
+    if(m_Tracking && oldLabel != newLabel)
+      {
+      this->MarkSlicesChanged(idx[2], idx[2]);
+      this->GetEntry(oldLabel).Remove(1);
+      this->GetEntry(oldLabel).MarkDirty(idx, idx);
+      this->GetEntry(newLabel).Add(idx, idx[0], 1);
+      this->GetEntry(newLabel).MarkDirty(idx, idx);
+      }
+  }
+
+  /** Record a change of a run of voxels along the x axis */
+  void RecordRunChange(LabelType oldLabel, LabelType newLabel,
+                       const IndexType &start, unsigned long length)
+  {
+    if(m_Tracking && oldLabel != newLabel && length > 0)
+      {
+      IndexType end = start;
+      end[0] += length - 1;
+      this->MarkSlicesChanged(start[2], start[2]);
+      this->GetEntry(oldLabel).Remove(length);
+      this->GetEntry(oldLabel).MarkDirty(start, end);
+      this->GetEntry(newLabel).Add(start, end[0], length);
+      this->GetEntry(newLabel).MarkDirty(start, end);
+      }
+  }
+
+  /** Record that all voxels with label 'source' have been assigned 'target' */
+  void RecordReplaceLabel(LabelType source, LabelType target);
+
+  /**
+   * Get the bounding box of the changes to each label since the last call to
+   * this method, and clear the log. Returns false if the log is incomplete,
+   * i.e., the image was modified in ways that were not reported to the index
+   * (or this is the first call), in which case the client should assume that
+   * every label has changed.
+   */
+  bool ConsumeDirtyRegions(std::map<LabelType, RegionType> &dirty);
+
+  /**
+   * Get the time of the last change recorded by the index. Times come from
+   * the global ITK clock, so times taken from another index are never
+   * mistaken for times of this one
+   */
+  unsigned long GetChangeTime() const { return m_ChangeTime.GetMTime(); }
+
+  /**
+   * Get the z indices of the slices where voxels have changed label since the
+   * given change time. Returns false if the index has not recorded all the
+   * changes since then, in which case the client should assume that every
+   * slice has changed.
+   */
+  bool GetChangedSlices(unsigned long time, std::vector<itk::IndexValueType> &slices);
+
+protected:
+
+  // Count and extents of a single label, and the extents of its changes
+  struct Entry
+  {
+    unsigned long Count;
+    IndexType Lower, Upper;
+    bool Dirty;
+    IndexType DirtyLower, DirtyUpper;
+
+    Entry() : Count(0), Dirty(false) {}
+
+    void Add(const IndexType &start, itk::IndexValueType x_end, unsigned long n)
+    {
+      if(Count == 0)
+        {
+        Lower = start; Upper = start; Upper[0] = x_end;
+        }
+      else
+        {
+        for(int d = 0; d < 3; d++)
+          {
+          if(Lower[d] > start[d]) Lower[d] = start[d];
+          if(Upper[d] < start[d]) Upper[d] = start[d];
+          }
+        if(Upper[0] < x_end) Upper[0] = x_end;
+        }
+      Count += n;
+      }
+
+    void Remove(unsigned long n)
+    {
+      Count = (Count > n) ? Count - n : 0;
+    }
+
+    void MarkDirty(const IndexType &lower, const IndexType &upper)
+    {
+      if(!Dirty)
+        {
+        DirtyLower = lower; DirtyUpper = upper; Dirty = true;
+        }
+      else
+        {
+        for(int d = 0; d < 3; d++)
+          {
+          if(DirtyLower[d] > lower[d]) DirtyLower[d] = lower[d];
+          if(DirtyUpper[d] < upper[d]) DirtyUpper[d] = upper[d];
+          }
+        }
+    }
+  };
+
+  void MarkSlicesChanged(itk::IndexValueType z0, itk::IndexValueType z1)
+  {
+    for(itk::IndexValueType z = z0; z <= z1; z++)
+      m_SliceChangeTime[z - m_SliceOrigin] = m_ChangeTime.GetMTime();
+  }
+
+  Entry &GetEntry(LabelType label)
+  {
+    if(label >= m_Entries.size())
+      m_Entries.resize(label + 1);
+    return m_Entries[label];
+  }
+
+  // Scan the runs of the image to recompute the index
+  void Rebuild();
+
+  // Forget the changes of the slices, which are no longer known
+  void RestartJournal();
+
+  // The image being tracked
+  SmartPtr<ImageType> m_Image;
+
+  // Per-label entries, indexed by label
+  std::vector<Entry> m_Entries;
+
+  // Whether the index has been computed and the MTime of the image then
+  bool m_Valid;
+  unsigned long m_SyncTime;
+
+  // Whether the log of dirty regions covers all changes since it was consumed
+  bool m_LogValid;
+
+  // Time of the last change of each slice. The change time is advanced by
+  // each incremental update. Changes made before the journal start time are
+  // not known
+  std::vector<unsigned long> m_SliceChangeTime;
+  itk::IndexValueType m_SliceOrigin;
+  itk::TimeStamp m_ChangeTime;
+  unsigned long m_JournalStart;
+
+  // Depth of nested incremental updates and whether they are being applied
+  int m_UpdateDepth;
+  bool m_Tracking;
+};
+
+#endif // LABELCOUNTINDEX_H
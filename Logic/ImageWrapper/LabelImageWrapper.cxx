@@ -44,9 +44,17 @@
 #include "UndoDataManager.h"
 #include "Rebroadcaster.h"
 
+#include <algorithm>
+
 LabelImageWrapper::LabelImageWrapper()
 {
-  m_UndoManager = new UndoManagerType(4, 200000);
+  m_UndoManager = NewUndoManager();
+}
+
+LabelImageWrapper::UndoManagerType *LabelImageWrapper::NewUndoManager()
+{
+  // Keep at least 4 undo points, and as many more as fit into 128 MB
+  return new UndoManagerType(4, 128 * 1024 * 1024);
 }
 
 LabelImageWrapper::~LabelImageWrapper()
@@ -60,6 +68,9 @@ void LabelImageWrapper::UpdateImagePointer(
   Superclass::UpdateImagePointer(image, refSpace, tran);
   m_UndoManager->Clear();
 
+  // The label counts will be computed from the new image when first needed
+  m_LabelCountIndex.SetImage(image);
+
   // Modified event on the image is rebroadcast as the WrapperImageChangeEvent
   Rebroadcaster::Rebroadcast(image, itk::ModifiedEvent(),
                              this, WrapperImageChangeEvent());
@@ -85,6 +96,22 @@ void LabelImageWrapper::ClearUndoPoints()
   m_UndoManager->Clear();
 }
 
+void LabelImageWrapper::SwapImageContents(ImageType *alt, UndoManagerType *&altUndo)
+{
+  // Exchange the runs of the two images
+  ImageType *seg = this->GetImage();
+  seg->SwapBuffer(alt);
+
+  // Each image takes its undo history along
+  std::swap(m_UndoManager, altUndo);
+  if(!m_UndoManager)
+    m_UndoManager = NewUndoManager();
+
+  // The label counts are rebuilt from the new contents when first needed
+  alt->Modified();
+  seg->Modified();
+}
+
 bool LabelImageWrapper::IsUndoPossible()
 {
   return m_UndoManager->IsUndoPossible();
@@ -92,39 +119,8 @@ bool LabelImageWrapper::IsUndoPossible()
 
 void LabelImageWrapper::Undo()
 {
-  // Get the commit for the undo
-  const UndoManagerType::Commit &commit = m_UndoManager->GetCommitForUndo();
-
-  // The label image that will undergo undo
-  typedef itk::ImageRegionIterator<ImageType> IteratorType;
-  ImageType *imSeg = this->GetImage();
-
-  // Iterate over all the deltas in reverse order
-  UndoManagerType::DList::const_reverse_iterator dit = commit.GetDeltas().rbegin();
-  for(; dit != commit.GetDeltas().rend(); ++dit)
-    {
-    // Apply the changes in the current delta
-    UndoManagerType::Delta *delta = *dit;
-
-    // Iterator for the relevant region in the label image
-    IteratorType lit(imSeg, delta->GetRegion());
-
-    // Iterate over the rles in the delta
-    for(size_t i = 0; i < delta->GetNumberOfRLEs(); i++)
-      {
-      size_t n = delta->GetRLELength(i);
-      LabelType d = delta->GetRLEValue(i);
-      for(size_t j = 0; j < n; j++)
-        {
-        if(d != 0)
-          lit.Set(lit.Get() - d);
-        ++lit;
-        }
-      }
-    }
-
-  // Set modified flags
-  imSeg->Modified();
+  // Subtract the deltas in the undo commit from the image
+  this->ApplyUndoRedoCommit(false);
 }
 
 bool LabelImageWrapper::IsRedoPossible()
@@ -134,32 +130,52 @@ bool LabelImageWrapper::IsRedoPossible()
 
 void LabelImageWrapper::Redo()
 {
-  // Get the commit for the redo
-  const UndoManagerType::Commit &commit = m_UndoManager->GetCommitForRedo();
+  // Add the deltas in the redo commit to the image
+  this->ApplyUndoRedoCommit(true);
+}
 
-  // The label image that will undergo redo
+void LabelImageWrapper::ApplyUndoRedoCommit(bool redo)
+{
+  // Get the commit for the undo or redo
+  const UndoManagerType::Commit &commit = redo
+      ? m_UndoManager->GetCommitForRedo()
+      : m_UndoManager->GetCommitForUndo();
+
+  // The label image that will undergo undo/redo
   typedef itk::ImageRegionIterator<ImageType> IteratorType;
   ImageType *imSeg = this->GetImage();
 
-  // Iterate over all the deltas in reverse order
-  UndoManagerType::DList::const_iterator dit = commit.GetDeltas().begin();
-  for(; dit != commit.GetDeltas().end(); ++dit)
+  // The label counts are updated as the deltas are applied
+  m_LabelCountIndex.BeginIncrementalUpdate();
+
+  // Undo applies the deltas in reverse order, redo in forward order
+  std::vector<UndoManagerType::Delta *> deltas(
+        commit.GetDeltas().begin(), commit.GetDeltas().end());
+  if(!redo)
+    std::reverse(deltas.begin(), deltas.end());
+
+  for(size_t k = 0; k < deltas.size(); k++)
     {
     // Apply the changes in the current delta
-    UndoManagerType::Delta *delta = *dit;
+    UndoManagerType::Delta *delta = deltas[k];
 
     // Iterator for the relevant region in the label image
     IteratorType lit(imSeg, delta->GetRegion());
 
     // Iterate over the rles in the delta
-    for(size_t i = 0; i < delta->GetNumberOfRLEs(); i++)
+    for(UndoManagerDelta::RunIterator rit(delta); !rit.IsAtEnd(); ++rit)
       {
-      size_t n = delta->GetRLELength(i);
-      LabelType d = delta->GetRLEValue(i);
+      size_t n = rit.GetLength();
+      LabelType d = rit.GetValue();
       for(size_t j = 0; j < n; j++)
         {
         if(d != 0)
-          lit.Set(lit.Get() + d);
+          {
+          LabelType l_old = lit.Get();
+          LabelType l_new = redo ? l_old + d : l_old - d;
+          lit.Set(l_new);
+          m_LabelCountIndex.RecordChange(l_old, l_new, lit.GetIndex());
+          }
         ++lit;
         }
       }
@@ -167,6 +183,7 @@ void LabelImageWrapper::Redo()
 
   // Set modified flags
   imSeg->Modified();
+  m_LabelCountIndex.EndIncrementalUpdate();
 }
 
 LabelImageWrapper::UndoManagerDelta *
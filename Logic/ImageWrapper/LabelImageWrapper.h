@@ -3,6 +3,7 @@
 
 #include "ImageWrapperTraits.h"
 #include "ScalarImageWrapper.h"
+#include "LabelCountIndex.h"
 
 template <typename TPixel> class UndoDataManager;
 template <typename TPixel> class UndoDelta;
@@ -70,12 +71,33 @@ public:
   /** Get the undo manager */
   itkGetMacro(UndoManager, const UndoManagerType *)
 
+  /**
+   * Exchange the voxels and the undo history of the label image with those of
+   * an alternate image with the same buffered region, e.g., the classifier
+   * examples kept by SNAPImageData. Only the run buffers of the two images and
+   * the undo managers are exchanged, so this takes constant time, and the
+   * image object itself stays the same. The caller owns the alternate undo
+   * manager. If it is NULL, the label image gets an empty undo history.
+   */
+  void SwapImageContents(ImageType *alt, UndoManagerType *&altUndo);
+
   /** This is not used by the undo system itself, but uses the undo code to
    * store the contents of the image as an undo delta object, which can then
    * be stored in memory compactly. The caller is responsible for deleting the
    * array created in this call. */
   UndoManagerDelta *CompressImage() const;
 
+  /**
+   * Get the index of per-label voxel counts and bounding boxes. The index is
+   * updated incrementally by SegmentationUpdateIterator and by undo/redo, and
+   * rebuilt from the image if it has been modified by other means.
+   */
+  LabelCountIndex *GetLabelCountIndex() { return &m_LabelCountIndex; }
+
+  /** Get the number of voxels with a given label (uses the count index) */
+  unsigned long GetNumberOfVoxelsWithLabel(LabelType label)
+    { return m_LabelCountIndex.GetCount(label); }
+
 protected:
 
   LabelImageWrapper();
@@ -85,6 +107,15 @@ protected:
   // image. These deltas are compressed, allowing us to store a bunch of
   // undo steps with little cost in performance or memory
   UndoManagerType *m_UndoManager;
+
+  // Per-label voxel counts and bounding boxes
+  LabelCountIndex m_LabelCountIndex;
+
+  // Create an undo manager with the default memory budget
+  static UndoManagerType *NewUndoManager();
+
+  // Apply the deltas in the next undo or redo commit to the image
+  void ApplyUndoRedoCommit(bool redo);
 };
 
 #endif // LABELIMAGEWRAPPER_H
@@ -0,0 +1,161 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: NativeBufferKernels.h,v $
+  Language:  C++
+  Date:      $Date: 2010/10/14 16:21:04 $
+  Version:   $Revision: 1.6 $
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#ifndef NATIVEBUFFERKERNELS_H
+#define NATIVEBUFFERKERNELS_H
+
+#include "itkMultiThreader.h"
+#include <algorithm>
+#include <cstddef>
+
+/**
+ * \class NativeBufferKernels
+ * \brief Threaded kernels that scan and convert the flat component buffer of
+ * an image read by GuidedNativeImageIO.
+ *
+ * The buffer is split into one contiguous chunk per thread. Within a chunk,
+ * the loops are written with independent accumulators and no branches that
+ * depend on earlier iterations, so that the compiler can vectorize them.
+ *
+ * The cast is done in place, like CastNativeImage does, so that loading an
+ * image never takes extra memory. Since the output element i overlaps the
+ * input elements near i * sizeof(TOutput) / sizeof(TNative), the buffer is
+ * converted in rounds: the elements converted in parallel in one round are
+ * chosen so that their outputs never overlap the inputs of the same round or
+ * of the rounds that follow. For a conversion to a narrower type the rounds
+ * go up from the start of the buffer and grow geometrically, and for a
+ * conversion to a wider type they go down from the end.
+ */
+template <typename TNative>
+class NativeBufferKernels
+{
+public:
+
+  /** Find the minimum and maximum of a buffer of n > 0 values. If nThreads
+   * is zero, the global default number of threads is used */
+  static void ComputeRange(const TNative *buffer, size_t n,
+                           TNative &vmin, TNative &vmax,
+                           unsigned int nThreads = 0);
+
+  /** Check if every value of the buffer is preserved when rounded to the
+   * type TOutput and cast back */
+  template <typename TOutput>
+  static bool IsExactlyRepresentable(const TNative *buffer, size_t n,
+                                     unsigned int nThreads = 0);
+
+  /** Convert the values of the buffer in place using a functor called as
+   * f(TNative *src, TOutput *trg), which must only access its own element.
+   * The buffer must be large enough to hold n values of the larger type */
+  template <typename TOutput, typename TFunctor>
+  static void CastInPlace(TNative *buffer, size_t n, const TFunctor &f,
+                          unsigned int nThreads = 0);
+
+  /** Same as CastInPlace, but for separate input and output buffers */
+  template <typename TOutput, typename TFunctor>
+  static void Cast(const TNative *input, TOutput *output, size_t n,
+                   const TFunctor &f, unsigned int nThreads = 0);
+
+protected:
+
+  // Number of values below which a buffer is processed by one thread
+  enum { MinimumChunk = 0x10000 };
+
+  // Number of independent accumulators in the reductions
+  enum { Lanes = 8 };
+
+  // Data shared by the threads of the range computation
+  struct RangeData
+  {
+    const TNative *Buffer;
+    size_t Size;
+    TNative Min[ITK_MAX_THREADS], Max[ITK_MAX_THREADS];
+  };
+
+  // Data shared by the threads of the representability check
+  template <typename TOutput> struct RepresentableData
+  {
+    const TNative *Buffer;
+    size_t Size;
+    volatile bool Result;
+  };
+
+  // Data shared by the threads of a cast
+  template <typename TOutput, typename TFunctor> struct CastData
+  {
+    const TNative *Input;
+    TOutput *Output;
+    size_t Begin, End;
+    const TFunctor *Functor;
+  };
+
+  // Get the number of threads to use for n values
+  static unsigned int GetThreadCount(size_t n, unsigned int nThreads);
+
+  // Get the part of [begin, end) processed by a thread
+  static void GetChunk(size_t begin, size_t end, unsigned int thread,
+                       unsigned int nThreads, size_t &cb, size_t &ce);
+
+  // Serial kernels
+  static void RangeKernel(const TNative *p, size_t n, TNative &vmin, TNative &vmax);
+
+  template <typename TOutput>
+  static bool RepresentableKernel(const TNative *p, size_t n);
+
+  template <typename TOutput, typename TFunctor>
+  static void CastKernel(const TNative *src, TOutput *trg, size_t n, TFunctor f);
+
+  // Convert the range [begin, end) of an in-place buffer in parallel
+  template <typename TOutput, typename TFunctor>
+  static void CastRange(TNative *buffer, size_t begin, size_t end,
+                        const TFunctor &f, unsigned int nThreads);
+
+  // Thread callbacks
+  static ITK_THREAD_RETURN_TYPE RangeCallback(void *arg);
+
+  template <typename TOutput>
+  static ITK_THREAD_RETURN_TYPE RepresentableCallback(void *arg);
+
+  template <typename TOutput, typename TFunctor>
+  static ITK_THREAD_RETURN_TYPE CastCallback(void *arg);
+
+  // Run a callback on a number of threads
+  static void Execute(itk::ThreadFunctionType callback,
+                      void *data, unsigned int nThreads);
+};
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "NativeBufferKernels.txx"
+#endif
+
+#endif // NATIVEBUFFERKERNELS_H
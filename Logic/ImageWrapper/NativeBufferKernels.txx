@@ -0,0 +1,363 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: NativeBufferKernels.txx,v $
+  Language:  C++
+  Date:      $Date: 2010/10/14 16:21:04 $
+  Version:   $Revision: 1.11 $
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#ifndef NATIVEBUFFERKERNELS_TXX
+#define NATIVEBUFFERKERNELS_TXX
+
+#include "NativeBufferKernels.h"
+
+template <typename TNative>
+unsigned int
+NativeBufferKernels<TNative>
+::GetThreadCount(size_t n, unsigned int nThreads)
+{
+  if(nThreads == 0)
+    nThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  // Do not bother starting threads for small chunks of data
+  size_t max_useful = std::max((size_t) 1, n / MinimumChunk);
+  return (unsigned int) std::min(std::min((size_t) nThreads, max_useful),
+                                 (size_t) ITK_MAX_THREADS);
+}
+
+template <typename TNative>
+void
+NativeBufferKernels<TNative>
+::GetChunk(size_t begin, size_t end, unsigned int thread,
+           unsigned int nThreads, size_t &cb, size_t &ce)
+{
+  size_t n = end - begin;
+  cb = begin + (n / nThreads) * thread + std::min((size_t) thread, n % nThreads);
+  ce = cb + n / nThreads + (thread < n % nThreads ? 1 : 0);
+}
+
+template <typename TNative>
+void
+NativeBufferKernels<TNative>
+::Execute(itk::ThreadFunctionType callback, void *data, unsigned int nThreads)
+{
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads(nThreads);
+  threader->SetSingleMethod(callback, data);
+  threader->SingleMethodExecute();
+}
+
+/*****************************************************************************
+ * RANGE
+ ****************************************************************************/
+
+template <typename TNative>
+void
+NativeBufferKernels<TNative>
+::RangeKernel(const TNative *p, size_t n, TNative &vmin, TNative &vmax)
+{
+  // Keep a separate minimum and maximum in each lane, so that the loop
+  // carries no dependency between consecutive values
+  TNative lo[Lanes], hi[Lanes];
+  for(int k = 0; k < Lanes; k++)
+    lo[k] = hi[k] = p[0];
+
+  size_t nb = n - n % Lanes;
+  for(size_t i = 0; i < nb; i += Lanes)
+    {
+    for(int k = 0; k < Lanes; k++)
+      {
+      TNative v = p[i + k];
+      lo[k] = (v < lo[k]) ? v : lo[k];
+      hi[k] = (v > hi[k]) ? v : hi[k];
+      }
+    }
+
+  for(size_t i = nb; i < n; i++)
+    {
+    TNative v = p[i];
+    lo[0] = (v < lo[0]) ? v : lo[0];
+    hi[0] = (v > hi[0]) ? v : hi[0];
+    }
+
+  vmin = lo[0]; vmax = hi[0];
+  for(int k = 1; k < Lanes; k++)
+    {
+    if(lo[k] < vmin) vmin = lo[k];
+    if(hi[k] > vmax) vmax = hi[k];
+    }
+}
+
+template <typename TNative>
+ITK_THREAD_RETURN_TYPE
+NativeBufferKernels<TNative>
+::RangeCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  RangeData *data = static_cast<RangeData *>(info->UserData);
+
+  size_t cb, ce;
+  GetChunk(0, data->Size, info->ThreadID, info->NumberOfThreads, cb, ce);
+  RangeKernel(data->Buffer + cb, ce - cb, data->Min[info->ThreadID], data->Max[info->ThreadID]);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <typename TNative>
+void
+NativeBufferKernels<TNative>
+::ComputeRange(const TNative *buffer, size_t n,
+               TNative &vmin, TNative &vmax, unsigned int nThreads)
+{
+  unsigned int nt = GetThreadCount(n, nThreads);
+  if(nt == 1)
+    {
+    RangeKernel(buffer, n, vmin, vmax);
+    return;
+    }
+
+  RangeData data;
+  data.Buffer = buffer;
+  data.Size = n;
+  Execute(&RangeCallback, &data, nt);
+
+  // Combine the ranges of the threads
+  vmin = data.Min[0]; vmax = data.Max[0];
+  for(unsigned int t = 1; t < nt; t++)
+    {
+    if(data.Min[t] < vmin) vmin = data.Min[t];
+    if(data.Max[t] > vmax) vmax = data.Max[t];
+    }
+}
+
+/*****************************************************************************
+ * REPRESENTABILITY
+ ****************************************************************************/
+
+template <typename TNative>
+template <typename TOutput>
+bool
+NativeBufferKernels<TNative>
+::RepresentableKernel(const TNative *p, size_t n)
+{
+  // Accumulate mismatches without branching. This uses the same expression
+  // as the original test of whether floating point data is really integer
+  bool mismatch = false;
+  for(size_t i = 0; i < n; i++)
+    {
+    TNative v = p[i];
+    mismatch |= (v != static_cast<TNative>(static_cast<TOutput>(v + 0.5)));
+    }
+  return !mismatch;
+}
+
+template <typename TNative>
+template <typename TOutput>
+ITK_THREAD_RETURN_TYPE
+NativeBufferKernels<TNative>
+::RepresentableCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  RepresentableData<TOutput> *data =
+      static_cast<RepresentableData<TOutput> *>(info->UserData);
+
+  size_t cb, ce;
+  GetChunk(0, data->Size, info->ThreadID, info->NumberOfThreads, cb, ce);
+
+  // Check in blocks, stopping as soon as any thread finds a mismatch
+  for(size_t b = cb; b < ce && data->Result; b += MinimumChunk)
+    {
+    if(!RepresentableKernel<TOutput>(data->Buffer + b, std::min(ce - b, (size_t) MinimumChunk)))
+      data->Result = false;
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <typename TNative>
+template <typename TOutput>
+bool
+NativeBufferKernels<TNative>
+::IsExactlyRepresentable(const TNative *buffer, size_t n, unsigned int nThreads)
+{
+  RepresentableData<TOutput> data;
+  data.Buffer = buffer;
+  data.Size = n;
+  data.Result = true;
+
+  unsigned int nt = GetThreadCount(n, nThreads);
+  if(nt == 1)
+    {
+    itk::MultiThreader::ThreadInfoStruct info;
+    info.ThreadID = 0;
+    info.NumberOfThreads = 1;
+    info.UserData = &data;
+    RepresentableCallback<TOutput>(&info);
+    }
+  else
+    {
+    Execute(&RepresentableCallback<TOutput>, &data, nt);
+    }
+
+  return data.Result;
+}
+
+/*****************************************************************************
+ * CAST
+ ****************************************************************************/
+
+template <typename TNative>
+template <typename TOutput, typename TFunctor>
+void
+NativeBufferKernels<TNative>
+::CastKernel(const TNative *src, TOutput *trg, size_t n, TFunctor f)
+{
+  // The functors take non-const pointers, but do not modify the input
+  TNative *p = const_cast<TNative *>(src);
+  for(size_t i = 0; i < n; i++)
+    f(p + i, trg + i);
+}
+
+template <typename TNative>
+template <typename TOutput, typename TFunctor>
+ITK_THREAD_RETURN_TYPE
+NativeBufferKernels<TNative>
+::CastCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  CastData<TOutput, TFunctor> *data =
+      static_cast<CastData<TOutput, TFunctor> *>(info->UserData);
+
+  size_t cb, ce;
+  GetChunk(data->Begin, data->End, info->ThreadID, info->NumberOfThreads, cb, ce);
+  CastKernel<TOutput, TFunctor>(data->Input + cb, data->Output + cb, ce - cb, *data->Functor);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <typename TNative>
+template <typename TOutput, typename TFunctor>
+void
+NativeBufferKernels<TNative>
+::Cast(const TNative *input, TOutput *output, size_t n,
+       const TFunctor &f, unsigned int nThreads)
+{
+  unsigned int nt = GetThreadCount(n, nThreads);
+  if(nt == 1)
+    {
+    CastKernel<TOutput, TFunctor>(input, output, n, f);
+    return;
+    }
+
+  CastData<TOutput, TFunctor> data;
+  data.Input = input;
+  data.Output = output;
+  data.Begin = 0;
+  data.End = n;
+  data.Functor = &f;
+  Execute(&CastCallback<TOutput, TFunctor>, &data, nt);
+}
+
+template <typename TNative>
+template <typename TOutput, typename TFunctor>
+void
+NativeBufferKernels<TNative>
+::CastRange(TNative *buffer, size_t begin, size_t end,
+            const TFunctor &f, unsigned int nThreads)
+{
+  TOutput *output = reinterpret_cast<TOutput *>(buffer);
+  unsigned int nt = GetThreadCount(end - begin, nThreads);
+  if(nt == 1)
+    {
+    CastKernel<TOutput, TFunctor>(buffer + begin, output + begin, end - begin, f);
+    return;
+    }
+
+  CastData<TOutput, TFunctor> data;
+  data.Input = buffer;
+  data.Output = output;
+  data.Begin = begin;
+  data.End = end;
+  data.Functor = &f;
+  Execute(&CastCallback<TOutput, TFunctor>, &data, nt);
+}
+
+template <typename TNative>
+template <typename TOutput, typename TFunctor>
+void
+NativeBufferKernels<TNative>
+::CastInPlace(TNative *buffer, size_t n, const TFunctor &f, unsigned int nThreads)
+{
+  const size_t sn = sizeof(TNative), st = sizeof(TOutput);
+  TOutput *output = reinterpret_cast<TOutput *>(buffer);
+  TFunctor fs = f;
+
+  if(st == sn)
+    {
+    // Each output occupies exactly the bytes of its own input
+    CastRange<TOutput, TFunctor>(buffer, 0, n, f, nThreads);
+    }
+  else if(st < sn)
+    {
+    // Convert a head of the buffer serially in ascending order. After that,
+    // a round [a, b) may run in parallel as long as its outputs end before
+    // its inputs begin, i.e., b * st <= a * sn
+    size_t a = std::min(n, (size_t) MinimumChunk);
+    for(size_t i = 0; i < a; i++)
+      fs(buffer + i, output + i);
+
+    while(a < n)
+      {
+      size_t b = std::max(a + 1, std::min(n, (a * sn) / st));
+      CastRange<TOutput, TFunctor>(buffer, a, b, f, nThreads);
+      a = b;
+      }
+    }
+  else
+    {
+    // Go down from the end of the buffer. A round [a, b) may run in parallel
+    // if its outputs begin after its inputs end, i.e., a * st >= b * sn
+    size_t b = n, h = std::min(n, (size_t) MinimumChunk);
+    while(b > h)
+      {
+      size_t a = std::max(h, std::min(b - 1, (b * sn + st - 1) / st));
+      CastRange<TOutput, TFunctor>(buffer, a, b, f, nThreads);
+      b = a;
+      }
+
+    // Convert the rest serially in descending order
+    for(size_t i = b; i > 0; i--)
+      fs(buffer + i - 1, output + i - 1);
+    }
+}
+
+#endif // NATIVEBUFFERKERNELS_TXX
@@ -41,6 +41,26 @@ ScalarImageHistogram
   m_TotalSamples = 0;
 }
 
+void
+ScalarImageHistogram
+::AddSamples(double v, unsigned long n)
+{
+  unsigned long k = (m_Bins[this->GetBinIndex(v)] += n);
+  m_MaxFrequency = std::max(m_MaxFrequency, k);
+  m_TotalSamples += n;
+}
+
+void
+ScalarImageHistogram
+::InitializeFromHistogram(const Self &source, double vmin, double vmax, size_t nBins)
+{
+  this->Initialize(vmin, vmax, nBins);
+  for(size_t i = 0; i < source.m_Bins.size(); i++)
+    {
+    if(source.m_Bins[i])
+      this->AddSamples(source.GetBinCenter(i), source.m_Bins[i]);
+    }
+}
 
 double
 ScalarImageHistogram
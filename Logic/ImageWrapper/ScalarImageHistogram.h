@@ -18,6 +18,20 @@ public:
 
   void Initialize(double vmin, double vmax, size_t nBins);
   void AddSample(double v);
+
+  /** Add n samples with the same value */
+  void AddSamples(double v, unsigned long n);
+
+  /**
+   * Initialize the histogram with the given range and number of bins, and
+   * fill it from the bins of another (finer) histogram, without revisiting
+   * the samples. The count of each bin of the source histogram is added to
+   * the bin that contains its center. The result is exactly what adding the
+   * samples would have given when each bin of the source histogram holds a
+   * single value, e.g., one bin per value of an integer image.
+   */
+  void InitializeFromHistogram(const Self &source,
+                               double vmin, double vmax, size_t nBins);
   double GetBinMin(size_t iBin) const;
   double GetBinMax(size_t iBin) const;
   double GetBinCenter(size_t iBin) const;
@@ -59,6 +73,9 @@ protected:
   ScalarImageHistogram();
   virtual ~ScalarImageHistogram();
 
+  // Bin into which a sample falls, with clamping to the first and last bins
+  int GetBinIndex(double v) const;
+
   std::vector<unsigned long> m_Bins;
 
   double m_FirstBinStart, m_BinWidth, m_Scale;
@@ -67,7 +84,7 @@ protected:
 
 };
 
-inline void ScalarImageHistogram::AddSample(double v)
+inline int ScalarImageHistogram::GetBinIndex(double v) const
 {
   int index = (int) (m_Scale * (v - m_FirstBinStart));
 
@@ -76,7 +93,12 @@ inline void ScalarImageHistogram::AddSample(double v)
   else if(index >= m_BinCount)
     index = m_BinCount - 1;
 
-  unsigned long k = ++m_Bins[index];
+  return index;
+}
+
+inline void ScalarImageHistogram::AddSample(double v)
+{
+  unsigned long k = ++m_Bins[this->GetBinIndex(v)];
 
   // Update total, max frequency
   if(m_MaxFrequency < k)
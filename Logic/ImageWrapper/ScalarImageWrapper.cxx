@@ -392,6 +392,27 @@ ScalarImageWrapper<TTraits, TBase>
     }
 }
 
+template<class TTraits, class TBase>
+void
+ScalarImageWrapper<TTraits, TBase>
+::GetRunLengthIntensities(
+    const itk::ImageRegion<3> &region,
+    const itk::Index<3> &startIdx, long runlength,
+    double *out) const
+{
+  if(this->IsSlicingOrthogonal())
+    {
+    ConstIterator it(this->m_Image, region);
+    it.SetIndex(startIdx);
+    for(long q = 0; q < runlength; q++, ++it)
+      out[q] = (double) it.Get();
+    }
+  else
+    {
+    std::fill(out, out + runlength, nan(""));
+    }
+}
+
 /**
   Get the RGBA apperance of the voxel at the intersection of the three
   display slices.
@@ -185,6 +185,13 @@ public:
       const itk::Index<3> &startIdx, long runlength,
       double *out_sum, double *out_sumsq) const ITK_OVERRIDE;
 
+  /** Copy the intensities of a run of voxels starting at startIdx into an
+   * array, in internal (not native mapped) format */
+  virtual void GetRunLengthIntensities(
+      const itk::ImageRegion<3> &region,
+      const itk::Index<3> &startIdx, long runlength,
+      double *out) const ITK_OVERRIDE;
+
   /**
    * This method returns a vector of values for the voxel under the cursor.
    * This is the natural value or set of values that should be displayed to
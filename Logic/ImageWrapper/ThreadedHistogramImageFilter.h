@@ -11,8 +11,14 @@
  * uses threading for faster histogram computation. It also is meant to be
  * used with the itk::MinimumMaximumImageFilter to avoid an extra pass for
  * determining the range of the histogram. The histogram in this filter is
- * constructed from equal size bins between the input min and max, and the
- * number of bins is a power of two.
+ * constructed from equal size bins between the input min and max.
+ *
+ * The voxels are not counted into the output histogram directly. Instead,
+ * the filter keeps a fine base histogram of the image (one bin per value for
+ * integer images, BaseBinsForFloat bins otherwise), and the output is derived
+ * from it. Changing the number of bins or the intensity transform therefore
+ * does not touch the voxels. The image is only rescanned when it, or its
+ * range, has changed since the base histogram was built.
  */
 template <class TInputImage>
 class ThreadedHistogramImageFilter :
@@ -81,6 +87,9 @@ public:
    */
   HistogramType *GetHistogramOutput() const { return m_OutputHistogram; }
 
+  /** Number of bins in the base histogram of non-integer images */
+  itkStaticConstMacro(BaseBinsForFloat, unsigned int, 16384);
+
 protected:
 
   ThreadedHistogramImageFilter();
@@ -91,6 +100,9 @@ protected:
     AllocateOutputs method. */
   void AllocateOutputs() ITK_OVERRIDE;
 
+  /** Rebuild the base histogram if needed, and derive the output from it */
+  void GenerateData() ITK_OVERRIDE;
+
   /** Initialize some accumulators before the threads run. */
   void BeforeThreadedGenerateData() ITK_OVERRIDE;
 
@@ -113,6 +125,12 @@ private:
   ThreadedHistogramImageFilter(const Self &); //purposely not implemented
   void operator=(const Self &);               //purposely not implemented
 
+  // Whether the base histogram reflects the current input and range
+  bool IsBaseHistogramCurrent() const;
+
+  // Initialize a histogram with the base histogram parameters for the range
+  void InitializeBaseHistogram(HistogramType *hist, PixelType pxmin, PixelType pxmax) const;
+
   // Inputs
   SmartPtr<PixelObjectType> m_InputMin, m_InputMax;
 
@@ -122,9 +140,17 @@ private:
   // Intensity transform
   double m_TransformScale, m_TransformShift;
 
-  // Per-thread histograms
+  // Per-thread histograms, kept between updates
   std::vector< HistogramPointer > m_ThreadHistogram;
 
+  // The base histogram, and the input, its modification time and the range
+  // for which it was computed
+  HistogramPointer m_BaseHistogram;
+  const InputImageType *m_BaseImage;
+  itk::ModifiedTimeType m_BaseImageMTime;
+  PixelType m_BaseMin, m_BaseMax;
+  bool m_BaseValid;
+
   // The output histogram
   HistogramPointer m_OutputHistogram;
 };
@@ -19,6 +19,11 @@ ThreadedHistogramImageFilter<TInputImage>
   m_Bins = 0;
   m_TransformScale = 1.0;
   m_TransformShift = 0.0;
+
+  m_BaseImage = NULL;
+  m_BaseImageMTime = 0;
+  m_BaseMin = m_BaseMax = 0;
+  m_BaseValid = false;
 }
 
 template <class TInputImage>
@@ -94,6 +99,53 @@ ThreadedHistogramImageFilter<TInputImage>
   // Nothing to be done for the histogram output
 }
 
+template <class TInputImage>
+void
+ThreadedHistogramImageFilter<TInputImage>
+::InitializeBaseHistogram(HistogramType *hist, PixelType pxmin, PixelType pxmax) const
+{
+  // For integer images with a moderate range, use one bin per value, so that
+  // histograms with fewer bins can be derived exactly. The bins are centered
+  // on the values
+  double range = (double) pxmax - (double) pxmin;
+  if(itk::NumericTraits<PixelType>::is_integer && range < 0x10000)
+    hist->Initialize(pxmin - 0.5, pxmax + 0.5, (size_t) range + 1);
+  else
+    hist->Initialize(pxmin, pxmax, BaseBinsForFloat);
+}
+
+template <class TInputImage>
+bool
+ThreadedHistogramImageFilter<TInputImage>
+::IsBaseHistogramCurrent() const
+{
+  const InputImageType *image = this->GetInput();
+  return m_BaseValid
+      && image == m_BaseImage
+      && image->GetMTime() <= m_BaseImageMTime
+      && m_InputMin->Get() == m_BaseMin
+      && m_InputMax->Get() == m_BaseMax;
+}
+
+template <class TInputImage>
+void
+ThreadedHistogramImageFilter<TInputImage>
+::GenerateData()
+{
+  // Only scan the image if the base histogram is out of date
+  if(this->IsBaseHistogramCurrent())
+    this->AllocateOutputs();
+  else
+    Superclass::GenerateData();
+
+  // Derive the output histogram from the base histogram
+  m_OutputHistogram->InitializeFromHistogram(
+        *m_BaseHistogram, m_InputMin->Get(), m_InputMax->Get(), m_Bins);
+
+  // Apply the transform to the histogram
+  m_OutputHistogram->ApplyIntensityTransform(m_TransformScale, m_TransformShift);
+}
+
 template <class TInputImage>
 void
 ThreadedHistogramImageFilter<TInputImage>
@@ -105,16 +157,21 @@ ThreadedHistogramImageFilter<TInputImage>
   PixelType pxmin = m_InputMin->Get();
   PixelType pxmax = m_InputMax->Get();
 
-  // Initialize the per-thread histograms
+  // Initialize the per-thread histograms. These are only allocated the first
+  // time, after that Initialize() reuses their storage
   m_ThreadHistogram.resize(numberOfThreads);
   for(unsigned int i = 0; i < numberOfThreads; i++)
     {
-    m_ThreadHistogram[i] = HistogramType::New();
-    m_ThreadHistogram[i]->Initialize(pxmin, pxmax, m_Bins);
+    if(!m_ThreadHistogram[i])
+      m_ThreadHistogram[i] = HistogramType::New();
+    this->InitializeBaseHistogram(m_ThreadHistogram[i], pxmin, pxmax);
     }
 
-  // Initialize the output
-  m_OutputHistogram->Initialize(pxmin, pxmax, m_Bins);
+  // Initialize the base histogram
+  if(!m_BaseHistogram)
+    m_BaseHistogram = HistogramType::New();
+  this->InitializeBaseHistogram(m_BaseHistogram, pxmin, pxmax);
+  m_BaseValid = false;
 }
 
 template< class TInputImage >
@@ -145,11 +202,15 @@ ThreadedHistogramImageFilter<TInputImage>
   // Add up the partial histograms
   for(unsigned int i = 0; i < m_ThreadHistogram.size(); i++)
     {
-    m_OutputHistogram->AddCompatibleHistogram(*m_ThreadHistogram[i]);
+    m_BaseHistogram->AddCompatibleHistogram(*m_ThreadHistogram[i]);
     }
 
-  // Apply the transform to the histogram
-  m_OutputHistogram->ApplyIntensityTransform(m_TransformScale, m_TransformShift);
+  // Record what the base histogram was computed for
+  m_BaseImage = this->GetInput();
+  m_BaseImageMTime = m_BaseImage->GetMTime();
+  m_BaseMin = m_InputMin->Get();
+  m_BaseMax = m_InputMax->Get();
+  m_BaseValid = true;
 }
 
 template< class TInputImage >
@@ -105,6 +105,32 @@ VectorImageWrapper<TTraits, TBase>
     }
 }
 
+template<class TTraits, class TBase>
+void
+VectorImageWrapper<TTraits, TBase>
+::GetRunLengthIntensities(
+    const itk::ImageRegion<3> &region,
+    const itk::Index<3> &startIdx, long runlength,
+    double *out) const
+{
+  size_t nc = this->GetNumberOfComponents();
+  if(this->IsSlicingOrthogonal())
+    {
+    ConstIterator it(this->m_Image, region);
+    it.SetIndex(startIdx);
+    for(long q = 0; q < runlength; q++, ++it)
+      {
+      PixelType p = it.Get();
+      for(size_t c = 0; c < nc; c++)
+        *out++ = (double) p[c];
+      }
+    }
+  else
+    {
+    std::fill(out, out + runlength * nc, nan(""));
+    }
+}
+
 template<class TTraits, class TBase>
 void
 VectorImageWrapper<TTraits,TBase>
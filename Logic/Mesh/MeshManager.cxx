@@ -157,6 +157,9 @@ MeshManager
     // Make sure the pipeline has the right image
     pipeline->SetImage(wrapper->GetImage());
 
+    // Let the pipeline find the changed labels using the layer's index
+    pipeline->SetLabelCountIndex(wrapper->GetLabelCountIndex());
+
       // Pass the options to the pipeline
     pipeline->SetMeshOptions(m_GlobalState->GetMeshOptions());
 
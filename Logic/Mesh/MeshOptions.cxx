@@ -74,6 +74,12 @@ MeshOptions
     NewSimpleProperty("MeshSmoothingFeatureEdgeSmoothing", false);
   m_MeshSmoothingBoundarySmoothingModel = 
     NewSimpleProperty("MeshSmoothingBoundarySmoothing", false);
+
+  // Begin discrete extraction params
+  m_UseDiscreteSurfaceExtractionModel =
+    NewSimpleProperty("UseDiscreteSurfaceExtraction", false);
+  m_DiscreteSmoothingIterationsModel =
+    NewRangedProperty("DiscreteSmoothingIterations", 10u,0u,100u,1u);
 }
 
 /*
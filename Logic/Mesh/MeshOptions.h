@@ -69,6 +69,12 @@ public:
   irisSimplePropertyAccessMacro(MeshSmoothingFeatureEdgeSmoothing,bool)
   irisSimplePropertyAccessMacro(MeshSmoothingBoundarySmoothing,bool)
 
+  // Discrete surface extraction properties. When enabled, the surfaces of
+  // all labels are extracted in one pass by MultiLabelSurfaceExtractor, and
+  // the Gaussian smoothing options are replaced by its constrained smoothing
+  irisSimplePropertyAccessMacro(UseDiscreteSurfaceExtraction,bool)
+  irisRangedPropertyAccessMacro(DiscreteSmoothingIterations,unsigned int)
+
 protected:
   MeshOptions();
 
@@ -95,6 +101,10 @@ private:
   SmartPtr<ConcreteRangedFloatProperty> m_MeshSmoothingFeatureAngleModel;
   SmartPtr<ConcreteSimpleBooleanProperty> m_MeshSmoothingFeatureEdgeSmoothingModel;
   SmartPtr<ConcreteSimpleBooleanProperty> m_MeshSmoothingBoundarySmoothingModel;
+
+  // Begin discrete extraction params
+  SmartPtr<ConcreteSimpleBooleanProperty> m_UseDiscreteSurfaceExtractionModel;
+  SmartPtr<ConcreteRangedUIntProperty> m_DiscreteSmoothingIterationsModel;
 };
 
 #endif // __MeshOptions_h_
@@ -44,9 +44,29 @@
 #include "IRISVectorTypesToITKConversion.h"
 #include "VTKMeshPipeline.h"
 #include "MeshOptions.h"
+#include "MultiLabelSurfaceExtractor.h"
+#include "RLEImageOperations.h"
+#include "AllPurposeProgressAccumulator.h"
+#include "IRISException.h"
+#include "LabelCountIndex.h"
 
 // ITK includes
 #include "itkBinaryThresholdImageFilter.h"
+#include "itkFastMutexLock.h"
+#include "itkSimpleFastMutexLock.h"
+
+// VTK includes
+#include <vtkDecimatePro.h>
+#include <vtkSmoothPolyDataFilter.h>
+#include <vtkPolyDataNormals.h>
+#include <vtkCellData.h>
+#include <vtkPointData.h>
+#include <vtkIntArray.h>
+#include <vtkIdTypeArray.h>
+#include <vtkIdList.h>
+
+#include <algorithm>
+#include <functional>
 
 using namespace std;
 
@@ -72,12 +92,24 @@ MultiLabelMeshPipeline
   // Set the initial mesh options
   m_MeshOptions = MeshOptions::New();
   m_VTKPipeline->SetMeshOptions(m_MeshOptions);
+
+  // Set up the threading. The worker pipelines are created on demand
+  m_Threader = itk::MultiThreader::New();
+  m_NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  // The single pass surface extractor
+  m_SurfaceExtractor = MultiLabelSurfaceExtractor::New();
+
+  // Changes are tracked by checksums until an index is provided
+  m_LabelCountIndex = NULL;
 }
 
 MultiLabelMeshPipeline
 ::~MultiLabelMeshPipeline()
 {
   delete m_VTKPipeline;
+  for(size_t i = 0; i < m_Workers.size(); i++)
+    delete m_Workers[i].Pipeline;
 }
 
 void
@@ -92,6 +124,8 @@ MultiLabelMeshPipeline
 
     // Apply the options to the internal pipeline
     m_VTKPipeline->SetMeshOptions(m_MeshOptions);
+    for(size_t i = 0; i < m_Workers.size(); i++)
+      m_Workers[i].Pipeline->SetMeshOptions(m_MeshOptions);
 
     // Clear the cached stuff
     m_MeshInfo.clear();
@@ -200,7 +234,7 @@ void MultiLabelMeshPipeline::UpdateMeshInfoHelper(
   current_meshinfo->Count += run_length;
 }
 
-void MultiLabelMeshPipeline::UpdateMeshes(itk::Command *progressCommand)
+void MultiLabelMeshPipeline::FindDirtyLabelsByChecksum(std::vector<LabelType> &dirty)
 {
   // Create a temporary table of mesh info
   MeshInfoMap meshmap;
@@ -257,11 +291,6 @@ void MultiLabelMeshPipeline::UpdateMeshes(itk::Command *progressCommand)
       it++;
     }
 
-
-  // Deal with progress accumulation
-  SmartPtr<AllPurposeProgressAccumulator> progress = AllPurposeProgressAccumulator::New();
-  progress->AddObserver(itk::ProgressEvent(), progressCommand);
-
   // Next we check which meshes are new or updated and mark them as needing to
   // be recomputed
   for(MeshInfoMap::const_iterator it = meshmap.begin(); it != meshmap.end(); ++it)
@@ -278,51 +307,97 @@ void MultiLabelMeshPipeline::UpdateMeshes(itk::Command *progressCommand)
       info.BoundingBox[0] = it->second.BoundingBox[0];
       info.BoundingBox[1] = it->second.BoundingBox[1];
       info.Mesh = NULL;
-
-      // Capture progress from this mesh
-      progress->RegisterSource(m_VTKPipeline->GetProgressAccumulator(), info.Count);
+      dirty.push_back(it->first);
       }
     }
+}
 
-  // Now compute the meshes
-  for(MeshInfoMap::iterator it = m_MeshInfo.begin(); it != m_MeshInfo.end(); it++)
+void MultiLabelMeshPipeline::FindDirtyLabelsFromIndex(
+    std::vector<LabelType> &dirty, SlabMap &slabs)
+{
+  // Get the regions changed since the last update. If the index was unable
+  // to track all the changes, every label must be recomputed
+  std::map<LabelType, itk::ImageRegion<3> > changes;
+  bool complete = m_LabelCountIndex->ConsumeDirtyRegions(changes);
+
+  // Remove the meshes for labels that are no longer present
+  for(MeshInfoMap::iterator it = m_MeshInfo.begin(); it != m_MeshInfo.end();)
     {
-    if(it->second.Mesh == NULL)
-      {
-      // Create the mesh
-      MeshInfo &mi = it->second;
-      mi.Mesh = vtkSmartPointer<vtkPolyData>::New();
+    if(m_LabelCountIndex->GetCount(it->first) == 0)
+      m_MeshInfo.erase(it++);
+    else
+      it++;
+    }
 
-      // TODO: make this more elegant
-      InputImageType::RegionType bbWiderRegion;
-      for(int d = 0; d < 3; d++)
+  // Parts of large meshes can only be replaced if they come from the
+  // discrete extractor and have not been altered by post-processing
+  bool use_slabs = m_MeshOptions->GetUseDiscreteSurfaceExtraction()
+      && !m_MeshOptions->GetUseDecimation()
+      && !m_MeshOptions->GetUseMeshSmoothing();
+  long margin = this->GetDiscreteSlabMargin();
+
+  std::vector<LabelType> present = m_LabelCountIndex->GetLabelsPresent();
+  for(size_t i = 0; i < present.size(); i++)
+    {
+    LabelType label = present[i];
+    if(label == 0)
+      continue;
+
+    // Meshes that have not changed are kept. New labels have no mesh yet
+    MeshInfo &info = m_MeshInfo[label];
+    std::map<LabelType, itk::ImageRegion<3> >::const_iterator itc = changes.find(label);
+    if(complete && info.Mesh && itc == changes.end())
+      continue;
+
+    // Update the cached information from the index
+    itk::ImageRegion<3> bbox = m_LabelCountIndex->GetBoundingBox(label);
+    info.Count = m_LabelCountIndex->GetCount(label);
+    info.BoundingBox[0] = Vector3i(bbox.GetIndex());
+    info.BoundingBox[1] = Vector3i(bbox.GetUpperIndex());
+    dirty.push_back(label);
+
+    // The faces affected by the change are within 'margin' slices of it, and
+    // UpdateDiscreteMeshSlab extracts the same margin around these faces. If
+    // that window is small relative to the mesh, only the slab is extracted
+    // again
+    if(use_slabs && complete && info.Mesh && itc != changes.end())
+      {
+      long s0 = itc->second.GetIndex(2) - margin;
+      long s1 = itc->second.GetUpperIndex()[2] + margin;
+      long window = (s1 - s0 + 1) + 2 * margin;
+      if(2 * window < (long) bbox.GetSize(2))
         {
-        unsigned long len =
-            (unsigned long) (1 + mi.BoundingBox[1][d] - mi.BoundingBox[0][d]);
-        bbWiderRegion.SetIndex(d, mi.BoundingBox[0][d]);
-        bbWiderRegion.SetSize(d, len);
+        slabs[label] = std::make_pair(s0, s1);
+        continue;
         }
-      bbWiderRegion.PadByRadius(5);
-      bbWiderRegion.Crop(m_InputImage->GetLargestPossibleRegion());
+      }
 
-      // Pass the region to the ROI filter and propagate the filter
-      m_ROIFilter->SetInput(m_InputImage);
-      m_ROIFilter->SetRegionOfInterest(bbWiderRegion);
-      m_ROIFilter->Update();
+    info.Mesh = NULL;
+    }
+}
 
-      // Set the parameters for the thresholding filter
-      m_ThrehsoldFilter->SetLowerThreshold(it->first);
-      m_ThrehsoldFilter->SetUpperThreshold(it->first);
-      m_ThrehsoldFilter->UpdateLargestPossibleRegion();
+void MultiLabelMeshPipeline::UpdateMeshes(itk::Command *progressCommand)
+{
+  // Determine which labels need to be recomputed, and for which of them only
+  // a slab of the mesh has to be extracted again
+  std::vector<LabelType> dirty;
+  SlabMap slabs;
+  if(m_LabelCountIndex)
+    this->FindDirtyLabelsFromIndex(dirty, slabs);
+  else
+    this->FindDirtyLabelsByChecksum(dirty);
 
-      // Graft the polydata to the last filter in the pipeline
-      m_VTKPipeline->SetImage(m_ThrehsoldFilter->GetOutput());
-      m_VTKPipeline->ComputeMesh(it->second.Mesh);
+  // Deal with progress accumulation
+  SmartPtr<AllPurposeProgressAccumulator> progress = AllPurposeProgressAccumulator::New();
+  progress->AddObserver(itk::ProgressEvent(), progressCommand);
 
-      // Update progress
-      progress->StartNextRun(m_VTKPipeline->GetProgressAccumulator());
-      }
-    }
+  // Now compute the meshes, in parallel if there is more than one to compute
+  if(m_MeshOptions->GetUseDiscreteSurfaceExtraction())
+    this->ComputeMeshesDiscrete(dirty, slabs, progress);
+  else if(m_NumberOfThreads > 1 && dirty.size() > 1)
+    this->ComputeMeshesParallel(dirty, progress);
+  else
+    this->ComputeMeshesSequential(dirty, progress);
 
   // Clean up the progress
   progress->UnregisterAllSources();
@@ -331,6 +406,449 @@ void MultiLabelMeshPipeline::UpdateMeshes(itk::Command *progressCommand)
   this->Modified();
 }
 
+MultiLabelMeshPipeline::InputImageType::RegionType
+MultiLabelMeshPipeline
+::GetMeshRegion(const MeshInfo &mi) const
+{
+  // TODO: make this more elegant
+  InputImageType::RegionType bbWiderRegion;
+  for(int d = 0; d < 3; d++)
+    {
+    unsigned long len =
+        (unsigned long) (1 + mi.BoundingBox[1][d] - mi.BoundingBox[0][d]);
+    bbWiderRegion.SetIndex(d, mi.BoundingBox[0][d]);
+    bbWiderRegion.SetSize(d, len);
+    }
+  bbWiderRegion.PadByRadius(5);
+  bbWiderRegion.Crop(m_InputImage->GetLargestPossibleRegion());
+  return bbWiderRegion;
+}
+
+void
+MultiLabelMeshPipeline
+::ComputeMeshesSequential(
+    const std::vector<LabelType> &labels, AllPurposeProgressAccumulator *progress)
+{
+  // Capture progress from each mesh
+  for(size_t i = 0; i < labels.size(); i++)
+    progress->RegisterSource(m_VTKPipeline->GetProgressAccumulator(),
+                             m_MeshInfo[labels[i]].Count);
+
+  for(size_t i = 0; i < labels.size(); i++)
+    {
+    // Create the mesh
+    MeshInfo &mi = m_MeshInfo[labels[i]];
+    mi.Mesh = vtkSmartPointer<vtkPolyData>::New();
+
+    // Pass the region to the ROI filter and propagate the filter
+    m_ROIFilter->SetInput(m_InputImage);
+    m_ROIFilter->SetRegionOfInterest(this->GetMeshRegion(mi));
+    m_ROIFilter->Update();
+
+    // Set the parameters for the thresholding filter
+    m_ThrehsoldFilter->SetLowerThreshold(labels[i]);
+    m_ThrehsoldFilter->SetUpperThreshold(labels[i]);
+    m_ThrehsoldFilter->UpdateLargestPossibleRegion();
+
+    // Graft the polydata to the last filter in the pipeline
+    m_VTKPipeline->SetImage(m_ThrehsoldFilter->GetOutput());
+    m_VTKPipeline->ComputeMesh(mi.Mesh);
+
+    // Update progress
+    progress->StartNextRun(m_VTKPipeline->GetProgressAccumulator());
+    }
+}
+
+void
+MultiLabelMeshPipeline
+::ComputeMeshesDiscrete(
+    const std::vector<LabelType> &labels, const SlabMap &slabs,
+    AllPurposeProgressAccumulator *progress)
+{
+  // Split the labels into those that are extracted in full, in one pass,
+  // and those for which only a slab is extracted
+  std::vector<LabelType> full;
+  itk::ImageRegion<3> full_region;
+  for(size_t i = 0; i < labels.size(); i++)
+    {
+    if(slabs.find(labels[i]) != slabs.end())
+      continue;
+
+    // Sweep the lines around the union of the bounding boxes
+    InputImageType::RegionType region = this->GetMeshRegion(m_MeshInfo[labels[i]]);
+    if(full.empty())
+      {
+      full_region = region;
+      }
+    else
+      {
+      InputImageType::IndexType lower, upper;
+      for(int d = 0; d < 3; d++)
+        {
+        lower[d] = std::min(full_region.GetIndex(d), region.GetIndex(d));
+        upper[d] = std::max(full_region.GetUpperIndex()[d], region.GetUpperIndex()[d]);
+        }
+      full_region.SetIndex(lower);
+      full_region.SetUpperIndex(upper);
+      }
+    full.push_back(labels[i]);
+    }
+
+  if(full.size())
+    {
+    // Extract the surfaces of all the labels in one pass
+    m_SurfaceExtractor->SetImage(m_InputImage);
+    m_SurfaceExtractor->SetLabels(full);
+    m_SurfaceExtractor->SetRegion(full_region);
+    m_SurfaceExtractor->SetSmoothingIterations(
+          m_MeshOptions->GetDiscreteSmoothingIterations());
+    m_SurfaceExtractor->Update(progress);
+
+    // Post-process the meshes and store them
+    const MultiLabelSurfaceExtractor::MeshCollection &meshes =
+        m_SurfaceExtractor->GetMeshes();
+    for(size_t i = 0; i < full.size(); i++)
+      {
+      MeshInfo &mi = m_MeshInfo[full[i]];
+      mi.Mesh = vtkSmartPointer<vtkPolyData>::New();
+
+      MultiLabelSurfaceExtractor::MeshCollection::const_iterator it = meshes.find(full[i]);
+      if(it != meshes.end())
+        this->PostProcessDiscreteMesh(it->second, mi.Mesh);
+      }
+    }
+
+  // Replace the affected slabs of the other meshes
+  for(SlabMap::const_iterator it = slabs.begin(); it != slabs.end(); ++it)
+    this->UpdateDiscreteMeshSlab(it->first, it->second.first, it->second.second);
+}
+
+long
+MultiLabelMeshPipeline
+::GetDiscreteSlabMargin() const
+{
+  // A voxel owns the faces on its side of the slice after it, and each
+  // smoothing iteration moves a vertex by the positions of its neighbours
+  return m_MeshOptions->GetDiscreteSmoothingIterations() + 2;
+}
+
+void
+MultiLabelMeshPipeline
+::UpdateDiscreteMeshSlab(LabelType label, long s0, long s1)
+{
+  MeshInfo &mi = m_MeshInfo[label];
+
+  // Extract the faces in a window around the slab, wide enough that the
+  // smoothed positions of the vertices in the slab are not affected by the
+  // edges of the window
+  long margin = this->GetDiscreteSlabMargin();
+  InputImageType::RegionType region = this->GetMeshRegion(mi);
+  long z0 = std::max((long) region.GetIndex(2), s0 - margin);
+  long z1 = std::min((long) region.GetUpperIndex()[2], s1 + margin);
+  if(z1 < z0)
+    return;
+  region.SetIndex(2, z0);
+  region.SetSize(2, z1 + 1 - z0);
+
+  std::vector<LabelType> labels(1, label);
+  m_SurfaceExtractor->SetImage(m_InputImage);
+  m_SurfaceExtractor->SetLabels(labels);
+  m_SurfaceExtractor->SetRegion(region);
+  m_SurfaceExtractor->SetSmoothingIterations(
+        m_MeshOptions->GetDiscreteSmoothingIterations());
+  m_SurfaceExtractor->Update();
+
+  // Combine the faces of the new mesh that are owned by the slab with the
+  // faces of the old mesh that are not. The new faces go first, so that the
+  // vertices on the boundary of the slab take their new positions
+  vtkSmartPointer<vtkPolyData> stitched = vtkSmartPointer<vtkPolyData>::New();
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+  points->SetDataTypeToFloat();
+  vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+  vtkSmartPointer<vtkIntArray> slices = vtkSmartPointer<vtkIntArray>::New();
+  slices->SetName("Slice");
+  vtkSmartPointer<vtkIdTypeArray> corners = vtkSmartPointer<vtkIdTypeArray>::New();
+  corners->SetName("CornerId");
+  std::map<vtkIdType, vtkIdType> corner_map;
+
+  const MultiLabelSurfaceExtractor::MeshCollection &meshes = m_SurfaceExtractor->GetMeshes();
+  MultiLabelSurfaceExtractor::MeshCollection::const_iterator itm = meshes.find(label);
+  if(itm != meshes.end())
+    AppendDiscreteCells(itm->second, true, s0, s1, points, polys, slices, corners, corner_map);
+  AppendDiscreteCells(mi.Mesh, false, s0, s1, points, polys, slices, corners, corner_map);
+
+  stitched->SetPoints(points);
+  stitched->SetPolys(polys);
+  stitched->GetCellData()->AddArray(slices);
+  stitched->GetPointData()->AddArray(corners);
+
+  // Compute the normals of the stitched mesh
+  mi.Mesh = vtkSmartPointer<vtkPolyData>::New();
+  this->PostProcessDiscreteMesh(stitched, mi.Mesh);
+}
+
+void
+MultiLabelMeshPipeline
+::AppendDiscreteCells(vtkPolyData *mesh, bool inside, long s0, long s1,
+                      vtkPoints *points, vtkCellArray *polys,
+                      vtkIntArray *slices, vtkIdTypeArray *corners,
+                      std::map<vtkIdType, vtkIdType> &corner_map)
+{
+  vtkIntArray *src_slices =
+      vtkIntArray::SafeDownCast(mesh->GetCellData()->GetArray("Slice"));
+  vtkIdTypeArray *src_corners =
+      vtkIdTypeArray::SafeDownCast(mesh->GetPointData()->GetArray("CornerId"));
+  if(!src_slices || !src_corners)
+    return;
+
+  vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+  for(vtkIdType c = 0; c < mesh->GetNumberOfCells(); c++)
+    {
+    long slice = src_slices->GetValue(c);
+    if((slice >= s0 && slice <= s1) != inside)
+      continue;
+
+    // Map the points of the cell by their voxel corners
+    mesh->GetCellPoints(c, ids);
+    std::vector<vtkIdType> cell(ids->GetNumberOfIds());
+    for(size_t j = 0; j < cell.size(); j++)
+      {
+      vtkIdType p = ids->GetId(j), corner = src_corners->GetValue(p);
+      std::map<vtkIdType, vtkIdType>::iterator itc = corner_map.find(corner);
+      if(itc == corner_map.end())
+        {
+        itc = corner_map.insert(std::make_pair(corner, points->InsertNextPoint(mesh->GetPoint(p)))).first;
+        corners->InsertNextValue(corner);
+        }
+      cell[j] = itc->second;
+      }
+
+    polys->InsertNextCell((vtkIdType) cell.size(), &cell[0]);
+    slices->InsertNextValue(slice);
+    }
+}
+
+void
+MultiLabelMeshPipeline
+::PostProcessDiscreteMesh(vtkPolyData *input, vtkPolyData *output)
+{
+  // The same polygon filters as used by VTKMeshPipeline, with the same options
+  vtkSmartPointer<vtkDecimatePro> decimate;
+  vtkSmartPointer<vtkSmoothPolyDataFilter> smooth;
+  vtkSmartPointer<vtkPolyDataNormals> normals = vtkSmartPointer<vtkPolyDataNormals>::New();
+  vtkAlgorithmOutput *tail = NULL;
+
+  if(m_MeshOptions->GetUseDecimation())
+    {
+    decimate = vtkSmartPointer<vtkDecimatePro>::New();
+    decimate->SetInputData(input);
+    decimate->SetTargetReduction(m_MeshOptions->GetDecimateTargetReduction());
+    decimate->SetMaximumError(m_MeshOptions->GetDecimateMaximumError());
+    decimate->SetFeatureAngle(m_MeshOptions->GetDecimateFeatureAngle());
+    decimate->SetPreserveTopology(m_MeshOptions->GetDecimatePreserveTopology());
+    tail = decimate->GetOutputPort();
+    }
+
+  if(m_MeshOptions->GetUseMeshSmoothing())
+    {
+    smooth = vtkSmartPointer<vtkSmoothPolyDataFilter>::New();
+    if(tail)
+      smooth->SetInputConnection(tail);
+    else
+      smooth->SetInputData(input);
+    smooth->SetNumberOfIterations(m_MeshOptions->GetMeshSmoothingIterations());
+    smooth->SetRelaxationFactor(m_MeshOptions->GetMeshSmoothingRelaxationFactor());
+    smooth->SetFeatureAngle(m_MeshOptions->GetMeshSmoothingFeatureAngle());
+    smooth->SetFeatureEdgeSmoothing(m_MeshOptions->GetMeshSmoothingFeatureEdgeSmoothing());
+    smooth->SetBoundarySmoothing(m_MeshOptions->GetMeshSmoothingBoundarySmoothing());
+    smooth->SetConvergence(m_MeshOptions->GetMeshSmoothingConvergence());
+    tail = smooth->GetOutputPort();
+    }
+
+  // The extractor orients the faces consistently, so the normals do not
+  // need to be reoriented or split
+  if(tail)
+    normals->SetInputConnection(tail);
+  else
+    normals->SetInputData(input);
+  normals->SplittingOff();
+  normals->ConsistencyOff();
+  normals->AutoOrientNormalsOff();
+  normals->Update();
+
+  output->ShallowCopy(normals->GetOutput());
+}
+
+struct MultiLabelMeshPipeline::ParallelUpdateData
+{
+  MultiLabelMeshPipeline *Pipeline;
+
+  // Labels to process, largest bounding box first, and the next one to take
+  std::vector<std::pair<LabelType, MeshInfo *> > Queue;
+  size_t Next;
+
+  // Total and completed weight (number of voxels) for progress reporting
+  double TotalWeight, DoneWeight;
+  void *ProgressSource;
+
+  // Error message from the first worker that failed
+  std::string Error;
+
+  // Lock protecting the fields above
+  itk::SimpleFastMutexLock Lock;
+
+  // Lock passed on to the VTK pipelines
+  itk::FastMutexLock::Pointer VTKLock;
+};
+
+void
+MultiLabelMeshPipeline
+::ComputeMeshesParallel(
+    const std::vector<LabelType> &labels, AllPurposeProgressAccumulator *progress)
+{
+  // Sort the labels by the size of the region from which the mesh is
+  // extracted, so that the most expensive labels are started first
+  std::vector<std::pair<unsigned long, LabelType> > order;
+  for(size_t i = 0; i < labels.size(); i++)
+    {
+    unsigned long size = this->GetMeshRegion(m_MeshInfo[labels[i]]).GetNumberOfPixels();
+    order.push_back(std::make_pair(size, labels[i]));
+    }
+  std::sort(order.begin(), order.end(),
+            std::greater<std::pair<unsigned long, LabelType> >());
+
+  // Set up the work queue. The meshes are allocated here, so that the workers
+  // do not modify the mesh info map
+  ParallelUpdateData data;
+  data.Pipeline = this;
+  data.Next = 0;
+  data.TotalWeight = 0.0;
+  data.DoneWeight = 0.0;
+  data.VTKLock = itk::FastMutexLock::New();
+  for(size_t i = 0; i < order.size(); i++)
+    {
+    MeshInfo &mi = m_MeshInfo[order[i].second];
+    mi.Mesh = vtkSmartPointer<vtkPolyData>::New();
+    data.Queue.push_back(std::make_pair(order[i].second, &mi));
+    data.TotalWeight += mi.Count;
+    }
+
+  // Make sure there are enough workers in the pool
+  unsigned int n_threads = std::min((size_t) m_NumberOfThreads, labels.size());
+  while(m_Workers.size() < n_threads)
+    {
+    MeshWorker worker;
+    worker.Image = InternalImageType::New();
+    worker.Pipeline = new VTKMeshPipeline();
+    worker.Pipeline->SetMeshOptions(m_MeshOptions);
+    m_Workers.push_back(worker);
+    }
+
+  // The workers report progress through a generic source, since their own
+  // pipelines run in other threads and cannot fire events
+  data.ProgressSource = progress->RegisterGenericSource(1, 1.0);
+
+  // Run the workers
+  m_Threader->SetNumberOfThreads(n_threads);
+  m_Threader->SetSingleMethod(&MultiLabelMeshPipeline::ParallelUpdateCallback, &data);
+  m_Threader->SingleMethodExecute();
+
+  // Finish progress
+  AllPurposeProgressAccumulator::GenericProgressCallback(data.ProgressSource, 1.0);
+  progress->UnregsterGenericSource(data.ProgressSource);
+
+  // If a worker failed, forget the labels in this batch so they are
+  // recomputed on the next update, and pass the error on
+  if(data.Error.size())
+    {
+    for(size_t i = 0; i < data.Queue.size(); i++)
+      m_MeshInfo.erase(data.Queue[i].first);
+    throw IRISException("Failed to compute mesh: %s", data.Error.c_str());
+    }
+}
+
+void
+MultiLabelMeshPipeline
+::ComputeMeshWithWorker(
+    MeshWorker &worker, LabelType label, MeshInfo &mi, itk::FastMutexLock *lock)
+{
+  InputImageType::RegionType region = this->GetMeshRegion(mi);
+
+  // Fill the -1/1 mask of the label directly from the runs of the input
+  // image. This replaces the ROI and threshold filters, which cannot be
+  // shared between threads
+  InternalImageType *image = worker.Image;
+  image->SetRegions(region);
+  image->SetSpacing(m_InputImage->GetSpacing());
+  image->SetDirection(m_InputImage->GetDirection());
+  image->SetOrigin(m_InputImage->GetOrigin());
+  image->Allocate();
+  RLEImageOperations<InputImageType>::MaskByValue(
+        m_InputImage, region, label, image, 1.0f, -1.0f);
+
+  // Like the output of the ROI filter, the mask should start at index zero,
+  // with the origin moved to the corner of the region
+  InternalImageType::PointType origin;
+  m_InputImage->TransformIndexToPhysicalPoint(region.GetIndex(), origin);
+  image->SetRegions(region.GetSize());
+  image->SetOrigin(origin);
+  image->Modified();
+
+  // Run the VTK pipeline of the worker
+  worker.Pipeline->SetImage(image);
+  worker.Pipeline->ComputeMesh(mi.Mesh, lock);
+}
+
+ITK_THREAD_RETURN_TYPE
+MultiLabelMeshPipeline
+::ParallelUpdateCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ParallelUpdateData *data = static_cast<ParallelUpdateData *>(info->UserData);
+  MultiLabelMeshPipeline *self = data->Pipeline;
+  MeshWorker &worker = self->m_Workers[info->ThreadID];
+
+  while(true)
+    {
+    // Take the next label off the queue
+    data->Lock.Lock();
+    bool done = data->Next >= data->Queue.size() || data->Error.size();
+    std::pair<LabelType, MeshInfo *> item;
+    if(!done)
+      item = data->Queue[data->Next++];
+    data->Lock.Unlock();
+
+    if(done)
+      break;
+
+    try
+      {
+      self->ComputeMeshWithWorker(worker, item.first, *item.second, data->VTKLock);
+      }
+    catch(std::exception &exc)
+      {
+      data->Lock.Lock();
+      if(data->Error.empty())
+        data->Error = exc.what();
+      data->Lock.Unlock();
+      break;
+      }
+
+    // Record the completed work
+    data->Lock.Lock();
+    data->DoneWeight += item.second->Count;
+    double fraction = data->DoneWeight / data->TotalWeight;
+    data->Lock.Unlock();
+
+    // Only the calling thread (thread 0) fires progress events
+    if(info->ThreadID == 0 && fraction < 1.0)
+      AllPurposeProgressAccumulator::GenericProgressCallback(data->ProgressSource, fraction);
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
 void 
 MultiLabelMeshPipeline
 ::SetImage(MultiLabelMeshPipeline::InputImageType *image)
@@ -342,6 +860,17 @@ MultiLabelMeshPipeline
     }
 }
 
+void
+MultiLabelMeshPipeline
+::SetLabelCountIndex(LabelCountIndex *index)
+{
+  if(m_LabelCountIndex != index)
+    {
+    m_LabelCountIndex = index;
+    m_MeshInfo.clear();
+    }
+}
+
 
 MultiLabelMeshPipeline::MeshInfo::MeshInfo()
 {
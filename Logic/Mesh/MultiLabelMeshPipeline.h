@@ -39,11 +39,13 @@
 #include "itkImageRegion.h"
 #include "itkSmartPointer.h"
 #include "vtkSmartPointer.h"
+#include "vtkType.h"
 #include "itksys/MD5.h"
 #include "itkObjectFactory.h"
 #include "ImageWrapperTraits.h"
 #include "RLERegionOfInterestImageFilter.h"
 #include "RLEImageScanlineIterator.h"
+#include "itkMultiThreader.h"
 
 
 // Forward reference to itk classes
@@ -59,6 +61,12 @@ class MeshOptions;
 class VTKMeshPipeline;
 class vtkPolyData;
 class AllPurposeProgressAccumulator;
+class MultiLabelSurfaceExtractor;
+class LabelCountIndex;
+class vtkPoints;
+class vtkCellArray;
+class vtkIntArray;
+class vtkIdTypeArray;
 
 
 /**
@@ -70,6 +78,22 @@ class AllPurposeProgressAccumulator;
  * whether it has been updated relative to the corresponding mesh. This makes
  * it possible for selective mesh recomputation, leading to fast mesh computation
  * even for big segmentations.
+ *
+ * When more than one thread is allowed, the labels whose meshes need to be
+ * recomputed are processed concurrently by a pool of workers, each owning its
+ * own mask image and VTK pipeline. Labels are handed out to the workers in
+ * order of decreasing bounding box size, so that the largest meshes are not
+ * left for the end. Progress is only reported from the calling thread.
+ *
+ * Alternatively, when discrete surface extraction is selected in the mesh
+ * options, the surfaces of all the labels that need updating are extracted
+ * in a single pass over the image by MultiLabelSurfaceExtractor.
+ *
+ * If the label count index of the segmentation layer is provided, the labels
+ * to update are taken from the regions that the index has recorded as
+ * changed, rather than by computing checksums over the whole image. In that
+ * case, discrete meshes of large labels are updated by extracting only the
+ * slab of slices affected by the change and stitching it into the old mesh.
  */
 class MultiLabelMeshPipeline : public itk::Object
 {
@@ -107,6 +131,14 @@ public:
   /** Set the input segmentation image */
   void SetImage(InputImageType *input);
 
+  /**
+   * Set the label count index of the segmentation layer, which is then used
+   * to find the labels that changed since the last update. The pipeline
+   * becomes the consumer of the index's log of changes, and must not outlive
+   * the index.
+   */
+  void SetLabelCountIndex(LabelCountIndex *index);
+
   /** Compute the bounding boxes for different regions.  Prerequisite for 
    * calling ComputeMesh(). Returns the total number of voxels in all boxes */
   unsigned long ComputeBoundingBoxes();
@@ -131,6 +163,14 @@ public:
   /** Update the meshes */
   void UpdateMeshes(itk::Command *progressCommand);
 
+  /**
+   * Set the number of threads used to compute meshes for different labels.
+   * By default, this is ITK's global default number of threads. With a single
+   * thread the meshes are computed sequentially by the shared pipeline.
+   */
+  itkSetMacro(NumberOfThreads, unsigned int)
+  itkGetConstMacro(NumberOfThreads, unsigned int)
+
   /** Get the collection of computed meshes */
   std::map<LabelType, vtkSmartPointer<vtkPolyData> > GetMeshCollection();
 
@@ -183,6 +223,82 @@ private:
   // The VTK pipeline
   VTKMeshPipeline *           m_VTKPipeline;
 
+  // Number of threads used by UpdateMeshes
+  unsigned int                m_NumberOfThreads;
+
+  // A worker used to compute meshes in parallel. Each worker has its own
+  // image that holds the -1/1 mask of the current label and its own pipeline
+  struct MeshWorker
+  {
+    InternalImagePointer Image;
+    VTKMeshPipeline *Pipeline;
+  };
+
+  // The pool of workers, allocated on demand
+  std::vector<MeshWorker> m_Workers;
+
+  // The threader used to run the workers
+  itk::MultiThreader::Pointer m_Threader;
+
+  // Data shared by the workers during a parallel update
+  struct ParallelUpdateData;
+
+  // The label count index used to track changes (optional)
+  LabelCountIndex *m_LabelCountIndex;
+
+  // Ranges of slices to extract again for some labels
+  typedef std::map<LabelType, std::pair<long, long> > SlabMap;
+
+  // Find the labels to update by comparing checksums of their runs
+  void FindDirtyLabelsByChecksum(std::vector<LabelType> &dirty);
+
+  // Find the labels to update from the changes recorded by the index
+  void FindDirtyLabelsFromIndex(std::vector<LabelType> &dirty, SlabMap &slabs);
+
+  // Get the padded region around the bounding box of a label
+  InputImageType::RegionType GetMeshRegion(const MeshInfo &mi) const;
+
+  // Compute meshes for the labels that need updating, one label at a time
+  void ComputeMeshesSequential(
+      const std::vector<LabelType> &labels, AllPurposeProgressAccumulator *progress);
+
+  // Compute meshes for the labels that need updating using the worker pool
+  void ComputeMeshesParallel(
+      const std::vector<LabelType> &labels, AllPurposeProgressAccumulator *progress);
+
+  // Compute the mesh for a label using a worker from the pool
+  void ComputeMeshWithWorker(
+      MeshWorker &worker, LabelType label, MeshInfo &mi, itk::FastMutexLock *lock);
+
+  // Extracts the surfaces of all labels in one pass, in discrete mode
+  SmartPtr<MultiLabelSurfaceExtractor> m_SurfaceExtractor;
+
+  // Compute meshes for the labels that need updating in a single pass
+  void ComputeMeshesDiscrete(
+      const std::vector<LabelType> &labels, const SlabMap &slabs,
+      AllPurposeProgressAccumulator *progress);
+
+  // Number of slices around a change (and around a re-extracted slab) whose
+  // discrete mesh faces or vertices the change can affect
+  long GetDiscreteSlabMargin() const;
+
+  // Replace the faces of a discrete mesh owned by slices s0 to s1
+  void UpdateDiscreteMeshSlab(LabelType label, long s0, long s1);
+
+  // Append the cells of a discrete mesh that are inside (or outside) a range
+  // of slices to a mesh under construction, merging points by voxel corner
+  static void AppendDiscreteCells(
+      vtkPolyData *mesh, bool inside, long s0, long s1,
+      vtkPoints *points, vtkCellArray *polys,
+      vtkIntArray *slices, vtkIdTypeArray *corners,
+      std::map<vtkIdType, vtkIdType> &corner_map);
+
+  // Apply decimation, mesh smoothing and normals to a discrete mesh
+  void PostProcessDiscreteMesh(vtkPolyData *input, vtkPolyData *output);
+
+  // Thread callback for the parallel update
+  static ITK_THREAD_RETURN_TYPE ParallelUpdateCallback(void *arg);
+
   // Helper routine for the update command
   void UpdateMeshInfoHelper(
       MeshInfo *current_meshinfo,
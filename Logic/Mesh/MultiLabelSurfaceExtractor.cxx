@@ -0,0 +1,419 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: MultiLabelSurfaceExtractor.cxx,v $
+  Language:  C++
+  Date:      $Date: 2010/06/28 18:45:08 $
+  Version:   $Revision: 1.4 $
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#include "MultiLabelSurfaceExtractor.h"
+#include "AllPurposeProgressAccumulator.h"
+#include "ImageWrapperBase.h"
+
+#include <vtkPolyData.h>
+#include <vtkPoints.h>
+#include <vtkCellArray.h>
+#include <vtkCellData.h>
+#include <vtkPointData.h>
+#include <vtkIntArray.h>
+#include <vtkIdTypeArray.h>
+#include <vnl/vnl_det.h>
+#include <algorithm>
+
+MultiLabelSurfaceExtractor::MultiLabelSurfaceExtractor()
+{
+  m_AllLabels = true;
+  m_SmoothingIterations = 10;
+  m_SmoothingRelaxationFactor = 0.5;
+  for(int d = 0; d < 3; d++)
+    m_Size[d] = 0;
+}
+
+void MultiLabelSurfaceExtractor::SetImage(InputImageType *image)
+{
+  if(m_Image != image)
+    {
+    m_Image = image;
+    this->Modified();
+    }
+}
+
+void MultiLabelSurfaceExtractor::SetLabels(const std::vector<LabelType> &labels)
+{
+  m_AllLabels = labels.empty();
+  m_Requested.assign(MAX_COLOR_LABELS + 1, false);
+  for(size_t i = 0; i < labels.size(); i++)
+    m_Requested[labels[i]] = true;
+  this->Modified();
+}
+
+void MultiLabelSurfaceExtractor::SetRegion(const itk::ImageRegion<3> &region)
+{
+  m_Region = region;
+  this->Modified();
+}
+
+const MultiLabelSurfaceExtractor::RLLine &
+MultiLabelSurfaceExtractor::GetLine(long y, long z) const
+{
+  if(y < 0 || y >= m_Size[1] || z < 0 || z >= m_Size[2])
+    return m_Background;
+
+  // The buffer is indexed by (y,z) in image coordinates
+  BufferType::IndexType bi;
+  bi[0] = m_Image->GetBufferedRegion().GetIndex(1) + y;
+  bi[1] = m_Image->GetBufferedRegion().GetIndex(2) + z;
+  return m_Image->GetBuffer()->GetPixel(bi);
+}
+
+vtkIdType MultiLabelSurfaceExtractor::GetVertex(int plane, long i, long j)
+{
+  size_t pos = j * (m_Size[0] + 1) + i;
+  vtkIdType &id = m_CornerId[plane][pos];
+  if(id < 0)
+    {
+    // The corner (i,j,k) lies half a voxel before the voxel (i,j,k)
+    id = (vtkIdType) (m_Points.size() / 3);
+    m_Points.push_back(i - 0.5f);
+    m_Points.push_back(j - 0.5f);
+    m_Points.push_back(m_PlaneSlice[plane] - 0.5f);
+    m_CornerIndex.push_back(m_PlaneSlice[plane] * m_CornerId[plane].size() + pos);
+    m_PlaneTouched[plane].push_back(pos);
+    }
+  return id;
+}
+
+void MultiLabelSurfaceExtractor::ResetPlane(int plane, long k)
+{
+  // Only clear the entries that were set, rather than the whole plane
+  std::vector<size_t> &touched = m_PlaneTouched[plane];
+  for(size_t i = 0; i < touched.size(); i++)
+    m_CornerId[plane][touched[i]] = -1;
+  touched.clear();
+  m_PlaneSlice[plane] = k;
+}
+
+void MultiLabelSurfaceExtractor::AddFace(
+    vtkIdType v0, vtkIdType v1, vtkIdType v2, vtkIdType v3,
+    LabelType lower, LabelType upper, long slice)
+{
+  Face f;
+  f.Vertex[0] = v0; f.Vertex[1] = v1; f.Vertex[2] = v2; f.Vertex[3] = v3;
+  f.Lower = lower; f.Upper = upper; f.Slice = slice;
+  m_Faces.push_back(f);
+}
+
+void MultiLabelSurfaceExtractor::AddLineFaces(
+    const RLLine &line, long y, int lo, int hi)
+{
+  // Walk over the run boundaries, including the two ends of the line
+  LabelType prev = 0;
+  long i = 0;
+  for(size_t s = 0; s <= line.size(); s++)
+    {
+    LabelType next = (s < line.size()) ? line[s].second : 0;
+    if(prev != next && (this->IsRequested(prev) || this->IsRequested(next)))
+      {
+      this->AddFace(this->GetVertex(lo, i, y), this->GetVertex(lo, i, y + 1),
+                    this->GetVertex(hi, i, y + 1), this->GetVertex(hi, i, y),
+                    prev, next, m_PlaneSlice[lo]);
+      }
+    if(s < line.size())
+      i += line[s].first;
+    prev = next;
+    }
+}
+
+void MultiLabelSurfaceExtractor::AddFacesBetweenLines(
+    const RLLine &lower, const RLLine &upper, int axis, long y, int lo, int hi)
+{
+  // Walk the runs of both lines together, visiting intervals over which
+  // both lines have a constant label
+  size_t sl = 0, su = 0;
+  long el = lower[0].first, eu = upper[0].first, t = 0;
+  while(t < m_Size[0])
+    {
+    long e = std::min(el, eu);
+    LabelType ll = lower[sl].second, lu = upper[su].second;
+    if(ll != lu && (this->IsRequested(ll) || this->IsRequested(lu)))
+      {
+      for(long x = t; x < e; x++)
+        {
+        if(axis == 1)
+          this->AddFace(this->GetVertex(lo, x, y), this->GetVertex(hi, x, y),
+                        this->GetVertex(hi, x + 1, y), this->GetVertex(lo, x + 1, y),
+                        ll, lu, m_PlaneSlice[lo]);
+        else
+          this->AddFace(this->GetVertex(lo, x, y), this->GetVertex(lo, x + 1, y),
+                        this->GetVertex(lo, x + 1, y + 1), this->GetVertex(lo, x, y + 1),
+                        ll, lu, m_PlaneSlice[lo]);
+        }
+      }
+
+    t = e;
+    if(el == e && ++sl < lower.size())
+      el += lower[sl].first;
+    if(eu == e && ++su < upper.size())
+      eu += upper[su].first;
+    }
+}
+
+void MultiLabelSurfaceExtractor::Update(AllPurposeProgressAccumulator *progress)
+{
+  m_Meshes.clear();
+  m_Points.clear();
+  m_CornerIndex.clear();
+  m_Faces.clear();
+  if(!m_Image)
+    return;
+
+  void *source = progress ? progress->RegisterGenericSource(1, 1.0) : NULL;
+
+  for(int d = 0; d < 3; d++)
+    m_Size[d] = m_Image->GetBufferedRegion().GetSize(d);
+  m_Background.assign(1, InputImageType::RLSegment(m_Size[0], 0));
+
+  // Set up the two planes of corners
+  size_t plane_size = (m_Size[0] + 1) * (m_Size[1] + 1);
+  for(int p = 0; p < 2; p++)
+    {
+    m_CornerId[p].assign(plane_size, -1);
+    m_PlaneTouched[p].clear();
+    }
+  // The range of lines to sweep, relative to the start of the image
+  long y0 = 0, y1 = m_Size[1] - 1, z0 = 0, z1 = m_Size[2] - 1;
+  if(m_Region.GetNumberOfPixels() > 0)
+    {
+    const InputImageType::IndexType &start = m_Image->GetBufferedRegion().GetIndex();
+    y0 = std::max(y0, (long) (m_Region.GetIndex(1) - start[1]));
+    y1 = std::min(y1, (long) (m_Region.GetUpperIndex()[1] - start[1]));
+    z0 = std::max(z0, (long) (m_Region.GetIndex(2) - start[2]));
+    z1 = std::min(z1, (long) (m_Region.GetUpperIndex()[2] - start[2]));
+    }
+
+  int lo = 0, hi = 1;
+  m_PlaneSlice[lo] = z0;
+  m_PlaneSlice[hi] = z0 + 1;
+
+  for(long z = z0; z <= z1; z++)
+    {
+    for(long y = y0; y <= y1; y++)
+      {
+      // Faces between slices z-1 and z
+      this->AddFacesBetweenLines(this->GetLine(y, z - 1), this->GetLine(y, z), 2, y, lo, lo);
+
+      // Faces inside the line
+      this->AddLineFaces(this->GetLine(y, z), y, lo, hi);
+      }
+
+    // Faces between lines y-1 and y
+    for(long y = y0; y <= y1 + 1; y++)
+      this->AddFacesBetweenLines(this->GetLine(y - 1, z), this->GetLine(y, z), 1, y, lo, hi);
+
+    // Faces past the last slice
+    if(z == m_Size[2] - 1)
+      for(long y = y0; y <= y1; y++)
+        this->AddFacesBetweenLines(this->GetLine(y, z), m_Background, 2, y, hi, hi);
+
+    // The upper plane becomes the lower plane of the next slice
+    this->ResetPlane(lo, z + 2);
+    std::swap(lo, hi);
+
+    if(source)
+      AllPurposeProgressAccumulator::GenericProgressCallback(
+            source, 0.8 * (z + 1 - z0) / (z1 + 1 - z0));
+    }
+
+  // Release the planes
+  for(int p = 0; p < 2; p++)
+    {
+    std::vector<vtkIdType>().swap(m_CornerId[p]);
+    std::vector<size_t>().swap(m_PlaneTouched[p]);
+    }
+
+  this->Smooth();
+  this->GenerateMeshes();
+
+  // Release the intermediate data
+  std::vector<float>().swap(m_Points);
+  std::vector<vtkIdType>().swap(m_CornerIndex);
+  std::vector<Face>().swap(m_Faces);
+
+  if(source)
+    {
+    AllPurposeProgressAccumulator::GenericProgressCallback(source, 1.0);
+    progress->UnregsterGenericSource(source);
+    }
+}
+
+void MultiLabelSurfaceExtractor::Smooth()
+{
+  if(m_SmoothingIterations == 0)
+    return;
+
+  size_t nv = m_Points.size() / 3;
+  std::vector<float> corners = m_Points, sum(3 * nv);
+  std::vector<unsigned int> count(nv);
+  float factor = (float) m_SmoothingRelaxationFactor;
+
+  for(unsigned int iter = 0; iter < m_SmoothingIterations; iter++)
+    {
+    std::fill(sum.begin(), sum.end(), 0.0f);
+    std::fill(count.begin(), count.end(), 0u);
+
+    // Accumulate the neighbors of each vertex along the edges of the faces
+    for(size_t f = 0; f < m_Faces.size(); f++)
+      {
+      const vtkIdType *v = m_Faces[f].Vertex;
+      for(int e = 0; e < 4; e++)
+        {
+        vtkIdType a = v[e], b = v[(e + 1) % 4];
+        for(int d = 0; d < 3; d++)
+          {
+          sum[3 * a + d] += m_Points[3 * b + d];
+          sum[3 * b + d] += m_Points[3 * a + d];
+          }
+        count[a]++; count[b]++;
+        }
+      }
+
+    // Move each vertex towards the average, staying within its cell
+    for(size_t i = 0; i < nv; i++)
+      {
+      if(count[i] == 0)
+        continue;
+      for(int d = 0; d < 3; d++)
+        {
+        float &x = m_Points[3 * i + d];
+        float c = corners[3 * i + d];
+        x += factor * (sum[3 * i + d] / count[i] - x);
+        x = std::min(std::max(x, c - 0.5f), c + 0.5f);
+        }
+      }
+    }
+}
+
+void MultiLabelSurfaceExtractor::GenerateMeshes()
+{
+  // Count the faces of each label
+  std::vector<size_t> offset(MAX_COLOR_LABELS + 2, 0);
+  for(size_t f = 0; f < m_Faces.size(); f++)
+    {
+    if(this->IsRequested(m_Faces[f].Lower))
+      offset[m_Faces[f].Lower + 1]++;
+    if(this->IsRequested(m_Faces[f].Upper))
+      offset[m_Faces[f].Upper + 1]++;
+    }
+  for(size_t l = 1; l < offset.size(); l++)
+    offset[l] += offset[l - 1];
+
+  // Sort the faces by label. Each entry is 2 * face + 1 if the face is seen
+  // from its upper side
+  std::vector<size_t> sorted(offset.back()), fill(offset.begin(), offset.end() - 1);
+  for(size_t f = 0; f < m_Faces.size(); f++)
+    {
+    if(this->IsRequested(m_Faces[f].Lower))
+      sorted[fill[m_Faces[f].Lower]++] = 2 * f;
+    if(this->IsRequested(m_Faces[f].Upper))
+      sorted[fill[m_Faces[f].Upper]++] = 2 * f + 1;
+    }
+
+  // The transform from voxel index to NIFTI coordinates
+  vnl_matrix_fixed<double, 4, 4> vox2nii = ImageWrapperBase::ConstructNiftiSform(
+        m_Image->GetDirection().GetVnlMatrix(),
+        m_Image->GetOrigin().GetVnlVector(),
+        m_Image->GetSpacing().GetVnlVector());
+  const InputImageType::IndexType &start = m_Image->GetBufferedRegion().GetIndex();
+
+  // If the transform flips orientation, so must the faces
+  bool flip = vnl_det(m_Image->GetDirection().GetVnlMatrix()) < 0;
+
+  // Map from global vertex ids to the ids in the current mesh
+  size_t nv = m_Points.size() / 3;
+  std::vector<vtkIdType> local(nv, -1);
+  std::vector<vtkIdType> used;
+
+  for(size_t l = 1; l <= MAX_COLOR_LABELS; l++)
+    {
+    if(offset[l] == offset[l + 1])
+      continue;
+
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetDataTypeToFloat();
+    vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+    vtkSmartPointer<vtkIntArray> slices = vtkSmartPointer<vtkIntArray>::New();
+    slices->SetName("Slice");
+    vtkSmartPointer<vtkIdTypeArray> corners = vtkSmartPointer<vtkIdTypeArray>::New();
+    corners->SetName("CornerId");
+
+    for(size_t k = offset[l]; k < offset[l + 1]; k++)
+      {
+      const Face &face = m_Faces[sorted[k] / 2];
+      bool reverse = ((sorted[k] & 1) != 0) != flip;
+
+      // Get the local ids of the face corners, adding points as needed
+      vtkIdType q[4];
+      for(int c = 0; c < 4; c++)
+        {
+        vtkIdType v = face.Vertex[reverse ? 3 - c : c];
+        if(local[v] < 0)
+          {
+          vnl_vector_fixed<double, 4> p;
+          for(int d = 0; d < 3; d++)
+            p[d] = m_Points[3 * v + d] + start[d];
+          p[3] = 1.0;
+          vnl_vector_fixed<double, 4> x = vox2nii * p;
+          local[v] = points->InsertNextPoint(x[0], x[1], x[2]);
+          corners->InsertNextValue(m_CornerIndex[v]);
+          used.push_back(v);
+          }
+        q[c] = local[v];
+        }
+
+      // Split the quad into two triangles
+      vtkIdType t1[3] = { q[0], q[1], q[2] }, t2[3] = { q[0], q[2], q[3] };
+      polys->InsertNextCell(3, t1);
+      polys->InsertNextCell(3, t2);
+      slices->InsertNextValue(face.Slice + start[2]);
+      slices->InsertNextValue(face.Slice + start[2]);
+      }
+
+    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+    mesh->SetPoints(points);
+    mesh->SetPolys(polys);
+    mesh->GetCellData()->AddArray(slices);
+    mesh->GetPointData()->AddArray(corners);
+    m_Meshes[(LabelType) l] = mesh;
+
+    // Reset the local ids
+    for(size_t i = 0; i < used.size(); i++)
+      local[used[i]] = -1;
+    used.clear();
+    }
+}
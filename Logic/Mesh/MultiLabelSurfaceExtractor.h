@@ -0,0 +1,211 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: MultiLabelSurfaceExtractor.h,v $
+  Language:  C++
+  Date:      $Date: 2009/01/23 20:09:38 $
+  Version:   $Revision: 1.3 $
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#ifndef __MultiLabelSurfaceExtractor_h_
+#define __MultiLabelSurfaceExtractor_h_
+
+#include "SNAPCommon.h"
+#include "ImageWrapperTraits.h"
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+#include "vtkSmartPointer.h"
+#include "vtkType.h"
+#include <map>
+#include <vector>
+
+class vtkPolyData;
+class AllPurposeProgressAccumulator;
+
+/**
+ * \class MultiLabelSurfaceExtractor
+ * \brief Extracts the surfaces of all labels in a label image in a single
+ * sweep over the runs of the RLE image.
+ *
+ * This is a discrete (multi-label) surface extraction in the spirit of
+ * surface nets. A quadrilateral is generated for every face shared by two
+ * voxels with different labels, and it is added to the surface of both
+ * labels with opposite orientations. The vertices of the quadrilaterals are
+ * the voxel corners, and they are shared between all labels that meet at a
+ * corner, so adjacent surfaces fit together without gaps. The vertices are
+ * then relaxed towards the average of their neighbors, constrained to stay
+ * within half a voxel of the corner, which removes the staircase pattern.
+ *
+ * Faces along the x axis only occur at run boundaries, and faces along y and
+ * z are found by walking the runs of two adjacent lines together, so the cost
+ * of the sweep is proportional to the number of runs plus the number of
+ * boundary faces. Only two planes of voxel corners are kept in memory at any
+ * time. Space outside of the image is treated as the clear label, so that
+ * surfaces are closed.
+ *
+ * The output meshes are in NIFTI (RAS) coordinates, like those produced by
+ * VTKMeshPipeline, and have consistently oriented triangles with outward
+ * facing normals, but no normals are computed. Each triangle is tagged with
+ * the slice that owns it (cell array "Slice") and each point with the index
+ * of its voxel corner (point array "CornerId"), so that a part of a mesh can
+ * be re-extracted over a range of slices and stitched into the old mesh.
+ * Faces between slices k-1 and k, and faces within slice k, are owned by k.
+ */
+class MultiLabelSurfaceExtractor : public itk::Object
+{
+public:
+
+  irisITKObjectMacro(MultiLabelSurfaceExtractor, itk::Object)
+
+  /** Input image type */
+  typedef LabelImageWrapperTraits::ImageType InputImageType;
+
+  /** Collection of output meshes */
+  typedef std::map<LabelType, vtkSmartPointer<vtkPolyData> > MeshCollection;
+
+  /** Set the input segmentation image */
+  void SetImage(InputImageType *image);
+
+  /** Restrict the extraction to a set of labels. If the set is empty (the
+   * default), surfaces are extracted for all non-zero labels */
+  void SetLabels(const std::vector<LabelType> &labels);
+
+  /** Restrict the sweep to the lines of the image that intersect a region.
+   * The region is always extended to whole lines along x. Faces are only
+   * generated for the slices of the region, but the voxels just outside of
+   * the region are used to find them. An empty region (the default) means
+   * the whole image */
+  void SetRegion(const itk::ImageRegion<3> &region);
+
+  /** Number of constrained smoothing iterations applied to the vertices */
+  itkSetMacro(SmoothingIterations, unsigned int)
+  itkGetConstMacro(SmoothingIterations, unsigned int)
+
+  /** Fraction of the distance to the average of the neighbors that each
+   * vertex moves in a smoothing iteration */
+  itkSetMacro(SmoothingRelaxationFactor, double)
+  itkGetConstMacro(SmoothingRelaxationFactor, double)
+
+  /** Extract the surfaces. If a progress accumulator is given, progress is
+   * reported to it through a generic source */
+  void Update(AllPurposeProgressAccumulator *progress = NULL);
+
+  /** Get the meshes computed by the last call to Update() */
+  const MeshCollection &GetMeshes() const { return m_Meshes; }
+
+protected:
+
+  MultiLabelSurfaceExtractor();
+  ~MultiLabelSurfaceExtractor() {}
+
+private:
+
+  typedef InputImageType::RLLine RLLine;
+  typedef InputImageType::BufferType BufferType;
+
+  // A face between two voxels, with its corners in counter-clockwise order
+  // when seen from the voxel with label Upper, i.e., the normal of the face
+  // points from the Lower voxel to the Upper voxel
+  struct Face
+  {
+    vtkIdType Vertex[4];
+    LabelType Lower, Upper;
+    long Slice;
+  };
+
+  // Is a surface requested for a label?
+  bool IsRequested(LabelType label) const
+    { return label != 0 && (m_AllLabels || m_Requested[label]); }
+
+  // Get the line of the image at (y,z), or a line of background if outside
+  const RLLine &GetLine(long y, long z) const;
+
+  // Get (creating if needed) the vertex at corner (i,j) of the given plane
+  vtkIdType GetVertex(int plane, long i, long j);
+
+  // Clear the vertex ids in a plane and assign it to corner slice k
+  void ResetPlane(int plane, long k);
+
+  // Add a face owned by a slice
+  void AddFace(vtkIdType v0, vtkIdType v1, vtkIdType v2, vtkIdType v3,
+               LabelType lower, LabelType upper, long slice);
+
+  // Faces between voxels (i-1,y,z) and (i,y,z) along a line
+  void AddLineFaces(const RLLine &line, long y, int lo, int hi);
+
+  // Faces between two lines. For axis 1, the lines are (y-1,z) and (y,z) and
+  // the faces span planes lo and hi. For axis 2, the lines are adjacent along
+  // z, both at row y, and the faces lie in plane lo
+  void AddFacesBetweenLines(const RLLine &lower, const RLLine &upper,
+                            int axis, long y, int lo, int hi);
+
+  // Relax the vertex positions
+  void Smooth();
+
+  // Generate the output meshes
+  void GenerateMeshes();
+
+  // Input image
+  SmartPtr<InputImageType> m_Image;
+
+  // Requested labels
+  bool m_AllLabels;
+  std::vector<bool> m_Requested;
+
+  // Requested region
+  itk::ImageRegion<3> m_Region;
+
+  // Smoothing parameters
+  unsigned int m_SmoothingIterations;
+  double m_SmoothingRelaxationFactor;
+
+  // Size of the image
+  long m_Size[3];
+
+  // A line of background used outside of the image
+  RLLine m_Background;
+
+  // Vertex ids at the corners in two planes, the corner slice index held by
+  // each plane and the list of entries set in each plane
+  std::vector<vtkIdType> m_CornerId[2];
+  long m_PlaneSlice[2];
+  std::vector<size_t> m_PlaneTouched[2];
+
+  // Vertex positions, in voxel units relative to the start of the image,
+  // and the voxel corners at which the vertices were created
+  std::vector<float> m_Points;
+  std::vector<vtkIdType> m_CornerIndex;
+
+  // All the faces
+  std::vector<Face> m_Faces;
+
+  // The output meshes
+  MeshCollection m_Meshes;
+};
+
+#endif // __MultiLabelSurfaceExtractor_h_
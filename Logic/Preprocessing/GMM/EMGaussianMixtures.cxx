@@ -1,8 +1,12 @@
 #include "EMGaussianMixtures.h"
 #include <iostream>
-#include <ctime>
+#include <algorithm>
+#include <vnl/vnl_math.h>
+
+// Minimum number of samples processed by a thread
+static const int EM_MIN_SAMPLES_PER_THREAD = 4096;
 
-EMGaussianMixtures::EMGaussianMixtures(double **x, int dataSize, int dataDim, int numOfClass)
+EMGaussianMixtures::EMGaussianMixtures(const float *x, int dataSize, int dataDim, int numOfClass)
   :m_x(x), m_numOfData(dataSize), m_dimOfGaussian(dataDim), m_numOfGaussian(numOfClass), m_setPriorFlag(0), m_numOfIteration(0), m_fail(0)
 {
   m_latent = new double*[dataSize];
@@ -29,6 +33,23 @@ EMGaussianMixtures::EMGaussianMixtures(double **x, int dataSize, int dataDim, in
   m_maxIteration = 30;
   m_precision = 1.0e-7;
   m_logLikelihood = std::numeric_limits<double>::infinity();
+  m_currentLogLikelihood = 0;
+
+  // Do not bother starting threads for small samples
+  int nt = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  m_numOfThreads = std::max(1, std::min(
+                              std::min(nt, (int) ITK_MAX_THREADS),
+                              dataSize / EM_MIN_SAMPLES_PER_THREAD));
+
+  // Each thread accumulates, for each Gaussian, the first moment (dataDim
+  // values) and the second moment (dataDim^2 values) in the M-step. The sums
+  // of the posteriors in the E-step use the first numOfClass values, followed
+  // by the log likelihood of the samples of the thread
+  m_threadStride = std::max(numOfClass + 1, numOfClass * (dataDim + dataDim * dataDim));
+  m_threadStats.resize(m_numOfThreads * m_threadStride);
+  m_logWeight.resize(numOfClass);
+  m_isDelta.resize(numOfClass);
+  m_shift.resize(numOfClass * dataDim);
 }
 
 EMGaussianMixtures::~EMGaussianMixtures()
@@ -109,319 +130,302 @@ double ** EMGaussianMixtures::Update(void)
   m_fail = 0;
   while ((fabs(m_logLikelihood - currentLogLikelihood) > m_precision) && (m_numOfIteration < m_maxIteration))
     {
-    if (m_logLikelihood < currentLogLikelihood)
+    // EM never decreases the likelihood, so allow for round-off only
+    if (m_numOfIteration > 1 && currentLogLikelihood < m_logLikelihood - m_precision)
       {
       m_fail = 1;
-      std::cout << "!!!!!! Log Likelihood increase, EM fails" << std::endl;
-      std::cout << "old=" <<m_logLikelihood << std::endl << "new=" << currentLogLikelihood << std::endl;
-      // break;
       }
     ++m_numOfIteration;
     m_logLikelihood = currentLogLikelihood;
-    EvaluatePDF();
+    ExpectationStep();
     currentLogLikelihood = EvaluateLogLikelihood();
-    UpdateLatent();
-    UpdateMean();
-    UpdateCovariance();
+    MaximizationStep();
     if (m_setPriorFlag == 0)
       {
       UpdateWeight();
       }
-
-    std::cout << std::endl <<"=====================" << std::endl;
-    std::cout << "After " << m_numOfIteration << " Iteration:" << std::endl;
-    std::cout << "log likelihood:" << std::endl << m_logLikelihood << std::endl;
-    PrintParameters();
-    //getchar();
     }
   return m_latent;
 }
 
 double ** EMGaussianMixtures::UpdateOnce(void)
 {
-  long start = 0;
-  long end = 0;
-  start = clock();
-  EvaluatePDF();
-  end = clock();
-  std::cout << "evaluate pdf spending " << (end-start)/1000 << std::endl;
-  start = clock();
+  ExpectationStep();
   double currentLogLikelihood = EvaluateLogLikelihood();
-  end = clock();
-  std::cout << "evaluate likelihood spending " << (end-start)/1000 << std::endl;
-  if (m_logLikelihood < currentLogLikelihood)
+  if (m_numOfIteration > 0 && currentLogLikelihood < m_logLikelihood - m_precision)
     {
     m_fail = 1;
-    std::cout << "!!!!!! Log Likelihood increase, EM fails" << std::endl;
-    std::cout << "old=" <<m_logLikelihood << std::endl << "new=" << currentLogLikelihood << std::endl;
-    }
-  if (fabs(m_logLikelihood - currentLogLikelihood) <= m_precision)
-    {
-    std::cout << "Log Likelihood converged" << std::endl;
-    }
-  if (m_numOfIteration >= m_maxIteration)
-    {
-    std::cout << "Reach the maximum iteration number" << std::endl;
     }
   ++m_numOfIteration;
   m_logLikelihood = currentLogLikelihood;
-  
-  start = clock();
-  UpdateLatent();
-  end = clock();
-  std::cout << "latent spending " << (end-start)/1000 << std::endl;
-  start = clock();
-  UpdateMean();
-  end = clock();
-  std::cout << "mean spending " << (end-start)/1000 << std::endl;
-  start = clock();
-  UpdateCovariance();
-  end = clock();
-  std::cout << "covariance spending " << (end-start)/1000 << std::endl;
+
+  MaximizationStep();
   if (m_setPriorFlag == 0)
     {
-    start = clock();
     UpdateWeight();
-    end = clock();
-    std::cout << "weight spending " << (end-start)/1000 << std::endl;
     }
-
-  std::cout << std::endl <<"=====================" << std::endl;
-  std::cout << "After " << m_numOfIteration << " Iteration:" << std::endl;
-  std::cout << "log likelihood:" << std::endl << m_logLikelihood << std::endl;
-  PrintParameters();
-  //getchar();
   return m_latent;
 }
 
-void EMGaussianMixtures::EvaluatePDF(void)
+void EMGaussianMixtures::RunThreads(Pass step)
 {
-  for (int i = 0; i < m_numOfData; i++)
+  ThreadData td;
+  td.Self = this;
+  td.Step = step;
+
+  if(m_numOfThreads == 1)
     {
-    for (int j = 0; j < m_numOfGaussian; j++)
-      {
-      m_log_pdf[i][j] = m_gmm->EvaluateLogPDF(j, m_x[i]);
-      }
+    itk::MultiThreader::ThreadInfoStruct info;
+    info.ThreadID = 0;
+    info.NumberOfThreads = 1;
+    info.UserData = &td;
+    ThreadCallback(&info);
     }
-  if (m_setPriorFlag == 0)
+  else
     {
-    for (int j = 0; j < m_numOfGaussian; j++)
-      {
-      m_weight[j] = m_gmm->GetWeight(j);
-      }
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(m_numOfThreads);
+    threader->SetSingleMethod(&EMGaussianMixtures::ThreadCallback, &td);
+    threader->SingleMethodExecute();
     }
 }
 
-#include <vnl/vnl_math.h>
-
-double EMGaussianMixtures::ComputePosterior(int nGauss, double *log_pdf, double *w, double *log_w, int j)
+ITK_THREAD_RETURN_TYPE EMGaussianMixtures::ThreadCallback(void *arg)
 {
-  // Instead of directly computing the expression
-  //   latent[i][j] = w[j] * N(x_i; m_j, Sigma_j) / Sum_k[w[k] * N(x_i; m_k, Sigma_k)]
-  // which is equivalently
-  //   latent[i][j] = exp(a_j) / Sum_k[ exp(a_k) ]
-  // where
-  //   a_j = log( w[j] * N(x_i; m_j, Sigma_j) )
-  // we compute
-  //   latent[i][j] = 1 / (1 + Sum_(k!=j)[ exp(a_k - a_j) ])
-  // which is numerically stable
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ThreadData *td = static_cast<ThreadData *>(info->UserData);
+  EMGaussianMixtures *self = td->Self;
 
-  // If the weight of the class is zero, the posterior is automatically zero
-  if(w[j] == 0)
-    return 0;
+  // Each thread takes a contiguous range of samples
+  int n = self->m_numOfData, nt = info->NumberOfThreads, t = info->ThreadID;
+  int first = (n / nt) * t + std::min(t, n % nt);
+  int last = first + n / nt + (t < n % nt ? 1 : 0);
 
-  // We are computing m_latent[i][j]
-  double denom = 1.0;
+  double *stats = &self->m_threadStats[t * self->m_threadStride];
+  std::fill(stats, stats + self->m_threadStride, 0.0);
 
-  // The log of w[j] * pdf[j];
-  double exp_j = (log_w[j] + log_pdf[j]);
-  for (int k = 0; k < nGauss; k++)
+  if(td->Step == EXPECTATION)
+    self->ThreadedExpectation(first, last, stats);
+  else
+    self->ThreadedMaximization(first, last, stats);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void EMGaussianMixtures::ExpectationStep(void)
+{
+  if (m_setPriorFlag == 0)
     {
-    if(j != k && w[k] > 0)
+    for (int j = 0; j < m_numOfGaussian; j++)
       {
-      // The log of (w[k] * pdf[k]) / (w[j] * pdf[j])
-      double exponent = (log_w[k] + log_pdf[k]) - exp_j;
-      if(exponent < -20)
-        {
-        // (w[k] * pdf[k]) / (w[j] * pdf[j]) is effectively zero
-        continue;
-        }
-      else if(exponent > 20)
-        {
-        // latent[i][j] is effectively zero
-        denom = vnl_huge_val(1.0);
-        break;
-        }
-      else
-        {
-        denom += exp(exponent);
-        }
+      m_weight[j] = m_gmm->GetWeight(j);
+      m_logWeight[j] = log(m_weight[j]);
       }
     }
 
-  // Now compute 1/denom
-  double post = 1.0 / denom;
-  return post;
-}
+  // Delta functions do not contribute to the likelihood
+  for (int j = 0; j < m_numOfGaussian; j++)
+    m_isDelta[j] = m_gmm->GetGaussian(j)->isDeltaFunction();
 
-void EMGaussianMixtures::UpdateLatent(void)
-{
-  double sum = 0;
-  for (int i = 0; i < m_numOfGaussian; i++)
+  RunThreads(EXPECTATION);
+
+  // Add up the sums of the posteriors and the log likelihoods of the threads
+  for (int j = 0; j < m_numOfGaussian; j++)
     {
-    m_sum[i] = 0;
+    m_sum[j] = 0;
+    for (int t = 0; t < m_numOfThreads; t++)
+      m_sum[j] += m_threadStats[t * m_threadStride + j];
     }
+  // The log likelihood is reported per sample, so that the precision does
+  // not depend on the number of samples
+  double logLikelihood = 0;
+  for (int t = 0; t < m_numOfThreads; t++)
+    logLikelihood += m_threadStats[t * m_threadStride + m_numOfGaussian];
+  m_currentLogLikelihood = logLikelihood / m_numOfData;
+}
 
-  // Compute log of the weights and store in logw
-  vnl_vector<double> logw(m_numOfGaussian);
-  for(int i = 0; i < m_numOfGaussian; i++)
-    logw(i) = log(m_weight[i]);
-  
-  if (m_setPriorFlag == 0)
+void EMGaussianMixtures::ThreadedExpectation(int first, int last, double *sum)
+{
+  // The Gaussians are evaluated with scratch vectors owned by the thread
+  VectorType x(m_dimOfGaussian), xscratch(m_dimOfGaussian);
+  for (int i = first; i < last; i++)
     {
-    for (int i = 0; i < m_numOfData; i++)
-      {
-      for (int j = 0; j < m_numOfGaussian; j++)
-        {
-        m_latent[i][j] = ComputePosterior(m_numOfGaussian, m_log_pdf[i], m_weight, logw.data_block(), j);
-        m_sum[j] += m_latent[i][j];
-        }
-
+    const float *xi = m_x + (size_t) i * m_dimOfGaussian;
+    for (int k = 0; k < m_dimOfGaussian; k++)
+      x[k] = xi[k];
 
-      /*
-      sum = 0;
-      for (int j = 0; j < m_numOfGaussian; j++)
-        {
-        m_tmp1[j] = m_weight[j] * m_pdf[i][j];
-        sum += m_tmp1[j];
-        }
-      if(sum == 0)
-        {
-        for (int j = 0; j < m_numOfGaussian; j++)
-          {
-          m_latent[i][j] = 1.0 / m_numOfGaussian;
-          m_sum[j] += m_latent[i][j];
-          }
-        }
-      else
-        {
-        for (int j = 0; j < m_numOfGaussian; j++)
-          {
-          m_latent[i][j] = m_tmp1[j] / sum;
-          m_sum[j] += m_latent[i][j];
-          }
-        }
-        */
+    // Add up the likelihood of the sample, weighted by the prior if set
+    const double *w = m_setPriorFlag ? m_prior[i] : m_weight;
+    double lik = 0;
+    for (int j = 0; j < m_numOfGaussian; j++)
+      {
+      m_log_pdf[i][j] = m_gmm->EvaluateLogPDF(j, x, xscratch);
+      if (!m_isDelta[j])
+        lik += w[j] * exp(m_log_pdf[i][j]);
       }
-    }
-  else
-    {
-    /**= THIS IS NOT USED
-    for (int i = 0; i < m_numOfData; i++)
+    sum[m_numOfGaussian] += log(lik);
+
+    // The posteriors are only computed without a prior (computing them with
+    // a prior is not implemented)
+    if (m_setPriorFlag == 0)
       {
-      sum = 0;
-      for (int j = 0; j < m_numOfGaussian; j++)
-        {
-        m_tmp1[j] = m_prior[i][j] * m_pdf[i][j];
-        sum += m_tmp1[j];
-        }
       for (int j = 0; j < m_numOfGaussian; j++)
         {
-        m_latent[i][j] = m_tmp1[j] / sum;
-        m_sum[j] += m_latent[i][j];
+        m_latent[i][j] = ComputePosterior(m_numOfGaussian, m_log_pdf[i], m_weight, &m_logWeight[0], j);
+        sum[j] += m_latent[i][j];
         }
       }
-      */
     }
 }
 
-void EMGaussianMixtures::UpdateMean(void)
+void EMGaussianMixtures::MaximizationStep(void)
 {
+  // The moments are taken about the current means, which are close to the
+  // new means, so that the covariances do not lose precision when computed
+  // from the second moments
   for (int i = 0; i < m_numOfGaussian; i++)
     {
-    for (int j = 0; j < m_dimOfGaussian; j++)
-      {
-      m_tmp2[j] = 0;
-      }
-    
-    for (int j = 0; j < m_numOfData; j++)
+    const VectorType &mean = m_gmm->GetMean(i);
+    bool finite = true;
+    for (int k = 0; k < m_dimOfGaussian; k++)
+      finite = finite && vnl_math_isfinite(mean[k]);
+    for (int k = 0; k < m_dimOfGaussian; k++)
+      m_shift[i * m_dimOfGaussian + k] = finite ? mean[k] : 0.0;
+    }
+
+  RunThreads(MAXIMIZATION);
+
+  int d = m_dimOfGaussian, stride = d + d * d;
+  for (int i = 0; i < m_numOfGaussian; i++)
+    {
+    // Add up the moments of the threads
+    for (int k = 0; k < stride; k++)
       {
-      for (int k = 0; k < m_dimOfGaussian; k++)
-        {
-        m_tmp2[k] += m_latent[j][i] * m_x[j][k];
-        }
+      double s = 0;
+      for (int t = 0; t < m_numOfThreads; t++)
+        s += m_threadStats[t * m_threadStride + i * stride + k];
+      if (k < d)
+        m_tmp2[k] = s;
+      else
+        m_tmp3[k - d] = s;
       }
 
     // This can lead to a possible divide by zero situation. In case the sum
     // of latent variables for class i is zero, we set the mean of that class
-    // to infinity
-    if(m_sum[i] > 0)
+    // to infinity and the covariance to zero
+    if (m_sum[i] > 0)
       {
-      for (int j = 0; j < m_dimOfGaussian; j++)
+      // Mean relative to the shift
+      for (int k = 0; k < d; k++)
+        m_tmp2[k] /= m_sum[i];
+
+      // Only the upper triangle of the second moment is accumulated
+      for (int k = 0; k < d; k++)
         {
-        m_tmp2[j] = m_tmp2[j] / m_sum[i];
+        for (int l = k; l < d; l++)
+          {
+          double cov = m_tmp3[k * d + l] / m_sum[i] - m_tmp2[k] * m_tmp2[l];
+          m_tmp3[k * d + l] = m_tmp3[l * d + k] = cov;
+          }
         }
+
+      for (int k = 0; k < d; k++)
+        m_tmp2[k] += m_shift[i * d + k];
       }
     else
       {
-      for (int j = 0; j < m_dimOfGaussian; j++)
-        {
-        m_tmp2[j] = - std::numeric_limits<double>::infinity();
-        }
+      for (int k = 0; k < d; k++)
+        m_tmp2[k] = - std::numeric_limits<double>::infinity();
+      for (int k = 0; k < d * d; k++)
+        m_tmp3[k] = 0.0;
       }
 
-
-    m_gmm->SetMean(i, VectorType(m_tmp2, m_dimOfGaussian));
+    m_gmm->SetMean(i, VectorType(m_tmp2, d));
+    m_gmm->SetCovariance(i, MatrixType(m_tmp3, d, d));
     }
 }
 
-void EMGaussianMixtures::UpdateCovariance(void)
+void EMGaussianMixtures::ThreadedMaximization(int first, int last, double *moments)
 {
-  for (int i = 0; i < m_numOfGaussian; i++)
+  int d = m_dimOfGaussian, stride = d + d * d;
+  std::vector<double> r(d);
+  for (int i = first; i < last; i++)
     {
-    const VectorType &current_mean = m_gmm->GetMean(i);
-    
-    for (int j = 0; j < m_dimOfGaussian; j++)
-      {
-      for (int k = 0; k < m_dimOfGaussian; k++)
-        {
-        m_tmp3[j*m_dimOfGaussian+k] = 0;
-        }
-      }
-    
-    for (int j = 0; j < m_numOfData; j++)
+    const float *xi = m_x + (size_t) i * d;
+    for (int j = 0; j < m_numOfGaussian; j++)
       {
-      for (int k = 0; k < m_dimOfGaussian; k++)
+      double w = m_latent[i][j];
+      if (w == 0)
+        continue;
+
+      double *m1 = moments + j * stride, *m2 = m1 + d;
+      const double *shift = &m_shift[j * d];
+      for (int k = 0; k < d; k++)
         {
-        m_tmp2[k] = m_x[j][k] - current_mean[k];
+        r[k] = xi[k] - shift[k];
+        m1[k] += w * r[k];
         }
-      for (int k = 0; k < m_dimOfGaussian; k++)
+
+      for (int k = 0; k < d; k++)
         {
-        for (int l = 0; l < m_dimOfGaussian; l++)
-          {
-          m_tmp3[k*m_dimOfGaussian+l] += m_tmp2[k] * m_tmp2[l] * m_latent[j][i];
-          }
+        double wr = w * r[k];
+        for (int l = k; l < d; l++)
+          m2[k * d + l] += wr * r[l];
         }
       }
+    }
+}
+
+
+double EMGaussianMixtures::ComputePosterior(int nGauss, double *log_pdf, double *w, double *log_w, int j)
+{
+  // Instead of directly computing the expression
+  //   latent[i][j] = w[j] * N(x_i; m_j, Sigma_j) / Sum_k[w[k] * N(x_i; m_k, Sigma_k)]
+  // which is equivalently
+  //   latent[i][j] = exp(a_j) / Sum_k[ exp(a_k) ]
+  // where
+  //   a_j = log( w[j] * N(x_i; m_j, Sigma_j) )
+  // we compute
+  //   latent[i][j] = 1 / (1 + Sum_(k!=j)[ exp(a_k - a_j) ])
+  // which is numerically stable
 
-    if(m_sum[i] > 0)
+  // If the weight of the class is zero, the posterior is automatically zero
+  if(w[j] == 0)
+    return 0;
+
+  // We are computing m_latent[i][j]
+  double denom = 1.0;
+
+  // The log of w[j] * pdf[j];
+  double exp_j = (log_w[j] + log_pdf[j]);
+  for (int k = 0; k < nGauss; k++)
+    {
+    if(j != k && w[k] > 0)
       {
-      for (int j = 0; j < m_dimOfGaussian*m_dimOfGaussian; j++)
+      // The log of (w[k] * pdf[k]) / (w[j] * pdf[j])
+      double exponent = (log_w[k] + log_pdf[k]) - exp_j;
+      if(exponent < -20)
         {
-        m_tmp3[j] = m_tmp3[j] / m_sum[i];
+        // (w[k] * pdf[k]) / (w[j] * pdf[j]) is effectively zero
+        continue;
         }
-      }
-    else
-      {
-      for (int j = 0; j < m_dimOfGaussian*m_dimOfGaussian; j++)
+      else if(exponent > 20)
+        {
+        // latent[i][j] is effectively zero
+        denom = vnl_huge_val(1.0);
+        break;
+        }
+      else
         {
-        m_tmp3[j] = 0.0;
+        denom += exp(exponent);
         }
       }
-
-
-    m_gmm->SetCovariance(i, MatrixType(m_tmp3, m_dimOfGaussian, m_dimOfGaussian));
     }
+
+  // Now compute 1/denom
+  double post = 1.0 / denom;
+  return post;
 }
 
 void EMGaussianMixtures::UpdateWeight(void)
@@ -434,35 +438,8 @@ void EMGaussianMixtures::UpdateWeight(void)
 
 double EMGaussianMixtures::EvaluateLogLikelihood(void)
 {
-  double tmp1 = 0;
-  double tmp2 = 0;
-  if (m_setPriorFlag == 0)
-    {
-    for (int i = 0; i < m_numOfData; i++)
-      {
-      tmp1 = 0;
-      for (int j = 0; j < m_numOfGaussian; j++)
-        {
-        if(!m_gmm->GetGaussian(j)->isDeltaFunction())
-          tmp1 += m_weight[j] * exp(m_log_pdf[i][j]);
-        }
-      tmp2 += log(tmp1);
-      }
-    }
-  else
-    {
-    for (int i = 0; i < m_numOfData; i++)
-      {
-      tmp1 = 0;
-      for (int j = 0; j < m_numOfGaussian; j++)
-        {
-        if(!m_gmm->GetGaussian(j)->isDeltaFunction())
-          tmp1 += m_prior[i][j] * exp(m_log_pdf[i][j]);
-        }
-      tmp2 += log(tmp1);
-      }
-    }
-  return tmp1;
+  // Accumulated by the threads in the last E-step
+  return m_currentLogLikelihood;
 }
 
 void EMGaussianMixtures::PrintParameters(void)
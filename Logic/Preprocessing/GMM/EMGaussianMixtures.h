@@ -3,11 +3,21 @@
 
 #include "GaussianMixtureModel.h"
 #include "SNAPCommon.h"
+#include "itkMultiThreader.h"
+#include <vector>
 
+/**
+ * Expectation-maximization for Gaussian mixture models. The data are passed
+ * in as a contiguous buffer of dataSize rows of dataDim values. Both steps
+ * are split over threads by ranges of samples: in the E-step each thread
+ * computes the posteriors of its samples and their sums, and in the M-step
+ * each thread accumulates the weighted first and second moments of its
+ * samples, which are then added up to get the means and covariances.
+ */
 class EMGaussianMixtures
 {
 public:
-  EMGaussianMixtures(double **x, int dataSize, int dataDim, int numOfClass);
+  EMGaussianMixtures(const float *x, int dataSize, int dataDim, int numOfClass);
   ~EMGaussianMixtures();
 
   typedef Gaussian::MatrixType MatrixType;
@@ -31,22 +41,43 @@ public:
 
   double ** Update(void);
   double ** UpdateOnce(void);
+
+  // Mean log likelihood of the samples under the model of the last E-step
   double EvaluateLogLikelihood(void);
   void PrintParameters(void);
 
   static double ComputePosterior(int nGauss, double *log_pdf, double *w, double *log_w, int j);
 
 private:
-  void EvaluatePDF(void);
-  void UpdateLatent(void);
-  void UpdateMean(void);
-  void UpdateCovariance(void);
+  // Compute the log PDFs and the posteriors (latent variables)
+  void ExpectationStep(void);
+
+  // Compute the means and covariances from the posteriors
+  void MaximizationStep(void);
   void UpdateWeight(void);
-  
+
+  // The passes over the data run by the threads
+  enum Pass { EXPECTATION, MAXIMIZATION };
+
+  struct ThreadData
+  {
+    EMGaussianMixtures *Self;
+    Pass Step;
+  };
+
+  void RunThreads(Pass step);
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+
+  // Process the samples [first, last), adding to the accumulators of a thread.
+  // The E-step adds the posteriors to sum[0..numOfClass) and the log
+  // likelihood of the samples to sum[numOfClass]
+  void ThreadedExpectation(int first, int last, double *sum);
+  void ThreadedMaximization(int first, int last, double *moments);
+
   double **m_latent;
   double **m_log_pdf;
   double **m_prior;
-  double **m_x;
+  const float *m_x;
   double *m_probs;
   double *m_probs2;
   double *m_tmp1;
@@ -55,6 +86,7 @@ private:
   double *m_sum;
   double *m_weight;
   double m_logLikelihood;
+  double m_currentLogLikelihood;
   int m_numOfGaussian;
   int m_dimOfGaussian;
   int m_maxIteration;
@@ -64,6 +96,17 @@ private:
   int m_fail;
   double m_precision;
 
+  // Number of threads, and accumulators for each thread (of size m_threadStride)
+  int m_numOfThreads;
+  int m_threadStride;
+  std::vector<double> m_threadStats;
+
+  // Log of the weights, whether each Gaussian is a delta function, and the
+  // points about which moments are taken
+  std::vector<double> m_logWeight;
+  std::vector<char> m_isDelta;
+  std::vector<double> m_shift;
+
   SmartPtr<GaussianMixtureModel> m_gmm;
 };
 
@@ -95,6 +95,54 @@ double Gaussian::EvaluateLogPDF(VectorType &x, VectorType &xscratch)
   return 0.5 * logz;
 }
 
+bool Gaussian::ComputeInverseCholeskyFactor(MatrixType &Linv, double &log_norm) const
+{
+  // Cholesky decomposition of the covariance matrix
+  int d = m_dimension;
+  MatrixType L(d, d, 0.0);
+  for(int j = 0; j < d; j++)
+    {
+    double s = m_covariance_matrix(j,j);
+    for(int k = 0; k < j; k++)
+      s -= L(j,k) * L(j,k);
+
+    // Singular covariance matrices (delta functions) are not handled here
+    if(!(s > 0))
+      return false;
+
+    L(j,j) = sqrt(s);
+    for(int i = j + 1; i < d; i++)
+      {
+      double t = m_covariance_matrix(i,j);
+      for(int k = 0; k < j; k++)
+        t -= L(i,k) * L(j,k);
+      L(i,j) = t / L(j,j);
+      }
+    }
+
+  // Invert L by forward substitution, one column at a time
+  Linv.set_size(d, d);
+  Linv.fill(0.0);
+  for(int j = 0; j < d; j++)
+    {
+    Linv(j,j) = 1.0 / L(j,j);
+    for(int i = j + 1; i < d; i++)
+      {
+      double t = 0;
+      for(int k = j; k < i; k++)
+        t -= L(i,k) * Linv(k,j);
+      Linv(i,j) = t / L(i,i);
+      }
+    }
+
+  // log(norm) = -0.5 * (d * log(2 pi) + log(det(Sigma))), det(Sigma) = prod(L_ii)^2
+  log_norm = -0.5 * d * log(2 * vnl_math::pi);
+  for(int j = 0; j < d; j++)
+    log_norm -= log(L(j,j));
+
+  return true;
+}
+
 double Gaussian::EvaluatePDF(double *x)
 {
   // We got to exponentiate somewhere, so might as well do it here
@@ -26,6 +26,12 @@ public:
   // Evaluate log PDF with user-provided scratch buffer
   double EvaluateLogPDF(VectorType &x, VectorType &xscratch);
 
+  // Compute the inverse Linv of the lower triangular Cholesky factor of the
+  // covariance (Sigma = L L^T) and the log of the normalization constant, so
+  // that log(p(x)) = log_norm - 0.5 * |Linv (x - mean)|^2. Returns false if
+  // the covariance is not positive definite
+  bool ComputeInverseCholeskyFactor(MatrixType &Linv, double &log_norm) const;
+
   void PrintParameters();
 
   // Tests whether the Gaussian is a delta function (i.e., has zero total variance)
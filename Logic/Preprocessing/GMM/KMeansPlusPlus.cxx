@@ -2,8 +2,12 @@
 #include "math.h"
 #include "time.h"
 #include "stdlib.h"
+#include <algorithm>
 
-KMeansPlusPlus::KMeansPlusPlus(double **x, int dataSize, int dataDim, int numOfClusters)
+// Minimum number of samples processed by a thread
+static const int KMEANS_MIN_SAMPLES_PER_THREAD = 4096;
+
+KMeansPlusPlus::KMeansPlusPlus(const float *x, int dataSize, int dataDim, int numOfClusters)
   :m_dataSize(dataSize), m_dataDim(dataDim), m_numOfClusters(numOfClusters)
 {
   m_x = x;
@@ -14,6 +18,14 @@ KMeansPlusPlus::KMeansPlusPlus(double **x, int dataSize, int dataDim, int numOfC
 
   m_gmm = GaussianMixtureModel::New();
   m_gmm->Initialize(dataDim, numOfClusters);
+
+  // Do not bother starting threads for small samples
+  int nt = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  m_numOfThreads = std::max(1, std::min(
+                              std::min(nt, (int) ITK_MAX_THREADS),
+                              dataSize / KMEANS_MIN_SAMPLES_PER_THREAD));
+  m_threadDistSum.resize(m_numOfThreads);
+  m_threadStats.resize(m_numOfThreads * numOfClusters * (1 + dataDim));
 }
 
 KMeansPlusPlus::~KMeansPlusPlus()
@@ -24,102 +36,171 @@ KMeansPlusPlus::~KMeansPlusPlus()
   delete m_distance;
 }
 
-double KMeansPlusPlus::Distance(const double *x, const double *y)
+double KMeansPlusPlus::Distance(const float *x, const float *y)
 {
   double tmp = 0;
   for (int i = 0; i < m_dataDim; i++)
   {
-    tmp += (x[i] - y[i]) * (x[i] - y[i]);
+    double d = (double) x[i] - (double) y[i];
+    tmp += d * d;
   }
   return sqrt(tmp);
 }
 
-void KMeansPlusPlus::Initialize(void)
+void KMeansPlusPlus::GetChunk(int thread, int &first, int &last)
 {
-  // for (int i = 0; i < numOfClusters; i++)
-  // {
-  //   m_xCounter[i] = 0;
-  // }
+  int n = m_dataSize, nt = m_numOfThreads;
+  first = (n / nt) * thread + std::min(thread, n % nt);
+  last = first + n / nt + (thread < n % nt ? 1 : 0);
+}
 
-  srand(time(0));
+void KMeansPlusPlus::RunThreads(Pass step, int center)
+{
+  ThreadData td;
+  td.Self = this;
+  td.Step = step;
+  td.Center = center;
 
-  m_centers[0] = (int)(((double) rand() / (double) RAND_MAX) * m_dataSize);
-  double distSum = 0;
-  for (int i = 0; i < m_dataSize; i++)
+  if(m_numOfThreads == 1)
+    {
+    itk::MultiThreader::ThreadInfoStruct info;
+    info.ThreadID = 0;
+    info.NumberOfThreads = 1;
+    info.UserData = &td;
+    ThreadCallback(&info);
+    }
+  else
     {
-    m_xCenter[i] = m_centers[0];
-    m_distance[i] = Distance(m_x[i], m_x[m_centers[0]]);
-    distSum += m_distance[i];
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(m_numOfThreads);
+    threader->SetSingleMethod(&KMeansPlusPlus::ThreadCallback, &td);
+    threader->SingleMethodExecute();
     }
-  m_xCounter[0] = m_dataSize;
+}
 
-  double probDist = 0;
-  double currentSum = 0;
-  int idx = 0;
-  for (int i = 1; i < m_numOfClusters; i++)
+ITK_THREAD_RETURN_TYPE KMeansPlusPlus::ThreadCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ThreadData *td = static_cast<ThreadData *>(info->UserData);
+  KMeansPlusPlus *self = td->Self;
+
+  int t = info->ThreadID, first, last;
+  self->GetChunk(t, first, last);
+
+  int d = self->m_dataDim, nc = self->m_numOfClusters;
+  double *stats = &self->m_threadStats[t * nc * (1 + d)];
+
+  if(td->Step == ADD_CENTER)
     {
-    m_xCounter[i] = 0;
-    probDist = ((double) rand() / (double) RAND_MAX) * distSum;
-    currentSum = 0;
-    for (idx = 0; idx < m_dataSize; idx++)
+    // Move the samples that are closer to the new center than to their
+    // current center into its cluster
+    int c = td->Center;
+    const float *xc = self->m_x + (size_t) self->m_centers[c] * d;
+    double distSum = 0;
+    for (int j = first; j < last; j++)
       {
-      currentSum += m_distance[idx];
-      if (currentSum >= probDist)
+      double dist = self->Distance(self->m_x + (size_t) j * d, xc);
+      if (c == 0 || self->m_distance[j] > dist)
         {
-        break;
+        self->m_distance[j] = dist;
+        self->m_xCenter[j] = c;
         }
+      distSum += self->m_distance[j];
       }
-
-    m_centers[i] = idx;
-
-    distSum = 0;
-    for (int j = 0; j < m_dataSize; j++)
+    self->m_threadDistSum[t] = distSum;
+    }
+  else if(td->Step == CLUSTER_MEANS)
+    {
+    // Count the samples of each cluster and add them up
+    std::fill(stats, stats + nc * (1 + d), 0.0);
+    for (int j = first; j < last; j++)
       {
-      if (m_distance[j] > Distance(m_x[j], m_x[m_centers[i]]))
-        {
-        ++m_xCounter[i];
-        for (int k = 0; k < i; k++)
-          {
-          if (m_centers[k] == m_xCenter[j])
-            {
-            --m_xCounter[k];
-            break;
-            }
-          }
-        m_distance[j] = Distance(m_x[j], m_x[m_centers[i]]);
-        m_xCenter[j] = m_centers[i];
-        }
-      distSum += m_distance[j];
+      int c = self->m_xCenter[j];
+      const float *xj = self->m_x + (size_t) j * d;
+      double *sc = stats + c * (1 + d);
+      sc[0] += 1;
+      for (int k = 0; k < d; k++)
+        sc[k + 1] += xj[k];
       }
     }
-
-  Gaussian::VectorType tmpMean(m_dataDim, 0.0);
-  for (int i = 0; i < m_numOfClusters; i++)
+  else
     {
-    m_gmm->SetMean(i, tmpMean);
+    // Find the largest distance from the mean in each cluster
+    std::fill(stats, stats + nc, 0.0);
+    for (int j = first; j < last; j++)
+      {
+      int c = self->m_xCenter[j];
+      const float *xj = self->m_x + (size_t) j * d;
+      const double *mean = self->m_gmm->GetMean(c).data_block();
+      double dist = 0;
+      for (int k = 0; k < d; k++)
+        dist += (xj[k] - mean[k]) * (xj[k] - mean[k]);
+      dist = sqrt(dist);
+      if (stats[c] < dist)
+        stats[c] = dist;
+      }
     }
 
-  for (int i = 0; i < m_dataSize; i++)
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+void KMeansPlusPlus::Initialize(void)
+{
+  srand(time(0));
+
+  // The first center is drawn uniformly, and all samples belong to it
+  m_centers[0] = std::min(m_dataSize - 1,
+                          (int)(((double) rand() / (double) RAND_MAX) * m_dataSize));
+  RunThreads(ADD_CENTER, 0);
+
+  for (int i = 1; i < m_numOfClusters; i++)
     {
-    for (int j = 0; j < m_numOfClusters; j++)
+    double distSum = 0;
+    for (int t = 0; t < m_numOfThreads; t++)
+      distSum += m_threadDistSum[t];
+
+    // Draw the next center with probability proportional to the distance
+    // to the nearest center. Find the range of samples that contains it
+    // from the sums of the threads, then scan just that range
+    double probDist = ((double) rand() / (double) RAND_MAX) * distSum;
+    double currentSum = 0;
+    int t = 0;
+    while (t < m_numOfThreads - 1 && currentSum + m_threadDistSum[t] < probDist)
+      currentSum += m_threadDistSum[t++];
+
+    int first, last, idx;
+    GetChunk(t, first, last);
+    for (idx = first; idx < last - 1; idx++)
       {
-      if (m_xCenter[i] == m_centers[j])
+      currentSum += m_distance[idx];
+      if (currentSum >= probDist)
         {
-        tmpMean = m_gmm->GetMean(j);
-        for (int k = 0; k < m_dataDim; k++)
-          {
-          tmpMean[k] = tmpMean[k] + m_x[i][k];
-          }
-        m_gmm->SetMean(j, tmpMean);
         break;
         }
       }
+
+    m_centers[i] = idx;
+    RunThreads(ADD_CENTER, i);
     }
-  // m_gmm->PrintParameters();
-  // getchar();
+
+  // Compute the size and the mean of each cluster
+  RunThreads(CLUSTER_MEANS);
+
+  int d = m_dataDim;
+  Gaussian::VectorType tmpMean(d);
   for (int i = 0; i < m_numOfClusters; i++)
     {
-    tmpMean = m_gmm->GetMean(i);
+    double count = 0;
+    tmpMean.fill(0.0);
+    for (int t = 0; t < m_numOfThreads; t++)
+      {
+      const double *sc = &m_threadStats[(t * m_numOfClusters + i) * (1 + d)];
+      count += sc[0];
+      for (int k = 0; k < d; k++)
+        tmpMean[k] += sc[k + 1];
+      }
+    m_xCounter[i] = (int) count;
 
     if(m_xCounter[i] > 0)
       {
@@ -135,39 +216,23 @@ void KMeansPlusPlus::Initialize(void)
     m_gmm->SetMean(i, tmpMean);
     }
 
-  double *radius = new double[m_numOfClusters];
-  for (int i = 0; i < m_numOfClusters; i++)
-    {
-    radius[i] = 0;
-    }
-  for (int i = 0; i < m_dataSize; i++)
-    {
-    for (int j = 0; j < m_numOfClusters; j++)
-      {
-      if (m_xCenter[i] == m_centers[j])
-        {
-        double dist = Distance(m_x[i], m_gmm->GetMean(j).data_block());
-        if (radius[j] < dist)
-          {
-          radius[j] = dist;
-          }
-        break;
-        }
-      }
-    }
+  // The covariance of each cluster is based on its radius
+  RunThreads(CLUSTER_RADII);
 
   Gaussian::MatrixType tmpcovar(m_dataDim, m_dataDim, 0);
   for (int i = 0; i < m_numOfClusters; i++)
     {
+    double radius = 0;
+    for (int t = 0; t < m_numOfThreads; t++)
+      radius = std::max(radius, m_threadStats[t * m_numOfClusters * (1 + d) + i]);
+
     for (int j = 0; j < m_dataDim; j++)
       {
-      tmpcovar(j,j) = radius[i];
+      tmpcovar(j,j) = radius;
       }
     m_gmm->SetCovariance(i, tmpcovar);
     }
 
-  delete[] radius;
-
   for (int i = 0; i < m_numOfClusters; i++)
     {
     m_gmm->SetWeight(i, 1.0/(double) m_numOfClusters);
@@ -3,18 +3,48 @@
 
 #include "GaussianMixtureModel.h"
 #include "SNAPCommon.h"
+#include "itkMultiThreader.h"
+#include <vector>
 
+/**
+ * K-means++ seeding of a Gaussian mixture model. The data are passed in as a
+ * contiguous buffer of dataSize rows of dataDim values. The passes over the
+ * data (updating the distance of each sample to its nearest center after a
+ * center is added, and computing the statistics of the clusters) are split
+ * over threads by ranges of samples. Each thread also keeps the sum of the
+ * distances in its range, so that the next center is drawn by scanning just
+ * one range.
+ */
 class KMeansPlusPlus
 {
 public:
-  KMeansPlusPlus(double **x, int dataSize, int dataDim, int numOfClusters);
+  KMeansPlusPlus(const float *x, int dataSize, int dataDim, int numOfClusters);
   ~KMeansPlusPlus();
 
-  double Distance(const double *x, const double *y);
+  double Distance(const float *x, const float *y);
   void Initialize(void);
   GaussianMixtureModel * GetGaussianMixtureModel(void);
 private:
-  double **m_x;
+
+  // The passes over the data run by the threads
+  enum Pass { ADD_CENTER, CLUSTER_MEANS, CLUSTER_RADII };
+
+  struct ThreadData
+  {
+    KMeansPlusPlus *Self;
+    Pass Step;
+    int Center;
+  };
+
+  void RunThreads(Pass step, int center = 0);
+  static ITK_THREAD_RETURN_TYPE ThreadCallback(void *arg);
+
+  // Get the range of samples processed by a thread
+  void GetChunk(int thread, int &first, int &last);
+
+  const float *m_x;
+
+  // Index of the cluster of each sample (not of the sample at its center)
   int *m_xCenter;
   int *m_centers;
   int *m_xCounter;
@@ -23,6 +53,12 @@ private:
   int m_dataDim;
   int m_numOfClusters;
   SmartPtr<GaussianMixtureModel> m_gmm;
+
+  // Number of threads, the sum of the distances in the range of each thread,
+  // and per-thread accumulators of the cluster statistics
+  int m_numOfThreads;
+  std::vector<double> m_threadDistSum;
+  std::vector<double> m_threadStats;
 };
 
 #endif
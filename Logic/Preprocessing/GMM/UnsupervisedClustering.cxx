@@ -12,7 +12,6 @@ UnsupervisedClustering::UnsupervisedClustering()
 {
   m_ClusteringEM = NULL;
   m_NumberOfClusters = 3;
-  m_DataArray = NULL;
   m_NumberOfSamples = 0;
 }
 
@@ -23,17 +22,6 @@ UnsupervisedClustering::~UnsupervisedClustering()
     delete m_ClusteringEM;
     delete m_ClusteringInitializer;
     }
-
-  if(m_DataArray)
-    {
-    // Delete the main data buffer
-    delete m_DataArray[0];
-
-    // Delete the pointers into the buffer
-    delete m_DataArray;
-    }
-
-
 }
 
 
@@ -59,15 +47,6 @@ void UnsupervisedClustering::SetMixtureModel(GaussianMixtureModel *model)
 
 void UnsupervisedClustering::SampleDataSource()
 {
-  if(m_DataArray)
-    {
-    // Delete the main data buffer
-    delete m_DataArray[0];
-
-    // Delete the pointers into the buffer
-    delete m_DataArray;
-    }
-
   // Figure out the number of data components
   unsigned int nComp = 0;
   for(LayerIterator lit = m_DataSource->GetLayers(
@@ -82,10 +61,8 @@ void UnsupervisedClustering::SampleDataSource()
   int nsam = (m_NumberOfSamples == 0) ? nvox : m_NumberOfSamples;
 
   // Create data structure for the EM code
-  m_DataArray = new double *[nsam];
-  double *buffer = new double[nsam * nComp];
-  for(int i = 0; i < nsam; i++, buffer+=nComp)
-    m_DataArray[i] = buffer;
+  m_DataArray.resize((size_t) nsam * nComp);
+  std::vector<double> voxel(nComp);
 
   // Create a random walk through the speed image, which should be initialized
   // at this point. We iterate over the speed image because we can easily access
@@ -119,10 +96,14 @@ void UnsupervisedClustering::SampleDataSource()
         !lit.IsAtEnd(); ++lit)
       {
       ImageWrapperBase *iw = lit.GetLayer();
-      iw->GetVoxelAsDouble(idx, m_DataArray[pVoxel] + iOffset);
+      iw->GetVoxelAsDouble(idx, &voxel[iOffset]);
       iOffset += iw->GetNumberOfComponents();
       }
 
+    float *sample = &m_DataArray[(size_t) pVoxel * nComp];
+    for(unsigned int i = 0; i < nComp; i++)
+      sample[i] = (float) voxel[i];
+
     // Store as a 'central' sample if in the central 60% of the image
     if(m_CenterSamples.size() < 400 && rcenter.IsInside(idx))
       {
@@ -166,7 +147,7 @@ void UnsupervisedClustering::InitializeEM()
   assert(m_DataSource);
 
   // Make sure samples exist
-  if(m_SamplesDirty || m_DataArray == NULL)
+  if(m_SamplesDirty || m_DataArray.empty())
     this->SampleDataSource();
 
   if(m_ClusteringEM)
@@ -177,12 +158,12 @@ void UnsupervisedClustering::InitializeEM()
 
   // Allocate the EM algorithm
   m_ClusteringEM = new EMGaussianMixtures(
-        m_DataArray, m_NumberOfVoxels,
+        &m_DataArray[0], m_NumberOfVoxels,
         m_NumberOfComponents, m_NumberOfClusters);
 
   // Allocate the K means ++
   m_ClusteringInitializer = new KMeansPlusPlus(
-        m_DataArray, m_NumberOfVoxels,
+        &m_DataArray[0], m_NumberOfVoxels,
         m_NumberOfComponents, m_NumberOfClusters);
 
   m_ClusteringInitializer->Initialize();
@@ -203,6 +184,7 @@ void UnsupervisedClustering::SortClustersByRelevance()
 {
   int ng = m_MixtureModel->GetNumberOfGaussians();
   vnl_vector<double> log_pdf(ng), log_w(ng), w(ng);
+  vnl_vector<double> x(m_NumberOfComponents), x_scratch(m_NumberOfComponents);
 
   // the array to sort
   typedef std::pair<double, int> RelevancePair;
@@ -219,9 +201,12 @@ void UnsupervisedClustering::SortClustersByRelevance()
   for(int i = 0; i < m_CenterSamples.size(); i++)
     {
     int s = m_CenterSamples[i];
+    for(int j = 0; j < m_NumberOfComponents; j++)
+      x[j] = m_DataArray[(size_t) s * m_NumberOfComponents + j];
+
     for(int k = 0; k < ng; k++)
       {
-      log_pdf[k] = m_MixtureModel->EvaluateLogPDF(k, m_DataArray[s]);
+      log_pdf[k] = m_MixtureModel->EvaluateLogPDF(k, x, x_scratch);
       }
 
     for(int k = 0; k < ng; k++)
@@ -4,6 +4,7 @@
 #include <itkObject.h>
 #include <itkObjectFactory.h>
 #include <SNAPCommon.h>
+#include <vector>
 
 class KMeansPlusPlus;
 class EMGaussianMixtures;
@@ -54,8 +55,8 @@ protected:
 
   bool m_SamplesDirty;
 
-  // TODO: probably double is larger than we need
-  double **m_DataArray;
+  // The samples, one row of m_NumberOfComponents values per sample
+  std::vector<float> m_DataArray;
 
   // A set of samples located near the center of the image, used to sort
   // initial clusters in terms of relevance to the user
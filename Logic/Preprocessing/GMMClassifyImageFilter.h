@@ -3,10 +3,19 @@
 
 #include "itkImageToImageFilter.h"
 #include "GaussianMixtureModel.h"
+#include <vector>
 
 /**
  * @brief A class that takes multiple multi-component images and uses a
  * Gaussian mixture model to combine them into a single probability map.
+ *
+ * By default the voxels are classified in blocks. The components of a block
+ * of voxels are copied from the input buffers into float arrays, one array
+ * per component, and each Gaussian is evaluated for the whole block using
+ * the inverse of the Cholesky factor of its covariance, which is computed
+ * once before the threads start. The inner loops run over the voxels of the
+ * block, so that the compiler can vectorize them. Gaussians with a singular
+ * covariance are still evaluated one voxel at a time.
  */
 template <class TInputImage, class TInputVectorImage, class TOutputImage>
 class GMMClassifyImageFilter :
@@ -54,6 +63,11 @@ public:
   /** We need to override this method because of multiple input types */
   void GenerateInputRequestedRegion() ITK_OVERRIDE;
 
+  /** Whether the voxels are classified in blocks (default) or one at a time */
+  itkSetMacro(UseBlockedEvaluation, bool)
+  itkGetMacro(UseBlockedEvaluation, bool)
+  itkBooleanMacro(UseBlockedEvaluation)
+
 protected:
 
   GMMClassifyImageFilter();
@@ -61,10 +75,58 @@ protected:
 
   void PrintSelf(std::ostream& os, itk::Indent indent) const ITK_OVERRIDE;
 
+  void BeforeThreadedGenerateData() ITK_OVERRIDE;
+
   void ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread,
                             itk::ThreadIdType threadId) ITK_OVERRIDE;
 
+  // Classify one voxel at a time
+  void VoxelwiseGenerateData(const OutputImageRegionType &region);
+
+  // Classify blocks of voxels
+  void BlockedGenerateData(const OutputImageRegionType &region);
+
+  // Number of voxels in a block
+  enum { BlockSize = 256 };
+
+  // A Gaussian with non-zero weight, prepared for blocked evaluation
+  struct BlockGaussian
+  {
+    // Index of the Gaussian in the mixture model
+    int Index;
+
+    // Whether the covariance has a Cholesky factor. If not, the Gaussian is
+    // evaluated one voxel at a time
+    bool Factored;
+
+    // The mean and the rows of the lower triangle of the inverse Cholesky
+    // factor, packed one after another
+    std::vector<float> Mean, InvChol;
+
+    // Log of the weight plus log of the normalization constant (just the
+    // log of the weight if not factored)
+    float LogScale;
+
+    // 1 for foreground, -1 for background
+    float Sign;
+  };
+
+  // Scratch arrays used by one thread, of size BlockSize per component or
+  // per Gaussian
+  struct BlockWorkspace
+  {
+    std::vector<float> X, R, Y, Q, A, Max, Num, Den;
+  };
+
+  // Compute the difference between the foreground and background posteriors
+  // of the first n voxels of a block whose components are in ws.X
+  void EvaluateBlock(int n, BlockWorkspace &ws, float *result);
+
   GaussianMixtureModel *m_MixtureModel;
+
+  bool m_UseBlockedEvaluation;
+
+  std::vector<BlockGaussian> m_BlockGaussians;
 };
 
 #ifndef ITK_MANUAL_INSTANTIATION
@@ -3,14 +3,18 @@
 
 #include "GMMClassifyImageFilter.h"
 #include "itkImageRegionConstIterator.h"
+#include "itkImageScanlineIterator.h"
 #include "EMGaussianMixtures.h"
 #include "ImageCollectionToImageFilter.h"
+#include <limits>
+#include <cmath>
 
 template <class TInputImage, class TInputVectorImage, class TOutputImage>
 GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
 ::GMMClassifyImageFilter()
 {
   m_MixtureModel = NULL;
+  m_UseBlockedEvaluation = true;
 }
 
 template <class TInputImage, class TInputVectorImage, class TOutputImage>
@@ -81,11 +85,274 @@ GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
   os << indent << "GMMClassifyImageFilter" << std::endl;
 }
 
+template <class TInputImage, class TInputVectorImage, class TOutputImage>
+void
+GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
+::BeforeThreadedGenerateData()
+{
+  assert(m_MixtureModel);
+  m_BlockGaussians.clear();
+  if(!m_UseBlockedEvaluation)
+    return;
+
+  int nComp = m_MixtureModel->GetNumberOfComponents();
+  for(int k = 0; k < m_MixtureModel->GetNumberOfGaussians(); k++)
+    {
+    // Gaussians with zero weight have zero posterior and do not affect the
+    // posteriors of the others
+    double w = m_MixtureModel->GetWeight(k);
+    if(w == 0)
+      continue;
+
+    BlockGaussian bg;
+    bg.Index = k;
+    bg.Sign = m_MixtureModel->IsForeground(k) ? 1.0f : -1.0f;
+
+    Gaussian::MatrixType Linv;
+    double log_norm;
+    bg.Factored = m_MixtureModel->GetGaussian(k)->ComputeInverseCholeskyFactor(Linv, log_norm);
+    if(bg.Factored)
+      {
+      const Gaussian::VectorType &mean = m_MixtureModel->GetMean(k);
+      for(int i = 0; i < nComp; i++)
+        {
+        bg.Mean.push_back((float) mean[i]);
+        for(int j = 0; j <= i; j++)
+          bg.InvChol.push_back((float) Linv(i,j));
+        }
+      bg.LogScale = (float) (log(w) + log_norm);
+      }
+    else
+      {
+      bg.LogScale = (float) log(w);
+      }
+
+    m_BlockGaussians.push_back(bg);
+    }
+}
+
 template <class TInputImage, class TInputVectorImage, class TOutputImage>
 void
 GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
 ::ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread,
                        itk::ThreadIdType threadId)
+{
+  if(m_UseBlockedEvaluation)
+    this->BlockedGenerateData(outputRegionForThread);
+  else
+    this->VoxelwiseGenerateData(outputRegionForThread);
+}
+
+template <class TInputImage, class TInputVectorImage, class TOutputImage>
+void
+GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
+::EvaluateBlock(int n, BlockWorkspace &ws, float *result)
+{
+  int nComp = m_MixtureModel->GetNumberOfComponents();
+  int nGauss = (int) m_BlockGaussians.size();
+  float *q = &ws.Q[0], *y = &ws.Y[0];
+
+  // Compute a_k = log(w_k * p_k(x)) for every Gaussian
+  for(int k = 0; k < nGauss; k++)
+    {
+    const BlockGaussian &bg = m_BlockGaussians[k];
+    float *a = &ws.A[k * BlockSize];
+
+    if(bg.Factored)
+      {
+      // Subtract the mean
+      for(int c = 0; c < nComp; c++)
+        {
+        const float *xc = &ws.X[c * BlockSize];
+        float *rc = &ws.R[c * BlockSize], mc = bg.Mean[c];
+        for(int t = 0; t < n; t++)
+          rc[t] = xc[t] - mc;
+        }
+
+      // The squared Mahalanobis distance is |Linv r|^2
+      for(int t = 0; t < n; t++)
+        q[t] = 0.0f;
+
+      const float *L = &bg.InvChol[0];
+      for(int i = 0; i < nComp; i++)
+        {
+        for(int t = 0; t < n; t++)
+          y[t] = 0.0f;
+
+        for(int j = 0; j <= i; j++, L++)
+          {
+          const float *rj = &ws.R[j * BlockSize];
+          float lij = *L;
+          for(int t = 0; t < n; t++)
+            y[t] += lij * rj[t];
+          }
+
+        for(int t = 0; t < n; t++)
+          q[t] += y[t] * y[t];
+        }
+
+      for(int t = 0; t < n; t++)
+        a[t] = bg.LogScale - 0.5f * q[t];
+      }
+    else
+      {
+      // Singular covariance, use the eigen-decomposition in Gaussian
+      vnl_vector<double> x(nComp), x_scratch(nComp);
+      Gaussian *g = m_MixtureModel->GetGaussian(bg.Index);
+      for(int t = 0; t < n; t++)
+        {
+        for(int c = 0; c < nComp; c++)
+          x[c] = ws.X[c * BlockSize + t];
+        a[t] = (float) (bg.LogScale + g->EvaluateLogPDF(x, x_scratch));
+        }
+      }
+    }
+
+  // Compute the posteriors relative to the largest a_k, which is numerically
+  // stable. Voxels where all a_k are -inf get zero
+  float *amax = &ws.Max[0], *num = &ws.Num[0], *den = &ws.Den[0];
+  const float neg_inf = -std::numeric_limits<float>::infinity();
+  for(int t = 0; t < n; t++)
+    {
+    amax[t] = neg_inf;
+    num[t] = den[t] = 0.0f;
+    }
+
+  for(int k = 0; k < nGauss; k++)
+    {
+    const float *a = &ws.A[k * BlockSize];
+    for(int t = 0; t < n; t++)
+      amax[t] = (a[t] > amax[t]) ? a[t] : amax[t];
+    }
+
+  for(int t = 0; t < n; t++)
+    amax[t] = (amax[t] > neg_inf) ? amax[t] : 0.0f;
+
+  for(int k = 0; k < nGauss; k++)
+    {
+    const float *a = &ws.A[k * BlockSize];
+    float sign = m_BlockGaussians[k].Sign;
+    for(int t = 0; t < n; t++)
+      {
+      float e = std::exp(a[t] - amax[t]);
+      den[t] += e;
+      num[t] += sign * e;
+      }
+    }
+
+  for(int t = 0; t < n; t++)
+    result[t] = (den[t] > 0.0f) ? num[t] / den[t] : 0.0f;
+}
+
+template <class TInputImage, class TInputVectorImage, class TOutputImage>
+void
+GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
+::BlockedGenerateData(const OutputImageRegionType &region)
+{
+  int nComp = m_MixtureModel->GetNumberOfComponents();
+  int nGauss = (int) m_BlockGaussians.size();
+  OutputImagePointer outputPtr = this->GetOutput(0);
+
+  // Get the buffer and the number of components of each input
+  std::vector<itk::ImageBase<ImageDimension> *> images;
+  std::vector<const InputComponentType *> buffers;
+  std::vector<int> ncomp;
+  for( itk::InputDataObjectIterator it( this ); !it.IsAtEnd(); it++ )
+    {
+    InputImageType *input = dynamic_cast< InputImageType * >( it.GetInput() );
+    InputVectorImageType *vecInput = dynamic_cast< InputVectorImageType * >( it.GetInput() );
+    if(input)
+      {
+      images.push_back(input);
+      buffers.push_back(input->GetBufferPointer());
+      ncomp.push_back(1);
+      }
+    else if(vecInput)
+      {
+      images.push_back(vecInput);
+      buffers.push_back(vecInput->GetBufferPointer());
+      ncomp.push_back(vecInput->GetNumberOfComponentsPerPixel());
+      }
+    }
+
+  // Allocate the scratch arrays
+  BlockWorkspace ws;
+  ws.X.resize(nComp * BlockSize);
+  ws.R.resize(nComp * BlockSize);
+  ws.A.resize(std::max(nGauss, 1) * BlockSize);
+  ws.Y.resize(BlockSize);
+  ws.Q.resize(BlockSize);
+  ws.Max.resize(BlockSize);
+  ws.Num.resize(BlockSize);
+  ws.Den.resize(BlockSize);
+  std::vector<float> result(BlockSize);
+
+  // The pieces of output lines that make up the current block
+  std::vector<std::pair<OutputPixelType *, int> > segments;
+  int nb = 0;
+
+  long len = region.GetSize(0);
+  std::vector<itk::OffsetValueType> offsets(images.size());
+  itk::ImageScanlineIterator<TOutputImage> it_out(outputPtr, region);
+  while(!it_out.IsAtEnd())
+    {
+    typename OutputImageType::IndexType idx = it_out.GetIndex();
+    OutputPixelType *out = outputPtr->GetBufferPointer() + outputPtr->ComputeOffset(idx);
+    for(unsigned int m = 0; m < images.size(); m++)
+      offsets[m] = images[m]->ComputeOffset(idx);
+
+    for(long t0 = 0; t0 < len; )
+      {
+      // Copy as much of the line as fits in the block, one array per component
+      int n = (int) std::min(len - t0, (long) (BlockSize - nb));
+      int c = 0;
+      for(unsigned int m = 0; m < images.size(); m++)
+        {
+        int nc = ncomp[m];
+        const InputComponentType *p = buffers[m] + (offsets[m] + t0) * nc;
+        for(int j = 0; j < nc && c < nComp; j++, c++)
+          {
+          float *xc = &ws.X[c * BlockSize + nb];
+          for(int t = 0; t < n; t++)
+            xc[t] = (float) p[t * nc + j];
+          }
+        }
+
+      segments.push_back(std::make_pair(out + t0, n));
+      nb += n;
+      t0 += n;
+
+      // Classify a full block and write it to the output lines
+      if(nb == BlockSize)
+        {
+        this->EvaluateBlock(nb, ws, &result[0]);
+        const float *r = &result[0];
+        for(unsigned int s = 0; s < segments.size(); s++)
+          for(int t = 0; t < segments[s].second; t++)
+            segments[s].first[t] = (OutputPixelType) (*r++ * 0x7fff);
+        segments.clear();
+        nb = 0;
+        }
+      }
+
+    it_out.NextLine();
+    }
+
+  // Classify the last partial block
+  if(nb > 0)
+    {
+    this->EvaluateBlock(nb, ws, &result[0]);
+    const float *r = &result[0];
+    for(unsigned int s = 0; s < segments.size(); s++)
+      for(int t = 0; t < segments[s].second; t++)
+        segments[s].first[t] = (OutputPixelType) (*r++ * 0x7fff);
+    }
+}
+
+template <class TInputImage, class TInputVectorImage, class TOutputImage>
+void
+GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
+::VoxelwiseGenerateData(const OutputImageRegionType &region)
 {
   // Get the number of inputs
   assert(m_MixtureModel);
@@ -97,7 +364,7 @@ GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
       TInputImage, TInputVectorImage> CollectionIter;
 
   typedef itk::ImageRegionIterator<TOutputImage> OutputIter;
-  OutputIter it_out(outputPtr, outputRegionForThread);
+  OutputIter it_out(outputPtr, region);
 
   vnl_vector<double> x(m_MixtureModel->GetNumberOfComponents());
   vnl_vector<double> x_scratch(m_MixtureModel->GetNumberOfComponents());
@@ -117,7 +384,7 @@ GMMClassifyImageFilter<TInputImage, TInputVectorImage, TOutputImage>
     }
 
   // Configure the input collection iterator
-  CollectionIter cit(outputRegionForThread);
+  CollectionIter cit(region);
   for( itk::InputDataObjectIterator it( this ); !it.IsAtEnd(); it++ )
     cit.AddImage(it.GetInput());
 
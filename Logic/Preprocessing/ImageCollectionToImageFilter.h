@@ -159,6 +159,10 @@ public:
   void GoToBegin() { m_InternalIter.GoToBegin(); }
   void GoToEnd() { m_InternalIter.GoToEnd(); }
 
+  /** Move to a voxel in the region, or get the index of the current voxel */
+  void SetIndex(const IndexType &index) { m_InternalIter.SetIndex(index); }
+  IndexType GetIndex() const { return m_InternalIter.GetIndex(); }
+
   /** Get a pointer to a component */
   InternalPixelType &Value(unsigned int comp)
   {
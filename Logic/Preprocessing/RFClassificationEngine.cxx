@@ -3,8 +3,7 @@
 
 #include "SNAPImageData.h"
 #include "ImageWrapper.h"
-#include "ImageCollectionToImageFilter.h"
-#include "RLEImageRegionIterator.h"
+#include "RFTrainingSampleCache.h"
 
 // Includes from the random forest library
 #include "Library/classification.h"
@@ -14,7 +13,7 @@ template <class TPixel, class TLabel, int VDim>
 RFClassificationEngine<TPixel,TLabel,VDim>::RFClassificationEngine()
 {
   m_DataSource = NULL;
-  m_Sample = NULL;
+  m_SampleCache = new RFTrainingSampleCache();
   m_Classifier = ClassifierType::New();
   m_ForestSize = 50;
   m_TreeDepth = 30;
@@ -25,8 +24,7 @@ RFClassificationEngine<TPixel,TLabel,VDim>::RFClassificationEngine()
 template <class TPixel, class TLabel, int VDim>
 RFClassificationEngine<TPixel,TLabel,VDim>::~RFClassificationEngine()
 {
-  if(m_Sample)
-    delete m_Sample;
+  delete m_SampleCache;
 }
 
 template <class TPixel, class TLabel, int VDim>
@@ -36,6 +34,7 @@ void RFClassificationEngine<TPixel,TLabel,VDim>::SetDataSource(SNAPImageData *im
     {
     // Copy the data source
     m_DataSource = imageData;
+    m_SampleCache->Clear();
 
     // Reset the classifier
     m_Classifier->Reset();
@@ -53,88 +52,29 @@ void RFClassificationEngine<TPixel,TLabel,VDim>:: TrainClassifier()
 {
   assert(m_DataSource && m_DataSource->IsMainLoaded());
 
-  typedef ImageCollectionConstRegionIteratorWithIndex<
-      AnatomicScalarImageWrapper::ImageType,
-      AnatomicImageWrapper::ImageType> CollectionIter;
-
-  // TODO: in the future, we should only recompute the sample when we know
-  // that the data has changed. However, currently, we are just going to
-  // compute a new sample every time
-
-  // Delete the sample
-  if(m_Sample)
-    delete m_Sample;
-
   // Get the segmentation image - which determines the samples
   // TODO: this is defaulting to the first image - is this correct?
   LabelImageWrapper *wrpSeg = m_DataSource->GetFirstSegmentationLayer();
-  LabelImageWrapper::ImagePointer imgSeg = wrpSeg->GetImage();
-  typedef itk::ImageRegionConstIteratorWithIndex<LabelImageWrapper::ImageType> LabelIter;
-
-  // Shrink the buffered region by radius because we can't handle BCs
-  itk::ImageRegion<3> reg = imgSeg->GetBufferedRegion();
-  reg.ShrinkByRadius(m_PatchRadius);
 
-  // We need to iterate throught the label image once to determine the
-  // number of samples to allocate.
-  unsigned long nSamples = 0;
-  for(LabelIter lit(imgSeg, reg); !lit.IsAtEnd(); ++lit)
-    if(lit.Value())
-      nSamples++;
-
-  // Create an iterator for going over all the anatomical image data
-  CollectionIter cit(reg);
-  cit.SetRadius(m_PatchRadius);
-
-  // Add all the anatomical images to this iterator
+  // Get all the anatomical images, from which the features are taken
+  std::vector<itk::DataObject *> images;
   for(LayerIterator it = m_DataSource->GetLayers(MAIN_ROLE | OVERLAY_ROLE);
       !it.IsAtEnd(); ++it)
     {
-    cit.AddImage(it.GetLayer()->GetImageBase());
+    images.push_back(it.GetLayer()->GetImageBase());
     }
 
-  // Get the number of components
-  int nComp = cit.GetTotalComponents();
-  int nPatch = cit.GetNeighborhoodSize();
-  int nColumns = nComp * nPatch;
-
-  // Are we using coordinate informtion
-  if(m_UseCoordinateFeatures)
-    nColumns += 3;
-
-  // Create a new sample
-  m_Sample = new SampleType(nSamples, nColumns);
-
-  // Now fill out the samples
-  int iSample = 0;
-  for(LabelIter lit(imgSeg, reg); !lit.IsAtEnd(); ++lit, ++cit)
-    {
-    LabelType label = lit.Value();
-    if(label)
-      {
-      // Fill in the data
-      std::vector<GreyType> &column = m_Sample->data[iSample];
-      int k = 0;
-      for(int i = 0; i < nComp; i++)
-        for(int j = 0; j < nPatch; j++)
-          column[k++] = cit.NeighborValue(i,j);
-
-      // Add the coordinate features if used
-      if(m_UseCoordinateFeatures)
-        for(int d = 0; d < 3; d++)
-          column[k++] = lit.GetIndex()[d];
-
-      // Fill in the label
-      m_Sample->label[iSample] = label;
-
-      ++iSample;
-      }
-    }
+  // Bring the cached samples up to date. Only the slices changed since the
+  // last training are compared, and only the features of voxels that have
+  // been labeled since then are extracted
+  m_SampleCache->SetFeatures(images, m_PatchRadius, m_UseCoordinateFeatures);
+  m_SampleCache->Update(wrpSeg->GetImage(), wrpSeg->GetLabelCountIndex());
+  SampleType *sample = m_SampleCache->GetSample();
 
   // Check that the sample has at least two distinct labels
   bool isValidSample = false;
-  for(int iSample = 1; iSample < m_Sample->Size(); iSample++)
-    if(m_Sample->label[iSample] != m_Sample->label[iSample-1])
+  for(int iSample = 1; iSample < sample->Size(); iSample++)
+    if(sample->label[iSample] != sample->label[iSample-1])
       { isValidSample = true; break; }
 
   // Now there is a valid sample. The text task is to train the classifier
@@ -156,8 +96,8 @@ void RFClassificationEngine<TPixel,TLabel,VDim>:: TrainClassifier()
   params.verbose = true;
 
   // Cap the number of training voxels at some reasonable number
-  if(m_Sample->Size() > 10000)
-    params.subSamplePercent = 100 * 10000.0 / m_Sample->Size();
+  if(sample->Size() > 10000)
+    params.subSamplePercent = 100 * 10000.0 / sample->Size();
   else
     params.subSamplePercent = 0;
 
@@ -188,7 +128,7 @@ void RFClassificationEngine<TPixel,TLabel,VDim>:: TrainClassifier()
 
   // Perform classifier training
   classification.Learning(
-        params, *m_Sample,
+        params, *sample,
         *m_Classifier->GetForest(),
         m_Classifier->GetValidLabel(),
         m_Classifier->GetClassToLabelMapping());
@@ -9,6 +9,7 @@
 template <class TPixel, class TLabel, int VDim> class RandomForestClassifier;
 template <class TData, class TLabel> class MLData;
 class SNAPImageData;
+class RFTrainingSampleCache;
 
 /**
  * This class serves as the high-level interface between ITK-SNAP and the
@@ -89,9 +90,9 @@ protected:
   // Are coordinates included as features
   bool m_UseCoordinateFeatures;
 
-  // Cached samples used to train the classifier
+  // Cached samples used to train the classifier, kept between trainings
   typedef MLData<GreyType, LabelType> SampleType;
-  SampleType *m_Sample;
+  RFTrainingSampleCache *m_SampleCache;
 
 };
 
@@ -0,0 +1,437 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: RFTrainingSampleCache.cxx,v $
+  Language:  C++
+  Date:      $Date: 2007/12/30 04:05:15 $
+  Version:   $Revision: 1.2 $
+  Copyright (c) 2007 Paul A. Yushkevich
+  
+  This file is part of ITK-SNAP 
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information. 
+
+=========================================================================*/
+#include "RFTrainingSampleCache.h"
+#include "ImageCollectionToImageFilter.h"
+#include "RLEImageOperations.h"
+#include "LabelCountIndex.h"
+
+// Includes from the random forest library
+#include "Library/data.h"
+
+#include <algorithm>
+
+typedef ImageCollectionConstRegionIteratorWithIndex<
+    AnatomicScalarImageWrapperTraits<GreyType>::ImageType,
+    AnatomicImageWrapperTraits<GreyType>::ImageType> SampleCollectionIter;
+
+// Visitor that collects the labeled runs of a slab
+struct LabeledRunCollector
+{
+  std::vector<RFTrainingSampleCache::Run> *runs;
+  LabeledRunCollector(std::vector<RFTrainingSampleCache::Run> *r) : runs(r) {}
+
+  void operator() (const itk::Index<3> &start, itk::SizeValueType length, LabelType label)
+  {
+    if(label)
+      {
+      RFTrainingSampleCache::Run run;
+      run.y = start[1];
+      run.x = start[0];
+      run.length = (long) length;
+      run.label = label;
+      runs->push_back(run);
+      }
+  }
+};
+
+RFTrainingSampleCache::RFTrainingSampleCache()
+{
+  m_Radius.Fill(0);
+  m_UseCoordinates = false;
+  m_NumberOfFeatures = 0;
+  m_Sample = NULL;
+  m_Index = NULL;
+  m_IndexTime = 0;
+}
+
+RFTrainingSampleCache::~RFTrainingSampleCache()
+{
+  if(m_Sample)
+    delete m_Sample;
+}
+
+void
+RFTrainingSampleCache
+::SetFeatures(const std::vector<itk::DataObject *> &images,
+              const RadiusType &radius, bool useCoordinates)
+{
+  std::vector<unsigned long> mtimes;
+  for(unsigned int i = 0; i < images.size(); i++)
+    mtimes.push_back(images[i]->GetMTime());
+
+  if(images != m_Images || mtimes != m_ImageMTimes
+     || radius != m_Radius || useCoordinates != m_UseCoordinates)
+    {
+    this->Clear();
+    m_Images = images;
+    m_ImageMTimes = mtimes;
+    m_Radius = radius;
+    m_UseCoordinates = useCoordinates;
+    }
+}
+
+void
+RFTrainingSampleCache
+::Clear()
+{
+  m_Slabs.clear();
+  m_Region = RegionType();
+  m_RowVoxel.clear();
+  m_FreeRows.clear();
+  if(m_Sample)
+    delete m_Sample;
+  m_Sample = NULL;
+}
+
+void
+RFTrainingSampleCache
+::Update(LabelImageType *seg, LabelCountIndex *index)
+{
+  // Count the features
+  RegionType reg = seg->GetBufferedRegion();
+  reg.ShrinkByRadius(m_Radius);
+
+  SampleCollectionIter cit(reg);
+  cit.SetRadius(m_Radius);
+  for(unsigned int i = 0; i < m_Images.size(); i++)
+    cit.AddImage(m_Images[i]);
+  int nFeatures = cit.GetTotalComponents() * cit.GetNeighborhoodSize();
+  if(m_UseCoordinates)
+    nFeatures += 3;
+
+  // Start over if the region (shrunk by radius because we can't handle BCs)
+  // or the number of features have changed
+  bool fresh = false;
+  if(!m_Sample || reg != m_Region || nFeatures != m_NumberOfFeatures)
+    {
+    this->Clear();
+    m_Region = reg;
+    m_NumberOfFeatures = nFeatures;
+    m_Sample = new SampleType(0, nFeatures);
+    fresh = true;
+    }
+  m_Slabs.resize(reg.GetSize(2));
+
+  // Find the slabs that may have changed since the last update. Without a
+  // complete record of the changes from the index, all slabs are compared
+  std::vector<long> candidates;
+  std::vector<itk::IndexValueType> changed;
+  if(index && index == m_Index && !fresh
+     && index->GetChangedSlices(m_IndexTime, changed))
+    {
+    for(size_t i = 0; i < changed.size(); i++)
+      {
+      long k = (long) (changed[i] - reg.GetIndex(2));
+      if(k >= 0 && k < (long) reg.GetSize(2))
+        candidates.push_back(k);
+      }
+    }
+  else
+    {
+    for(long k = 0; k < (long) reg.GetSize(2); k++)
+      candidates.push_back(k);
+    }
+
+  // Later updates only need the changes made from now on. The index is
+  // brought up to date first, so that its change record covers them
+  m_Index = index;
+  m_IndexTime = 0;
+  if(index)
+    {
+    index->Update();
+    m_IndexTime = index->GetChangeTime();
+    }
+
+  // Update the rows of the slabs whose labeled runs have changed
+  std::vector<long> dirty;
+  for(size_t i = 0; i < candidates.size(); i++)
+    {
+    long k = candidates[i];
+    RegionType rslab = reg;
+    rslab.SetIndex(2, reg.GetIndex(2) + k);
+    rslab.SetSize(2, 1);
+
+    std::vector<Run> runs;
+    LabeledRunCollector collector(&runs);
+    RLEImageOperations<LabelImageType>::ForEachRun(seg, rslab, collector);
+
+    if(runs != m_Slabs[k].Runs)
+      {
+      this->UpdateSlab(k, runs);
+      if(m_Slabs[k].Added.size())
+        dirty.push_back(k);
+      }
+    }
+
+  // Extract the features of the new voxels in parallel
+  if(dirty.size())
+    {
+    unsigned int nThreads = std::min(
+          (unsigned int) itk::MultiThreader::GetGlobalDefaultNumberOfThreads(),
+          (unsigned int) std::min(dirty.size(), (size_t) ITK_MAX_THREADS));
+
+    ExtractThreadData td;
+    td.Self = this;
+    td.Slices = &dirty;
+
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads(nThreads);
+    threader->SetSingleMethod(&RFTrainingSampleCache::ExtractThreaderCallback, &td);
+    threader->SingleMethodExecute();
+    }
+
+  // Remove the rows of the voxels that are no longer labeled
+  this->CompactRows();
+}
+
+void
+RFTrainingSampleCache
+::UpdateSlab(long k, std::vector<Run> &runs)
+{
+  Slab &slab = m_Slabs[k];
+  std::vector<unsigned long> rows;
+  slab.Added.clear();
+
+  // Walk the voxels of the old and the new runs together in raster order.
+  // (io, to) is the current old voxel and po its position in the slab
+  size_t io = 0;
+  long to = 0;
+  unsigned long po = 0, pn = 0;
+  for(size_t in = 0; in < runs.size(); in++)
+    {
+    const Run &rn = runs[in];
+    for(long t = 0; t < rn.length; t++, pn++)
+      {
+      long y = rn.y, x = rn.x + t;
+
+      // Old voxels that come before this one are no longer labeled
+      while(io < slab.Runs.size()
+            && (slab.Runs[io].y < y || (slab.Runs[io].y == y && slab.Runs[io].x + to < x)))
+        {
+        m_FreeRows.push_back(slab.Rows[po++]);
+        if(++to == slab.Runs[io].length)
+          { io++; to = 0; }
+        }
+
+      if(io < slab.Runs.size() && slab.Runs[io].y == y && slab.Runs[io].x + to == x)
+        {
+        // The voxel keeps its row, but its label may have changed
+        unsigned long row = slab.Rows[po++];
+        m_RowVoxel[row] = std::make_pair(k, pn);
+        rows.push_back(row);
+        if(++to == slab.Runs[io].length)
+          { io++; to = 0; }
+        }
+      else
+        {
+        // A new voxel, whose row is assigned below
+        if(slab.Added.size() && slab.Added.back().y == y
+           && slab.Added.back().x + slab.Added.back().length == x)
+          {
+          slab.Added.back().length++;
+          }
+        else
+          {
+          AddedRun ar;
+          ar.y = y; ar.x = x; ar.length = 1; ar.pos = pn;
+          slab.Added.push_back(ar);
+          }
+        rows.push_back(0);
+        }
+      }
+    }
+
+  // The remaining old voxels are no longer labeled
+  for(; po < slab.Rows.size(); po++)
+    m_FreeRows.push_back(slab.Rows[po]);
+
+  slab.Runs.swap(runs);
+  slab.Rows.swap(rows);
+
+  // Assign rows to the new voxels
+  for(size_t i = 0; i < slab.Added.size(); i++)
+    {
+    const AddedRun &ar = slab.Added[i];
+    for(long t = 0; t < ar.length; t++)
+      {
+      unsigned long p = ar.pos + t, row = this->AllocateRow();
+      slab.Rows[p] = row;
+      m_RowVoxel[row] = std::make_pair(k, p);
+      }
+    }
+
+  // Set the labels of all the voxels
+  unsigned long p = 0;
+  for(size_t r = 0; r < slab.Runs.size(); r++)
+    for(long t = 0; t < slab.Runs[r].length; t++, p++)
+      m_Sample->label[slab.Rows[p]] = slab.Runs[r].label;
+}
+
+unsigned long
+RFTrainingSampleCache
+::AllocateRow()
+{
+  if(m_FreeRows.size())
+    {
+    unsigned long row = m_FreeRows.back();
+    m_FreeRows.pop_back();
+    return row;
+    }
+
+  m_Sample->data.push_back(std::vector<GreyType>(m_NumberOfFeatures));
+  m_Sample->label.push_back(0);
+  m_RowVoxel.push_back(std::make_pair(0l, 0ul));
+  return m_Sample->data.size() - 1;
+}
+
+void
+RFTrainingSampleCache
+::CompactRows()
+{
+  if(m_FreeRows.empty())
+    return;
+
+  // Fill the lowest free rows with the highest rows in use
+  std::sort(m_FreeRows.begin(), m_FreeRows.end());
+  size_t lo = 0, hi = m_FreeRows.size();
+  unsigned long nRows = m_Sample->data.size();
+  while(lo < hi)
+    {
+    unsigned long last = nRows - 1;
+    if(m_FreeRows[hi - 1] == last)
+      {
+      hi--;
+      }
+    else
+      {
+      unsigned long row = m_FreeRows[lo++];
+      m_Sample->data[row].swap(m_Sample->data[last]);
+      m_Sample->label[row] = m_Sample->label[last];
+      m_RowVoxel[row] = m_RowVoxel[last];
+      m_Slabs[m_RowVoxel[row].first].Rows[m_RowVoxel[row].second] = row;
+      }
+    nRows--;
+    }
+
+  m_Sample->data.resize(nRows);
+  m_Sample->label.resize(nRows);
+  m_RowVoxel.resize(nRows);
+  m_FreeRows.clear();
+}
+
+ITK_THREAD_RETURN_TYPE
+RFTrainingSampleCache
+::ExtractThreaderCallback(void *arg)
+{
+  itk::MultiThreader::ThreadInfoStruct *info =
+      static_cast<itk::MultiThreader::ThreadInfoStruct *>(arg);
+  ExtractThreadData *td = static_cast<ExtractThreadData *>(info->UserData);
+  RFTrainingSampleCache *self = td->Self;
+
+  // Each thread uses its own iterator over the feature images
+  SampleCollectionIter cit(self->m_Region);
+  cit.SetRadius(self->m_Radius);
+  for(unsigned int i = 0; i < self->m_Images.size(); i++)
+    cit.AddImage(self->m_Images[i]);
+
+  int nComp = cit.GetTotalComponents();
+  int nPatch = cit.GetNeighborhoodSize();
+  int nFeatures = self->m_NumberOfFeatures;
+  std::vector<GreyType> column;
+
+  for(unsigned int s = info->ThreadID; s < td->Slices->size(); s += info->NumberOfThreads)
+    {
+    long k = (*td->Slices)[s];
+    Slab &slab = self->m_Slabs[k];
+
+    // The rows of the new voxels, in the order of the added runs
+    std::vector<std::vector<GreyType> *> rows;
+    for(size_t r = 0; r < slab.Added.size(); r++)
+      for(long t = 0; t < slab.Added[r].length; t++)
+        rows.push_back(&self->m_Sample->data[slab.Rows[slab.Added[r].pos + t]]);
+
+    // Fill in the features one column at a time, walking along the runs
+    itk::Index<3> idx;
+    idx[2] = self->m_Region.GetIndex(2) + k;
+    column.resize(rows.size());
+    int c = 0;
+    for(int i = 0; i < nComp; i++)
+      {
+      for(int j = 0; j < nPatch; j++, c++)
+        {
+        GreyType *p = column.size() ? &column[0] : NULL;
+        for(size_t r = 0; r < slab.Added.size(); r++)
+          {
+          const AddedRun &run = slab.Added[r];
+          idx[0] = run.x; idx[1] = run.y;
+          cit.SetIndex(idx);
+          for(long t = 0; t < run.length; t++, ++cit)
+            *p++ = cit.NeighborValue(i,j);
+          }
+
+        for(size_t q = 0; q < rows.size(); q++)
+          (*rows[q])[c] = column[q];
+        }
+      }
+
+    // Add the coordinate features if used
+    if(self->m_UseCoordinates)
+      {
+      size_t q = 0;
+      for(size_t r = 0; r < slab.Added.size(); r++)
+        {
+        const AddedRun &run = slab.Added[r];
+        for(long t = 0; t < run.length; t++, q++)
+          {
+          std::vector<GreyType> &row = *rows[q];
+          row[nFeatures - 3] = (GreyType) (run.x + t);
+          row[nFeatures - 2] = (GreyType) run.y;
+          row[nFeatures - 1] = (GreyType) idx[2];
+          }
+        }
+      }
+
+    slab.Added.clear();
+    }
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+unsigned long
+RFTrainingSampleCache
+::GetNumberOfSamples() const
+{
+  return m_Sample ? m_Sample->data.size() : 0;
+}
@@ -0,0 +1,186 @@
+/*=========================================================================
+
+  Program:   ITK-SNAP
+  Module:    $RCSfile: RFTrainingSampleCache.h,v $
+  Language:  C++
+  Date:      $Date: 2009/01/24 01:50:21 $
+  Version:   $Revision: 1.4 $
+  Copyright (c) 2007 Paul A. Yushkevich
+
+  This file is part of ITK-SNAP
+
+  ITK-SNAP is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  -----
+
+  Copyright (c) 2003 Insight Software Consortium. All rights reserved.
+  See ITKCopyright.txt or http://www.itk.org/HTML/Copyright.htm for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef RFTRAININGSAMPLECACHE_H
+#define RFTRAININGSAMPLECACHE_H
+
+#include "SNAPCommon.h"
+#include "ImageWrapperTraits.h"
+#include "itkMultiThreader.h"
+#include <vector>
+
+template <class TData, class TLabel> class MLData;
+namespace itk { class DataObject; }
+class LabelCountIndex;
+
+/**
+ * \class RFTrainingSampleCache
+ * \brief Training samples for the random forest, kept between trainings.
+ *
+ * The samples are the voxels of the segmentation with non-zero labels, and
+ * their features are the intensities of all components of the feature
+ * images in a patch around the voxel, optionally followed by the voxel
+ * coordinates. The labeled voxels are found from the runs of the RLE
+ * segmentation, one slice (slab) at a time.
+ *
+ * The samples are stored in a persistent sample, and each labeled voxel
+ * knows its row. When the segmentation changes, the runs of the slabs that
+ * the label count index of the segmentation reports as changed are compared
+ * with those of the last update (all slabs are compared if the index did not
+ * record every change). Rows of voxels that are no longer
+ * labeled are removed, voxels that are still labeled keep their row (and
+ * only their label is updated), and features are only extracted for the
+ * newly labeled voxels. Thus retraining after a few strokes only costs the
+ * voxels of those strokes. The features of the new voxels are extracted in
+ * parallel over slabs, column by column, so that each column is filled by
+ * reading consecutive voxels of one component along the runs.
+ *
+ * The features are kept in the rows of the sample rather than in columns,
+ * because the forest library reads the rows of MLData directly. Keeping the
+ * columns instead would mean transposing the whole sample into rows for
+ * every training, which costs as much as the copy that the incremental
+ * update avoids.
+ *
+ * Changing the feature images, the patch radius or the use of coordinates
+ * clears the cache.
+ */
+class RFTrainingSampleCache
+{
+public:
+
+  typedef LabelImageWrapperTraits::ImageType LabelImageType;
+  typedef itk::ImageRegion<3> RegionType;
+  typedef itk::Size<3> RadiusType;
+  typedef MLData<GreyType, LabelType> SampleType;
+
+  // A run of voxels with a non-zero label in a slab
+  struct Run
+  {
+    long y, x, length;
+    LabelType label;
+    bool operator == (const Run &r) const
+      { return y == r.y && x == r.x && length == r.length && label == r.label; }
+  };
+
+  RFTrainingSampleCache();
+  ~RFTrainingSampleCache();
+
+  /** Set the images from which features are taken, which must be scalar or
+   * vector images of GreyType with the same buffered region as the
+   * segmentation, along with the patch radius and the use of coordinates */
+  void SetFeatures(const std::vector<itk::DataObject *> &images,
+                   const RadiusType &radius, bool useCoordinates);
+
+  /** Bring the samples up to date with a segmentation. Samples are taken
+   * from voxels whose patch lies entirely inside of the image. If the label
+   * count index of the segmentation is given, only the slabs that it reports
+   * as changed since the last update are compared */
+  void Update(LabelImageType *seg, LabelCountIndex *index = NULL);
+
+  /** Number of samples found by the last update */
+  unsigned long GetNumberOfSamples() const;
+
+  /** Number of features of each sample */
+  int GetNumberOfFeatures() const { return m_NumberOfFeatures; }
+
+  /** Get the sample, in the row-wise form used by the forest library. The
+   * order of the rows is arbitrary. The sample is owned by the cache and is
+   * modified by the next update */
+  SampleType *GetSample() const { return m_Sample; }
+
+  /** Remove all samples */
+  void Clear();
+
+protected:
+
+  // A run of newly labeled voxels, with the position of its first voxel in
+  // the order of the voxels of the slab
+  struct AddedRun
+  {
+    long y, x, length;
+    unsigned long pos;
+  };
+
+  // The labeled voxels of one slice. Rows[p] is the row of the sample that
+  // holds the p-th voxel of the runs. Added holds the voxels whose features
+  // have not been extracted yet
+  struct Slab
+  {
+    std::vector<Run> Runs;
+    std::vector<unsigned long> Rows;
+    std::vector<AddedRun> Added;
+  };
+
+  // Data shared by the threads extracting slabs
+  struct ExtractThreadData
+  {
+    RFTrainingSampleCache *Self;
+    std::vector<long> *Slices;
+  };
+
+  // Update the rows of a slab for a new set of runs
+  void UpdateSlab(long k, std::vector<Run> &runs);
+
+  // Get a row for a new sample
+  unsigned long AllocateRow();
+
+  // Remove the free rows, moving the last rows of the sample into them
+  void CompactRows();
+
+  // Extract the features of the added voxels of the slabs
+  static ITK_THREAD_RETURN_TYPE ExtractThreaderCallback(void *arg);
+
+  // Feature images and parameters
+  std::vector<itk::DataObject *> m_Images;
+  std::vector<unsigned long> m_ImageMTimes;
+  RadiusType m_Radius;
+  bool m_UseCoordinates;
+  int m_NumberOfFeatures;
+
+  // Region from which samples are taken and the slabs along its z axis
+  RegionType m_Region;
+  std::vector<Slab> m_Slabs;
+
+  // The label count index used by the last update and its change time then
+  LabelCountIndex *m_Index;
+  unsigned long m_IndexTime;
+
+  // The samples, the slab and position of the voxel in each row, and the
+  // rows that are no longer used
+  SampleType *m_Sample;
+  std::vector<std::pair<long, unsigned long> > m_RowVoxel;
+  std::vector<unsigned long> m_FreeRows;
+};
+
+#endif // RFTRAININGSAMPLECACHE_H
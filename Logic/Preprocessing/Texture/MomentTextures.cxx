@@ -2,7 +2,10 @@
 #include "itkImage.h"
 #include "itkVectorImage.h"
 #include "itkImageRegionIteratorWithIndex.h"
+#include "itkImageRegionIterator.h"
 #include "itkNeighborhoodIterator.h"
+#include <vector>
+#include <algorithm>
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
@@ -11,11 +14,303 @@ const int MAX_VAL=100000;
 
 namespace bilwaj {
 
+// Reductions over a window along a line
+enum WindowOperation { WINDOW_SUM, WINDOW_MIN, WINDOW_MAX };
+
+// Replace each value in a buffer with dimensions 'ext' by the sum, minimum or
+// maximum of the values within radius r along axis d. Only the values whose
+// window lies inside of the buffer are replaced. Sums are accumulated in
+// double precision, whatever the type of the buffer
+template <class T>
+static void WindowFilter(std::vector<T> &buffer, const size_t *ext,
+                         unsigned int d, size_t r, WindowOperation op)
+{
+  size_t stride = 1;
+  for(unsigned int e = 0; e < d; e++)
+    stride *= ext[e];
+
+  size_t len = ext[d], nOuter = buffer.size() / (stride * len);
+  std::vector<double> line(len + 1);
+
+  for(size_t o = 0; o < nOuter; o++)
+    {
+    for(size_t in = 0; in < stride; in++)
+      {
+      T *p = &buffer[o * stride * len + in];
+      if(op == WINDOW_SUM)
+        {
+        // Running sums along the line
+        line[0] = 0.0;
+        for(size_t i = 0; i < len; i++)
+          line[i + 1] = line[i] + p[i * stride];
+        for(size_t i = r; i + r < len; i++)
+          p[i * stride] = static_cast<T>(line[i + r + 1] - line[i - r]);
+        }
+      else
+        {
+        for(size_t i = 0; i < len; i++)
+          line[i] = p[i * stride];
+        for(size_t i = r; i + r < len; i++)
+          {
+          double m = line[i - r];
+          for(size_t j = i - r + 1; j <= i + r; j++)
+            m = (op == WINDOW_MIN) ? std::min(m, line[j]) : std::max(m, line[j]);
+          p[i * stride] = static_cast<T>(m);
+          }
+        }
+      }
+    }
+}
+
+// Advance an index over a buffer with dimensions 'ext', first dimension fastest
+static void NextIndex(size_t *idx, const size_t *ext, unsigned int dim)
+{
+  for(unsigned int d = 0; d < dim; d++)
+    {
+    if(++idx[d] < ext[d])
+      return;
+    idx[d] = 0;
+    }
+}
+
+template <class TInputImage, class TOutputImage>
+void
+MomentTextureFilter<TInputImage, TOutputImage>
+::BoxSumGenerateData(const RegionType &region)
+{
+  const unsigned int dim = ImageDimension;
+  const InputImageType *input = this->GetInput();
+  RegionType inRegion = input->GetBufferedRegion();
+
+  // Number of voxels in the neighborhood
+  size_t nNbr = 1;
+  for(unsigned int d = 0; d < dim; d++)
+    nNbr *= 2 * m_Radius[d] + 1;
+  double n = (double) nNbr;
+
+  // Binomial coefficients and powers of the mean for the central moments
+  std::vector<double> binom(m_HighestDegree + 2), mpow(m_HighestDegree + 2);
+  std::vector<double> moments(m_HighestDegree + 1);
+  OutputPixelType out_pix(m_HighestDegree);
+
+  // Scratch buffers, reused by all the tiles. The sums are accumulated in
+  // double precision
+  std::vector<double> v, vpow, work, sums;
+  std::vector<float> vmin, vmax;
+  std::vector<size_t> offset, nbr;
+
+  // Go through the region in tiles, so that the scratch space does not
+  // depend on the size of the region
+  size_t nTiles[ImageDimension], tpos[ImageDimension], nTotal = 1;
+  for(unsigned int d = 0; d < dim; d++)
+    {
+    nTiles[d] = (region.GetSize(d) + BoxSumTileSize - 1) / BoxSumTileSize;
+    nTotal *= nTiles[d];
+    }
+
+  std::fill(tpos, tpos + dim, 0);
+  for(size_t t = 0; t < nTotal; t++, NextIndex(tpos, nTiles, dim))
+    {
+    RegionType chunk;
+    for(unsigned int d = 0; d < dim; d++)
+      {
+      size_t start = tpos[d] * BoxSumTileSize;
+      chunk.SetIndex(d, region.GetIndex(d) + (long) start);
+      chunk.SetSize(d, std::min((size_t) BoxSumTileSize, region.GetSize(d) - start));
+      }
+
+    // Dimensions of the tile padded by the radius
+    size_t ext[ImageDimension], stride[ImageDimension], nExt = 1, nLine = 0;
+    for(unsigned int d = 0; d < dim; d++)
+      {
+      ext[d] = chunk.GetSize(d) + 2 * m_Radius[d];
+      stride[d] = nExt;
+      nExt *= ext[d];
+      nLine += ext[d];
+      }
+
+    // Load the padded tile. Outside of the image, the values at the edge
+    // are repeated, like the boundary condition of the neighborhood iterator
+    v.resize(nExt);
+    vmin.resize(nExt);
+    size_t pos[ImageDimension];
+    std::fill(pos, pos + dim, 0);
+    typename InputImageType::IndexType idx;
+    for(size_t i = 0; i < nExt; i++, NextIndex(pos, ext, dim))
+      {
+      for(unsigned int d = 0; d < dim; d++)
+        {
+        long x = chunk.GetIndex(d) - (long) m_Radius[d] + (long) pos[d];
+        long x0 = inRegion.GetIndex(d), x1 = x0 + inRegion.GetSize(d) - 1;
+        idx[d] = std::max(x0, std::min(x1, x));
+        }
+      vmin[i] = static_cast<float>(input->GetPixel(idx));
+      v[i] = vmin[i];
+      }
+
+    // Minimum and maximum over the neighborhoods
+    vmax = vmin;
+    for(unsigned int d = 0; d < dim; d++)
+      {
+      WindowFilter(vmin, ext, d, m_Radius[d], WINDOW_MIN);
+      WindowFilter(vmax, ext, d, m_Radius[d], WINDOW_MAX);
+      }
+
+    // Shift the intensities to the middle of their range in the tile, which
+    // does not change the central moments but reduces round-off in the sums
+    double shift = 0.5 * (*std::min_element(v.begin(), v.end())
+                          + *std::max_element(v.begin(), v.end()));
+    for(size_t i = 0; i < nExt; i++)
+      v[i] -= shift;
+
+    // Offsets of the voxels of the tile in the padded buffer, and of the
+    // voxels of a neighborhood relative to its first voxel
+    size_t nChunk = chunk.GetNumberOfPixels(), size[ImageDimension], nsize[ImageDimension];
+    for(unsigned int d = 0; d < dim; d++)
+      {
+      size[d] = chunk.GetSize(d);
+      nsize[d] = 2 * m_Radius[d] + 1;
+      }
+
+    offset.resize(nChunk);
+    std::fill(pos, pos + dim, 0);
+    for(size_t j = 0; j < nChunk; j++, NextIndex(pos, size, dim))
+      {
+      offset[j] = 0;
+      for(unsigned int d = 0; d < dim; d++)
+        offset[j] += (pos[d] + m_Radius[d]) * stride[d];
+      }
+
+    nbr.resize(nNbr);
+    std::fill(pos, pos + dim, 0);
+    size_t corner = 0;
+    for(unsigned int d = 0; d < dim; d++)
+      corner += m_Radius[d] * stride[d];
+    for(size_t k = 0; k < nNbr; k++, NextIndex(pos, nsize, dim))
+      {
+      nbr[k] = 0;
+      for(unsigned int d = 0; d < dim; d++)
+        nbr[k] += pos[d] * stride[d];
+      }
+
+    // Box sums of the powers of the intensity, divided by the neighborhood
+    // size. The sums of power p for voxel j are in sums[(p - 1) * nChunk + j]
+    sums.resize(m_HighestDegree * nChunk);
+    vpow.assign(nExt, 1.0);
+    for(unsigned int p = 1; p <= m_HighestDegree; p++)
+      {
+      for(size_t i = 0; i < nExt; i++)
+        vpow[i] *= v[i];
+
+      work = vpow;
+      for(unsigned int d = 0; d < dim; d++)
+        WindowFilter(work, ext, d, m_Radius[d], WINDOW_SUM);
+
+      double *sp = &sums[(p - 1) * nChunk];
+      for(size_t j = 0; j < nChunk; j++)
+        sp[j] = work[offset[j]] / n;
+      }
+
+    // Compute the moments of each voxel
+    itk::ImageRegionIterator<OutputImageType> TexIt(this->GetOutput(), chunk);
+    for(size_t j = 0; j < nChunk; j++, ++TexIt)
+      {
+      // The range includes zero, as in the neighborhood computation
+      double lo = vmin[offset[j]], hi = vmax[offset[j]];
+      double range = std::max(hi, 0.0) - std::min(lo, 0.0);
+
+      // Without a range the moments are undefined
+      out_pix.Fill(0);
+      if(range > 0)
+        {
+        // The sums of the powers of the shifted intensities are accurate to
+        // about nLine * eps * far^q, where far is the largest shifted value
+        // in the neighborhood. The central moments are combinations of these
+        // sums with coefficients up to 2^q. Where this error would show in
+        // the output (1000 * moment / range^q), as near a flat dark region
+        // next to bright structures, the moments are taken directly about
+        // the mean of the neighborhood instead
+        double far = std::max(hi - shift, shift - lo) / range;
+        double err = 1000.0 * nLine * 1.0e-15;
+        for(unsigned int q = 1; q <= m_HighestDegree; q++)
+          err *= 2 * far;
+
+        if(err < 0.01)
+          {
+          double mean = sums[j];
+          mpow[0] = 1.0;
+          for(unsigned int p = 1; p <= m_HighestDegree; p++)
+            mpow[p] = -mean * mpow[p - 1];
+
+          // Expand the central moment of order q in terms of the raw moments
+          moments[1] = mean;
+          for(unsigned int q = 2; q <= m_HighestDegree; q++)
+            {
+            double moment = mpow[q];
+            binom[0] = 1.0;
+            for(unsigned int i = 1; i <= q; i++)
+              {
+              binom[i] = binom[i - 1] * (q - i + 1) / i;
+              moment += binom[i] * sums[(i - 1) * nChunk + j] * mpow[q - i];
+              }
+            moments[q] = moment;
+            }
+          }
+        else
+          {
+          const double *pv = &v[offset[j] - corner];
+          double mean = 0.0;
+          for(size_t k = 0; k < nNbr; k++)
+            mean += pv[nbr[k]];
+          mean /= n;
+
+          std::fill(moments.begin(), moments.end(), 0.0);
+          for(size_t k = 0; k < nNbr; k++)
+            {
+            double dv = pv[nbr[k]] - mean, dvq = dv;
+            for(unsigned int q = 2; q <= m_HighestDegree; q++)
+              {
+              dvq *= dv;
+              moments[q] += dvq;
+              }
+            }
+          for(unsigned int q = 2; q <= m_HighestDegree; q++)
+            moments[q] /= n;
+          moments[1] = mean;
+          }
+
+        // The first moment is just the mean
+        out_pix[0] = static_cast<OutputComponentType>(1000 * (moments[1] + shift) / range);
+
+        double rpow = range;
+        for(unsigned int q = 2; q <= m_HighestDegree; q++)
+          {
+          rpow *= range;
+          out_pix[q - 1] = static_cast<OutputComponentType>(1000 * moments[q] / rpow);
+          }
+        }
+
+      TexIt.Set(out_pix);
+      }
+    }
+}
+
 template <class TInputImage, class TOutputImage>
 void
 MomentTextureFilter<TInputImage, TOutputImage>
 ::ThreadedGenerateData(const RegionType & outputRegionForThread,
                        itk::ThreadIdType threadId)
+{
+  if(m_UseBoxSums)
+    this->BoxSumGenerateData(outputRegionForThread);
+  else
+    this->NeighborhoodGenerateData(outputRegionForThread);
+}
+
+template <class TInputImage, class TOutputImage>
+void
+MomentTextureFilter<TInputImage, TOutputImage>
+::NeighborhoodGenerateData(const RegionType & outputRegionForThread)
 {
   // Iterator for the output region
   typedef itk::ImageRegionIteratorWithIndex<OutputImageType> OutputIteratorType;
@@ -45,9 +45,19 @@ public:
   itkSetMacro(HighestDegree, unsigned int)
   itkGetMacro(HighestDegree, unsigned int)
 
+  /**
+   * Compute the moments from running box sums of the powers of the intensity
+   * (default). The time per voxel then does not depend on the radius. When
+   * off, the whole neighborhood of each voxel is visited. Both give the same
+   * textures up to rounding
+   */
+  itkSetMacro(UseBoxSums, bool)
+  itkGetMacro(UseBoxSums, bool)
+  itkBooleanMacro(UseBoxSums)
+
 protected:
 
-  MomentTextureFilter() : m_HighestDegree(2) { m_Radius.Fill(1); }
+  MomentTextureFilter() : m_HighestDegree(2), m_UseBoxSums(true) { m_Radius.Fill(1); }
   ~MomentTextureFilter() {}
 
   virtual void ThreadedGenerateData(const RegionType & outputRegionForThread,
@@ -55,12 +65,25 @@ protected:
 
   virtual void UpdateOutputInformation() ITK_OVERRIDE;
 
+  // Compute the textures by visiting the neighborhood of each voxel
+  void NeighborhoodGenerateData(const RegionType &region);
+
+  // Compute the textures from box sums of the powers of the intensity, one
+  // tile of the region at a time
+  void BoxSumGenerateData(const RegionType &region);
+
+  // Largest size of a tile along each dimension in BoxSumGenerateData
+  enum { BoxSumTileSize = 32 };
+
   // Highest degree for which to generate the textures
   unsigned int m_HighestDegree;
 
   // Radius of the neighborhood for texture generation
   SizeType m_Radius;
 
+  // Whether to use box sums
+  bool m_UseBoxSums;
+
 private:
 
   MomentTextureFilter(const Self &); //purposely not implemented
@@ -1,6 +1,7 @@
 #ifndef RLEImage_h
 #define RLEImage_h
 
+#include <algorithm> //std::swap
 #include <utility> //std::pair
 #include <vector>
 #include <itkImageBase.h>
@@ -180,6 +181,16 @@ public:
     /** We need to allow itk-style const iterators to be constructed. */
     typename BufferType::Pointer GetBuffer() const { return myBuffer; }
 
+    /** Exchange the pixel data with another image that has the same buffered
+    * region. Only the run buffers are exchanged, so this takes constant time.
+    * Neither image is marked as modified. */
+    void SwapBuffer(Self * other)
+    {
+        itkAssertOrThrowMacro(this->GetBufferedRegion() == other->GetBufferedRegion(),
+            "Images with different buffered regions can not exchange buffers.");
+        std::swap(myBuffer, other->myBuffer);
+    }
+
     /** Returns N-1-dimensional index, the remainder after 0-index is removed. */
     static inline typename BufferType::IndexType
         truncateIndex(const IndexType & index);
@@ -0,0 +1,188 @@
+#ifndef RLEImageOperations_h
+#define RLEImageOperations_h
+
+#include "RLEImage.h"
+#include <algorithm>
+
+/** Run visitor that does nothing. Used as the default for run operations. */
+struct RLENullRunVisitor
+{
+    template <typename TIndex, typename TPixel>
+    void operator()(const TIndex &, itk::SizeValueType, const TPixel &, const TPixel &) {}
+};
+
+/** Run-level operations on an RLEImage.
+* These operations manipulate the RLLine segments of the image directly,
+* rather than going through pixel iterators, which decode and re-encode runs
+* for every pixel. The cost of each operation is proportional to the number
+* of runs in the image, not the number of pixels. Lines that are modified are
+* cleaned up (adjacent segments with equal values merged) once per line.
+*
+* Operations that modify the image report every piece of every visited run
+* to a visitor, in the same order as a region iterator would traverse the
+* pixels, as visitor(start, length, old_value, new_value). This allows the
+* caller to build undo deltas or update label statistics as runs are edited.
+*
+* Operations that modify the image do not call Modified() on it; that is left
+* to the caller, since it may want to batch several operations.
+*/
+template <typename TImage>
+class RLEImageOperations
+{
+public:
+    typedef TImage                              ImageType;
+    typedef typename ImageType::PixelType       PixelType;
+    typedef typename ImageType::RLLine          RLLine;
+    typedef typename ImageType::RLSegment       RLSegment;
+    typedef typename ImageType::BufferType      BufferType;
+    typedef typename ImageType::IndexType       IndexType;
+    typedef typename ImageType::IndexValueType  IndexValueType;
+    typedef typename ImageType::RegionType      RegionType;
+    typedef itk::SizeValueType                  SizeValueType;
+
+    /** Call visitor(start, length, value) for each run of the image inside
+    * the region. Runs are clipped to the region along the X axis. */
+    template <typename TVisitor>
+    static void ForEachRun(const ImageType *image, const RegionType &region, TVisitor &visitor);
+
+    /** Count the pixels with the given value in the region */
+    static SizeValueType CountValue(const ImageType *image, const RegionType &region,
+                                    const PixelType &value);
+
+    /** Count the pixels with the given value in the whole buffered region */
+    static SizeValueType CountValue(const ImageType *image, const PixelType &value)
+    { return CountValue(image, image->GetBufferedRegion(), value); }
+
+    /** Compute the bounding box of the pixels in the region that have the
+    * given value or, if 'invert' is set, that do not have it. Returns false,
+    * leaving the box unchanged, if there are no such pixels. */
+    static bool ComputeBoundingBox(const ImageType *image, const RegionType &region,
+                                   const PixelType &value, bool invert, RegionType &box);
+
+    /** Replace all pixels with value 'oldValue' by 'newValue' in the whole
+    * image. Returns the number of pixels changed. */
+    static SizeValueType ReplaceValue(ImageType *image,
+                                      const PixelType &oldValue, const PixelType &newValue);
+
+    /** Replace each pixel value v in the region by f(v). The visitor is called
+    * for every piece of every run in the region. Returns the number of pixels
+    * whose value changed. */
+    template <typename TFunctor, typename TVisitor>
+    static SizeValueType TransformValues(ImageType *image, const RegionType &region,
+                                         TFunctor &f, TVisitor &visitor);
+
+    /** Replace each pixel value v by f(v), but only for the pixels in the
+    * region whose index satisfies dot(index, normal) - intercept > 0. Along
+    * each line the half-space is a single interval, so runs are only split at
+    * its two end points. The visitor is called for every piece of every run in
+    * the region, including the ones outside of the half-space. */
+    template <typename TFunctor, typename TVisitor>
+    static SizeValueType TransformHalfSpace(ImageType *image, const RegionType &region,
+                                            const double normal[3], double intercept,
+                                            TFunctor &f, TVisitor &visitor);
+
+    /** Fill the output image, over the given region, with 'inside' where the
+    * RLE image has the given value and 'outside' elsewhere. The region must be
+    * contained in the buffered regions of both images. This is the run-level
+    * equivalent of BinaryThresholdImageFilter with equal thresholds. */
+    template <typename TOutputImage>
+    static void MaskByValue(const ImageType *image, const RegionType &region,
+                            const PixelType &value, TOutputImage *output,
+                            typename TOutputImage::PixelType inside,
+                            typename TOutputImage::PixelType outside);
+
+    /** Merge adjacent segments with equal values in a line */
+    static void MergeLine(RLLine &line);
+
+protected:
+
+    /** Visitor used to count pixels with a value */
+    struct CountVisitor
+    {
+        PixelType value;
+        SizeValueType count;
+        CountVisitor(const PixelType &v) : value(v), count(0) {}
+        void operator()(const IndexType &, SizeValueType n, const PixelType &v)
+        { if (v == value) count += n; }
+    };
+
+    /** Visitor used to find the bounding box of pixels with (or without) a value */
+    struct BoundingBoxVisitor
+    {
+        PixelType value;
+        bool invert, found;
+        IndexType lower, upper;
+        BoundingBoxVisitor(const PixelType &v, bool inv) : value(v), invert(inv), found(false) {}
+        void operator()(const IndexType &start, SizeValueType n, const PixelType &v)
+        {
+            if ((v == value) == invert)
+                return;
+            IndexType last = start;
+            last[0] += n - 1;
+            for (unsigned int d = 0; d < ImageType::ImageDimension; d++)
+            {
+                lower[d] = found ? std::min(lower[d], start[d]) : start[d];
+                upper[d] = found ? std::max(upper[d], last[d]) : last[d];
+            }
+            found = true;
+        }
+    };
+
+    /** Visitor used to fill a mask image run by run */
+    template <typename TOutputImage>
+    struct MaskVisitor
+    {
+        typedef typename TOutputImage::PixelType OutputPixelType;
+        TOutputImage *output;
+        PixelType value;
+        OutputPixelType inside, outside;
+        MaskVisitor(TOutputImage *o, const PixelType &v, OutputPixelType in, OutputPixelType out)
+            : output(o), value(v), inside(in), outside(out) {}
+        void operator()(const IndexType &start, SizeValueType n, const PixelType &v)
+        {
+            OutputPixelType *p = output->GetBufferPointer() + output->ComputeOffset(start);
+            std::fill(p, p + n, v == value ? inside : outside);
+        }
+    };
+
+    /** Apply f to the pixels of a line in [applyBegin, applyEnd) and report the
+    * pieces in [visitBegin, visitEnd) to the visitor. Positions are relative to
+    * the start of the line, and lineStart is the image index of the first pixel
+    * of the line. Returns the number of changed pixels. */
+    template <typename TFunctor, typename TVisitor>
+    static SizeValueType TransformLine(RLLine &line, const IndexType &lineStart,
+                                       IndexValueType visitBegin, IndexValueType visitEnd,
+                                       IndexValueType applyBegin, IndexValueType applyEnd,
+                                       TFunctor &f, TVisitor &visitor);
+
+    /** Append a segment to a line, merging with the last segment if possible */
+    static void AppendSegment(RLLine &line, SizeValueType length, const PixelType &value)
+    {
+        if (!line.empty() && line.back().second == value)
+            line.back().first += length;
+        else
+            line.push_back(RLSegment(length, value));
+    }
+
+    /** Half-space test for TransformHalfSpace, evaluated in index order */
+    static bool InHalfSpace(IndexValueType x, double ty, double tz, double n0, double intercept)
+    {
+        return x * n0 + ty + tz - intercept > 0;
+    }
+
+    /** Get the index of the first pixel of the line at the buffer index */
+    static IndexType GetLineStart(const ImageType *image, const typename BufferType::IndexType &bi)
+    {
+        IndexType idx;
+        idx[0] = image->GetBufferedRegion().GetIndex(0);
+        for (unsigned int d = 1; d < ImageType::ImageDimension; d++)
+            idx[d] = bi[d - 1];
+        return idx;
+    }
+};
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "RLEImageOperations.txx"
+#endif
+
+#endif //RLEImageOperations_h
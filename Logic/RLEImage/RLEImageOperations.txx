@@ -0,0 +1,271 @@
+#ifndef RLEImageOperations_txx
+#define RLEImageOperations_txx
+
+#include "RLEImageOperations.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIteratorWithIndex.h"
+#include <algorithm>
+#include <cmath>
+
+template <typename TImage>
+template <typename TVisitor>
+void RLEImageOperations<TImage>
+::ForEachRun(const ImageType *image, const RegionType &region, TVisitor &visitor)
+{
+    if (region.GetNumberOfPixels() == 0)
+        return;
+
+    // X range of the region, relative to the start of the line
+    IndexValueType x0 = image->GetBufferedRegion().GetIndex(0);
+    IndexValueType rBegin = region.GetIndex(0) - x0;
+    IndexValueType rEnd = rBegin + region.GetSize(0);
+
+    itk::ImageRegionConstIteratorWithIndex<BufferType> bit(
+        image->GetBuffer(), ImageType::truncateRegion(region));
+    for (; !bit.IsAtEnd(); ++bit)
+    {
+        const RLLine &line = bit.Value();
+        IndexType start = GetLineStart(image, bit.GetIndex());
+
+        IndexValueType t = 0;
+        for (SizeValueType x = 0; x < line.size() && t < rEnd; x++)
+        {
+            IndexValueType a = std::max(t, rBegin);
+            t += line[x].first;
+            IndexValueType b = std::min(t, rEnd);
+            if (b > a)
+            {
+                start[0] = x0 + a;
+                visitor(start, (SizeValueType) (b - a), line[x].second);
+            }
+        }
+    }
+}
+
+template <typename TImage>
+typename RLEImageOperations<TImage>::SizeValueType
+RLEImageOperations<TImage>
+::CountValue(const ImageType *image, const RegionType &region, const PixelType &value)
+{
+    CountVisitor counter(value);
+    ForEachRun(image, region, counter);
+    return counter.count;
+}
+
+template <typename TImage>
+bool
+RLEImageOperations<TImage>
+::ComputeBoundingBox(const ImageType *image, const RegionType &region,
+                     const PixelType &value, bool invert, RegionType &box)
+{
+    BoundingBoxVisitor bbv(value, invert);
+    ForEachRun(image, region, bbv);
+    if (!bbv.found)
+        return false;
+
+    box.SetIndex(bbv.lower);
+    for (unsigned int d = 0; d < ImageType::ImageDimension; d++)
+        box.SetSize(d, bbv.upper[d] + 1 - bbv.lower[d]);
+    return true;
+}
+
+template <typename TImage>
+typename RLEImageOperations<TImage>::SizeValueType
+RLEImageOperations<TImage>
+::ReplaceValue(ImageType *image, const PixelType &oldValue, const PixelType &newValue)
+{
+    if (oldValue == newValue)
+        return 0;
+
+    SizeValueType nChanged = 0;
+    itk::ImageRegionIterator<BufferType> bit(
+        image->GetBuffer(), image->GetBuffer()->GetBufferedRegion());
+    for (; !bit.IsAtEnd(); ++bit)
+    {
+        RLLine &line = bit.Value();
+        bool lineChanged = false;
+        for (SizeValueType x = 0; x < line.size(); x++)
+        {
+            if (line[x].second == oldValue)
+            {
+                line[x].second = newValue;
+                nChanged += line[x].first;
+                lineChanged = true;
+            }
+        }
+
+        if (lineChanged && image->GetOnTheFlyCleanup())
+            MergeLine(line);
+    }
+    return nChanged;
+}
+
+template <typename TImage>
+template <typename TFunctor, typename TVisitor>
+typename RLEImageOperations<TImage>::SizeValueType
+RLEImageOperations<TImage>
+::TransformValues(ImageType *image, const RegionType &region, TFunctor &f, TVisitor &visitor)
+{
+    if (region.GetNumberOfPixels() == 0)
+        return 0;
+
+    IndexValueType rBegin = region.GetIndex(0) - image->GetBufferedRegion().GetIndex(0);
+    IndexValueType rEnd = rBegin + region.GetSize(0);
+
+    SizeValueType nChanged = 0;
+    itk::ImageRegionIteratorWithIndex<BufferType> bit(
+        image->GetBuffer(), ImageType::truncateRegion(region));
+    for (; !bit.IsAtEnd(); ++bit)
+    {
+        nChanged += TransformLine(bit.Value(), GetLineStart(image, bit.GetIndex()),
+                                  rBegin, rEnd, rBegin, rEnd, f, visitor);
+    }
+    return nChanged;
+}
+
+template <typename TImage>
+template <typename TFunctor, typename TVisitor>
+typename RLEImageOperations<TImage>::SizeValueType
+RLEImageOperations<TImage>
+::TransformHalfSpace(ImageType *image, const RegionType &region,
+                     const double normal[3], double intercept,
+                     TFunctor &f, TVisitor &visitor)
+{
+    if (region.GetNumberOfPixels() == 0)
+        return 0;
+
+    IndexValueType x0 = image->GetBufferedRegion().GetIndex(0);
+    IndexValueType rBegin = region.GetIndex(0) - x0;
+    IndexValueType rEnd = rBegin + region.GetSize(0);
+
+    SizeValueType nChanged = 0;
+    itk::ImageRegionIteratorWithIndex<BufferType> bit(
+        image->GetBuffer(), ImageType::truncateRegion(region));
+    for (; !bit.IsAtEnd(); ++bit)
+    {
+        IndexType start = GetLineStart(image, bit.GetIndex());
+
+        // The half-space test for the pixel at offset x in the line
+        double ty = start[1] * normal[1], tz = start[2] * normal[2];
+        double c = ty + tz - intercept;
+
+        // Find the interval [aBegin, aEnd) of the line inside the half-space.
+        // The estimate is refined using the same expression as a pixel-wise
+        // loop would use, so that the results are identical.
+        IndexValueType aBegin = rBegin, aEnd = rEnd;
+        if (normal[0] > 0)
+        {
+            double xs = -c / normal[0] - x0;
+            aBegin = (xs < rBegin) ? rBegin : (xs >= rEnd ? rEnd : (IndexValueType) std::floor(xs));
+            while (aBegin > rBegin && InHalfSpace(aBegin - 1 + x0, ty, tz, normal[0], intercept))
+                aBegin--;
+            while (aBegin < rEnd && !InHalfSpace(aBegin + x0, ty, tz, normal[0], intercept))
+                aBegin++;
+        }
+        else if (normal[0] < 0)
+        {
+            double xs = -c / normal[0] - x0;
+            aEnd = (xs < rBegin) ? rBegin : (xs >= rEnd ? rEnd : (IndexValueType) std::ceil(xs));
+            while (aEnd < rEnd && InHalfSpace(aEnd + x0, ty, tz, normal[0], intercept))
+                aEnd++;
+            while (aEnd > rBegin && !InHalfSpace(aEnd - 1 + x0, ty, tz, normal[0], intercept))
+                aEnd--;
+        }
+        else if (!InHalfSpace(0, ty, tz, 0.0, intercept))
+        {
+            aBegin = aEnd = rBegin;
+        }
+
+        nChanged += TransformLine(bit.Value(), start, rBegin, rEnd, aBegin, aEnd, f, visitor);
+    }
+    return nChanged;
+}
+
+template <typename TImage>
+template <typename TOutputImage>
+void RLEImageOperations<TImage>
+::MaskByValue(const ImageType *image, const RegionType &region,
+              const PixelType &value, TOutputImage *output,
+              typename TOutputImage::PixelType inside,
+              typename TOutputImage::PixelType outside)
+{
+    // Fill each run directly into the output buffer
+    MaskVisitor<TOutputImage> filler(output, value, inside, outside);
+    ForEachRun(image, region, filler);
+}
+
+template <typename TImage>
+void RLEImageOperations<TImage>
+::MergeLine(RLLine &line)
+{
+    if (line.size() < 2)
+        return;
+
+    SizeValueType k = 0;
+    for (SizeValueType x = 1; x < line.size(); x++)
+    {
+        if (line[x].second == line[k].second)
+            line[k].first += line[x].first;
+        else
+            line[++k] = line[x];
+    }
+    line.resize(k + 1);
+}
+
+template <typename TImage>
+template <typename TFunctor, typename TVisitor>
+typename RLEImageOperations<TImage>::SizeValueType
+RLEImageOperations<TImage>
+::TransformLine(RLLine &line, const IndexType &lineStart,
+                IndexValueType visitBegin, IndexValueType visitEnd,
+                IndexValueType applyBegin, IndexValueType applyEnd,
+                TFunctor &f, TVisitor &visitor)
+{
+    // Clamp the apply interval to the visit interval
+    applyBegin = std::min(std::max(applyBegin, visitBegin), visitEnd);
+    applyEnd = std::min(std::max(applyEnd, applyBegin), visitEnd);
+    IndexValueType cuts[4] = { visitBegin, applyBegin, applyEnd, visitEnd };
+
+    RLLine out;
+    out.reserve(line.size() + 4);
+
+    SizeValueType nChanged = 0;
+    IndexType start = lineStart;
+    IndexValueType t = 0;
+    for (SizeValueType x = 0; x < line.size(); x++)
+    {
+        const PixelType v = line[x].second;
+        IndexValueType p = t, end = t + line[x].first;
+
+        // Split the segment at the interval end points
+        while (p < end)
+        {
+            IndexValueType q = end;
+            for (int k = 0; k < 4; k++)
+                if (cuts[k] > p && cuts[k] < q)
+                    q = cuts[k];
+
+            PixelType nv = (p >= applyBegin && p < applyEnd) ? f(v) : v;
+            if (p >= visitBegin && p < visitEnd)
+            {
+                start[0] = lineStart[0] + p;
+                visitor(start, (SizeValueType) (q - p), v, nv);
+            }
+            if (nv != v)
+                nChanged += q - p;
+
+            AppendSegment(out, q - p, nv);
+            p = q;
+        }
+        t = end;
+    }
+
+    // Only replace the line if something actually changed
+    if (nChanged > 0)
+        line.swap(out);
+
+    return nChanged;
+}
+
+#endif //RLEImageOperations_txx
@@ -291,6 +291,16 @@ public:
   itkGetMacro(BypassMainInput, bool)
   itkSetMacro(BypassMainInput, bool)
 
+  /**
+   * Whether slices perpendicular to the x axis use an index of the cumulative
+   * run ends of every line, so that the run containing the slice is found
+   * by binary search rather than by scanning the line. The index is filled
+   * in while the first such slice is generated, and rebuilt when the image
+   * is modified. On by default.
+   */
+  itkGetMacro(UseRunIndex, bool)
+  itkSetMacro(UseRunIndex, bool)
+
 protected:
 
   IRISSlicer();
@@ -316,9 +326,16 @@ protected:
   virtual void CallCopyOutputRegionToInputRegion(InputImageRegionType &destRegion,
                                                  const OutputImageRegionType &srcRegion) ITK_OVERRIDE;
 
+  /** Generates the slice, splitting the rows of the volume that cross the
+    * slice between threads */
   void GenerateData() ITK_OVERRIDE;
-  //void ThreadedGenerateData(const OutputImageRegionType &outputRegionForThread,
-  //    itk::ThreadIdType threadId);
+
+  /** Generates the part of the slice that comes from the rows [begin, end)
+    * along the outer axis (y when slicing along z, z otherwise) */
+  void GenerateSliceRows(long begin, long end);
+
+  /** Thread callback for GenerateData */
+  static ITK_THREAD_RETURN_TYPE SliceThreaderCallback(void *arg);
 
   /** Uncompresses a RLE line into a buffer pointed by out.
     * After each pixel is written, adds stride to the pointer.
@@ -370,6 +387,21 @@ private:
   // Whether the main input should always be bypassed
   bool m_BypassMainInput;
 
+  // Whether to use the run index for slices along x
+  bool m_UseRunIndex;
+
+  // The input and the first output pixel of the slice being generated
+  const InputImageType *m_SliceInput;
+  TPixel *m_SliceOutput;
+
+  // Run index: the cumulative run ends of all lines, one line after another,
+  // and the position of each line in that array. The index is valid for the
+  // image and modified time below, and is filled while m_RunIndexFill is set
+  std::vector<CounterType> m_RunIndexEnds;
+  std::vector<size_t> m_RunIndexStart;
+  const InputImageType *m_RunIndexImage;
+  itk::ModifiedTimeType m_RunIndexMTime;
+  bool m_RunIndexFill;
 };
 
 #ifndef ITK_MANUAL_INSTANTIATION
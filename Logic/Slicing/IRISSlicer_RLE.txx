@@ -65,6 +65,16 @@ IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
 
   // Initialize to a zero slice index
   m_SliceIndex = 0;
+
+  m_BypassMainInput = false;
+
+  // The run index is built on demand
+  m_UseRunIndex = true;
+  m_SliceInput = NULL;
+  m_SliceOutput = NULL;
+  m_RunIndexImage = NULL;
+  m_RunIndexMTime = 0;
+  m_RunIndexFill = false;
 }
 
 template< typename TPixel, typename CounterType, class TOutputImage, class TPreviewImage>
@@ -196,8 +206,7 @@ void IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
 }
 
 #include "RLEImageRegionConstIterator.h"
-
-#define sign(forward) (forward ? 1 : -1)
+#include <algorithm>
 
 template< typename TPixel, typename CounterType, class TOutputImage, class TPreviewImage>
 void IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
@@ -218,35 +227,97 @@ void IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
 
   this->AllocateOutputs();
 
-  // Important: the size needs to be cast to long to avoid problems with
-  // pointer arithmetic on some MSVC versions!
-  long szVol[3];
-  szVol[0] = inputPtr->GetBufferedRegion().GetSize(0);
-  szVol[1] = inputPtr->GetBufferedRegion().GetSize(1);
-  szVol[2] = inputPtr->GetBufferedRegion().GetSize(2);
-
   // Also cast the output size to long
   long szSlice[2];
   szSlice[0] = outputPtr->GetBufferedRegion().GetSize(0);
   szSlice[1] = outputPtr->GetBufferedRegion().GetSize(1);
 
-  // The sign of the line and pixel traversal directions
-  int s_line = (m_LineTraverseForward) ? 1 : -1;
-  int s_pixel = (m_PixelTraverseForward) ? 1 : -1;
-
   typename TOutputImage::IndexType oStartInd;
   oStartInd[1] = (m_LineTraverseForward) ? 0 : szSlice[1] - 1;
   oStartInd[0] = (m_PixelTraverseForward) ? 0 : szSlice[0] - 1;
 
-  typename OutputImageType::PixelType *outSlice = &outputPtr->GetPixel(oStartInd);
+  m_SliceInput = inputPtr;
+  m_SliceOutput = &outputPtr->GetPixel(oStartInd);
+
+  // For slices along x, make sure that the run index is current. If not,
+  // allocate it here and let the threads fill it as they go
+  m_RunIndexFill = false;
+  if (m_SliceDirectionImageAxis == 0 && m_UseRunIndex
+      && (inputPtr != m_RunIndexImage || inputPtr->GetMTime() > m_RunIndexMTime))
+    {
+    const typename InputImageType::BufferType *buffer = inputPtr->GetBuffer();
+    size_t nLines = buffer->GetBufferedRegion().GetNumberOfPixels();
+    const typename InputImageType::RLLine *lines = buffer->GetBufferPointer();
+
+    m_RunIndexStart.resize(nLines + 1);
+    m_RunIndexStart[0] = 0;
+    for (size_t i = 0; i < nLines; i++)
+      m_RunIndexStart[i + 1] = m_RunIndexStart[i] + lines[i].size();
+    m_RunIndexEnds.resize(m_RunIndexStart[nLines]);
+
+    m_RunIndexFill = true;
+    m_RunIndexImage = inputPtr;
+    m_RunIndexMTime = inputPtr->GetMTime();
+    }
+
+  // Split the rows along the outer axis between the threads
+  long nRows = inputPtr->GetBufferedRegion().GetSize(
+        m_SliceDirectionImageAxis == 2 ? 1 : 2);
+  itk::MultiThreader *threader = this->GetMultiThreader();
+  threader->SetNumberOfThreads(
+        std::max(1, (int) std::min((long) this->GetNumberOfThreads(), nRows)));
+  threader->SetSingleMethod(&Self::SliceThreaderCallback, this);
+  threader->SingleMethodExecute();
+
+  m_RunIndexFill = false;
+  m_SliceInput = NULL;
+  m_SliceOutput = NULL;
+}
+
+template< typename TPixel, typename CounterType, class TOutputImage, class TPreviewImage>
+ITK_THREAD_RETURN_TYPE
+IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
+::SliceThreaderCallback(void *arg)
+{
+  typedef itk::MultiThreader::ThreadInfoStruct ThreadInfo;
+  ThreadInfo *info = static_cast<ThreadInfo *>(arg);
+  Self *self = static_cast<Self *>(info->UserData);
+
+  long nRows = self->m_SliceInput->GetBufferedRegion().GetSize(
+        self->m_SliceDirectionImageAxis == 2 ? 1 : 2);
+  long nt = info->NumberOfThreads, t = info->ThreadID;
+  long begin = (nRows * t) / nt, end = (nRows * (t + 1)) / nt;
+  if (begin < end)
+    self->GenerateSliceRows(begin, end);
+
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template< typename TPixel, typename CounterType, class TOutputImage, class TPreviewImage>
+void IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
+::GenerateSliceRows(long begin, long end)
+{
+  const InputImageType *inputPtr = m_SliceInput;
+  const typename InputImageType::BufferType *buffer = inputPtr->GetBuffer();
+  TPixel *outSlice = m_SliceOutput;
+
+  // Important: the size needs to be cast to long to avoid problems with
+  // pointer arithmetic on some MSVC versions!
+  long szVol[3];
+  szVol[0] = inputPtr->GetBufferedRegion().GetSize(0);
+  szVol[1] = inputPtr->GetBufferedRegion().GetSize(1);
+  szVol[2] = inputPtr->GetBufferedRegion().GetSize(2);
+
+  // The sign of the line and pixel traversal directions
+  long s_line = (m_LineTraverseForward) ? 1 : -1;
+  long s_pixel = (m_PixelTraverseForward) ? 1 : -1;
 
   if (m_SliceDirectionImageAxis == 2) //slicing along z
     {
-#pragma omp parallel for
-    for (int y = 0; y < szVol[1]; y++)
+    for (long y = begin; y < end; y++)
       {
-      typename InputImageType::BufferType::IndexType lineIndex = { { y, (int) m_SliceIndex } };
-      const typename InputImageType::RLLine & line = inputPtr->GetBuffer()->GetPixel(lineIndex);
+      typename InputImageType::BufferType::IndexType lineIndex = { { y, (long) m_SliceIndex } };
+      const typename InputImageType::RLLine & line = buffer->GetPixel(lineIndex);
       if (m_LineDirectionImageAxis == 1) //y is line coordinate
         {
         assert(m_PixelDirectionImageAxis == 0); //x is pixel coordinate
@@ -263,11 +334,10 @@ void IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
     }
   else if (m_SliceDirectionImageAxis == 1) //slicing along y
     {
-#pragma omp parallel for
-    for (int z = 0; z < szVol[2]; z++)
+    for (long z = begin; z < end; z++)
       {
-      typename InputImageType::BufferType::IndexType lineIndex = { { (int) m_SliceIndex, z } };
-      const typename InputImageType::RLLine & line = inputPtr->GetBuffer()->GetPixel(lineIndex);
+      typename InputImageType::BufferType::IndexType lineIndex = { { (long) m_SliceIndex, z } };
+      const typename InputImageType::RLLine & line = buffer->GetPixel(lineIndex);
       if (m_LineDirectionImageAxis == 2) //z is line coordinate
         {
         assert(m_PixelDirectionImageAxis == 0); //x is pixel coordinate
@@ -285,32 +355,46 @@ void IRISSlicer<RLEImage<TPixel, 3, CounterType>, TOutputImage, TPreviewImage>
   else //slicing along x, the low-preformance case
     {
     assert(m_SliceDirectionImageAxis == 0);
-#pragma omp parallel for
-    for (int z = 0; z < szVol[2]; z++)
-      for (int y = 0; y < szVol[1]; y++)
+    if (m_LineDirectionImageAxis != 1 && m_LineDirectionImageAxis != 2)
+      throw itk::ExceptionObject(__FILE__, __LINE__, "SliceDirectionImageAxis and SliceDirectionImageAxis cannot both have a value of 0!", __FUNCTION__);
+
+    const typename InputImageType::RLLine *lines = buffer->GetBufferPointer();
+    for (long z = begin; z < end; z++)
+      for (long y = 0; y < szVol[1]; y++)
         {
-        typename InputImageType::BufferType::IndexType lineIndex = { { y, z } };
-        const typename InputImageType::RLLine & line = inputPtr->GetBuffer()->GetPixel(lineIndex);
-        int t = 0;
-        for (int x = 0; x < line.size(); x++)
+        long li = y + z * szVol[1];
+        const typename InputImageType::RLLine & line = lines[li];
+
+        // Find the run that contains the slice
+        size_t r = 0;
+        if (m_UseRunIndex)
           {
-          t += line[x].first;
-          if (t > m_SliceIndex)
+          // The lines of this thread are filled in by this thread
+          CounterType *ends = m_RunIndexEnds.empty() ? NULL : &m_RunIndexEnds[m_RunIndexStart[li]];
+          if (m_RunIndexFill)
             {
-            if (m_LineDirectionImageAxis == 2) //z is line coordinate
-              {
-              assert(m_PixelDirectionImageAxis == 1); //y is pixel coordinate
-              *(outSlice + s_line*z*szVol[1] + s_pixel *y) = line[x].second;;
-              }
-            else if (m_LineDirectionImageAxis == 1) //y is line coordinate
-              {
-              assert(m_PixelDirectionImageAxis == 2); //z is pixel coordinate
-              *(outSlice + s_pixel*z + s_line *y*szVol[2]) = line[x].second;
-              }
-            else
-              throw itk::ExceptionObject(__FILE__, __LINE__, "SliceDirectionImageAxis and SliceDirectionImageAxis cannot both have a value of 0!", __FUNCTION__);
-            break;
+            CounterType t = 0;
+            for (size_t x = 0; x < line.size(); x++)
+              ends[x] = (t += line[x].first);
             }
+          r = std::upper_bound(ends, ends + line.size(), (CounterType) m_SliceIndex) - ends;
+          }
+        else
+          {
+          long t = line[0].first;
+          while (t <= (long) m_SliceIndex)
+            t += line[++r].first;
+          }
+
+        if (m_LineDirectionImageAxis == 2) //z is line coordinate
+          {
+          assert(m_PixelDirectionImageAxis == 1); //y is pixel coordinate
+          *(outSlice + s_line*z*szVol[1] + s_pixel *y) = line[r].second;
+          }
+        else //y is line coordinate
+          {
+          assert(m_PixelDirectionImageAxis == 2); //z is pixel coordinate
+          *(outSlice + s_pixel*z + s_line *y*szVol[2]) = line[r].second;
           }
         }
     }
@@ -46,6 +46,7 @@
 #include "itkImageToImageFilter.h"
 #include "itkTransform.h"
 #include "itkDataObjectDecorator.h"
+#include <vector>
 
 using itk::DataObjectDecorator;
 using itk::ProcessObject;
@@ -177,7 +178,15 @@ private:
 
 
 /**
- * An specialization of the traits class for RLE images
+ * An specialization of the traits class for RLE images. Labels are always
+ * sampled with nearest neighbor interpolation. The value at a sample is found
+ * on the run-length line through it without decompressing the line: the
+ * cumulative ends of the runs of the line are computed, and the run holding
+ * the sample is found by binary search. The run ends of recently visited lines
+ * are kept in a fixed number of cache slots, so the memory used does not
+ * depend on the size of the image. Consecutive samples along an output line
+ * usually fall on the same image line, and then the run is found by stepping
+ * from the run of the previous sample.
  */
 template <typename TPixel, typename CounterType, typename TOutputImage>
 class NonOrthogonalSlicerPixelAccessTraitsWorker<
@@ -188,15 +197,39 @@ public:
   typedef RLEImage<TPixel, 3, CounterType> InputImageType;
   typedef typename TOutputImage::InternalPixelType OutputComponentType;
 
-  NonOrthogonalSlicerPixelAccessTraitsWorker(InputImageType *adaptor) {}
+  NonOrthogonalSlicerPixelAccessTraitsWorker(InputImageType *image);
   ~NonOrthogonalSlicerPixelAccessTraitsWorker() {}
 
-  inline void ProcessVoxel(double *cix, bool use_nn, OutputComponentType **out_ptr)
-  {
-    assert(0);
-  }
+  inline void ProcessVoxel(double *cix, bool use_nn, OutputComponentType **out_ptr);
+
+  inline void SkipVoxels(int n, OutputComponentType **out_ptr);
+
+protected:
+
+  typedef typename InputImageType::RLLine RLLine;
+
+  // Get the cumulative run ends of a line, computing them if needed
+  const CounterType *GetRunEnds(long line);
 
-  inline void SkipVoxels(int n, OutputComponentType **out_ptr) {}
+  // The run-length lines of the image, and the extents of the image
+  const RLLine *m_Lines;
+  long m_Start[3], m_Size[3];
+
+  // Cumulative run ends of a recently visited line. A line is kept in the
+  // slot given by the low bits of its index, replacing the line there before
+  enum { LineCacheSize = 4096 };
+  struct CachedLine
+  {
+    long Line;
+    std::vector<CounterType> RunEnds;
+  };
+  std::vector<CachedLine> m_LineCache;
+
+  // The line and the run of the last sample
+  long m_CurrentLine;
+  const RLLine *m_CurrentLinePtr;
+  const CounterType *m_CurrentEnds;
+  size_t m_CurrentRun;
 };
 
 
@@ -46,6 +46,7 @@
 #include "NonOrthogonalSlicer.h"
 #include "FastLinearInterpolator.h"
 #include "ImageRegionConstIteratorWithIndexOverride.h"
+#include <algorithm>
 
 template <class TInputImage, class TOutputImage>
 NonOrthogonalSlicer<TInputImage, TOutputImage>
@@ -312,6 +313,100 @@ NonOrthogonalSlicerPixelAccessTraitsWorker<TInputImage, TOutputImage>
 }
 
 
+/*
+ * Traits for RLE images
+ */
+template <typename TPixel, typename CounterType, typename TOutputImage>
+NonOrthogonalSlicerPixelAccessTraitsWorker<RLEImage<TPixel, 3, CounterType>, TOutputImage>
+::NonOrthogonalSlicerPixelAccessTraitsWorker(InputImageType *image)
+{
+  // The buffered region always consists of whole lines
+  typename InputImageType::RegionType region = image->GetBufferedRegion();
+  for(int d = 0; d < 3; d++)
+    {
+    m_Start[d] = region.GetIndex(d);
+    m_Size[d] = region.GetSize(d);
+    }
+
+  m_Lines = image->GetBuffer()->GetBufferPointer();
+  m_LineCache.resize(LineCacheSize);
+  for(size_t i = 0; i < m_LineCache.size(); i++)
+    m_LineCache[i].Line = -1;
+
+  m_CurrentLine = -1;
+  m_CurrentLinePtr = NULL;
+  m_CurrentEnds = NULL;
+  m_CurrentRun = 0;
+}
+
+template <typename TPixel, typename CounterType, typename TOutputImage>
+const CounterType *
+NonOrthogonalSlicerPixelAccessTraitsWorker<RLEImage<TPixel, 3, CounterType>, TOutputImage>
+::GetRunEnds(long line)
+{
+  CachedLine &cl = m_LineCache[line & (LineCacheSize - 1)];
+  if(cl.Line != line)
+    {
+    const RLLine &rl = m_Lines[line];
+    cl.Line = line;
+    cl.RunEnds.resize(rl.size());
+    CounterType x = 0;
+    for(size_t r = 0; r < rl.size(); r++)
+      {
+      x += rl[r].first;
+      cl.RunEnds[r] = x;
+      }
+    }
+
+  return &cl.RunEnds[0];
+}
+
+template <typename TPixel, typename CounterType, typename TOutputImage>
+void
+NonOrthogonalSlicerPixelAccessTraitsWorker<RLEImage<TPixel, 3, CounterType>, TOutputImage>
+::ProcessVoxel(double *cix, bool itkNotUsed(use_nn), OutputComponentType **out_ptr)
+{
+  long x = (long) floor(cix[0] + 0.5) - m_Start[0];
+  long y = (long) floor(cix[1] + 0.5) - m_Start[1];
+  long z = (long) floor(cix[2] + 0.5) - m_Start[2];
+
+  if(x < 0 || x >= m_Size[0] || y < 0 || y >= m_Size[1] || z < 0 || z >= m_Size[2])
+    {
+    *(*out_ptr)++ = 0;
+    return;
+    }
+
+  long line = y + z * m_Size[1];
+  if(line != m_CurrentLine)
+    {
+    // Find the run by binary search on the run ends
+    m_CurrentLine = line;
+    m_CurrentLinePtr = m_Lines + line;
+    m_CurrentEnds = this->GetRunEnds(line);
+    m_CurrentRun = std::upper_bound(
+          m_CurrentEnds, m_CurrentEnds + m_CurrentLinePtr->size(), (CounterType) x)
+        - m_CurrentEnds;
+    }
+  else
+    {
+    // Step from the run of the last sample
+    while(x >= (long) m_CurrentEnds[m_CurrentRun])
+      ++m_CurrentRun;
+    while(m_CurrentRun > 0 && x < (long) m_CurrentEnds[m_CurrentRun - 1])
+      --m_CurrentRun;
+    }
+
+  *(*out_ptr)++ = static_cast<OutputComponentType>((*m_CurrentLinePtr)[m_CurrentRun].second);
+}
+
+template <typename TPixel, typename CounterType, typename TOutputImage>
+void
+NonOrthogonalSlicerPixelAccessTraitsWorker<RLEImage<TPixel, 3, CounterType>, TOutputImage>
+::SkipVoxels(int n, OutputComponentType **out_ptr)
+{
+  for(int i = 0; i < n; i++)
+    *(*out_ptr)++ = 0;
+}
 
 /*
  * Traits for the component extracting image adaptor. Note that in the call to the
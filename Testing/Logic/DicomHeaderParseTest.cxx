@@ -0,0 +1,174 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkImageFileWriter.h>
+#include <itkGDCMImageIO.h>
+#include <itkMetaDataObject.h>
+#include <itkMultiThreader.h>
+#include <itkTimeProbe.h>
+#include "itksys/SystemTools.hxx"
+#include "SNAPCommon.h"
+#include "GuidedNativeImageIO.h"
+#include "PerformanceTestUtilities.h"
+
+typedef itk::Image<short, 2> SliceImageType;
+typedef GuidedNativeImageIO::DicomDirectoryParseResult ParseResult;
+
+// Root of the UIDs of the generated files
+static const string uidRoot = "1.2.826.0.1.3680043.2.1125.99.";
+
+// Write one slice of a series as a DICOM file
+void writeSlice(const string &filename, int series, int slice, int size, const string &desc)
+{
+    SliceImageType::RegionType region;
+    region.SetSize(0, size);
+    region.SetSize(1, size);
+    SliceImageType::Pointer image = SliceImageType::New();
+    image->SetRegions(region);
+    image->Allocate();
+    image->FillBuffer((short) (100 * series + slice));
+
+    ostringstream seriesUID, instanceUID, number, position;
+    seriesUID << uidRoot << "1." << series;
+    instanceUID << uidRoot << "2." << series << "." << slice;
+    number << series;
+    position << "0\\0\\" << slice;
+
+    itk::MetaDataDictionary dict;
+    itk::EncapsulateMetaData<string>(dict, "0020|000e", seriesUID.str());
+    itk::EncapsulateMetaData<string>(dict, "0008|0018", instanceUID.str());
+    itk::EncapsulateMetaData<string>(dict, "0008|103e", desc);
+    itk::EncapsulateMetaData<string>(dict, "0020|0011", number.str());
+    itk::EncapsulateMetaData<string>(dict, "0020|0032", position.str());
+    image->SetMetaDataDictionary(dict);
+
+    itk::GDCMImageIO::Pointer io = itk::GDCMImageIO::New();
+    io->KeepOriginalUIDOn();
+    io->SetMetaDataDictionary(dict);
+
+    typedef itk::ImageFileWriter<SliceImageType> WriterType;
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetImageIO(io);
+    writer->SetFileName(filename.c_str());
+    writer->SetInput(image);
+    writer->Update();
+}
+
+string sliceFile(const string &dir, int series, int slice)
+{
+    ostringstream oss;
+    oss << dir << "/s" << series << "_" << slice << ".dcm";
+    return oss.str();
+}
+
+// Parse the directory with the given number of threads, and report the time
+ParseResult parse(const string &dir, unsigned int nt, double &ms)
+{
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(nt);
+    SmartPtr<GuidedNativeImageIO> io = GuidedNativeImageIO::New();
+
+    itk::TimeProbe tp;
+    tp.Start();
+    io->ParseDicomDirectory(dir);
+    tp.Stop();
+    ms = elapsedMs(tp);
+    return io->GetLastDicomParseResult();
+}
+
+// Number of series that differ between two parse results, in their files or
+// in their metadata
+double countDifferences(const ParseResult &a, const ParseResult &b)
+{
+    double n = 0;
+    for (ParseResult::SeriesMapType::const_iterator it = a.SeriesMap.begin(); it != a.SeriesMap.end(); ++it)
+    {
+        ParseResult::SeriesMapType::const_iterator jt = b.SeriesMap.find(it->first);
+        if (jt == b.SeriesMap.end()
+            || it->second.FileList != jt->second.FileList
+            || it->second.MetaData != jt->second.MetaData)
+            n++;
+    }
+    for (ParseResult::SeriesMapType::const_iterator jt = b.SeriesMap.begin(); jt != b.SeriesMap.end(); ++jt)
+        if (a.SeriesMap.find(jt->first) == a.SeriesMap.end())
+            n++;
+    return n;
+}
+
+//parse a directory of DICOM files with one and with several threads, and
+//with and without the header index, and check that the series are the same
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage:\n" << argv[0] << " OutputDirectory [threads] [slices]" << endl;
+        return 1;
+    }
+    unsigned int nt = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    int nSlices = 100;
+    if (argc > 2)
+        nt = atoi(argv[2]);
+    if (argc > 3)
+        nSlices = atoi(argv[3]);
+
+    string dir = string(argv[1]) + "/DicomHeaderParseTest";
+    string dicomDir = dir + "/dicom", indexDir = dir + "/index";
+    itksys::SystemTools::RemoveADirectory(dir.c_str());
+    itksys::SystemTools::MakeDirectory(dicomDir.c_str());
+
+    // Three series, the last of which has slices of two sizes and so is split
+    // in two by the rows and columns, and a file that is not DICOM
+    for (int i = 0; i < nSlices; i++)
+    {
+        writeSlice(sliceFile(dicomDir, 1, i), 1, i, 32, "T1 axial");
+        writeSlice(sliceFile(dicomDir, 2, i), 2, i, 32, "T2 axial");
+        writeSlice(sliceFile(dicomDir, 3, i), 3, i, i % 2 ? 48 : 32, "Mixed sizes");
+    }
+    ofstream readme((dicomDir + "/README.txt").c_str());
+    readme << "Not a DICOM file" << endl;
+    readme.close();
+
+    // Parse without the index, with one and with several threads
+    GuidedNativeImageIO::SetDicomHeaderIndexDirectory("");
+    double tSerial, tThreaded, tIndex, tFresh;
+    ParseResult serial = parse(dicomDir, 1, tSerial);
+    ParseResult threaded = parse(dicomDir, nt, tThreaded);
+
+    ostringstream threads;
+    threads << nt << " threads";
+    bool ok = (serial.SeriesMap.size() == 4);
+    ok = reportComparison("headers", "1 thread", tSerial, threads.str().c_str(), tThreaded,
+                          countDifferences(serial, threaded), 0) && ok;
+
+    // The first parse with the index writes it, and the second reads it
+    GuidedNativeImageIO::SetDicomHeaderIndexDirectory(indexDir);
+    parse(dicomDir, nt, tFresh);
+    ParseResult indexed = parse(dicomDir, nt, tIndex);
+    ok = reportComparison("index", "no index", tThreaded, "index", tIndex,
+                          countDifferences(serial, indexed), 0) && ok;
+
+    // Replace a file by one of another series, and remove another file. Only
+    // these must be read again, and the result must match a parse without
+    // the index
+    writeSlice(sliceFile(dicomDir, 1, 0), 4, 0, 64, "Localizer");
+    itksys::SystemTools::RemoveFile(sliceFile(dicomDir, 2, 1).c_str());
+
+    indexed = parse(dicomDir, nt, tIndex);
+    GuidedNativeImageIO::SetDicomHeaderIndexDirectory("");
+    ParseResult fresh = parse(dicomDir, nt, tFresh);
+    ok = (fresh.SeriesMap.size() == 5) && ok;
+    ok = reportComparison("changed files", "no index", tFresh, "index", tIndex,
+                          countDifferences(fresh, indexed), 0) && ok;
+
+    if (!ok)
+    {
+        cerr << "DICOM series differ between serial, threaded and indexed parses" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+
+using namespace std;
+
+#include <itkMultiThreader.h>
+#include <itkTimeProbe.h>
+#include <vnl/algo/vnl_cholesky.h>
+#include "GaussianMixtureModel.h"
+#include "KMeansPlusPlus.h"
+#include "EMGaussianMixtures.h"
+#include "PerformanceTestUtilities.h"
+
+// Time k-means++ seeding in ms
+double seed(const vector<float> &data, int nSamples, int nComp, int nGauss)
+{
+    itk::TimeProbe tp;
+    tp.Start();
+    KMeansPlusPlus kmeans(&data[0], nSamples, nComp, nGauss);
+    kmeans.Initialize();
+    tp.Stop();
+    return elapsedMs(tp);
+}
+
+// Run EM from the given model and return the time taken in ms
+double cluster(const vector<float> &data, int nSamples, int nComp, int nGauss, int nIter,
+               GaussianMixtureModel *init, GaussianMixtureModel::Pointer &result)
+{
+    itk::TimeProbe tp;
+    tp.Start();
+    EMGaussianMixtures em(&data[0], nSamples, nComp, nGauss);
+    em.SetGaussianMixtureModel(init);
+    for (int i = 0; i < nIter; i++)
+        em.UpdateOnce();
+    tp.Stop();
+
+    result = em.GetGaussianMixtureModel();
+    return elapsedMs(tp);
+}
+
+//time k-means++ and EM with one thread and with the default threads, and
+//check that the threaded EM finds the same model
+int main(int argc, char *argv[])
+{
+    int nSamples = 1000000, nComp = 3, nGauss = 5, nIter = 5;
+    if (argc > 1)
+        nSamples = atoi(argv[1]);
+    if (argc > 2)
+        nComp = atoi(argv[2]);
+    if (argc > 3)
+        nGauss = atoi(argv[3]);
+    if (argc > 4)
+        nIter = atoi(argv[4]);
+
+    // Draw the samples from a random mixture
+    srand(1234);
+    GaussianMixtureModel::Pointer truth = makeRandomMixtureModel(nComp, nGauss);
+    vector<float> data((size_t) nSamples * nComp);
+    vector<vnl_matrix<double> > L(nGauss);
+    for (int k = 0; k < nGauss; k++)
+        L[k] = vnl_cholesky(truth->GetCovariance(k)).lower_triangle();
+    vnl_vector<double> z(nComp), x(nComp);
+    for (int i = 0; i < nSamples; i++)
+    {
+        int k = rand() % nGauss;
+        for (int j = 0; j < nComp; j++)
+            z[j] = rndn();
+        x = truth->GetMean(k) + L[k] * z;
+        for (int j = 0; j < nComp; j++)
+            data[(size_t) i * nComp + j] = (float) x[j];
+    }
+
+    // Start EM from a perturbed model, the same for both runs
+    GaussianMixtureModel::Pointer init = makeRandomMixtureModel(nComp, nGauss);
+
+    int nThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    GaussianMixtureModel::Pointer serial, threaded;
+
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(1);
+    double tSeedSerial = seed(data, nSamples, nComp, nGauss);
+    double tSerial = cluster(data, nSamples, nComp, nGauss, nIter, init, serial);
+
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads(nThreads);
+    double tSeedThreaded = seed(data, nSamples, nComp, nGauss);
+    double tThreaded = cluster(data, nSamples, nComp, nGauss, nIter, init, threaded);
+
+    // The runs only differ in the order in which the sums are added up
+    double maxdiff = 0;
+    for (int k = 0; k < nGauss; k++)
+    {
+        for (int i = 0; i < nComp; i++)
+        {
+            double ms = serial->GetMean(k)[i], mt = threaded->GetMean(k)[i];
+            maxdiff = max(maxdiff, fabs(ms - mt) / max(1.0, fabs(ms)));
+            for (int j = 0; j < nComp; j++)
+            {
+                double cs = serial->GetCovariance(k)(i, j), ct = threaded->GetCovariance(k)(i, j);
+                maxdiff = max(maxdiff, fabs(cs - ct) / max(1.0, fabs(cs)));
+            }
+        }
+    }
+
+    cout << nSamples << " samples, " << nGauss << " clusters, " << nThreads << " threads" << endl;
+    cout << "k-means++: 1 thread " << tSeedSerial << " ms, threaded " << tSeedThreaded
+         << " ms (speedup " << tSeedSerial / tSeedThreaded << ")" << endl;
+    ostringstream name;
+    name << "EM, " << nIter << " iterations";
+    bool ok = reportComparison(name.str(), "1 thread", tSerial, "threaded", tThreaded, maxdiff, 1e-6);
+
+    if (!ok)
+        cerr << "Threaded EM differs from single-threaded EM" << endl;
+    return ok ? 0 : 1;
+}
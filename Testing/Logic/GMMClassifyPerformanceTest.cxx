@@ -0,0 +1,101 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkVectorImage.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkTimeProbe.h>
+#include "GaussianMixtureModel.h"
+#include "GMMClassifyImageFilter.h"
+#include "PerformanceTestUtilities.h"
+
+typedef itk::Image<short, 3> ScalarImageType;
+typedef itk::VectorImage<short, 3> VectorImageType;
+typedef itk::Image<short, 3> OutputImageType;
+typedef GMMClassifyImageFilter<ScalarImageType, VectorImageType, OutputImageType> FilterType;
+
+// Classify the inputs and return the time taken in ms
+double classify(ScalarImageType *scalar, VectorImageType *vector, GaussianMixtureModel *gmm,
+                bool blocked, OutputImageType::Pointer &result)
+{
+    FilterType::Pointer filter = FilterType::New();
+    filter->AddScalarImage(scalar);
+    filter->AddVectorImage(vector);
+    filter->SetMixtureModel(gmm);
+    filter->SetUseBlockedEvaluation(blocked);
+
+    itk::TimeProbe tp;
+    tp.Start();
+    filter->Update();
+    tp.Stop();
+
+    result = filter->GetOutput();
+    return elapsedMs(tp);
+}
+
+//time the GMM classification of a multi-channel image per voxel and in blocks
+int main(int argc, char *argv[])
+{
+    int size = 128, nVecComp = 3, maxGauss = 10;
+    if (argc > 1)
+        size = atoi(argv[1]);
+    if (argc > 2)
+        nVecComp = atoi(argv[2]);
+    if (argc > 3)
+        maxGauss = atoi(argv[3]);
+
+    // Create a scalar and a vector image with random intensities
+    srand(1234);
+    ScalarImageType::RegionType region;
+    region.SetSize(0, size);
+    region.SetSize(1, size);
+    region.SetSize(2, size);
+
+    ScalarImageType::Pointer scalar = ScalarImageType::New();
+    scalar->SetRegions(region);
+    scalar->Allocate();
+    for (itk::ImageRegionIterator<ScalarImageType> it(scalar, region); !it.IsAtEnd(); ++it)
+        it.Set((short) (1000 * rnd()));
+
+    VectorImageType::Pointer vector = VectorImageType::New();
+    vector->SetRegions(region);
+    vector->SetNumberOfComponentsPerPixel(nVecComp);
+    vector->Allocate();
+    VectorImageType::PixelType pix(nVecComp);
+    for (itk::ImageRegionIterator<VectorImageType> it(vector, region); !it.IsAtEnd(); ++it)
+    {
+        for (int i = 0; i < nVecComp; i++)
+            pix[i] = (short) (1000 * rnd());
+        it.Set(pix);
+    }
+
+    // The results should agree up to the rounding of the output values
+    bool consistent = true;
+    for (int nGauss = 2; nGauss <= maxGauss; nGauss += 4)
+    {
+        GaussianMixtureModel::Pointer gmm = makeRandomMixtureModel(nVecComp + 1, nGauss);
+
+        OutputImageType::Pointer outVoxel, outBlock;
+        double tVoxel = classify(scalar, vector, gmm, false, outVoxel);
+        double tBlock = classify(scalar, vector, gmm, true, outBlock);
+
+        itk::ImageRegionConstIterator<OutputImageType> ia(outVoxel, region), ib(outBlock, region);
+        int maxdiff = 0;
+        for (; !ia.IsAtEnd(); ++ia, ++ib)
+            maxdiff = max(maxdiff, abs((int) ia.Get() - (int) ib.Get()));
+
+        ostringstream name;
+        name << nGauss << " clusters";
+        consistent = reportComparison(name.str(), "per voxel", tVoxel, "blocked", tBlock,
+                                      maxdiff, 2) && consistent;
+    }
+
+    if (!consistent)
+        cerr << "Blocked classification differs from per-voxel classification" << endl;
+    return consistent ? 0 : 1;
+}
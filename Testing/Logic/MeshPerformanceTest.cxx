@@ -0,0 +1,218 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <map>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+#include <itkCommand.h>
+#include <itkMultiThreader.h>
+#include <itkTimeProbe.h>
+#include <vtkPolyData.h>
+#include <vtkIdList.h>
+#include <itkImageRegionConstIterator.h>
+#include "RLERegionOfInterestImageFilter.h"
+#include "MultiLabelMeshPipeline.h"
+#include "MeshOptions.h"
+
+typedef itk::Image<LabelType, 3> Seg3DImageType;
+typedef MultiLabelMeshPipeline::InputImageType RLEImage3D;
+
+RLEImage3D::Pointer loadImage(const char *filename, map<LabelType, double> &volumes)
+{
+    typedef itk::ImageFileReader<Seg3DImageType> SegReaderType;
+    SegReaderType::Pointer sr = SegReaderType::New();
+    sr->SetFileName(filename);
+    sr->Update();
+
+    // Volume of each label: the number of voxels times the volume of a voxel
+    Seg3DImageType *seg = sr->GetOutput();
+    double voxel = seg->GetSpacing()[0] * seg->GetSpacing()[1] * seg->GetSpacing()[2];
+    for (itk::ImageRegionConstIterator<Seg3DImageType> it(seg, seg->GetBufferedRegion()); !it.IsAtEnd(); ++it)
+        if (it.Get())
+            volumes[it.Get()] += voxel;
+
+    typedef itk::RegionOfInterestImageFilter<Seg3DImageType, RLEImage3D> inConverterType;
+    inConverterType::Pointer inConv = inConverterType::New();
+    inConv->SetInput(seg);
+    inConv->SetRegionOfInterest(seg->GetLargestPossibleRegion());
+    inConv->Update();
+    return inConv->GetOutput();
+}
+
+// Check that a mesh is closed and consistently oriented, i.e., that every
+// edge is traversed as often in one direction as in the other, and return
+// the volume that it encloses, which is positive for outward facing normals
+bool checkSurface(vtkPolyData *mesh, double &volume)
+{
+    map<pair<vtkIdType, vtkIdType>, int> edges;
+    vtkIdList *ids = vtkIdList::New();
+    volume = 0.0;
+    for (vtkIdType c = 0; c < mesh->GetNumberOfCells(); c++)
+    {
+        mesh->GetCellPoints(c, ids);
+        vtkIdType n = ids->GetNumberOfIds();
+        for (vtkIdType j = 0; j < n; j++)
+        {
+            vtkIdType a = ids->GetId(j), b = ids->GetId((j + 1) % n);
+            edges[make_pair(min(a, b), max(a, b))] += (a < b) ? 1 : -1;
+        }
+
+        // Signed volume of the tetrahedra between the origin and a fan of
+        // triangles covering the cell
+        double p0[3], p1[3], p2[3];
+        mesh->GetPoint(ids->GetId(0), p0);
+        for (vtkIdType j = 1; j + 1 < n; j++)
+        {
+            mesh->GetPoint(ids->GetId(j), p1);
+            mesh->GetPoint(ids->GetId(j + 1), p2);
+            volume += (p0[0] * (p1[1] * p2[2] - p1[2] * p2[1])
+                       + p0[1] * (p1[2] * p2[0] - p1[0] * p2[2])
+                       + p0[2] * (p1[0] * p2[1] - p1[1] * p2[0])) / 6.0;
+        }
+    }
+    ids->Delete();
+
+    for (map<pair<vtkIdType, vtkIdType>, int>::const_iterator it = edges.begin(); it != edges.end(); ++it)
+        if (it->second != 0)
+            return false;
+    return true;
+}
+
+// Check the discrete meshes of all labels. The volumes are only compared
+// with the voxel volumes if the vertices have not been relaxed
+bool checkDiscreteMeshes(const char *name, MultiLabelMeshPipeline *pipeline,
+                         const map<LabelType, double> &volumes, bool checkVolume)
+{
+    const MultiLabelMeshPipeline::MeshInfoMap &mim = pipeline->GetMeshInfo();
+    bool ok = (mim.size() == volumes.size());
+    double maxError = 0.0;
+    for (MultiLabelMeshPipeline::MeshInfoMap::const_iterator it = mim.begin(); it != mim.end(); ++it)
+    {
+        double volume;
+        if (!checkSurface(it->second.Mesh, volume))
+        {
+            cerr << name << ": mesh of label " << it->first << " is not closed and oriented" << endl;
+            ok = false;
+        }
+
+        map<LabelType, double>::const_iterator itv = volumes.find(it->first);
+        if (checkVolume && itv != volumes.end())
+            maxError = max(maxError, fabs(volume - itv->second) / itv->second);
+    }
+
+    if (maxError > 1e-6)
+    {
+        cerr << name << ": mesh volumes differ from voxel volumes by up to "
+             << maxError * 100 << "%" << endl;
+        ok = false;
+    }
+    return ok;
+}
+
+//compute all label meshes with different numbers of threads, measure time taken
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage:\n" << argv[0] << " InputSegmentation3D.ext [MaxThreads]" << endl;
+        return 1;
+    }
+
+    map<LabelType, double> volumes;
+    RLEImage3D::Pointer image = loadImage(argv[1], volumes);
+
+    unsigned int maxThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    if (argc > 2)
+        maxThreads = atoi(argv[2]);
+
+    // Progress is not reported anywhere
+    itk::CStyleCommand::Pointer cmd = itk::CStyleCommand::New();
+
+    vector<vtkIdType> refPoints;
+    double refTime = 0.0;
+    bool consistent = true, geometric = true;
+    for (unsigned int nt = 1; nt <= maxThreads; nt *= 2)
+    {
+        // Use a new pipeline each time, so that all meshes are recomputed
+        MultiLabelMeshPipeline::Pointer pipeline = MultiLabelMeshPipeline::New();
+        pipeline->SetNumberOfThreads(nt);
+        pipeline->SetImage(image);
+
+        itk::TimeProbe tp;
+        tp.Start();
+        pipeline->UpdateMeshes(cmd);
+        tp.Stop();
+
+        // Check that all thread counts produce the same meshes
+        vector<vtkIdType> points;
+        const MultiLabelMeshPipeline::MeshInfoMap &mim = pipeline->GetMeshInfo();
+        for (MultiLabelMeshPipeline::MeshInfoMap::const_iterator it = mim.begin(); it != mim.end(); ++it)
+            points.push_back(it->second.Mesh->GetNumberOfPoints());
+
+        if (nt == 1)
+        {
+            refPoints = points;
+            refTime = tp.GetMean();
+        }
+        else if (points != refPoints)
+        {
+            consistent = false;
+        }
+
+        cout << nt << " threads: " << mim.size() << " meshes took "
+             << tp.GetMean() * 1000 << " ms, speedup " << refTime / tp.GetMean() << endl;
+    }
+
+    // Single pass discrete surface extraction
+    {
+        MultiLabelMeshPipeline::Pointer pipeline = MultiLabelMeshPipeline::New();
+        SmartPtr<MeshOptions> options = MeshOptions::New();
+        options->SetUseDiscreteSurfaceExtraction(true);
+        pipeline->SetMeshOptions(options);
+        pipeline->SetImage(image);
+
+        itk::TimeProbe tp;
+        tp.Start();
+        pipeline->UpdateMeshes(cmd);
+        tp.Stop();
+
+        const MultiLabelMeshPipeline::MeshInfoMap &mim = pipeline->GetMeshInfo();
+        if (mim.size() != refPoints.size())
+            consistent = false;
+
+        cout << "discrete: " << mim.size() << " meshes took "
+             << tp.GetMean() * 1000 << " ms, speedup " << refTime / tp.GetMean() << endl;
+
+        // Relaxing the vertices changes the volume, but not the topology
+        geometric = checkDiscreteMeshes("discrete", pipeline, volumes, false);
+    }
+
+    // Without relaxation, the surfaces follow the voxel faces exactly
+    {
+        MultiLabelMeshPipeline::Pointer pipeline = MultiLabelMeshPipeline::New();
+        SmartPtr<MeshOptions> options = MeshOptions::New();
+        options->SetUseDiscreteSurfaceExtraction(true);
+        options->SetDiscreteSmoothingIterations(0);
+        pipeline->SetMeshOptions(options);
+        pipeline->SetImage(image);
+        pipeline->UpdateMeshes(cmd);
+
+        geometric = checkDiscreteMeshes("discrete, no relaxation", pipeline, volumes, true) && geometric;
+    }
+
+    if (!consistent)
+    {
+        cerr << "Meshes computed in parallel or in discrete mode differ from sequential meshes" << endl;
+        return 1;
+    }
+    if (!geometric)
+    {
+        cerr << "Discrete meshes do not enclose the labeled voxels" << endl;
+        return 1;
+    }
+    return 0;
+}
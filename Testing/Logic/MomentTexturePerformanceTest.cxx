@@ -0,0 +1,154 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkVectorImage.h>
+#include <itkImageFileReader.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkConstNeighborhoodIterator.h>
+#include <itkTimeProbe.h>
+#include "MomentTextures.h"
+#include "PerformanceTestUtilities.h"
+
+typedef itk::Image<short, 3> InputImageType;
+typedef itk::VectorImage<short, 3> TextureImageType;
+typedef bilwaj::MomentTextureFilter<InputImageType, TextureImageType> FilterType;
+
+InputImageType::Pointer loadImage(const char *filename)
+{
+    typedef itk::ImageFileReader<InputImageType> ReaderType;
+    ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(filename);
+    reader->Update();
+    return reader->GetOutput();
+}
+
+// Create an image with bright blocks on a nearly constant dark background,
+// where the moments of the background are small next to the range of the
+// intensities in the image
+InputImageType::Pointer makeImage(int size, int bright)
+{
+    InputImageType::RegionType region;
+    for (int d = 0; d < 3; d++)
+        region.SetSize(d, size);
+
+    InputImageType::Pointer image = InputImageType::New();
+    image->SetRegions(region);
+    image->Allocate();
+    for (itk::ImageRegionIteratorWithIndex<InputImageType> it(image, region); !it.IsAtEnd(); ++it)
+    {
+        InputImageType::IndexType idx = it.GetIndex();
+        bool inside = (idx[0] / 8 + idx[1] / 8 + idx[2] / 8) % 3 == 0;
+        it.Set((short) (inside ? bright - rand() % (bright / 10) : rand() % 3));
+    }
+    return image;
+}
+
+// Compute the textures and return the time taken in ms
+double computeTextures(InputImageType *image, unsigned int radius, unsigned int degree,
+                       bool boxSums, TextureImageType::Pointer &result)
+{
+    FilterType::Pointer filter = FilterType::New();
+    FilterType::SizeType r;
+    r.Fill(radius);
+    filter->SetInput(image);
+    filter->SetRadius(r);
+    filter->SetHighestDegree(degree);
+    filter->SetUseBoxSums(boxSums);
+
+    itk::TimeProbe tp;
+    tp.Start();
+    filter->Update();
+    tp.Stop();
+
+    result = filter->GetOutput();
+    return elapsedMs(tp);
+}
+
+// Largest difference between the components of two texture images, in
+// excess of the rounding of the output and of a relative tolerance. Voxels
+// whose neighborhood is all zero are skipped, since their moments are
+// undefined
+double maxDifference(InputImageType *image, unsigned int radius,
+                     TextureImageType *a, TextureImageType *b)
+{
+    itk::ConstNeighborhoodIterator<InputImageType>::RadiusType r;
+    r.Fill(radius);
+    itk::ConstNeighborhoodIterator<InputImageType> in(r, image, image->GetBufferedRegion());
+    itk::ImageRegionConstIterator<TextureImageType> ia(a, a->GetBufferedRegion());
+    itk::ImageRegionConstIterator<TextureImageType> ib(b, b->GetBufferedRegion());
+    double maxdiff = 0;
+    for (; !ia.IsAtEnd(); ++ia, ++ib, ++in)
+    {
+        bool zero = true;
+        for (unsigned int j = 0; j < in.Size() && zero; j++)
+            zero = (in.GetPixel(j) == 0);
+        if (zero)
+            continue;
+
+        TextureImageType::PixelType pa = ia.Get(), pb = ib.Get();
+        for (unsigned int k = 0; k < pa.GetSize(); k++)
+        {
+            double diff = abs((int) pa[k] - (int) pb[k]) - 1.0;
+            maxdiff = max(maxdiff, diff - 0.01 * abs((int) pa[k]));
+        }
+    }
+    return maxdiff;
+}
+
+// Compare the textures computed both ways for a range of radii
+bool compareTextures(const char *name, InputImageType *image,
+                     unsigned int maxRadius, unsigned int degree)
+{
+    bool consistent = true;
+    for (unsigned int r = 1; r <= maxRadius; r++)
+    {
+        TextureImageType::Pointer texNbr, texBox;
+        double tNbr = computeTextures(image, r, degree, false, texNbr);
+        double tBox = computeTextures(image, r, degree, true, texBox);
+        double diff = maxDifference(image, r, texNbr, texBox);
+
+        ostringstream label;
+        label << name << ", radius " << r;
+        consistent = reportComparison(label.str(), "neighborhood", tNbr, "box sums", tBox,
+                                      diff, 0) && consistent;
+    }
+    return consistent;
+}
+
+//time the texture computation with box sums and with neighborhood iteration,
+//and check that both give the same textures
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage:\n" << argv[0] << " InputImage3D.ext [MaxRadius] [Degree]" << endl;
+        return 1;
+    }
+
+    InputImageType::Pointer image = loadImage(argv[1]);
+
+    unsigned int maxRadius = 4, degree = 3;
+    if (argc > 2)
+        maxRadius = atoi(argv[2]);
+    if (argc > 3)
+        degree = atoi(argv[3]);
+
+    // The results should agree up to the rounding of the output values, on
+    // the image as is and on images with a dark background next to bright
+    // structures, where the moments are prone to cancellation
+    srand(1234);
+    bool consistent = compareTextures(argv[1], image, maxRadius, degree);
+    consistent = compareTextures("bright blocks", makeImage(64, 1000), maxRadius, degree) && consistent;
+    consistent = compareTextures("very bright blocks", makeImage(64, 30000), maxRadius, degree) && consistent;
+
+    if (!consistent)
+        cerr << "Box sum textures differ from neighborhood textures" << endl;
+    return consistent ? 0 : 1;
+}
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <cmath>
+#include <sstream>
+
+using namespace std;
+
+#include <itkMultiThreader.h>
+#include <itkTimeProbe.h>
+#include "NativeBufferKernels.h"
+#include "PerformanceTestUtilities.h"
+
+// Same mapping as the functor used by GuidedNativeImageIO
+template <typename TPixel, typename TNative>
+class ShiftScaleFunctor
+{
+public:
+    ShiftScaleFunctor(double shift, double scale) : m_Shift(shift), m_Scale(scale) {}
+    void operator()(TNative *src, TPixel *trg)
+    {
+        *trg = (TPixel) ((*src + m_Shift) * m_Scale + 0.5);
+    }
+private:
+    double m_Shift, m_Scale;
+};
+
+// Convert a buffer in place, with native values stored in a buffer large
+// enough for either type, and return the time taken in ms
+template <typename TNative, typename TOutput>
+double timeCast(const vector<TNative> &data, vector<TOutput> &result, unsigned int nt)
+{
+    size_t n = data.size();
+    size_t bytes = max(sizeof(TNative), sizeof(TOutput)) * n;
+    vector<char> buffer(bytes);
+    memcpy(&buffer[0], &data[0], n * sizeof(TNative));
+
+    ShiftScaleFunctor<TOutput, TNative> f(-10.0, 2.5);
+    itk::TimeProbe tp;
+    tp.Start();
+    NativeBufferKernels<TNative>::template CastInPlace<TOutput>(
+        reinterpret_cast<TNative *>(&buffer[0]), n, f, nt);
+    tp.Stop();
+
+    const TOutput *out = reinterpret_cast<const TOutput *>(&buffer[0]);
+    result.assign(out, out + n);
+    return elapsedMs(tp);
+}
+
+// Largest difference between two buffers
+template <typename T>
+double maxDifference(const vector<T> &a, const vector<T> &b)
+{
+    double maxdiff = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        maxdiff = max(maxdiff, fabs(1.0 * a[i] - 1.0 * b[i]));
+    return maxdiff;
+}
+
+// Time the range and the in-place cast of a buffer with different numbers of
+// threads, and check that all thread counts give the same results as a plain
+// serial conversion
+template <typename TNative, typename TOutput>
+bool testType(const char *name, size_t n, unsigned int maxThreads)
+{
+    vector<TNative> data(n);
+    srand(1234);
+    for (size_t i = 0; i < n; i++)
+        data[i] = (TNative) (rand() % 250 + (rand() % 100) * 0.01);
+
+    // The serial conversion
+    ShiftScaleFunctor<TOutput, TNative> f(-10.0, 2.5);
+    vector<TOutput> serial(n);
+    for (size_t i = 0; i < n; i++)
+        f(&data[i], &serial[i]);
+
+    bool consistent = true;
+    TNative refMin = 0, refMax = 0;
+    double refRange = 0.0, refCast = 0.0;
+    for (unsigned int nt = 1; nt <= maxThreads; nt *= 2)
+    {
+        TNative vmin, vmax;
+        itk::TimeProbe tp;
+        tp.Start();
+        NativeBufferKernels<TNative>::ComputeRange(&data[0], n, vmin, vmax, nt);
+        tp.Stop();
+        double tRange = elapsedMs(tp);
+
+        vector<TOutput> cast;
+        double tCast = timeCast(data, cast, nt);
+
+        if (nt == 1)
+        {
+            refMin = vmin; refMax = vmax;
+            refRange = tRange; refCast = tCast;
+        }
+
+        ostringstream threads;
+        threads << nt << " threads";
+        double rangeDiff = max(fabs(1.0 * vmin - refMin), fabs(1.0 * vmax - refMax));
+        consistent = reportComparison(string(name) + ", range", "1 thread", refRange,
+                                      threads.str().c_str(), tRange, rangeDiff, 0) && consistent;
+        consistent = reportComparison(string(name) + ", cast", "1 thread", refCast,
+                                      threads.str().c_str(), tCast,
+                                      maxDifference(cast, serial), 0) && consistent;
+    }
+
+    if (!consistent)
+        cerr << name << ": threaded results differ from serial results" << endl;
+    return consistent;
+}
+
+//time the conversion of native image buffers to the internal type
+int main(int argc, char *argv[])
+{
+    size_t n = 64 * 1024 * 1024;
+    if (argc > 1)
+        n = atol(argv[1]);
+
+    unsigned int maxThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+    if (argc > 2)
+        maxThreads = atoi(argv[2]);
+
+    bool ok = true;
+    ok &= testType<float, short>("float->short", n, maxThreads);
+    ok &= testType<double, short>("double->short", n, maxThreads);
+    ok &= testType<int, short>("int->short", n, maxThreads);
+    ok &= testType<unsigned short, short>("ushort->short", n, maxThreads);
+    ok &= testType<unsigned char, short>("uchar->short", n, maxThreads);
+
+    return ok ? 0 : 1;
+}
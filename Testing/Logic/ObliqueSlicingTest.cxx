@@ -0,0 +1,142 @@
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+#include <itkAffineTransform.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkTimeProbe.h>
+#include <vnl/vnl_math.h>
+#include "RLERegionOfInterestImageFilter.h"
+#include "NonOrthogonalSlicer.txx"
+
+typedef itk::Image<short, 3> Seg3DImageType;
+typedef itk::Image<short, 2> Seg2DImageType;
+typedef RLEImage<short> RLEImage3D;
+typedef itk::AffineTransform<double, 3> TransformType;
+
+Seg3DImageType::Pointer loadImage(const char *filename)
+{
+    typedef itk::ImageFileReader<Seg3DImageType> SegReaderType;
+    SegReaderType::Pointer sr = SegReaderType::New();
+    sr->SetFileName(filename);
+    sr->Update();
+    return sr->GetOutput();
+}
+
+RLEImage3D::Pointer toRLE(Seg3DImageType *image)
+{
+    typedef itk::RegionOfInterestImageFilter<Seg3DImageType, RLEImage3D> inConverterType;
+    inConverterType::Pointer inConv = inConverterType::New();
+    inConv->SetInput(image);
+    inConv->SetRegionOfInterest(image->GetLargestPossibleRegion());
+    inConv->Update();
+    return inConv->GetOutput();
+}
+
+// Slice an image with nearest neighbor interpolation, and report the time
+template <class TImage>
+Seg2DImageType::Pointer slice(TImage *image, Seg3DImageType *reference,
+                              TransformType *transform, double &ms)
+{
+    typedef NonOrthogonalSlicer<TImage, Seg2DImageType> SlicerType;
+    typename SlicerType::Pointer slicer = SlicerType::New();
+    slicer->SetInput(image);
+    slicer->SetReferenceImage(reference);
+    slicer->SetTransform(transform);
+    slicer->SetUseNearestNeighbor(true);
+
+    itk::TimeProbe tp;
+    tp.Start();
+    slicer->Update();
+    tp.Stop();
+    ms = tp.GetMean() * 1000;
+    return slicer->GetOutput();
+}
+
+//slice the RLE image and the decompressed image along oblique planes through
+//the center, and check that the slices are the same
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage:\n" << argv[0] << " InputSegmentation3D.ext" << endl;
+        return 1;
+    }
+
+    Seg3DImageType::Pointer image = loadImage(argv[1]);
+    RLEImage3D::Pointer rle = toRLE(image);
+
+    // The reference space is the middle axial slice of the image
+    Seg3DImageType::RegionType region = image->GetLargestPossibleRegion();
+    Seg3DImageType::IndexType idxMid = region.GetIndex();
+    idxMid[2] += region.GetSize(2) / 2;
+    Seg3DImageType::PointType origin;
+    image->TransformIndexToPhysicalPoint(idxMid, origin);
+
+    Seg3DImageType::RegionType refRegion;
+    refRegion.SetSize(0, region.GetSize(0));
+    refRegion.SetSize(1, region.GetSize(1));
+    refRegion.SetSize(2, 1);
+
+    Seg3DImageType::Pointer reference = Seg3DImageType::New();
+    reference->CopyInformation(image);
+    reference->SetOrigin(origin);
+    reference->SetRegions(refRegion);
+    reference->Allocate();
+    reference->FillBuffer(0);
+
+    // Rotate about the center of the image by various angles around axes
+    // that are not aligned with the image, so that the samples wander across
+    // lines and slices
+    Seg3DImageType::IndexType idxCenter = idxMid;
+    idxCenter[0] += region.GetSize(0) / 2;
+    idxCenter[1] += region.GetSize(1) / 2;
+    Seg3DImageType::PointType center;
+    image->TransformIndexToPhysicalPoint(idxCenter, center);
+
+    bool ok = true;
+    const double axes[3][3] = { { 1, 0.3, 0.1 }, { 0.2, 1, 0.4 }, { 0.7, 0.5, 0.2 } };
+    for (int a = 0; a < 3; a++)
+    {
+        for (int deg = 5; deg < 90; deg += 17)
+        {
+            TransformType::Pointer transform = TransformType::New();
+            TransformType::OutputVectorType axis;
+            for (int d = 0; d < 3; d++)
+                axis[d] = axes[a][d];
+            transform->SetCenter(center);
+            transform->Rotate3D(axis, deg * vnl_math::pi / 180.0);
+
+            double msPlain, msRLE;
+            Seg2DImageType::Pointer plain = slice(image.GetPointer(), reference, transform, msPlain);
+            Seg2DImageType::Pointer oblique = slice(rle.GetPointer(), reference, transform, msRLE);
+
+            // Count the differences, and the labeled voxels in the slice
+            unsigned long nDiff = 0, nLabeled = 0;
+            itk::ImageRegionConstIterator<Seg2DImageType> itp(plain, plain->GetBufferedRegion());
+            itk::ImageRegionConstIterator<Seg2DImageType> itr(oblique, oblique->GetBufferedRegion());
+            for (; !itp.IsAtEnd(); ++itp, ++itr)
+            {
+                if (itp.Get() != itr.Get())
+                    nDiff++;
+                if (itp.Get())
+                    nLabeled++;
+            }
+
+            cout << "axis " << a << ", " << deg << " degrees: " << nLabeled << " labeled, "
+                 << nDiff << " different, plain " << msPlain << " ms, RLE " << msRLE << " ms" << endl;
+            if (nDiff)
+                ok = false;
+        }
+    }
+
+    if (!ok)
+    {
+        cerr << "Oblique slices of the RLE image differ from those of the decompressed image" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef PERFORMANCETESTUTILITIES_H
+#define PERFORMANCETESTUTILITIES_H
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+
+#include <itkTimeProbe.h>
+#include <vnl/vnl_math.h>
+#include "GaussianMixtureModel.h"
+
+/**
+ * Helpers shared by the tests that time an optimized computation against a
+ * reference computation and check that both give the same results.
+ */
+
+// Uniform random number in [0, 1]
+inline double rnd()
+{
+    return rand() / (double) RAND_MAX;
+}
+
+// Standard normal sample by the Box-Muller transform
+inline double rndn()
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = rnd();
+    return sqrt(-2 * log(u)) * cos(2 * vnl_math::pi * v);
+}
+
+// Create a mixture model with random, overlapping clusters, with every other
+// cluster in the foreground
+inline GaussianMixtureModel::Pointer makeRandomMixtureModel(int nComp, int nGauss)
+{
+    GaussianMixtureModel::Pointer gmm = GaussianMixtureModel::New();
+    gmm->Initialize(nComp, nGauss);
+    for (int k = 0; k < nGauss; k++)
+    {
+        vnl_vector<double> mean(nComp);
+        vnl_matrix<double> A(nComp, nComp), cov(nComp, nComp);
+        for (int i = 0; i < nComp; i++)
+        {
+            mean[i] = 200 + 600 * rnd();
+            for (int j = 0; j < nComp; j++)
+                A(i, j) = 80 * rnd() - 40;
+        }
+        cov = A * A.transpose();
+        for (int i = 0; i < nComp; i++)
+            cov(i, i) += 100;
+
+        gmm->SetGaussian(k, mean, cov);
+        gmm->SetWeight(k, 1.0 / nGauss);
+        if (k % 2)
+            gmm->SetForeground(k);
+        else
+            gmm->SetBackground(k);
+    }
+    return gmm;
+}
+
+// Time taken by a stopped probe, in ms
+inline double elapsedMs(const itk::TimeProbe &tp)
+{
+    return tp.GetMean() * 1000;
+}
+
+// Print the times of the reference and the optimized computation, and the
+// largest difference between their results. Returns false if the difference
+// exceeds the tolerance
+inline bool reportComparison(const std::string &name,
+                             const char *refName, double tRef,
+                             const char *optName, double tOpt,
+                             double maxdiff, double tolerance)
+{
+    bool ok = (maxdiff <= tolerance);
+    std::cout << name << ": " << refName << " " << tRef << " ms, " << optName << " "
+              << tOpt << " ms (speedup " << tRef / tOpt << "), max difference "
+              << maxdiff << (ok ? "" : ", FAILED") << std::endl;
+    return ok;
+}
+
+#endif // PERFORMANCETESTUTILITIES_H
@@ -0,0 +1,172 @@
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkImageFileReader.h>
+#include <itkImageRegionConstIteratorWithIndex.h>
+#include <itkTimeProbe.h>
+#include "IRISApplication.h"
+#include "ImageIODelegates.h"
+#include "SegmentationStatistics.h"
+#include "TestSystemInfoDelegate.h"
+
+typedef itk::Image<double, 3> GrayImageType;
+typedef itk::Image<LabelType, 3> SegImageType;
+
+// Statistics of one label computed directly from the image files
+struct Reference
+{
+    unsigned long count;
+    vector<double> sum, sumsq, min, max;
+};
+
+template <class TImage>
+typename TImage::Pointer loadImage(const char *filename)
+{
+    typedef itk::ImageFileReader<TImage> ReaderType;
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName(filename);
+    reader->Update();
+    return reader->GetOutput();
+}
+
+// Compute the statistics of each label one voxel at a time
+map<LabelType, Reference> computeReference(SegImageType *seg, const vector<GrayImageType::Pointer> &gray)
+{
+    map<LabelType, Reference> ref;
+    size_t ngray = gray.size();
+    itk::ImageRegionConstIteratorWithIndex<SegImageType> it(seg, seg->GetBufferedRegion());
+    for (; !it.IsAtEnd(); ++it)
+    {
+        Reference &r = ref[it.Get()];
+        if (r.sum.empty())
+        {
+            r.count = 0;
+            r.sum.resize(ngray, 0.0);
+            r.sumsq.resize(ngray, 0.0);
+            r.min.resize(ngray, 1e100);
+            r.max.resize(ngray, -1e100);
+        }
+        r.count++;
+        for (size_t j = 0; j < ngray; j++)
+        {
+            double v = gray[j]->GetPixel(it.GetIndex());
+            r.sum[j] += v;
+            r.sumsq[j] += v * v;
+            r.min[j] = min(r.min[j], v);
+            r.max[j] = max(r.max[j], v);
+        }
+    }
+    return ref;
+}
+
+// Run the statistics with the given number of threads, and report the time
+void computeStats(IRISApplication *app, unsigned int nt, SegmentationStatistics &stats, double &ms)
+{
+    stats.SetComputeExtendedStatistics(true);
+    stats.SetNumberOfThreads(nt);
+    itk::TimeProbe tp;
+    tp.Start();
+    stats.Compute(app);
+    tp.Stop();
+    ms = tp.GetMean() * 1000;
+}
+
+// Sums added up in a different order may differ in the last bits
+bool same(double a, double b)
+{
+    return fabs(a - b) <= 1e-9 * max(1.0, fabs(a));
+}
+
+// Check the statistics against the reference, and the extended statistics
+// against those computed by one thread
+bool compare(const SegmentationStatistics &stats, const SegmentationStatistics &serial,
+             map<LabelType, Reference> &ref, size_t ngray)
+{
+    const SegmentationStatistics::EntryMap &sm = stats.GetStats(), &ss = serial.GetStats();
+    if (sm.size() != ref.size() || ss.size() != ref.size())
+        return false;
+
+    for (SegmentationStatistics::EntryMap::const_iterator it = sm.begin(); it != sm.end(); ++it)
+    {
+        if (!ref.count(it->first) || !ss.count(it->first))
+            return false;
+
+        const SegmentationStatistics::Entry &e = it->second, &es = ss.find(it->first)->second;
+        const Reference &r = ref[it->first];
+        if (e.count != r.count)
+            return false;
+
+        for (size_t j = 0; j < ngray; j++)
+        {
+            double mean = r.sum[j] / r.count;
+            double sd = sqrt((r.sumsq[j] - r.sum[j] * mean) / (r.count - 1));
+            if (!same(e.mean[j], mean) || (r.count > 1 && !same(e.stdev[j], sd))
+                || e.min[j] != r.min[j] || e.max[j] != r.max[j]
+                || e.median[j] != es.median[j])
+                return false;
+        }
+
+        for (int d = 0; d < 3; d++)
+        {
+            if (!same(e.centroid[d], es.centroid[d])
+                || e.bbox_lower[d] != es.bbox_lower[d] || e.bbox_upper[d] != es.bbox_upper[d])
+                return false;
+        }
+    }
+    return true;
+}
+
+//compute segmentation statistics over two gray layers with one and with
+//several threads, and check them against statistics computed voxel by voxel
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        cout << "Usage:\n" << argv[0] << " Gray3D.ext Segmentation3D.ext [threads]" << endl;
+        return 1;
+    }
+    unsigned int nt = 7;
+    if (argc > 3)
+        nt = atoi(argv[3]);
+
+    TestSystemInfoDelegate sidel(argv[0]);
+    SystemInterface::SetSystemInfoDelegate(&sidel);
+
+    // The segmentation is also loaded as an overlay, to have a second layer
+    // with different intensities
+    IRISApplication::Pointer app = IRISApplication::New();
+    IRISWarningList wl;
+    app->LoadImage(argv[1], MAIN_ROLE, wl);
+    app->LoadImage(argv[2], OVERLAY_ROLE, wl);
+    app->LoadImage(argv[2], LABEL_ROLE, wl);
+
+    vector<GrayImageType::Pointer> gray;
+    gray.push_back(loadImage<GrayImageType>(argv[1]));
+    gray.push_back(loadImage<GrayImageType>(argv[2]));
+    SegImageType::Pointer seg = loadImage<SegImageType>(argv[2]);
+    map<LabelType, Reference> ref = computeReference(seg, gray);
+
+    SegmentationStatistics serial, threaded;
+    double msSerial, msThreaded;
+    computeStats(app, 1, serial, msSerial);
+    computeStats(app, nt, threaded, msThreaded);
+
+    bool ok = compare(serial, serial, ref, gray.size());
+    ok = compare(threaded, serial, ref, gray.size()) && ok;
+
+    cout << ref.size() << " labels, " << gray.size() << " layers: 1 thread " << msSerial
+         << " ms, " << nt << " threads " << msThreaded << " ms" << endl;
+
+    if (!ok)
+    {
+        cerr << "Segmentation statistics differ from the voxel by voxel statistics" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -160,13 +160,15 @@ Seg2DImageType::Pointer cropIRIS(Seg3DImageType::Pointer image)
     return roi->GetOutput();
 }
 
-Seg2DImageType::Pointer cropRLEiris(RLEImage3D::Pointer image)
+typedef IRISSlicer<RLEImage3D, Seg2DImageType, RLEImage3D> RLESlicerType;
+
+RLESlicerType::Pointer makeRLESlicer(RLEImage3D::Pointer image, bool useRunIndex)
 {
-    typedef IRISSlicer<RLEImage3D, Seg2DImageType, RLEImage3D> roiType;
-    roiType::Pointer roi = roiType::New();
+    RLESlicerType::Pointer roi = RLESlicerType::New();
     roi->SetInput(image);
     roi->SetSliceIndex(sliceIndex);
     roi->SetSliceDirectionImageAxis(axis);
+    roi->SetUseRunIndex(useRunIndex);
     if (axis == 0) //x
     {
         roi->SetLineDirectionImageAxis(2);
@@ -182,10 +184,60 @@ Seg2DImageType::Pointer cropRLEiris(RLEImage3D::Pointer image)
         roi->SetLineDirectionImageAxis(1);
         roi->SetPixelDirectionImageAxis(0);
     }
+    return roi;
+}
+
+Seg2DImageType::Pointer cropRLEiris(RLEImage3D::Pointer image)
+{
+    RLESlicerType::Pointer roi = makeRLESlicer(image, true);
     roi->Update();
     return roi->GetOutput();
 }
 
+//slice every slice along each axis, with and without the run index,
+//report the throughput and check that both paths give the same slices
+bool reportThroughput(RLEImage3D::Pointer image)
+{
+    itk::Size<3> size = image->GetLargestPossibleRegion().GetSize();
+    int savedAxis = axis, savedSlice = sliceIndex;
+    bool same = true;
+    for (axis = 0; axis < 3; axis++)
+    {
+        std::vector<short> slices[2];
+        double voxels = (double) size[0] * size[1] * size[2];
+        for (int useIndex = 0; useIndex < 2; useIndex++)
+        {
+            sliceIndex = 0;
+            RLESlicerType::Pointer roi = makeRLESlicer(image, useIndex != 0);
+            itk::TimeProbe tp;
+            tp.Start();
+            for (unsigned int k = 0; k < size[axis]; k++)
+            {
+                roi->SetSliceIndex(k);
+                roi->Update();
+                Seg2DImageType *slice = roi->GetOutput();
+                short *p = slice->GetBufferPointer();
+                slices[useIndex].insert(slices[useIndex].end(),
+                    p, p + slice->GetBufferedRegion().GetNumberOfPixels());
+            }
+            tp.Stop();
+
+            double ms = tp.GetMean() * 1000;
+            cout << "Axis " << "XYZ"[axis] << (useIndex ? " with" : " without")
+                 << " run index: " << ms / size[axis] << " ms per slice, "
+                 << voxels / (ms * 1000) << " Mvoxels/s" << endl;
+        }
+        if (slices[0] != slices[1])
+        {
+            cerr << "Slices along " << "XYZ"[axis] << " differ with the run index" << endl;
+            same = false;
+        }
+    }
+    axis = savedAxis;
+    sliceIndex = savedSlice;
+    return same;
+}
+
 Seg3DImageType::Pointer cropRLE(Label3DType::Pointer image)
 {
     typedef itk::ChangeRegionLabelMapFilter<Label3DType> roiLMType;
@@ -207,7 +259,7 @@ int main(int argc, char *argv[])
 {
     if (argc < 5)
     {
-        cout << "Usage:\n" << argv[0] << " InputImage3D.ext OutputSlice2D.ext X|Y|Z SliceNumber [RLE|RLI|IRIS|Normal]" << endl;
+        cout << "Usage:\n" << argv[0] << " InputImage3D.ext OutputSlice2D.ext X|Y|Z SliceNumber [RLE|RLI|IRIS|irisRLE|Normal] [MEM|THROUGHPUT]" << endl;
         return 1;
     }
 
@@ -243,6 +295,10 @@ int main(int argc, char *argv[])
     if (argc>6)
         if (strcmp(argv[6], "MEM") == 0 || strcmp(argv[6], "mem") == 0)
             memCheck = true;
+    bool throughput = false;
+    if (argc>6)
+        if (strcmp(argv[6], "THROUGHPUT") == 0 || strcmp(argv[6], "throughput") == 0)
+            throughput = true;
 
     Seg3DImageType::Pointer cropped, inImage = loadImage(argv[1]);
     Label3DType::Pointer inLabelMap;
@@ -279,6 +335,8 @@ int main(int argc, char *argv[])
         cout << "Now check memory consumption";
         getchar();
     }
+    if (throughput && irisRLE && !reportThroughput(rleImage))
+        return 1;
 
     itk::TimeProbe tp;
     tp.Start();
@@ -0,0 +1,257 @@
+#include <iostream>
+#include <map>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkImageDuplicator.h>
+#include <itkImageRegionIterator.h>
+#include <itkImageRegionConstIterator.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkResampleImageFilter.h>
+#include <itkIdentityTransform.h>
+#include <itkNearestNeighborInterpolateImageFunction.h>
+#include <itkLinearInterpolateImageFunction.h>
+#include <itkBSplineInterpolateImageFunction.h>
+#include <itkWindowedSincInterpolateImageFunction.h>
+#include "IRISApplication.h"
+#include "IRISImageData.h"
+#include "SNAPImageData.h"
+#include "GlobalState.h"
+#include "ImageIODelegates.h"
+#include "LabelImageWrapper.h"
+#include "ScalarImageWrapper.h"
+#include "SegmentationUpdateIterator.h"
+#include "RLERegionOfInterestImageFilter.h"
+#include "TestSystemInfoDelegate.h"
+
+typedef LabelImageWrapper::ImageType RLESegImageType;
+typedef itk::Image<LabelType, 3> SegImageType;
+typedef LevelSetImageWrapper::ImageType LevelSetImageType;
+
+SegImageType::Pointer decompress(RLESegImageType *image)
+{
+    typedef itk::RegionOfInterestImageFilter<RLESegImageType, SegImageType> ConverterType;
+    ConverterType::Pointer conv = ConverterType::New();
+    conv->SetInput(image);
+    conv->SetRegionOfInterest(image->GetLargestPossibleRegion());
+    conv->Update();
+    return conv->GetOutput();
+}
+
+// Fill the snake with the union of two spheres, so that the inside of the
+// snake only covers part of the ROI
+void fillSnake(LevelSetImageType *snake)
+{
+    LevelSetImageType::RegionType region = snake->GetBufferedRegion();
+    double n[3], r = region.GetSize(0);
+    for (int d = 0; d < 3; d++)
+    {
+        n[d] = region.GetSize(d);
+        r = min(r, n[d]);
+    }
+
+    for (itk::ImageRegionIteratorWithIndex<LevelSetImageType> it(snake, region); !it.IsAtEnd(); ++it)
+    {
+        double d1 = 0, d2 = 0;
+        for (int d = 0; d < 3; d++)
+        {
+            double x = it.GetIndex()[d] - region.GetIndex(d);
+            d1 += (x - 0.4 * n[d]) * (x - 0.4 * n[d]);
+            d2 += (x - 0.8 * n[d]) * (x - 0.8 * n[d]);
+        }
+        it.Set((float) min(sqrt(d1) - 0.25 * r, sqrt(d2) - 0.1 * r));
+    }
+    snake->Modified();
+}
+
+// Write the snake back into a copy of the segmentation over the whole ROI,
+// as was done before the update was restricted to the region that can change
+SegImageType::Pointer writeBackFull(SegImageType *seg, LevelSetImageType *snake,
+                                    const SNAPSegmentationROISettings &roi, LabelType label,
+                                    DrawOverFilter drawOver, bool invert)
+{
+    typedef itk::ImageDuplicator<SegImageType> DuplicatorType;
+    DuplicatorType::Pointer dup = DuplicatorType::New();
+    dup->SetInputImage(seg);
+    dup->Update();
+    SegImageType::Pointer result = dup->GetOutput();
+
+    LevelSetImageType::Pointer source = snake;
+    if (roi.IsResampling())
+    {
+        typedef itk::ResampleImageFilter<LevelSetImageType, LevelSetImageType> ResampleFilterType;
+        ResampleFilterType::Pointer fltSample = ResampleFilterType::New();
+        fltSample->SetInput(snake);
+        fltSample->SetTransform(itk::IdentityTransform<double, 3>::New());
+
+        const unsigned int VRadius = 5;
+        typedef itk::Function::HammingWindowFunction<VRadius> WindowFunction;
+        typedef itk::ConstantBoundaryCondition<LevelSetImageType> Condition;
+        switch (roi.GetInterpolationMethod())
+        {
+        case NEAREST_NEIGHBOR:
+            fltSample->SetInterpolator(
+                itk::NearestNeighborInterpolateImageFunction<LevelSetImageType, double>::New());
+            break;
+        case TRILINEAR:
+            fltSample->SetInterpolator(
+                itk::LinearInterpolateImageFunction<LevelSetImageType, double>::New());
+            break;
+        case TRICUBIC:
+            fltSample->SetInterpolator(
+                itk::BSplineInterpolateImageFunction<LevelSetImageType, double>::New());
+            break;
+        case SINC_WINDOW_05:
+            fltSample->SetInterpolator(
+                itk::WindowedSincInterpolateImageFunction<
+                    LevelSetImageType, VRadius, WindowFunction, Condition, double>::New());
+            break;
+        }
+
+        fltSample->SetSize(roi.GetROI().GetSize());
+        fltSample->SetOutputSpacing(seg->GetSpacing());
+        fltSample->SetOutputOrigin(snake->GetOrigin());
+        fltSample->SetOutputDirection(snake->GetDirection());
+        fltSample->SetDefaultPixelValue(4.0f);
+        fltSample->UpdateLargestPossibleRegion();
+        source = fltSample->GetOutput();
+    }
+
+    SegmentationPaintFunctor paint(label, drawOver);
+    itk::ImageRegionConstIterator<LevelSetImageType> itSource(source, source->GetBufferedRegion());
+    itk::ImageRegionIterator<SegImageType> itTarget(result, roi.GetROI());
+    for (; !itSource.IsAtEnd(); ++itSource, ++itTarget)
+    {
+        float v = itSource.Get();
+        if ((!invert && v <= 0) || (invert && v >= 0))
+            itTarget.Set(paint(itTarget.Get()));
+        else if (label != 0 && itTarget.Get() == label)
+            itTarget.Set(0);
+    }
+    return result;
+}
+
+// Run a snake over an ROI of the image, write it back, and compare the
+// segmentation with the one written back over the whole ROI
+bool runCase(const char *name, const char *fnMain, const char *fnSeg,
+             double scale, InterpolationMethod method, bool invert)
+{
+    IRISApplication::Pointer app = IRISApplication::New();
+    IRISWarningList wl;
+    app->LoadImage(fnMain, MAIN_ROLE, wl);
+    app->LoadImage(fnSeg, LABEL_ROLE, wl);
+    SegImageType::Pointer before = decompress(app->GetSelectedSegmentationLayer()->GetImage());
+
+    // The ROI is the middle of the image
+    itk::ImageRegion<3> rgnROI;
+    Vector3ui dims;
+    for (int d = 0; d < 3; d++)
+    {
+        long n = before->GetBufferedRegion().GetSize(d);
+        rgnROI.SetIndex(d, n / 6);
+        rgnROI.SetSize(d, n - 2 * (n / 6));
+        dims[d] = (unsigned int) (rgnROI.GetSize(d) * scale + 0.5);
+    }
+
+    // Draw with the most common label in the ROI, so that voxels outside of
+    // the snake that already have the label are cleared
+    map<LabelType, unsigned long> counts;
+    for (itk::ImageRegionConstIterator<SegImageType> it(before, rgnROI); !it.IsAtEnd(); ++it)
+        counts[it.Get()]++;
+    LabelType label = 1;
+    unsigned long maxCount = 0;
+    for (map<LabelType, unsigned long>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+    {
+        if (it->first != 0 && it->second > maxCount)
+        {
+            label = it->first;
+            maxCount = it->second;
+        }
+    }
+
+    GlobalState *gs = app->GetGlobalState();
+    gs->SetDrawingColorLabel(label);
+    gs->SetPolygonInvert(invert);
+
+    SNAPSegmentationROISettings roi;
+    roi.SetROI(rgnROI);
+    roi.SetResampleDimensions(dims);
+    roi.SetInterpolationMethod(method);
+    gs->SetSegmentationROISettings(roi);
+
+    // Enter snake mode and set up the level set
+    app->InitializeSNAPImageData(roi);
+    app->SetCurrentImageDataToSNAP();
+
+    Bubble bubble;
+    for (int d = 0; d < 3; d++)
+        bubble.center[d] = dims[d] / 2;
+    bubble.radius = 3.0;
+    app->GetBubbleArray().push_back(bubble);
+    if (!app->InitializeActiveContourPipeline())
+    {
+        cerr << name << ": failed to initialize the active contour" << endl;
+        return false;
+    }
+
+    LevelSetImageType *snake = app->GetSNAPImageData()->GetSnake()->GetImage();
+    fillSnake(snake);
+
+    SegImageType::Pointer reference = writeBackFull(
+        before, snake, roi, label, gs->GetDrawOverFilter(), invert);
+
+    app->UpdateIRISWithSnapImageData();
+    SegImageType::Pointer after = decompress(
+        app->GetIRISImageData()->GetFirstSegmentationLayer()->GetImage());
+
+    // Count the voxels changed by the snake, and the differences from the
+    // segmentation written back over the whole ROI
+    unsigned long nChanged = 0, nDiff = 0;
+    itk::ImageRegionConstIterator<SegImageType> itBefore(before, before->GetBufferedRegion());
+    itk::ImageRegionConstIterator<SegImageType> itRef(reference, reference->GetBufferedRegion());
+    itk::ImageRegionConstIterator<SegImageType> itAfter(after, after->GetBufferedRegion());
+    for (; !itAfter.IsAtEnd(); ++itBefore, ++itRef, ++itAfter)
+    {
+        if (itRef.Get() != itBefore.Get())
+            nChanged++;
+        if (itRef.Get() != itAfter.Get())
+            nDiff++;
+    }
+
+    bool ok = (nDiff == 0 && nChanged > 0);
+    cout << name << ": label " << label << ", " << nChanged << " voxels changed, "
+         << nDiff << " different, " << (ok ? "ok" : "FAILED") << endl;
+    return ok;
+}
+
+//write snake results back into the segmentation, with and without resampling
+//the ROI, and check that the result is the same as when the whole ROI is
+//written back
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        cout << "Usage:\n" << argv[0] << " Gray3D.ext Segmentation3D.ext" << endl;
+        return 1;
+    }
+
+    TestSystemInfoDelegate sidel(argv[0]);
+    SystemInterface::SetSystemInfoDelegate(&sidel);
+
+    bool ok = runCase("no resampling", argv[1], argv[2], 1.0, NEAREST_NEIGHBOR, false);
+    ok = runCase("no resampling, inverted", argv[1], argv[2], 1.0, NEAREST_NEIGHBOR, true) && ok;
+    ok = runCase("upsampled, nearest neighbor", argv[1], argv[2], 1.5, NEAREST_NEIGHBOR, false) && ok;
+    ok = runCase("upsampled, linear", argv[1], argv[2], 1.5, TRILINEAR, false) && ok;
+    ok = runCase("upsampled, cubic", argv[1], argv[2], 1.5, TRICUBIC, false) && ok;
+    ok = runCase("downsampled, sinc", argv[1], argv[2], 0.6, SINC_WINDOW_05, false) && ok;
+
+    if (!ok)
+    {
+        cerr << "Restricted snake write-back differs from write-back over the whole ROI" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+#include <itkImage.h>
+#include <itkVectorImage.h>
+#include <itkImageFileWriter.h>
+#include <itkTimeProbe.h>
+#include "SNAPCommon.h"
+#include "Registry.h"
+#include "GuidedNativeImageIO.h"
+
+double rnd()
+{
+    return rand() / (double) RAND_MAX;
+}
+
+// Write an uncompressed image with ncomp components of random values in
+// [vmin, vmax], rounded if whole is set. The given value is put into the last
+// voxel, so that it is read in the last slab
+template <typename TNative>
+void writeImage(const string &filename, unsigned int dim[3], unsigned int ncomp,
+                double vmin, double vmax, bool whole, double last)
+{
+    typedef itk::VectorImage<TNative, 3> VectorImageType;
+    typename VectorImageType::Pointer image = VectorImageType::New();
+    typename VectorImageType::RegionType region;
+    for (int d = 0; d < 3; d++)
+        region.SetSize(d, dim[d]);
+    image->SetRegions(region);
+    image->SetNumberOfComponentsPerPixel(ncomp);
+    image->Allocate();
+
+    TNative *p = image->GetBufferPointer();
+    size_t n = image->GetPixelContainer()->Size();
+    for (size_t i = 0; i < n; i++)
+    {
+        double v = vmin + (vmax - vmin) * rnd();
+        p[i] = (TNative) (whole ? (double) (long) v : v);
+    }
+    p[n - 1] = (TNative) last;
+
+    // Scalar images are written as such, so that they are read as ITK-SNAP
+    // reads most files
+    if (ncomp == 1)
+    {
+        typedef itk::Image<TNative, 3> ScalarImageType;
+        typename ScalarImageType::Pointer scalar = ScalarImageType::New();
+        scalar->SetRegions(region);
+        scalar->Allocate();
+        copy(p, p + n, scalar->GetBufferPointer());
+
+        typedef itk::ImageFileWriter<ScalarImageType> WriterType;
+        typename WriterType::Pointer writer = WriterType::New();
+        writer->SetFileName(filename.c_str());
+        writer->SetInput(scalar);
+        writer->Update();
+    }
+    else
+    {
+        typedef itk::ImageFileWriter<VectorImageType> WriterType;
+        typename WriterType::Pointer writer = WriterType::New();
+        writer->SetFileName(filename.c_str());
+        writer->SetInput(image);
+        writer->Update();
+    }
+}
+
+// The result of reading an image and casting it to the internal type
+template <typename TOutputImage>
+struct ReadResult
+{
+    typename TOutputImage::Pointer Image;
+    double Scale, Shift;
+    string MD5;
+    bool Deferred;
+    double Time;
+};
+
+// Read an image with the given streaming threshold and cast it to the
+// internal type with RescaleNativeImageToIntegralType
+template <typename TOutputImage>
+ReadResult<TOutputImage> readImage(const string &filename, unsigned long threshold)
+{
+    ReadResult<TOutputImage> result;
+    itk::TimeProbe tp;
+    tp.Start();
+
+    SmartPtr<GuidedNativeImageIO> io = GuidedNativeImageIO::New();
+    io->SetStreamingThreshold(threshold);
+    Registry hints;
+    io->ReadNativeImage(filename.c_str(), hints);
+    result.Deferred = io->IsNativeImageDataDeferred();
+    result.MD5 = io->GetNativeImageMD5Hash();
+
+    RescaleNativeImageToIntegralType<TOutputImage> cast;
+    result.Image = cast(io);
+    result.Scale = cast.GetNativeScale();
+    result.Shift = cast.GetNativeShift();
+    io->DeallocateNativeImage();
+
+    tp.Stop();
+    result.Time = tp.GetMean() * 1000;
+    return result;
+}
+
+// Read the image in full and streamed, and check that the data, the range
+// and the whole number test give the same results either way
+template <typename TOutputImage>
+bool compare(const char *name, const string &filename, bool expectWhole)
+{
+    ReadResult<TOutputImage> full = readImage<TOutputImage>(filename, (unsigned long) -1);
+    ReadResult<TOutputImage> streamed = readImage<TOutputImage>(filename, 0);
+
+    // The mapping is the identity only if the data was found to be whole
+    bool whole = (streamed.Scale == 1.0 && streamed.Shift == 0.0);
+
+    size_t n = full.Image->GetPixelContainer()->Size();
+    bool same = !full.Deferred && streamed.Deferred
+            && n == streamed.Image->GetPixelContainer()->Size()
+            && equal(full.Image->GetBufferPointer(), full.Image->GetBufferPointer() + n,
+                     streamed.Image->GetBufferPointer())
+            && full.Scale == streamed.Scale && full.Shift == streamed.Shift
+            && full.MD5 == streamed.MD5 && whole == expectWhole;
+
+    cout << name << ": full " << full.Time << " ms, streamed " << streamed.Time
+         << " ms, scale " << streamed.Scale << ", shift " << streamed.Shift
+         << (whole ? ", whole" : "") << ", " << (same ? "ok" : "FAILED") << endl;
+    return same;
+}
+
+//write images of several native types, read them in full and streamed slab
+//by slab, and check that both reads give the same internal image
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage:\n" << argv[0] << " OutputDirectory [nx ny nz]" << endl;
+        return 1;
+    }
+
+    // Images of doubles of the default size span two 64MB slabs
+    unsigned int dim[3] = { 256, 256, 160 };
+    for (int d = 0; d < 3 && argc > d + 2; d++)
+        dim[d] = atoi(argv[d + 2]);
+
+    string dir = argv[1];
+    typedef itk::Image<GreyType, 3> ScalarType;
+    typedef itk::VectorImage<GreyType, 3> VectorType;
+    srand(1234);
+    bool ok = true;
+
+    // Whole floating point values in the range of the internal type
+    writeImage<float>(dir + "/stream_float_whole.mha", dim, 1, -1000, 3000, true, 3000);
+    ok = compare<ScalarType>("float, whole", dir + "/stream_float_whole.mha", true) && ok;
+
+    // The same, but with a fraction in the last slab only
+    writeImage<double>(dir + "/stream_double_frac.mha", dim, 1, -1000, 3000, true, 0.5);
+    ok = compare<ScalarType>("double, one fraction", dir + "/stream_double_frac.mha", false) && ok;
+
+    // Whole values, but with the maximum out of range in the last slab only
+    writeImage<double>(dir + "/stream_double_range.mha", dim, 1, 0, 1000, true, 1e6);
+    ok = compare<ScalarType>("double, out of range", dir + "/stream_double_range.mha", false) && ok;
+
+    // Integers that must be shifted into the internal range
+    writeImage<unsigned short>(dir + "/stream_ushort.mha", dim, 1, 1000, 60000, true, 65535);
+    ok = compare<ScalarType>("ushort", dir + "/stream_ushort.mha", false) && ok;
+    writeImage<int>(dir + "/stream_int.mha", dim, 1, -20000, 20000, true, -40000);
+    ok = compare<ScalarType>("int", dir + "/stream_int.mha", false) && ok;
+
+    // Multi-component images are never checked for whole values
+    writeImage<float>(dir + "/stream_float_vec.mha", dim, 2, -1000, 3000, true, 3000);
+    ok = compare<VectorType>("float, 2 components", dir + "/stream_float_vec.mha", false) && ok;
+
+    if (!ok)
+        cerr << "Streamed reads differ from full reads" << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+
+using namespace std;
+
+#include "SNAPCommon.h"
+#include "UndoDataManager.h"
+
+typedef UndoDelta<LabelType> DeltaType;
+typedef vector<pair<LabelType, size_t> > RunList;
+
+double rnd()
+{
+    return rand() / (double) RAND_MAX;
+}
+
+// Encode the runs into a delta, one voxel at a time for short runs
+DeltaType *encode(const RunList &runs)
+{
+    DeltaType *delta = new DeltaType();
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        if (runs[r].second < 16)
+            for (size_t i = 0; i < runs[r].second; i++)
+                delta->Encode(runs[r].first);
+        else
+            delta->EncodeRun(runs[r].first, runs[r].second);
+    }
+    delta->FinishEncoding();
+    return delta;
+}
+
+// Check that the runs read back from a delta are the expected ones, and
+// delete the delta
+bool check(const char *name, DeltaType *delta, const RunList &runs, bool compress)
+{
+    size_t rawSize = delta->GetStoredSize();
+    if (compress)
+        delta->Compress();
+
+    bool ok = (delta->GetNumberOfRLEs() == runs.size());
+    size_t r = 0;
+    for (DeltaType::RunIterator it(delta); ok && !it.IsAtEnd(); ++it, ++r)
+        ok = r < runs.size() && it.GetValue() == runs[r].first && it.GetLength() == runs[r].second;
+    ok = ok && r == runs.size();
+
+    cout << name << (compress ? " (compressed): " : ": ") << runs.size() << " runs, "
+         << rawSize << " -> " << delta->GetStoredSize() << " bytes, "
+         << (ok ? "ok" : "FAILED") << endl;
+
+    delete delta;
+    return ok;
+}
+
+// Append a run, with a value that differs from the previous run
+void addRun(RunList &runs, size_t length)
+{
+    LabelType value = (LabelType) (rand() % 8);
+    if (runs.size() && runs.back().first == value)
+        value = (LabelType) (value + 1);
+    runs.push_back(make_pair(value, length));
+}
+
+//encode run sequences into undo deltas, with and without compression, and
+//check that they decode to the same runs
+int main(int argc, char *argv[])
+{
+    int nRandom = 100000;
+    if (argc > 1)
+        nRandom = atoi(argv[1]);
+    srand(1234);
+
+    vector<pair<const char *, RunList> > tests;
+
+    // No runs at all
+    tests.push_back(make_pair("empty", RunList()));
+
+    // Lengths on both sides of each length prefix boundary (7 bits per byte)
+    RunList boundary;
+    for (int bits = 7; bits < 8 * (int) sizeof(size_t); bits += 7)
+    {
+        size_t b = ((size_t) 1) << bits;
+        addRun(boundary, b - 1);
+        addRun(boundary, b);
+        addRun(boundary, b + 1);
+    }
+    addRun(boundary, (size_t) -1);
+    tests.push_back(make_pair("prefix boundaries", boundary));
+
+    // A single voxel, and a single long run
+    RunList single;
+    addRun(single, 1);
+    tests.push_back(make_pair("single voxel", single));
+    RunList longRun;
+    addRun(longRun, 256 * 256 * 256);
+    tests.push_back(make_pair("single long run", longRun));
+
+    // Mostly short runs, as left by a paintbrush, with some long ones
+    RunList random;
+    for (int i = 0; i < nRandom; i++)
+    {
+        double p = rnd();
+        if (p < 0.8)
+            addRun(random, 1 + rand() % 16);
+        else if (p < 0.99)
+            addRun(random, 1 + rand() % 0x4000);
+        else
+            addRun(random, 1 + (size_t) (rnd() * 0x4000000));
+    }
+    tests.push_back(make_pair("random", random));
+
+    // Identical values in consecutive calls must merge into one run
+    RunList merged;
+    addRun(merged, 100);
+    DeltaType *delta = new DeltaType();
+    delta->EncodeRun(merged[0].first, 40);
+    delta->Encode(merged[0].first);
+    delta->EncodeRun(merged[0].first, 59);
+    delta->EncodeRun(merged[0].first, 0);
+    delta->FinishEncoding();
+    bool ok = check("merged runs", delta, merged, false);
+
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        ok = check(tests[i].first, encode(tests[i].second), tests[i].second, false) && ok;
+        ok = check(tests[i].first, encode(tests[i].second), tests[i].second, true) && ok;
+    }
+
+    if (!ok)
+        cerr << "Undo deltas do not decode to the encoded runs" << endl;
+    return ok ? 0 : 1;
+}
@@ -1,10 +1,12 @@
 #include "RLEImageRegionIterator.h"
 #include "RLERegionOfInterestImageFilter.h"
+#include "RLEImageOperations.h"
 #include <iostream>
 #include <string>
 #include <itkImageFileReader.h>
 #include <itkImageFileWriter.h>
 #include <itkTimeProbe.h>
+#include <itkImageRegionIteratorWithIndex.h>
 #include "IRISSlicer.h"
 #include "itkTestingComparisonImageFilter.h"
 
@@ -116,6 +118,82 @@ void test4bools(shortRLEImage::Pointer rleImage, Seg3DImageType::Pointer itkImag
     testIRISSlicer(rleImage, itkImage, sliceIndex, sliceAxis, lineAxis, pixelAxis, false, false);
 }
 
+// Functor used to test run-level transforms
+struct IncrementNonZero
+{
+    short operator()(short v) const { return v ? v + 1 : v; }
+};
+
+//invokes the run-level operations and compares them to pixel-wise results
+void testRunOperations(shortRLEImage::Pointer rleImage, Seg3DImageType::Pointer itkImage)
+{
+    typedef RLEImageOperations<shortRLEImage> OpsType;
+    itk::TimeProbe tp;
+
+    // Pick a label that occurs in the middle of the image
+    Seg3DImageType::IndexType center;
+    for (unsigned d = 0; d < 3; d++)
+        center[d] = itkImage->GetBufferedRegion().GetSize(d) / 2;
+    short label = itkImage->GetPixel(center);
+
+    std::cout << "CountValue<rle>: "; tp.Start();
+    itk::SizeValueType nRLE = OpsType::CountValue(rleImage, label);
+    tp.Stop(); std::cout << tp.GetMean() * 1000 << " ms " << std::endl; tp.Reset();
+
+    itk::SizeValueType nITK = 0;
+    itk::ImageRegionConstIterator<Seg3DImageType> it(itkImage, itkImage->GetBufferedRegion());
+    for (; !it.IsAtEnd(); ++it)
+        if (it.Get() == label)
+            nITK++;
+    std::cout << "Count difference for label " << label << ": " << (long) (nRLE - nITK) << std::endl;
+
+    // Bounding box of the label, run by run and pixel by pixel
+    shortRLEImage::RegionType bbRLE;
+    std::cout << "ComputeBoundingBox<rle>: "; tp.Start();
+    OpsType::ComputeBoundingBox(rleImage, rleImage->GetBufferedRegion(), label, false, bbRLE);
+    tp.Stop(); std::cout << tp.GetMean() * 1000 << " ms " << std::endl; tp.Reset();
+
+    Seg3DImageType::IndexType lower = center, upper = center;
+    itk::ImageRegionConstIteratorWithIndex<Seg3DImageType> iti(itkImage, itkImage->GetBufferedRegion());
+    for (; !iti.IsAtEnd(); ++iti)
+        if (iti.Get() == label)
+            for (unsigned d = 0; d < 3; d++)
+            {
+                lower[d] = std::min(lower[d], iti.GetIndex()[d]);
+                upper[d] = std::max(upper[d], iti.GetIndex()[d]);
+            }
+    bool bbSame = true;
+    for (unsigned d = 0; d < 3; d++)
+        bbSame &= (bbRLE.GetIndex(d) == lower[d]
+                   && (itk::IndexValueType) bbRLE.GetSize(d) == upper[d] - lower[d] + 1);
+    std::cout << "Bounding boxes of label " << label << (bbSame ? " match" : " differ") << std::endl;
+
+    // Relabel a half-space in both images and compare
+    double normal[3] = { 0.3, -0.5, 0.8 };
+    double intercept = center[0] * normal[0] + center[1] * normal[1] + center[2] * normal[2];
+    IncrementNonZero f;
+    RLENullRunVisitor nv;
+
+    std::cout << "TransformHalfSpace<rle>: "; tp.Start();
+    OpsType::TransformHalfSpace(rleImage, rleImage->GetBufferedRegion(), normal, intercept, f, nv);
+    tp.Stop(); std::cout << tp.GetMean() * 1000 << " ms " << std::endl; tp.Reset();
+
+    itk::ImageRegionIteratorWithIndex<Seg3DImageType> itw(itkImage, itkImage->GetBufferedRegion());
+    for (; !itw.IsAtEnd(); ++itw)
+    {
+        Seg3DImageType::IndexType idx = itw.GetIndex();
+        if (idx[0] * normal[0] + idx[1] * normal[1] + idx[2] * normal[2] - intercept > 0)
+            itw.Set(f(itw.Get()));
+    }
+
+    itk::SizeValueType nDiff = 0;
+    itk::ImageRegionConstIterator<shortRLEImage> itr(rleImage, rleImage->GetBufferedRegion());
+    for (it.GoToBegin(); !it.IsAtEnd(); ++it, ++itr)
+        if (it.Get() != itr.Get())
+            nDiff++;
+    std::cout << "Number of pixels with difference after half-space relabel: " << nDiff << std::endl << std::endl;
+}
+
 int main(int argc, char* argv[])
 {
     itk::TimeProbe tp;
@@ -140,6 +218,9 @@ int main(int argc, char* argv[])
     test4bools(test, inImage, inImage->GetBufferedRegion().GetSize(1) / 2, 1, 0, 2);
     test4bools(test, inImage, inImage->GetBufferedRegion().GetSize(0) / 2, 0, 2, 1);
     test4bools(test, inImage, inImage->GetBufferedRegion().GetSize(0) / 2, 0, 1, 2);
+
+    //Test run-level operations (modifies both images)
+    testRunOperations(test, inImage);
     std::cout << "All tests finished!";
     getchar();
 }